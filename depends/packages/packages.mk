@@ -1,7 +1,7 @@
-packages:=boost libevent gmp $(zcash_packages) libsodium
+packages:=boost libevent gmp $(zcash_packages) libsodium zlib
 native_packages := native_rust
 
-qt_packages = qrencode zlib
+qt_packages = qrencode
 
 qt_linux_packages:=qt expat dbus libxcb xcb_proto libXau xproto freetype fontconfig
 
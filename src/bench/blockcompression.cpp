@@ -0,0 +1,58 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+#include "bench/data.h"
+
+#include "blockcompression.h"
+#include "chainparams.h"
+#include "primitives/block.h"
+#include "streams.h"
+
+#include <stdio.h>
+
+// Read throughput of the block records of the blk files, uncompressed vs
+// compressed (-blockcompression): file read, decompression and deserialization.
+static const int NUM_RECORDS = 1000;
+
+static void ReadBlockRecords(benchmark::State& state, bool fCompress)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    CDataStream stream(benchmark::data::block2680960, SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+    const DiskRecord record = MakeDiskRecord(block, fCompress);
+    assert(record.fCompressed == fCompress);
+
+    CAutoFile file(tmpfile(), SER_DISK, CLIENT_VERSION);
+    assert(!file.IsNull());
+    for (int i = 0; i < NUM_RECORDS; i++) {
+        file << Params().MessageStart() << record.GetHeaderSize();
+        file.write((const char*)record.vData.data(), record.vData.size());
+    }
+
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    while (state.KeepRunning()) {
+        fseek(file.Get(), 0, SEEK_SET);
+        for (int i = 0; i < NUM_RECORDS; i++) {
+            ReadDiskRecord(file, ssRecord);
+            CBlock blockRead;
+            ssRecord >> blockRead;
+            assert(blockRead.vtx.size() == block.vtx.size());
+        }
+    }
+}
+
+static void ReadBlockRecordsRaw(benchmark::State& state)
+{
+    ReadBlockRecords(state, false);
+}
+
+static void ReadBlockRecordsCompressed(benchmark::State& state)
+{
+    ReadBlockRecords(state, true);
+}
+
+BENCHMARK(ReadBlockRecordsRaw, 50);
+BENCHMARK(ReadBlockRecordsCompressed, 50);
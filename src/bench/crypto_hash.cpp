@@ -49,6 +49,30 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
+/* Run a SHA256 benchmark with a specific implementation (and restore the autodetected one) */
+template <void (*Bench)(benchmark::State&), sha256_implementation::UseImplementation Impl>
+static void SHA256WithImplementation(benchmark::State& state)
+{
+    SHA256AutoDetect(Impl);
+    Bench(state);
+    SHA256AutoDetect();
+}
+
+static void SHA256_STANDARD(benchmark::State& state) { SHA256WithImplementation<SHA256, sha256_implementation::STANDARD>(state); }
+static void SHA256_SHANI(benchmark::State& state) { SHA256WithImplementation<SHA256, sha256_implementation::USE_SHANI>(state); }
+static void SHA256D64_1024_STANDARD(benchmark::State& state) { SHA256WithImplementation<SHA256D64_1024, sha256_implementation::STANDARD>(state); }
+static void SHA256D64_1024_SSE4(benchmark::State& state) { SHA256WithImplementation<SHA256D64_1024, sha256_implementation::USE_SSE4>(state); }
+static void SHA256D64_1024_AVX2(benchmark::State& state) { SHA256WithImplementation<SHA256D64_1024, sha256_implementation::USE_SSE4_AND_AVX2>(state); }
+static void SHA256D64_1024_SHANI(benchmark::State& state) { SHA256WithImplementation<SHA256D64_1024, sha256_implementation::USE_SHANI>(state); }
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -78,8 +102,15 @@ static void FastRandom_1bit(benchmark::State& state)
 BENCHMARK(RIPEMD160, 440);
 BENCHMARK(SHA1, 570);
 BENCHMARK(SHA256, 340);
+BENCHMARK(SHA256_STANDARD, 340);
+BENCHMARK(SHA256_SHANI, 340);
 BENCHMARK(SHA512, 330);
 
 BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(SHA256D64_1024, 7400);
+BENCHMARK(SHA256D64_1024_STANDARD, 7400);
+BENCHMARK(SHA256D64_1024_SSE4, 7400);
+BENCHMARK(SHA256D64_1024_AVX2, 7400);
+BENCHMARK(SHA256D64_1024_SHANI, 7400);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
@@ -0,0 +1,157 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "compat.h"
+#include "netbase.h"
+#include "util/system.h"
+
+#ifdef USE_EPOLL
+
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/epoll.h>
+
+// Simulates the socket handler wakeups of a node with many peers connected,
+// few of which (ACTIVE_PEERS) send data between two wakeups.
+static const int NUM_PEERS = 2000;
+static const int ACTIVE_PEERS = 20;
+
+/** Loopback TCP connections: the node side (non-blocking) and the remote peer side */
+class LoopbackPeers
+{
+public:
+    std::vector<SOCKET> vNodeSockets;
+    std::vector<SOCKET> vRemoteSockets;
+
+    explicit LoopbackPeers(int nPeers)
+    {
+        // two descriptors per peer, within the process limit
+        nPeers = std::min(nPeers, (RaiseFileDescriptorLimit(2 * nPeers + 64) - 64) / 2);
+
+        SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (hListen == INVALID_SOCKET ||
+                bind(hListen, (struct sockaddr*)&addr, len) != 0 ||
+                listen(hListen, SOMAXCONN) != 0 ||
+                getsockname(hListen, (struct sockaddr*)&addr, &len) != 0) {
+            CloseSocket(hListen);
+            return;
+        }
+        for (int i = 0; i < nPeers; i++) {
+            SOCKET hRemote = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            if (hRemote == INVALID_SOCKET) break;
+            if (connect(hRemote, (struct sockaddr*)&addr, len) != 0) {
+                CloseSocket(hRemote);
+                break;
+            }
+            SOCKET hNode = accept(hListen, nullptr, nullptr);
+            if (hNode == INVALID_SOCKET) {
+                CloseSocket(hRemote);
+                break;
+            }
+            SetSocketNonBlocking(hNode, true);
+            vNodeSockets.push_back(hNode);
+            vRemoteSockets.push_back(hRemote);
+        }
+        CloseSocket(hListen);
+    }
+
+    ~LoopbackPeers()
+    {
+        for (SOCKET& hSocket : vNodeSockets) CloseSocket(hSocket);
+        for (SOCKET& hSocket : vRemoteSockets) CloseSocket(hSocket);
+    }
+
+    // The next ACTIVE_PEERS peers send one byte each
+    int Send(size_t& nNext)
+    {
+        const int nActive = std::min<int>(ACTIVE_PEERS, vRemoteSockets.size());
+        for (int i = 0; i < nActive; i++) {
+            const char c = 0;
+            if (send(vRemoteSockets[nNext], &c, 1, MSG_NOSIGNAL) != 1) return i;
+            nNext = (nNext + 1) % vRemoteSockets.size();
+        }
+        return nActive;
+    }
+};
+
+static int Drain(SOCKET hSocket)
+{
+    char buf[256];
+    int nRead = 0;
+    int r;
+    while ((r = recv(hSocket, buf, sizeof(buf), MSG_DONTWAIT)) > 0) nRead += r;
+    return nRead;
+}
+
+// select/poll: the socket sets are built, and all the sockets passed to the
+// kernel, at every wakeup.
+static void SocketEventsPoll(benchmark::State& state)
+{
+    LoopbackPeers peers(NUM_PEERS);
+    size_t nNext = 0;
+    while (state.KeepRunning()) {
+        int nPending = peers.Send(nNext);
+        while (nPending > 0) {
+            std::set<SOCKET> recv_select_set;
+            for (SOCKET hSocket : peers.vNodeSockets) {
+                recv_select_set.insert(hSocket);
+            }
+            std::unordered_map<SOCKET, struct pollfd> pollfds;
+            for (SOCKET hSocket : recv_select_set) {
+                pollfds[hSocket].fd = hSocket;
+                pollfds[hSocket].events |= POLLIN;
+            }
+            std::vector<struct pollfd> vpollfds;
+            vpollfds.reserve(pollfds.size());
+            for (const auto& it : pollfds) {
+                vpollfds.push_back(it.second);
+            }
+            if (poll(vpollfds.data(), vpollfds.size(), 1000) <= 0) break;
+            for (const struct pollfd& entry : vpollfds) {
+                if (entry.revents & POLLIN) nPending -= Drain(entry.fd);
+            }
+        }
+    }
+}
+
+// epoll: the sockets are registered once, and only the ready ones are returned
+static void SocketEventsEpoll(benchmark::State& state)
+{
+    LoopbackPeers peers(NUM_PEERS);
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    for (SOCKET hSocket : peers.vNodeSockets) {
+        struct epoll_event e;
+        e.events = EPOLLIN | EPOLLET;
+        e.data.fd = hSocket;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &e);
+    }
+
+    size_t nNext = 0;
+    struct epoll_event events[256];
+    while (state.KeepRunning()) {
+        int nPending = peers.Send(nNext);
+        while (nPending > 0) {
+            int r = epoll_wait(epollfd, events, 256, 1000);
+            if (r <= 0) break;
+            for (int i = 0; i < r; i++) {
+                if (events[i].events & EPOLLIN) nPending -= Drain(events[i].data.fd);
+            }
+        }
+    }
+    close(epollfd);
+}
+
+BENCHMARK(SocketEventsPoll, 500);
+BENCHMARK(SocketEventsEpoll, 20 * 1000);
+
+#endif // USE_EPOLL
@@ -9,11 +9,13 @@
 #include "evo/deterministicmns.h"
 #include "evo/evodb.h"
 #include "evo/evonotificationinterface.h"
+#include "random.h"
 
 #include "sapling/sapling_operation.h"
 #include "scheduler.h"
 #include "script/sigcache.h"
 #include "sporkdb.h"
+#include "test/util/saplingutil.h"
 #include "txdb.h"
 #include "validation.h"
 #include "wallet/wallet.h"
@@ -24,6 +26,12 @@
 const unsigned int CREATE_BLOCK = 500;
 // Number of transparent transactions that will be created to make noise on this benchmark.
 const unsigned int CREATE_TRANSACTIONS_PER_BLOCK = 20;
+// Number of wallet transactions without shielded notes, for the witnesses update benchmark.
+const unsigned int WITNESS_NOISE_TRANSACTIONS = 100000;
+// Number of wallet transactions holding a shielded note, for the witnesses update benchmark.
+const unsigned int WITNESS_NOTE_TRANSACTIONS = 1000;
+// Number of note commitments in the block connected by the witnesses update benchmark.
+const unsigned int WITNESS_BLOCK_OUTPUTS = 20;
 
 static CMutableTransaction NewCoinbase(const int nHeight, const CScript& scriptPubKey)
 {
@@ -207,4 +215,54 @@ static void WalletProcessBlockBench(benchmark::State& state)
     pSporkDB.reset();
 }
 
+// Witnesses update of a large wallet (mostly transparent txs) when a block is connected and disconnected
+static void WalletIncrementNoteWitnessesBench(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    std::unique_ptr<CWallet> pwallet = std::make_unique<CWallet>("default", WalletDatabase::CreateMock());
+    bool isInit;
+    pwallet->LoadWallet(isInit);
+
+    for (unsigned int i = 0; i < WITNESS_NOISE_TRANSACTIONS; i++) {
+        CMutableTransaction mtx;
+        mtx.vout.emplace_back(5 * COIN, CScript() << OP_TRUE);
+        mtx.nLockTime = i;
+        CWalletTx wtx(pwallet.get(), MakeTransactionRef(mtx));
+        pwallet->LoadToWallet(wtx);
+    }
+
+    // First block: the wallet txs with the shielded notes
+    CBlock block1;
+    for (unsigned int i = 0; i < WITNESS_NOTE_TRANSACTIONS; i++) {
+        CWalletTx wtx(pwallet.get(), MakeShieldedTxWithCommitment());
+        mapSaplingNoteData_t noteData;
+        SaplingNoteData nd;
+        nd.ivk = libzcash::SaplingIncomingViewingKey();
+        noteData.emplace(SaplingOutPoint(wtx.GetHash(), 0), nd);
+        wtx.SetSaplingNoteData(noteData);
+        pwallet->LoadToWallet(wtx);
+        block1.vtx.emplace_back(wtx.tx);
+    }
+    SaplingMerkleTree saplingTree;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    pwallet->IncrementNoteWitnesses(&index1, &block1, saplingTree);
+
+    // Second block: note commitments of txs not in the wallet
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    for (unsigned int i = 0; i < WITNESS_BLOCK_OUTPUTS; i++) {
+        block2.vtx.emplace_back(MakeShieldedTxWithCommitment());
+    }
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+
+    while (state.KeepRunning()) {
+        SaplingMerkleTree saplingTree2 = saplingTree;
+        pwallet->IncrementNoteWitnesses(&index2, &block2, saplingTree2);
+        pwallet->DecrementNoteWitnesses(&index2);
+    }
+}
+
 BENCHMARK(WalletProcessBlockBench, 0);
+BENCHMARK(WalletIncrementNoteWitnessesBench, 10);
@@ -0,0 +1,91 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench/bench.h"
+
+#include "chainparams.h"
+#include "checkqueue.h"
+#include "consensus/zerocoin_verify.h"
+#include "libzerocoin/CoinRandomnessSchnorrSignature.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "util/system.h"
+#include "zpiv/zpivmodule.h"
+
+#include <boost/thread/thread.hpp>
+
+// Verification of the spends of a block of the public spends era: NUM_SPENDS
+// v4 public spends of v1 coins (Schnorr signature with the coin randomness),
+// serially or on the check queue workers.
+static const int NUM_SPENDS = 40;
+static const unsigned int QUEUE_BATCH_SIZE = 128;
+
+static std::shared_ptr<const libzerocoin::CoinSpend> NewPublicSpend(libzerocoin::ZerocoinParams* params)
+{
+    const libzerocoin::IntegerGroupParams& group = params->coinCommitmentGroup;
+    CBigNum serial;
+    do {
+        serial = CBigNum::randBignum(group.groupOrder);
+    } while (!libzerocoin::IsValidSerial(params, serial) || libzerocoin::ExtractVersionFromSerial(serial) != 1);
+    const CBigNum randomness = CBigNum::randBignum(group.groupOrder);
+    const CBigNum coin = group.g.pow_mod(serial, group.modulus).mul_mod(group.h.pow_mod(randomness, group.modulus), group.modulus);
+    const uint256 txOutHash = GetRandHash();
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint8_t)PUBSPEND_SCHNORR << (int)1 << serial << libzerocoin::CoinRandomnessSchnorrSignature(params, randomness, txOutHash);
+    auto spend = std::make_shared<PublicCoinSpend>(params, ss);
+    spend->setTxOutHash(txOutHash);
+    spend->pubCoin = libzerocoin::PublicCoin(params, coin, libzerocoin::ZQ_ONE);
+    assert(spend->Verify());
+    return spend;
+}
+
+static std::vector<CZerocoinSpendCheck> NewBlockChecks(const CTransaction& tx)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    // v1 coins use the v1 params
+    libzerocoin::ZerocoinParams* params = Params().GetConsensus().Zerocoin_Params(true);
+    std::vector<CZerocoinSpendCheck> vChecks;
+    for (int i = 0; i < NUM_SPENDS; i++) {
+        vChecks.emplace_back(tx, NewPublicSpend(params), true /* fPublicSpend */, 0);
+    }
+    return vChecks;
+}
+
+static void ZerocoinBlockSpendsVerify(benchmark::State& state)
+{
+    const CTransaction tx;
+    const std::vector<CZerocoinSpendCheck> vBlockChecks = NewBlockChecks(tx);
+    while (state.KeepRunning()) {
+        std::vector<CZerocoinSpendCheck> vChecks(vBlockChecks);
+        for (CZerocoinSpendCheck& check : vChecks) {
+            assert(check());
+        }
+    }
+}
+
+static void ZerocoinBlockSpendsCheckQueue(benchmark::State& state)
+{
+    const CTransaction tx;
+    const std::vector<CZerocoinSpendCheck> vBlockChecks = NewBlockChecks(tx);
+    CCheckQueue<CZerocoinSpendCheck> queue{QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (int i = 0; i < std::max(2, GetNumCores()) - 1; i++) {
+        tg.create_thread([&]{ queue.Thread(); });
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CZerocoinSpendCheck> control(&queue);
+        // one transaction per spend, as in the blocks
+        for (const CZerocoinSpendCheck& check : vBlockChecks) {
+            std::vector<CZerocoinSpendCheck> vChecks{check};
+            control.Add(vChecks);
+        }
+        assert(control.Wait());
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BENCHMARK(ZerocoinBlockSpendsVerify, 10);
+BENCHMARK(ZerocoinBlockSpendsCheckQueue, 10);
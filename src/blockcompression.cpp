@@ -0,0 +1,113 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcompression.h"
+
+#include "crypto/common.h"
+#include "utilstrencodings.h"
+
+#include <zlib.h>
+
+namespace {
+
+/** Id of the shared dictionary, stored in every compressed payload */
+const unsigned char RECORD_DICTIONARY_ID = 1;
+
+/** Size of the payload prefix: dictionary id and uncompressed size */
+const size_t RECORD_PREFIX_SIZE = 5;
+
+/**
+ * Dictionary shared by all the compressed records. Most PIVX blocks only hold a
+ * few hundred bytes (the coinstake and a handful of transactions), too little
+ * for deflate to find repetitions by itself, so the dictionary provides the
+ * byte patterns found in nearly every block and undo record: coinbase input,
+ * empty coinstake output, script templates (P2PKH, P2PK, P2CS), signatures
+ * and sequence numbers. Deflate prefers the matches closest to the end, so
+ * the most frequent patterns are last.
+ */
+const std::vector<unsigned char>& GetRecordDictionary()
+{
+    static const std::vector<unsigned char> dictionary = ParseHex(
+        // block header version, sapling transaction version/type
+        "0b000000" "0a000000" "0300" "0000" "0100"
+        // coinbase input
+        "01" "0000000000000000000000000000000000000000000000000000000000000000" "ffffffff"
+        // cold staking script (P2CS)
+        "3d76a97b63d114" "6714" "6888ac"
+        // block signature
+        "4630440220" "473045022100"
+        // empty coinstake output
+        "000000000000000000"
+        // P2PK coinstake outputs
+        "232102" "232103" "ac"
+        // signatures and public keys of the P2PKH inputs
+        "6a4730440220" "6b483045022100" "012102" "012103"
+        // sequence numbers, lock time, transaction version
+        "feffffff" "00000000" "01000000" "ffffffff"
+        // P2PKH outputs
+        "1976a914" "88ac" "1976a914" "88ac");
+    return dictionary;
+}
+
+} // namespace
+
+bool CompressRecord(Span<const unsigned char> data, std::vector<unsigned char>& vOut)
+{
+    if (data.size() > MAX_SIZE) {
+        return false;
+    }
+
+    z_stream strm{};
+    // Raw deflate: the blocks are checked against their hash, the undo data against its checksum
+    if (deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    const std::vector<unsigned char>& dictionary = GetRecordDictionary();
+    bool fSuccess = deflateSetDictionary(&strm, dictionary.data(), dictionary.size()) == Z_OK;
+    if (fSuccess) {
+        vOut.resize(RECORD_PREFIX_SIZE + deflateBound(&strm, data.size()));
+        vOut[0] = RECORD_DICTIONARY_ID;
+        WriteLE32(&vOut[1], data.size());
+        strm.next_in = const_cast<unsigned char*>(data.data());
+        strm.avail_in = data.size();
+        strm.next_out = vOut.data() + RECORD_PREFIX_SIZE;
+        strm.avail_out = vOut.size() - RECORD_PREFIX_SIZE;
+        fSuccess = deflate(&strm, Z_FINISH) == Z_STREAM_END;
+        vOut.resize(RECORD_PREFIX_SIZE + strm.total_out);
+    }
+    deflateEnd(&strm);
+    return fSuccess;
+}
+
+void DecompressRecord(Span<const unsigned char> data, CDataStream& ssOut)
+{
+    if (data.size() < RECORD_PREFIX_SIZE || data[0] != RECORD_DICTIONARY_ID) {
+        throw std::ios_base::failure("DecompressRecord(): unknown record format");
+    }
+    const uint32_t nSize = ReadLE32(&data[1]);
+    if (nSize > MAX_SIZE) {
+        throw std::ios_base::failure("DecompressRecord(): record size too large");
+    }
+
+    z_stream strm{};
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+        throw std::ios_base::failure("DecompressRecord(): inflateInit2 failed");
+    }
+    const std::vector<unsigned char>& dictionary = GetRecordDictionary();
+    const size_t nOffset = ssOut.size();
+    ssOut.resize(nOffset + nSize);
+    int ret = inflateSetDictionary(&strm, dictionary.data(), dictionary.size());
+    if (ret == Z_OK) {
+        strm.next_in = const_cast<unsigned char*>(data.data() + RECORD_PREFIX_SIZE);
+        strm.avail_in = data.size() - RECORD_PREFIX_SIZE;
+        strm.next_out = (unsigned char*)ssOut.data() + nOffset;
+        strm.avail_out = nSize;
+        ret = inflate(&strm, Z_FINISH);
+    }
+    const bool fSuccess = ret == Z_STREAM_END && strm.total_out == nSize;
+    inflateEnd(&strm);
+    if (!fSuccess) {
+        throw std::ios_base::failure("DecompressRecord(): corrupt record");
+    }
+}
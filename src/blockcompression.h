@@ -0,0 +1,105 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_BLOCKCOMPRESSION_H
+#define PIVX_BLOCKCOMPRESSION_H
+
+#include "clientversion.h"
+#include "serialize.h"
+#include "span.h"
+#include "streams.h"
+
+#include <vector>
+
+/**
+ * Optional compression of the block (blk) and undo (rev) file records (-blockcompression).
+ *
+ * A record is written as the network message start, a 4 bytes size and the
+ * payload. A compressed payload is a raw deflate stream of the serialized
+ * block or undo data, primed with a dictionary shared by all the records, and
+ * RECORD_COMPRESSED_FLAG is set in its size. Records are self-describing, so
+ * both kinds can be mixed in a file and are read transparently.
+ */
+static const bool DEFAULT_BLOCK_COMPRESSION = false;
+
+/** Set in the size of the header of a compressed record. Sizes are below MAX_BLOCKFILE_SIZE, so the bit is free. */
+static const uint32_t RECORD_COMPRESSED_FLAG = 0x80000000;
+
+/** Size of the record header: message start and size */
+static const unsigned int RECORD_HEADER_SIZE = 8;
+
+/**
+ * Compress a serialized block or undo data into a record payload:
+ * dictionary id (1 byte), uncompressed size (4 bytes), deflate stream.
+ */
+bool CompressRecord(Span<const unsigned char> data, std::vector<unsigned char>& vOut);
+
+/** Decompress a record payload, appending the serialized data to ssOut. Throws on corrupt data. */
+void DecompressRecord(Span<const unsigned char> data, CDataStream& ssOut);
+
+/** The payload of a block or undo record, as written to disk */
+struct DiskRecord
+{
+    std::vector<unsigned char> vData;
+    bool fCompressed{false};
+
+    /** The size field of the record header */
+    uint32_t GetHeaderSize() const { return (uint32_t)vData.size() | (fCompressed ? RECORD_COMPRESSED_FLAG : 0); }
+};
+
+/** Serialize obj into a record, compressed if fCompress and if it makes it smaller */
+template <typename T>
+DiskRecord MakeDiskRecord(const T& obj, bool fCompress)
+{
+    DiskRecord record;
+    CVectorWriter(SER_DISK, CLIENT_VERSION, record.vData, 0) << obj;
+    std::vector<unsigned char> vCompressed;
+    if (fCompress && CompressRecord(record.vData, vCompressed) && vCompressed.size() < record.vData.size()) {
+        record.vData.swap(vCompressed);
+        record.fCompressed = true;
+    }
+    return record;
+}
+
+/**
+ * Read the payload of a compressed record, whose header size (with the flag)
+ * is nSize, from the current position of the file, and decompress it into
+ * ssRecord. Throws on I/O errors and corrupt data.
+ */
+template <typename Stream>
+void ReadCompressedRecord(Stream& filein, uint32_t nSize, CDataStream& ssRecord)
+{
+    nSize &= ~RECORD_COMPRESSED_FLAG;
+    if (nSize > MAX_SIZE) {
+        throw std::ios_base::failure("ReadCompressedRecord(): record size too large");
+    }
+    std::vector<unsigned char> vCompressed(nSize);
+    filein.read((char*)vCompressed.data(), nSize);
+    DecompressRecord(vCompressed, ssRecord);
+}
+
+/**
+ * Read the record whose header starts at the current position of the file,
+ * and put its payload, decompressed if needed, in ssRecord. Throws on I/O
+ * errors and corrupt data.
+ */
+template <typename Stream>
+void ReadDiskRecord(Stream& filein, CDataStream& ssRecord)
+{
+    unsigned char pchMessageStart[4];
+    uint32_t nSize;
+    filein >> pchMessageStart >> nSize;
+    ssRecord.clear();
+    if (nSize & RECORD_COMPRESSED_FLAG) {
+        ReadCompressedRecord(filein, nSize, ssRecord);
+        return;
+    }
+    if (nSize > MAX_SIZE) {
+        throw std::ios_base::failure("ReadDiskRecord(): record size too large");
+    }
+    ssRecord.resize(nSize);
+    filein.read(ssRecord.data(), nSize);
+}
+
+#endif // PIVX_BLOCKCOMPRESSION_H
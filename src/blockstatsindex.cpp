@@ -0,0 +1,247 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstatsindex.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "policy/feerate.h"
+#include "primitives/block.h"
+#include "undo.h"
+#include "util/system.h"
+#include "validation.h"
+
+#include <algorithm>
+
+std::unique_ptr<CBlockStatsIndex> g_blockstatsindex;
+
+static const char DB_BLOCK_STATS = 's';
+static const char DB_BEST_BLOCK = 'B';
+
+namespace {
+
+/** Big-endian height, so that the entries are iterated in chain order */
+struct HeightKey
+{
+    uint32_t nHeight;
+    explicit HeightKey(uint32_t _nHeight = 0) : nHeight(_nHeight) {}
+    SERIALIZE_METHODS(HeightKey, obj) { READWRITE(Using<BigEndianFormatter<4>>(obj.nHeight)); }
+};
+
+} // anon namespace
+
+bool ComputeBlockStats(const CBlock& block, const CBlockUndo& blockundo, CBlockStats& stats)
+{
+    const int ntx = block.vtx.size();
+    if (ntx > 1 && (int) blockundo.vtxundo.size() + 1 != ntx) {
+        return false;
+    }
+
+    stats = CBlockStats();
+    stats.hashBlock = block.GetHash();
+    const int firstTxIndex = block.IsProofOfStake() ? 2 : 1;
+    stats.nTxCountAll = ntx;
+    stats.nTxCount = std::max(0, ntx - firstTxIndex);
+
+    // (fee rate, size) of each counted transaction
+    std::vector<std::pair<CAmount, int64_t>> vFeeRates;
+    vFeeRates.reserve(stats.nTxCount);
+
+    for (int idx = 0; idx < ntx; idx++) {
+        const CTransaction& tx = *(block.vtx[idx]);
+        if (tx.IsShieldedTx()) {
+            stats.nShieldedTxCount++;
+            stats.nShieldedSpends += tx.sapData->vShieldedSpend.size();
+            stats.nShieldedOutputs += tx.sapData->vShieldedOutput.size();
+        }
+
+        // coinbase/coinstake don't pay fees.
+        // zerocoin txes have fixed fee, don't count them here.
+        if (idx < firstTxIndex || tx.ContainsZerocoins())
+            continue;
+
+        const std::vector<Coin>& vprevout = blockundo.vtxundo[idx - 1].vprevout;
+        if (vprevout.size() != tx.vin.size()) {
+            return false;
+        }
+
+        // Transparent inputs + Shield inputs
+        CAmount nValueIn = tx.GetShieldedValueIn();
+        for (const Coin& coin : vprevout) {
+            nValueIn += coin.out.nValue;
+        }
+        // Transparent/Shield outputs
+        const CAmount nFee = nValueIn - tx.GetValueOut();
+        const int64_t nSize = GetSerializeSize(tx, CLIENT_VERSION);
+
+        stats.nTxBytes += nSize;
+        stats.nFees += nFee;
+        vFeeRates.emplace_back(CFeeRate(nFee, nSize).GetFeePerK(), nSize);
+    }
+
+    // fee rate percentiles, weighted by transaction size
+    if (!vFeeRates.empty()) {
+        std::sort(vFeeRates.begin(), vFeeRates.end());
+        int64_t nCumulative = 0;
+        size_t j = 0;
+        for (int i = 0; i < NUM_FEERATE_PERCENTILES; i++) {
+            const double threshold = FEERATE_PERCENTILES[i] * stats.nTxBytes;
+            while (j < vFeeRates.size() - 1 && nCumulative + vFeeRates[j].second < threshold) {
+                nCumulative += vFeeRates[j].second;
+                j++;
+            }
+            stats.feeratePercentiles[i] = vFeeRates[j].first;
+        }
+    }
+
+    return true;
+}
+
+CBlockStatsIndex::DB::DB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(GetDataDir() / "blockstats", nCacheSize, fMemory, fWipe)
+{}
+
+CBlockStatsIndex::CBlockStatsIndex(size_t nCacheSize, bool fMemory, bool fWipe) :
+    db(new DB(nCacheSize, fMemory, fWipe))
+{}
+
+CBlockStatsIndex::~CBlockStatsIndex()
+{
+    Interrupt();
+    Stop();
+}
+
+void CBlockStatsIndex::Start()
+{
+    interruptSync.reset();
+    syncThread = std::thread(&TraceThread<std::function<void()>>, "blkstatsidx", std::function<void()>(std::bind(&CBlockStatsIndex::ThreadSync, this)));
+}
+
+void CBlockStatsIndex::Interrupt()
+{
+    interruptSync();
+}
+
+void CBlockStatsIndex::Stop()
+{
+    if (syncThread.joinable()) {
+        syncThread.join();
+    }
+}
+
+bool CBlockStatsIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // the genesis block has no undo data (and nothing to undo)
+    CBlockUndo blockundo;
+    if (block.vtx.size() > 1 && !UndoReadFromDisk(blockundo, pindex)) {
+        return false;
+    }
+
+    CBlockStats stats;
+    if (!ComputeBlockStats(block, blockundo, stats)) {
+        return error("%s : undo data mismatch for block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+
+    CDBBatch batch(CLIENT_VERSION);
+    batch.Write(std::make_pair(DB_BLOCK_STATS, HeightKey(pindex->nHeight)), stats);
+    batch.Write(DB_BEST_BLOCK, pindex->GetBlockHash());
+    return db->WriteBatch(batch);
+}
+
+void CBlockStatsIndex::ThreadSync()
+{
+    // Resume from the last block written (or from the fork point, if it was
+    // disconnected while the node was down).
+    const CBlockIndex* pindex = nullptr;
+    uint256 hashBest;
+    if (db->Read(DB_BEST_BLOCK, hashBest)) {
+        LOCK(cs_main);
+        const CBlockIndex* pindexBest = LookupBlockIndex(hashBest);
+        if (pindexBest) pindex = chainActive.FindFork(pindexBest);
+    }
+
+    int64_t nLastLogTime = 0;
+    while (!interruptSync) {
+        const CBlockIndex* pindexNext;
+        {
+            LOCK(cs_main);
+            if (pindex && !chainActive.Contains(pindex)) {
+                pindex = chainActive.FindFork(pindex);
+            }
+            pindexNext = pindex ? chainActive.Next(pindex) : chainActive.Genesis();
+            if (!pindexNext) {
+                // Caught up with the tip. Any further block is going to be
+                // written from the validation interface callbacks.
+                fSynced = true;
+                break;
+            }
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindexNext) || !WriteBlock(block, pindexNext)) {
+            LogPrintf("%s: failed to index block %s. Block stats index disabled.\n", __func__, pindexNext->GetBlockHash().ToString());
+            return;
+        }
+        pindex = pindexNext;
+
+        const int64_t nNow = GetTime();
+        if (nNow - nLastLogTime >= 30) {
+            LogPrintf("Syncing block stats index with block chain, height %d\n", pindex->nHeight);
+            nLastLogTime = nNow;
+        }
+    }
+
+    if (fSynced) {
+        LogPrintf("Block stats index is enabled at height %d\n", pindex ? pindex->nHeight : -1);
+    }
+}
+
+void CBlockStatsIndex::BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex)
+{
+    if (!fSynced) return;
+    if (!WriteBlock(*block, pindex)) {
+        LogPrintf("%s: failed to index block %s\n", __func__, pindex->GetBlockHash().ToString());
+    }
+}
+
+void CBlockStatsIndex::BlockDisconnected(const std::shared_ptr<const CBlock>& block, const uint256& blockHash, int nBlockHeight, int64_t blockTime)
+{
+    if (!fSynced) return;
+    CDBBatch batch(CLIENT_VERSION);
+    batch.Erase(std::make_pair(DB_BLOCK_STATS, HeightKey(nBlockHeight)));
+    batch.Write(DB_BEST_BLOCK, block->hashPrevBlock);
+    db->WriteBatch(batch);
+}
+
+bool CBlockStatsIndex::LookupRange(int heightStart, int heightEnd, std::vector<CBlockStats>& vStats) const
+{
+    if (!fSynced || heightStart < 0 || heightEnd < heightStart) return false;
+
+    std::vector<uint256> vHashes;
+    vHashes.reserve(heightEnd - heightStart + 1);
+    {
+        LOCK(cs_main);
+        if (heightEnd > chainActive.Height()) return false;
+        for (int h = heightStart; h <= heightEnd; h++) {
+            vHashes.emplace_back(chainActive[h]->GetBlockHash());
+        }
+    }
+
+    vStats.clear();
+    vStats.reserve(vHashes.size());
+    std::unique_ptr<CDBIterator> pcursor(db->NewIterator());
+    pcursor->Seek(std::make_pair(DB_BLOCK_STATS, HeightKey(heightStart)));
+    for (int h = heightStart; h <= heightEnd; h++, pcursor->Next()) {
+        std::pair<char, HeightKey> key;
+        CBlockStats stats;
+        if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_BLOCK_STATS ||
+                (int) key.second.nHeight != h || !pcursor->GetValue(stats) ||
+                stats.hashBlock != vHashes[h - heightStart]) {
+            return false;
+        }
+        vStats.emplace_back(std::move(stats));
+    }
+    return true;
+}
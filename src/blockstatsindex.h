@@ -0,0 +1,116 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_BLOCKSTATSINDEX_H
+#define PIVX_BLOCKSTATSINDEX_H
+
+#include "amount.h"
+#include "dbwrapper.h"
+#include "serialize.h"
+#include "threadinterrupt.h"
+#include "uint256.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+
+static const bool DEFAULT_BLOCKSTATSINDEX = false;
+
+/** Percentiles (of the transaction bytes in a block) at which the fee rate is sampled */
+static const int NUM_FEERATE_PERCENTILES = 5;
+static const double FEERATE_PERCENTILES[NUM_FEERATE_PERCENTILES] = {0.10, 0.25, 0.50, 0.75, 0.90};
+
+/**
+ * Aggregated data of a single block, as reported by getblockindexstats.
+ * Coinbase/coinstake are only counted in nTxCountAll, and zerocoin
+ * transactions (which pay a fixed fee) are excluded from bytes, fees and
+ * fee rates.
+ */
+struct CBlockStats
+{
+    uint256 hashBlock;
+    int64_t nTxCount{0};
+    int64_t nTxCountAll{0};
+    int64_t nTxBytes{0};
+    CAmount nFees{0};
+    //! Size-weighted fee rate percentiles (satoshi per kB)
+    CAmount feeratePercentiles[NUM_FEERATE_PERCENTILES]{};
+    int64_t nShieldedTxCount{0};
+    int64_t nShieldedSpends{0};
+    int64_t nShieldedOutputs{0};
+
+    SERIALIZE_METHODS(CBlockStats, obj)
+    {
+        READWRITE(obj.hashBlock, obj.nTxCount, obj.nTxCountAll, obj.nTxBytes, obj.nFees);
+        for (int i = 0; i < NUM_FEERATE_PERCENTILES; i++) {
+            READWRITE(obj.feeratePercentiles[i]);
+        }
+        READWRITE(obj.nShieldedTxCount, obj.nShieldedSpends, obj.nShieldedOutputs);
+    }
+};
+
+/**
+ * Compute the statistics of a block, taking the value of the spent
+ * transparent outputs from its undo data.
+ * Returns false if the undo data doesn't match the block.
+ */
+bool ComputeBlockStats(const CBlock& block, const CBlockUndo& blockundo, CBlockStats& stats);
+
+/**
+ * Optional index of CBlockStats, keyed by block height.
+ * It is kept in sync with the active chain through the validation
+ * interface, after an initial catch-up done by a background thread.
+ */
+class CBlockStatsIndex : public CValidationInterface
+{
+private:
+    class DB : public CDBWrapper
+    {
+    public:
+        explicit DB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    };
+
+    std::unique_ptr<DB> db;
+
+    //! Whether the background sync reached the chain tip
+    std::atomic<bool> fSynced{false};
+
+    std::thread syncThread;
+    CThreadInterrupt interruptSync;
+
+    void ThreadSync();
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex);
+
+public:
+    explicit CBlockStatsIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CBlockStatsIndex();
+
+    void Start();
+    void Interrupt();
+    void Stop();
+
+    bool IsSynced() const { return fSynced; }
+
+    /**
+     * Read the stats of the active chain blocks in [heightStart, heightEnd].
+     * Returns false if the index has no up-to-date entry for some block of
+     * the range (e.g. still syncing, or right after a reorg).
+     */
+    bool LookupRange(int heightStart, int heightEnd, std::vector<CBlockStats>& vStats) const;
+
+protected:
+    void BlockConnected(const std::shared_ptr<const CBlock>& block, const CBlockIndex* pindex) override;
+    void BlockDisconnected(const std::shared_ptr<const CBlock>& block, const uint256& blockHash, int nBlockHeight, int64_t blockTime) override;
+};
+
+/** The global block stats index, used by getblockindexstats. May be null. */
+extern std::unique_ptr<CBlockStatsIndex> g_blockstatsindex;
+
+#endif // PIVX_BLOCKSTATSINDEX_H
@@ -1303,11 +1303,8 @@ int CBudgetManager::ProcessMessageInner(CNode* pfrom, std::string& strCommand, C
         if (!proposal.ParseBroadcast(vRecv)) {
             return 20;
         }
-        {
-            // Clear inv request
-            LOCK(cs_main);
-            g_connman->RemoveAskFor(proposal.GetHash(), MSG_BUDGET_PROPOSAL);
-        }
+        // Clear inv request
+        g_connman->RemoveAskFor(proposal.GetHash(), MSG_BUDGET_PROPOSAL);
         return ProcessProposal(proposal);
     }
 
@@ -1316,11 +1313,8 @@ int CBudgetManager::ProcessMessageInner(CNode* pfrom, std::string& strCommand, C
         vRecv >> vote;
         vote.SetValid(true);
 
-        {
-            // Clear inv request
-            LOCK(cs_main);
-            g_connman->RemoveAskFor(vote.GetHash(), MSG_BUDGET_VOTE);
-        }
+        // Clear inv request
+        g_connman->RemoveAskFor(vote.GetHash(), MSG_BUDGET_VOTE);
 
         CValidationState state;
         if (!ProcessProposalVote(vote, pfrom, state)) {
@@ -1339,11 +1333,8 @@ int CBudgetManager::ProcessMessageInner(CNode* pfrom, std::string& strCommand, C
         if (!finalbudget.ParseBroadcast(vRecv)) {
             return 20;
         }
-        {
-            // Clear inv request
-            LOCK(cs_main);
-            g_connman->RemoveAskFor(finalbudget.GetHash(), MSG_BUDGET_FINALIZED);
-        }
+        // Clear inv request
+        g_connman->RemoveAskFor(finalbudget.GetHash(), MSG_BUDGET_FINALIZED);
         return ProcessFinalizedBudget(finalbudget, pfrom);
     }
 
@@ -1352,11 +1343,8 @@ int CBudgetManager::ProcessMessageInner(CNode* pfrom, std::string& strCommand, C
         vRecv >> vote;
         vote.SetValid(true);
 
-        {
-            // Clear inv request
-            LOCK(cs_main);
-            g_connman->RemoveAskFor(vote.GetHash(), MSG_BUDGET_FINALIZED_VOTE);
-        }
+        // Clear inv request
+        g_connman->RemoveAskFor(vote.GetHash(), MSG_BUDGET_FINALIZED_VOTE);
 
         CValidationState state;
         if (!ProcessFinalizedBudgetVote(vote, pfrom, state)) {
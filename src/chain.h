@@ -29,6 +29,12 @@
  */
 static constexpr int64_t TIMESTAMP_WINDOW = 2 * 60 * 60;
 
+/** Format versions of the blk/rev files */
+enum BlockFileVersion : unsigned int {
+    BLOCKFILE_VERSION_RAW = 0,          //!< only uncompressed records
+    BLOCKFILE_VERSION_COMPRESSED = 1,   //!< may contain compressed records (see blockcompression.h)
+};
+
 class CBlockFileInfo
 {
 public:
@@ -39,16 +45,24 @@ public:
     unsigned int nHeightLast;  //!< highest height of block in file
     uint64_t nTimeFirst;       //!< earliest time of block in file
     uint64_t nTimeLast;        //!< latest time of block in file
+    unsigned int nVersion;     //!< format of the block and undo files (BlockFileVersion)
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << VARINT(nBlocks) << VARINT(nSize) << VARINT(nUndoSize) << VARINT(nHeightFirst) << VARINT(nHeightLast)
+          << VARINT(nTimeFirst) << VARINT(nTimeLast);
+        // Omitted for raw files, which keeps their entries readable by older versions
+        if (nVersion != BLOCKFILE_VERSION_RAW) s << VARINT(nVersion);
+    }
 
-    SERIALIZE_METHODS(CBlockFileInfo, obj)
+    template <typename Stream>
+    void Unserialize(Stream& s)
     {
-        READWRITE(VARINT(obj.nBlocks));
-        READWRITE(VARINT(obj.nSize));
-        READWRITE(VARINT(obj.nUndoSize));
-        READWRITE(VARINT(obj.nHeightFirst));
-        READWRITE(VARINT(obj.nHeightLast));
-        READWRITE(VARINT(obj.nTimeFirst));
-        READWRITE(VARINT(obj.nTimeLast));
+        s >> VARINT(nBlocks) >> VARINT(nSize) >> VARINT(nUndoSize) >> VARINT(nHeightFirst) >> VARINT(nHeightLast)
+          >> VARINT(nTimeFirst) >> VARINT(nTimeLast);
+        nVersion = BLOCKFILE_VERSION_RAW;
+        if (!s.empty()) s >> VARINT(nVersion);
     }
 
     void SetNull()
@@ -60,6 +74,7 @@ public:
         nHeightLast = 0;
         nTimeFirst = 0;
         nTimeLast = 0;
+        nVersion = BLOCKFILE_VERSION_RAW;
     }
 
     CBlockFileInfo()
@@ -23,7 +23,8 @@ bool CCoinsView::BatchWrite(CCoinsMap& mapCoins,
                             const uint256& hashBlock,
                             const uint256& hashSaplingAnchor,
                             CAnchorsSaplingMap& mapSaplingAnchors,
-                            CNullifiersMap& mapSaplingNullifiers) { return false; }
+                            CNullifiersMap& mapSaplingNullifiers,
+                            const CAmount& nSupplyDelta) { return false; }
 
 // Sapling
 bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
@@ -43,8 +44,9 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap& mapCoins,
                                   const uint256& hashBlock,
                                   const uint256& hashSaplingAnchor,
                                   CAnchorsSaplingMap& mapSaplingAnchors,
-                                  CNullifiersMap& mapSaplingNullifiers)
-{ return base->BatchWrite(mapCoins, hashBlock, hashSaplingAnchor, mapSaplingAnchors, mapSaplingNullifiers); }
+                                  CNullifiersMap& mapSaplingNullifiers,
+                                  const CAmount& nSupplyDelta)
+{ return base->BatchWrite(mapCoins, hashBlock, hashSaplingAnchor, mapSaplingAnchors, mapSaplingNullifiers, nSupplyDelta); }
 
 // Sapling
 bool CCoinsViewBacked::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return base->GetSaplingAnchorAt(rt, tree); }
@@ -54,7 +56,7 @@ uint256 CCoinsViewBacked::GetBestAnchor() const { return base->GetBestAnchor();
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 SaltedIdHasher::SaltedIdHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0), nSupplyDelta(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) +
@@ -108,6 +110,11 @@ void CCoinsViewCache::AddCoin(const COutPoint& outpoint, Coin&& coin, bool possi
         }
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
+    // Note: when overwriting, the callers have already fetched the existing coin (with HaveCoin)
+    if (!it->second.coin.IsSpent()) {
+        nSupplyDelta -= it->second.coin.out.nValue;
+    }
+    nSupplyDelta += coin.out.nValue;
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
@@ -135,6 +142,9 @@ void CCoinsViewCache::SpendCoin(const COutPoint& outpoint, Coin* moveout)
     CCoinsMap::iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) return;
     cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (!it->second.coin.IsSpent()) {
+        nSupplyDelta -= it->second.coin.out.nValue;
+    }
     if (moveout) {
         *moveout = std::move(it->second.coin);
     }
@@ -198,15 +208,23 @@ void BatchWriteAnchors(
                 MapEntry& entry = cacheAnchors[child_it->first];
                 entry.entered = child_it->second.entered;
                 entry.tree = child_it->second.tree;
+                entry.prevRoot = child_it->second.prevRoot;
+                entry.vCommitments = child_it->second.vCommitments;
                 entry.flags = MapEntry::DIRTY;
 
-                cachedCoinsUsage += entry.tree.DynamicMemoryUsage();
+                cachedCoinsUsage += entry.DynamicMemoryUsage();
             } else {
                 if (parent_it->second.entered != child_it->second.entered) {
                     // The parent may have removed the entry.
                     parent_it->second.entered = child_it->second.entered;
                     parent_it->second.flags |= MapEntry::DIRTY;
                 }
+                if (child_it->second.HasDelta() && !parent_it->second.HasDelta()) {
+                    // Same root, same tree: any delta leading to it is valid.
+                    parent_it->second.prevRoot = child_it->second.prevRoot;
+                    parent_it->second.vCommitments = child_it->second.vCommitments;
+                    cachedCoinsUsage += memusage::DynamicUsage(parent_it->second.vCommitments);
+                }
             }
         }
 
@@ -241,7 +259,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins,
                                  const uint256& hashBlockIn,
                                  const uint256 &hashSaplingAnchorIn,
                                  CAnchorsSaplingMap& mapSaplingAnchors,
-                                 CNullifiersMap& mapSaplingNullifiers)
+                                 CNullifiersMap& mapSaplingNullifiers,
+                                 const CAmount& nSupplyDeltaIn)
 {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
         // Ignore non-dirty entries (optimization).
@@ -303,6 +322,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins,
     hashSaplingAnchor = hashSaplingAnchorIn;
 
     hashBlock = hashBlockIn;
+    nSupplyDelta += nSupplyDeltaIn;
     return true;
 }
 
@@ -312,11 +332,13 @@ bool CCoinsViewCache::Flush()
             hashBlock,
             hashSaplingAnchor,
             cacheSaplingAnchors,
-            cacheSaplingNullifiers);
+            cacheSaplingNullifiers,
+            nSupplyDelta);
     cacheCoins.clear();
     cacheSaplingAnchors.clear();
     cacheSaplingNullifiers.clear();
     cachedCoinsUsage = 0;
+    nSupplyDelta = 0;
     return fOk;
 }
 
@@ -460,6 +482,7 @@ bool CCoinsViewCache::GetNullifier(const uint256 &nullifier) const {
 template<typename Tree, typename Cache, typename CacheIterator, typename CacheEntry>
 void CCoinsViewCache::AbstractPushAnchor(
         const Tree &tree,
+        const std::vector<uint256> &vCommitments,
         Cache &cacheAnchors,
         uint256 &hash
 )
@@ -477,23 +500,25 @@ void CCoinsViewCache::AbstractPushAnchor(
         auto insertRet = cacheAnchors.insert(std::make_pair(newrt, CacheEntry()));
         CacheIterator ret = insertRet.first;
 
+        if (!insertRet.second) {
+            cachedCoinsUsage -= ret->second.DynamicMemoryUsage();
+        }
         ret->second.entered = true;
         ret->second.tree = tree;
+        ret->second.prevRoot = vCommitments.empty() ? uint256() : currentRoot;
+        ret->second.vCommitments = vCommitments;
         ret->second.flags = CacheEntry::DIRTY;
-
-        if (insertRet.second) {
-            // An insert took place
-            cachedCoinsUsage += ret->second.tree.DynamicMemoryUsage();
-        }
+        cachedCoinsUsage += ret->second.DynamicMemoryUsage();
 
         hash = newrt;
     }
 }
 
-template<> void CCoinsViewCache::PushAnchor(const SaplingMerkleTree &tree)
+template<> void CCoinsViewCache::PushAnchor(const SaplingMerkleTree &tree, const std::vector<uint256>& vCommitments)
 {
     AbstractPushAnchor<SaplingMerkleTree, CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry>(
             tree,
+            vCommitments,
             cacheSaplingAnchors,
             hashSaplingAnchor
     );
@@ -150,6 +150,8 @@ struct CAnchorsSaplingCacheEntry
 {
     bool entered; // This will be false if the anchor is removed from the cache
     SaplingMerkleTree tree; // The tree itself
+    uint256 prevRoot; // The anchor this tree was appended to (null if unknown)
+    std::vector<uint256> vCommitments; // The note commitments appended to the tree of prevRoot
     unsigned char flags;
 
     enum Flags {
@@ -157,6 +159,10 @@ struct CAnchorsSaplingCacheEntry
     };
 
     CAnchorsSaplingCacheEntry() : entered(false), flags(0) {}
+
+    // Whether the tree can be stored as the commitments appended to the tree of prevRoot
+    bool HasDelta() const { return !prevRoot.IsNull(); }
+    size_t DynamicMemoryUsage() const { return tree.DynamicMemoryUsage() + memusage::DynamicUsage(vCommitments); }
 };
 
 struct CNullifiersCacheEntry
@@ -218,11 +224,13 @@ public:
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
     //! The passed mapCoins can be modified.
+    //! nSupplyDelta is the net change of the value of the unspent outputs.
     virtual bool BatchWrite(CCoinsMap& mapCoins,
                             const uint256& hashBlock,
                             const uint256& hashSaplingAnchor,
                             CAnchorsSaplingMap& mapSaplingAnchors,
-                            CNullifiersMap& mapSaplingNullifiers);
+                            CNullifiersMap& mapSaplingNullifiers,
+                            const CAmount& nSupplyDelta);
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor* Cursor() const;
@@ -265,7 +273,8 @@ public:
                     const uint256& hashBlock,
                     const uint256& hashSaplingAnchor,
                     CAnchorsSaplingMap& mapSaplingAnchors,
-                    CNullifiersMap& mapSaplingNullifiers) override;
+                    CNullifiersMap& mapSaplingNullifiers,
+                    const CAmount& nSupplyDelta) override;
 
     // Sapling
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const override;
@@ -297,6 +306,9 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Net change of the value of the unspent outputs, not yet flushed to the base view. */
+    CAmount nSupplyDelta;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -312,7 +324,9 @@ public:
 
     // Adds the tree to mapSaplingAnchors
     // and sets the current commitment root to this root.
-    template<typename Tree> void PushAnchor(const Tree &tree);
+    // vCommitments, if not empty, are the commitments appended to the tree
+    // of the current root to get this one (stored as a delta by the database).
+    template<typename Tree> void PushAnchor(const Tree &tree, const std::vector<uint256>& vCommitments = {});
 
     // Removes the current commitment root from mapAnchors and sets
     // the new current root.
@@ -337,7 +351,8 @@ public:
                     const uint256& hashBlock,
                     const uint256& hashSaplingAnchor,
                     CAnchorsSaplingMap& mapSaplingAnchors,
-                    CNullifiersMap& mapSaplingNullifiers) override;
+                    CNullifiersMap& mapSaplingNullifiers,
+                    const CAmount& nSupplyDelta) override;
 
     /**
      * Check if we have the given utxo already loaded in this cache.
@@ -384,6 +399,9 @@ public:
     //! Calculate the size of the cache (in bytes)
     size_t DynamicMemoryUsage() const;
 
+    //! Net change of the sum of the unspent outputs values, since the last flush
+    CAmount GetSupplyDelta() const { return nSupplyDelta; }
+
     /**
      * Amount of pivx coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -428,6 +446,7 @@ private:
     template<typename Tree, typename Cache, typename CacheIterator, typename CacheEntry>
     void AbstractPushAnchor(
             const Tree &tree,
+            const std::vector<uint256> &vCommitments,
             Cache &cacheAnchors,
             uint256 &hash
     );
@@ -131,15 +131,17 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state, bool fCol
     return true;
 }
 
-bool ContextualCheckTransaction(const CTransactionRef& tx, CValidationState& state, const CChainParams& chainparams, int nHeight, bool isMined, bool fIBD)
+bool ContextualCheckTransaction(const CTransactionRef& tx, CValidationState& state, const CChainParams& chainparams, int nHeight, bool isMined, bool fIBD,
+                                std::vector<CSaplingCheck>* pvSaplingChecks, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks,
+                                bool eraseCached)
 {
     // Dispatch to Sapling validator
-    if (!SaplingValidation::ContextualCheckTransaction(*tx, state, chainparams, nHeight, isMined, fIBD)) {
+    if (!SaplingValidation::ContextualCheckTransaction(*tx, state, chainparams, nHeight, isMined, fIBD, pvSaplingChecks, eraseCached)) {
         return false; // Failure reason has been set in validation state object
     }
 
     // Dispatch to ZerocoinTx validator
-    if (!ContextualCheckZerocoinTx(tx, state, chainparams.GetConsensus(), nHeight, isMined)) {
+    if (!ContextualCheckZerocoinTx(tx, state, chainparams.GetConsensus(), nHeight, isMined, pvZerocoinChecks)) {
         return false; // Failure reason has been set in validation state object
     }
 
@@ -14,14 +14,19 @@
 class CBlockIndex;
 class CChainParams;
 class CCoinsViewCache;
+class CSaplingCheck;
 class CValidationState;
+class CZerocoinSpendCheck;
 
 /** Transaction validation functions */
 
 /** Context-independent validity checks */
 bool CheckTransaction(const CTransaction& tx, CValidationState& state, bool fColdStakingActive);
-/** Context-dependent validity checks */
-bool ContextualCheckTransaction(const CTransactionRef& tx, CValidationState& state, const CChainParams& chainparams, int nHeight, bool isMined, bool fIBD);
+/** Context-dependent validity checks. If pvSaplingChecks is not null, the Sapling proofs are appended to it instead of being verified,
+ *  and the same for the zerocoin spends signatures with pvZerocoinChecks. eraseCached drops the tx from the Sapling proofs cache. */
+bool ContextualCheckTransaction(const CTransactionRef& tx, CValidationState& state, const CChainParams& chainparams, int nHeight, bool isMined, bool fIBD,
+                                std::vector<CSaplingCheck>* pvSaplingChecks = nullptr, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = nullptr,
+                                bool eraseCached = false);
 
 /**
  * Count ECDSA signature operations the old-fashioned (pre-0.6) way
@@ -14,7 +14,7 @@
 #include "zpiv/zpivmodule.h"
 
 
-static bool CheckZerocoinSpend(const CTransactionRef _tx, CValidationState& state)
+static bool CheckZerocoinSpend(const CTransactionRef _tx, CValidationState& state, int nHeight, std::vector<CZerocoinSpendCheck>* pvChecks)
 {
     const CTransaction& tx = *_tx;
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
@@ -77,10 +77,13 @@ static bool CheckZerocoinSpend(const CTransactionRef _tx, CValidationState& stat
 
         if (isPublicSpend) {
             libzerocoin::ZerocoinParams* params = consensus.Zerocoin_Params(false);
-            PublicCoinSpend ret(params);
-            if (!ZPIVModule::validateInput(txin, prevOut, tx, ret)){
+            auto ret = std::make_shared<PublicCoinSpend>(params);
+            if (!ZPIVModule::validateInput(txin, prevOut, tx, *ret, pvChecks == nullptr)){
                 return state.DoS(100, error("%s: public zerocoin spend did not verify", __func__));
             }
+            if (pvChecks) {
+                pvChecks->emplace_back(tx, std::move(ret), true /* fPublicSpend */, nHeight);
+            }
         }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -124,7 +127,8 @@ bool CheckPublicCoinSpendEnforced(int blockHeight, bool isPublicSpend)
     return true;
 }
 
-bool ContextualCheckZerocoinTx(const CTransactionRef& tx, CValidationState& state, const Consensus::Params& consensus, int nHeight, bool isMined)
+bool ContextualCheckZerocoinTx(const CTransactionRef& tx, CValidationState& state, const Consensus::Params& consensus, int nHeight, bool isMined,
+                               std::vector<CZerocoinSpendCheck>* pvChecks)
 {
     // zerocoin enforced via block time. First block with a zc mint is 863735
     const bool fZerocoinEnforced = (nHeight >= consensus.ZC_HeightStart);
@@ -169,7 +173,7 @@ bool ContextualCheckZerocoinTx(const CTransactionRef& tx, CValidationState& stat
     }
 
     if (hasPrivateSpendInputs || hasPublicSpendInputs) {
-        if (!CheckZerocoinSpend(tx, state))
+        if (!CheckZerocoinSpend(tx, state, nHeight, pvChecks))
             return false;   // failure reason logged in validation state
     }
 
@@ -209,9 +213,9 @@ bool IsSerialInBlockchain(const CBigNum& bnSerial, int& nHeightTx)
     return true;
 }
 
-bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight)
+bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight, bool fCheckSignature)
 {
-    if(!ContextualCheckZerocoinSpendNoSerialCheck(tx, spend, nHeight)){
+    if(!ContextualCheckZerocoinSpendNoSerialCheck(tx, spend, nHeight, fCheckSignature)){
         return false;
     }
 
@@ -224,20 +228,28 @@ bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::Coi
     return true;
 }
 
-bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight)
+static bool CheckZerocoinSpendSignature(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight)
+{
+    try {
+        if (!spend->HasValidSignature())
+            return error("%s: V2 zPIV spend does not have a valid signature\n", __func__);
+    } catch (const libzerocoin::InvalidSerialException& e) {
+        // Check if we are in the range of the attack
+        if(!isBlockBetweenFakeSerialAttackRange(nHeight))
+            return error("%s: Invalid serial detected, txid %s, in block %d\n", __func__, tx.GetHash().GetHex(), nHeight);
+        else
+            LogPrintf("%s: Invalid serial detected within range in block %d\n", __func__, nHeight);
+    }
+    return true;
+}
+
+bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight, bool fCheckSignature)
 {
     const Consensus::Params& consensus = Params().GetConsensus();
     //Check to see if the zPIV is properly signed
     if (consensus.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_ZC_V2)) {
-        try {
-            if (!spend->HasValidSignature())
-                return error("%s: V2 zPIV spend does not have a valid signature\n", __func__);
-        } catch (const libzerocoin::InvalidSerialException& e) {
-            // Check if we are in the range of the attack
-            if(!isBlockBetweenFakeSerialAttackRange(nHeight))
-                return error("%s: Invalid serial detected, txid %s, in block %d\n", __func__, tx.GetHash().GetHex(), nHeight);
-            else
-                LogPrintf("%s: Invalid serial detected within range in block %d\n", __func__, nHeight);
+        if (fCheckSignature && !CheckZerocoinSpendSignature(tx, spend, nHeight)) {
+            return false;
         }
 
         libzerocoin::SpendType expectedType = libzerocoin::SpendType::SPEND;
@@ -268,8 +280,10 @@ bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const lib
 bool ParseAndValidateZerocoinSpends(const Consensus::Params& consensus,
                                     const CTransaction& tx, int chainHeight,
                                     CValidationState& state,
-                                    std::vector<std::pair<CBigNum, uint256>>& vSpendsRet)
+                                    std::vector<std::pair<CBigNum, uint256>>& vSpendsRet,
+                                    std::vector<CZerocoinSpendCheck>* pvChecks)
 {
+    const bool fQueueSignatureChecks = pvChecks && consensus.NetworkUpgradeActive(chainHeight, Consensus::UPGRADE_ZC_V2);
     for (const CTxIn& txIn : tx.vin) {
         bool isPublicSpend = txIn.IsZerocoinPublicSpend();
         bool isPrivZerocoinSpend = txIn.IsZerocoinSpend();
@@ -283,26 +297,44 @@ bool ParseAndValidateZerocoinSpends(const Consensus::Params& consensus,
 
         if (isPublicSpend) {
             libzerocoin::ZerocoinParams* params = consensus.Zerocoin_Params(false);
-            PublicCoinSpend publicSpend(params);
-            if (!ZPIVModule::ParseZerocoinPublicSpend(txIn, tx, state, publicSpend)) {
+            auto publicSpend = std::make_shared<PublicCoinSpend>(params);
+            if (!ZPIVModule::ParseZerocoinPublicSpend(txIn, tx, state, *publicSpend)) {
                 return false;
             }
             //queue for db write after the 'justcheck' section has concluded
-            if (!ContextualCheckZerocoinSpend(tx, &publicSpend, chainHeight)) {
+            if (!ContextualCheckZerocoinSpend(tx, publicSpend.get(), chainHeight, !fQueueSignatureChecks)) {
                 state.DoS(100, error("%s: failed to add block %s with invalid public zc spend", __func__,
                                      tx.GetHash().GetHex()), REJECT_INVALID);
                 return false;
             }
-            vSpendsRet.emplace_back(publicSpend.getCoinSerialNumber(), tx.GetHash());
+            vSpendsRet.emplace_back(publicSpend->getCoinSerialNumber(), tx.GetHash());
+            if (fQueueSignatureChecks) {
+                pvChecks->emplace_back(tx, std::move(publicSpend), false /* fPublicSpend */, chainHeight);
+            }
         } else {
-            libzerocoin::CoinSpend spend = ZPIVModule::TxInToZerocoinSpend(txIn);
+            auto spend = std::make_shared<libzerocoin::CoinSpend>(ZPIVModule::TxInToZerocoinSpend(txIn));
             //queue for db write after the 'justcheck' section has concluded
-            if (!ContextualCheckZerocoinSpend(tx, &spend, chainHeight)) {
+            if (!ContextualCheckZerocoinSpend(tx, spend.get(), chainHeight, !fQueueSignatureChecks)) {
                 return state.DoS(100, error("%s: failed to add block %s with invalid zerocoinspend", __func__,
                                      tx.GetHash().GetHex()), REJECT_INVALID);
             }
-            vSpendsRet.emplace_back(spend.getCoinSerialNumber(), tx.GetHash());
+            vSpendsRet.emplace_back(spend->getCoinSerialNumber(), tx.GetHash());
+            if (fQueueSignatureChecks) {
+                pvChecks->emplace_back(tx, std::move(spend), false /* fPublicSpend */, chainHeight);
+            }
         }
     }
     return !vSpendsRet.empty();
 }
+
+bool CZerocoinSpendCheck::operator()()
+{
+    if (fPublicSpend) {
+        // Checked as a PublicCoinSpend, see CheckZerocoinSpend
+        if (!static_cast<const PublicCoinSpend&>(*spend).Verify()) {
+            return error("%s: public zerocoin spend did not verify, txid %s", __func__, ptx->GetHash().GetHex());
+        }
+        return true;
+    }
+    return CheckZerocoinSpendSignature(*ptx, spend.get(), nHeight);
+}
@@ -8,8 +8,11 @@
 #include "consensus/consensus.h"
 #include "script/interpreter.h"
 
+#include <memory>
+
 class CValidationState;
 class CBigNum;
+class CZerocoinSpendCheck;
 
 namespace Consensus {
     struct Params;
@@ -22,9 +25,12 @@ namespace libzerocoin {
 bool isBlockBetweenFakeSerialAttackRange(int nHeight);
 // Public coin spend
 bool CheckPublicCoinSpendEnforced(int blockHeight, bool isPublicSpend);
-bool ContextualCheckZerocoinTx(const CTransactionRef& tx, CValidationState& state, const Consensus::Params& consensus, int nHeight, bool isMined);
-bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight);
-bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight);
+// If pvChecks is not null, the spends signatures verification is appended to it instead of being done inline
+bool ContextualCheckZerocoinTx(const CTransactionRef& tx, CValidationState& state, const Consensus::Params& consensus, int nHeight, bool isMined,
+                               std::vector<CZerocoinSpendCheck>* pvChecks = nullptr);
+// fCheckSignature=false leaves the spend signature verification to the caller (see CZerocoinSpendCheck)
+bool ContextualCheckZerocoinSpend(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight, bool fCheckSignature = true);
+bool ContextualCheckZerocoinSpendNoSerialCheck(const CTransaction& tx, const libzerocoin::CoinSpend* spend, int nHeight, bool fCheckSignature = true);
 
 bool IsSerialInBlockchain(const CBigNum& bnSerial, int& nHeightTx);
 
@@ -32,6 +38,40 @@ bool IsSerialInBlockchain(const CBigNum& bnSerial, int& nHeightTx);
 bool ParseAndValidateZerocoinSpends(const Consensus::Params& consensus,
                                     const CTransaction& tx, int chainHeight,
                                     CValidationState& state,
-                                    std::vector<std::pair<CBigNum, uint256>>& vSpendsRet);
+                                    std::vector<std::pair<CBigNum, uint256>>& vSpendsRet,
+                                    std::vector<CZerocoinSpendCheck>* pvChecks = nullptr);
+
+/**
+ * Closure representing the signatures verification of one zerocoin spend:
+ * PublicCoinSpend::Verify for the public spends (commitment or Schnorr
+ * signature, and ECDSA signature), else CoinSpend::HasValidSignature.
+ * Note that this stores a reference to the transaction.
+ */
+class CZerocoinSpendCheck
+{
+private:
+    std::shared_ptr<const libzerocoin::CoinSpend> spend;
+    bool fPublicSpend;
+    const CTransaction* ptx;
+    int nHeight;
+
+public:
+    CZerocoinSpendCheck() : fPublicSpend(false), ptx(nullptr), nHeight(0) {}
+    CZerocoinSpendCheck(const CTransaction& txIn, std::shared_ptr<const libzerocoin::CoinSpend> spendIn, bool fPublicSpendIn, int nHeightIn) :
+        spend(std::move(spendIn)),
+        fPublicSpend(fPublicSpendIn),
+        ptx(&txIn),
+        nHeight(nHeightIn) {}
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        std::swap(spend, check.spend);
+        std::swap(fPublicSpend, check.fPublicSpend);
+        std::swap(ptx, check.ptx);
+        std::swap(nHeight, check.nHeight);
+    }
+};
 
 #endif // PIVX_CONSENSUS_ZEROCOIN_VERIFY_H
@@ -6,9 +6,49 @@
 
 #include "crypto/common.h"
 
+#include <assert.h>
 #include <string.h>
 #include <stdexcept>
 
+// The optimized implementations are selected at runtime (x86 only), and are not part of the consensus library
+#if defined(USE_ASM) && !defined(BUILD_BITCOIN_INTERNAL) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#if defined(ENABLE_SSE41)
+#define USE_SHA256_SSE41 1
+#endif
+#if defined(ENABLE_AVX2)
+#define USE_SHA256_AVX2 1
+#endif
+#if defined(ENABLE_SHANI)
+#define USE_SHA256_SHANI 1
+#endif
+#if defined(USE_SHA256_SSE41) || defined(USE_SHA256_AVX2) || defined(USE_SHA256_SHANI)
+#define HAVE_SHA256_CPUID 1
+#endif
+#endif
+
+#if defined(USE_SHA256_SSE41)
+namespace sha256d64_sse41
+{
+void Transform_4way(unsigned char* out, const unsigned char* in);
+void TransformS64_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(USE_SHA256_AVX2)
+namespace sha256d64_avx2
+{
+void Transform_8way(unsigned char* out, const unsigned char* in);
+void TransformS64_8way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+#if defined(USE_SHA256_SHANI)
+namespace sha256_shani
+{
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks);
+}
+#endif
+
 // Internal implementation code.
 namespace
 {
@@ -45,7 +85,7 @@ void inline Initialize(uint32_t* s)
 }
 
 /** Perform one SHA-256 transformation, processing a 64-byte chunk. */
-void Transform(uint32_t* s, const unsigned char* chunk)
+void TransformBlock(uint32_t* s, const unsigned char* chunk)
 {
     uint32_t a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
     uint32_t w0, w1, w2, w3, w4, w5, w6, w7, w8, w9, w10, w11, w12, w13, w14, w15;
@@ -128,7 +168,139 @@ void Transform(uint32_t* s, const unsigned char* chunk)
     s[7] += h;
 }
 
+/** Perform a number of SHA-256 transformations, processing 64-byte chunks. */
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    while (blocks--) {
+        TransformBlock(s, chunk);
+        chunk += 64;
+    }
+}
+
 } // namespace sha256
+
+typedef void (*TransformType)(uint32_t*, const unsigned char*, size_t);
+typedef void (*TransformD64Type)(unsigned char*, const unsigned char*);
+
+// 0x80 terminator, then the message length (512 bits) in the last 8 bytes
+const unsigned char padding64[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02, 0};
+
+/** Single-SHA256 of a 64-byte input, with the given transform. */
+template<TransformType tr>
+void TransformS64Wrapper(unsigned char* out, const unsigned char* in)
+{
+    uint32_t s[8];
+    sha256::Initialize(s);
+    tr(s, in, 1);
+    tr(s, padding64, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, s[i]);
+    }
+}
+
+/** Double-SHA256 of a 64-byte input, with the given transform. */
+template<TransformType tr>
+void TransformD64Wrapper(unsigned char* out, const unsigned char* in)
+{
+    // the second hash has a 32-byte input (256 bits)
+    unsigned char buffer2[64] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0};
+    uint32_t s[8];
+    sha256::Initialize(s);
+    tr(s, in, 1);
+    tr(s, padding64, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(buffer2 + 4 * i, s[i]);
+    }
+    sha256::Initialize(s);
+    tr(s, buffer2, 1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, s[i]);
+    }
+}
+
+TransformType Transform = sha256::Transform;
+TransformD64Type TransformS64 = TransformS64Wrapper<sha256::Transform>;
+TransformD64Type TransformD64 = TransformD64Wrapper<sha256::Transform>;
+TransformD64Type TransformD64_4way = nullptr;
+TransformD64Type TransformD64_8way = nullptr;
+TransformD64Type TransformS64_4way = nullptr;
+TransformD64Type TransformS64_8way = nullptr;
+
+bool SelfTest()
+{
+    // Compare the selected implementations with the generic one (which is covered by the test vectors)
+    unsigned char in[64 * 8];
+    unsigned char out[32 * 8];
+    unsigned char expected[32 * 8];
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (unsigned char)(i * 37 + 11);
+    }
+
+    // Transform: hash of the whole buffer
+    uint32_t s1[8], s2[8];
+    sha256::Initialize(s1);
+    sha256::Initialize(s2);
+    sha256::Transform(s1, in, 8);
+    Transform(s2, in, 8);
+    if (memcmp(s1, s2, sizeof(s1))) return false;
+
+    for (int i = 0; i < 8; i++) {
+        TransformD64Wrapper<sha256::Transform>(expected + 32 * i, in + 64 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        TransformD64(out + 32 * i, in + 64 * i);
+    }
+    if (memcmp(out, expected, sizeof(out))) return false;
+    if (TransformD64_4way) {
+        TransformD64_4way(out, in);
+        TransformD64_4way(out + 128, in + 256);
+        if (memcmp(out, expected, sizeof(out))) return false;
+    }
+    if (TransformD64_8way) {
+        TransformD64_8way(out, in);
+        if (memcmp(out, expected, sizeof(out))) return false;
+    }
+
+    for (int i = 0; i < 8; i++) {
+        TransformS64Wrapper<sha256::Transform>(expected + 32 * i, in + 64 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        TransformS64(out + 32 * i, in + 64 * i);
+    }
+    if (memcmp(out, expected, sizeof(out))) return false;
+    if (TransformS64_4way) {
+        TransformS64_4way(out, in);
+        TransformS64_4way(out + 128, in + 256);
+        if (memcmp(out, expected, sizeof(out))) return false;
+    }
+    if (TransformS64_8way) {
+        TransformS64_8way(out, in);
+        if (memcmp(out, expected, sizeof(out))) return false;
+    }
+    return true;
+}
+
+#if defined(HAVE_SHA256_CPUID)
+/** Query the CPU features (leaf/subleaf) with the cpuid instruction. */
+void inline cpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __asm__ ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "0"(leaf), "2"(subleaf));
+}
+
+/** Check whether the OS has enabled AVX registers. */
+bool AVXEnabled()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return (a & 6) == 6;
+}
+#endif
 } // namespace
 
 
@@ -148,14 +320,15 @@ CSHA256& CSHA256::Write(const unsigned char* data, size_t len)
         memcpy(buf + bufsize, data, 64 - bufsize);
         bytes += 64 - bufsize;
         data += 64 - bufsize;
-        sha256::Transform(s, buf);
+        Transform(s, buf, 1);
         bufsize = 0;
     }
-    while (end >= data + 64) {
+    if (end - data >= 64) {
         // Process full chunks directly from the source.
-        sha256::Transform(s, data);
-        bytes += 64;
-        data += 64;
+        size_t blocks = (end - data) / 64;
+        Transform(s, data, blocks);
+        data += 64 * blocks;
+        bytes += 64 * blocks;
     }
     if (end > data) {
         // Fill the buffer with what remains.
@@ -197,3 +370,125 @@ CSHA256& CSHA256::Reset()
     sha256::Initialize(s);
     return *this;
 }
+
+void SHA256Multi64(unsigned char* output, const unsigned char* input, size_t blocks)
+{
+    if (TransformS64_8way) {
+        while (blocks >= 8) {
+            TransformS64_8way(output, input);
+            output += 256;
+            input += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformS64_4way) {
+        while (blocks >= 4) {
+            TransformS64_4way(output, input);
+            output += 128;
+            input += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        TransformS64(output, input);
+        output += 32;
+        input += 64;
+        --blocks;
+    }
+}
+
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (TransformD64_8way) {
+        while (blocks >= 8) {
+            TransformD64_8way(out, in);
+            out += 256;
+            in += 512;
+            blocks -= 8;
+        }
+    }
+    if (TransformD64_4way) {
+        while (blocks >= 4) {
+            TransformD64_4way(out, in);
+            out += 128;
+            in += 256;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        TransformD64(out, in);
+        out += 32;
+        in += 64;
+        --blocks;
+    }
+}
+
+std::string SHA256AutoDetect(sha256_implementation::UseImplementation use_implementation)
+{
+    std::string ret = "standard";
+    Transform = sha256::Transform;
+    TransformS64 = TransformS64Wrapper<sha256::Transform>;
+    TransformD64 = TransformD64Wrapper<sha256::Transform>;
+    TransformD64_4way = nullptr;
+    TransformD64_8way = nullptr;
+    TransformS64_4way = nullptr;
+    TransformS64_8way = nullptr;
+
+#if defined(HAVE_SHA256_CPUID)
+    bool have_sse4 = false;
+    bool have_xsave = false;
+    bool have_avx = false;
+    bool have_avx2 = false;
+    bool have_shani = false;
+    bool enabled_avx = false;
+
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, eax, ebx, ecx, edx);
+    if (use_implementation & sha256_implementation::USE_SSE4) {
+        have_sse4 = (ecx >> 19) & 1;
+    }
+    have_xsave = (ecx >> 27) & 1;
+    have_avx = (ecx >> 28) & 1;
+    if (have_xsave && have_avx) {
+        enabled_avx = AVXEnabled();
+    }
+    cpuid(0, 0, eax, ebx, ecx, edx);
+    if (eax >= 7) {
+        cpuid(7, 0, eax, ebx, ecx, edx);
+        if (use_implementation & sha256_implementation::USE_AVX2) {
+            have_avx2 = (ebx >> 5) & 1;
+        }
+        if (use_implementation & sha256_implementation::USE_SHANI) {
+            have_shani = (ebx >> 29) & 1;
+        }
+    }
+
+#if defined(USE_SHA256_SHANI)
+    if (have_shani) {
+        Transform = sha256_shani::Transform;
+        TransformS64 = TransformS64Wrapper<sha256_shani::Transform>;
+        TransformD64 = TransformD64Wrapper<sha256_shani::Transform>;
+        ret = "shani(1way)";
+    }
+#endif
+
+#if defined(USE_SHA256_SSE41)
+    if (have_sse4) {
+        TransformD64_4way = sha256d64_sse41::Transform_4way;
+        TransformS64_4way = sha256d64_sse41::TransformS64_4way;
+        ret += ",sse41(4way)";
+    }
+#endif
+
+#if defined(USE_SHA256_AVX2)
+    if (have_avx2 && have_avx && enabled_avx) {
+        TransformD64_8way = sha256d64_avx2::Transform_8way;
+        TransformS64_8way = sha256d64_avx2::TransformS64_8way;
+        ret += ",avx2(8way)";
+    }
+#endif
+#endif // HAVE_SHA256_CPUID
+
+    assert(SelfTest());
+    return ret;
+}
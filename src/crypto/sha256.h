@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -26,4 +27,36 @@ public:
     CSHA256& Reset();
 };
 
+/** Compute multiple single-SHA256 hashes of 64-byte blobs.
+ *  output: pointer to a blocks*32 byte output buffer
+ *  input:  pointer to a blocks*64 byte input buffer
+ *  blocks: the number of hashes to compute.
+ */
+void SHA256Multi64(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Compute multiple double-SHA256's of 64-byte blobs.
+ *  output: pointer to a blocks*32 byte output buffer
+ *  input:  pointer to a blocks*64 byte input buffer
+ *  blocks: the number of hashes to compute.
+ *  The output may overlap the start of the input (in-place hashing of a merkle level).
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
+namespace sha256_implementation {
+enum UseImplementation : uint8_t {
+    STANDARD = 0,
+    USE_SSE4 = 1 << 0,
+    USE_AVX2 = 1 << 1,
+    USE_SHANI = 1 << 2,
+    USE_SSE4_AND_AVX2 = USE_SSE4 | USE_AVX2,
+    USE_SSE4_AND_SHANI = USE_SSE4 | USE_SHANI,
+    USE_ALL = USE_SSE4 | USE_AVX2 | USE_SHANI,
+};
+}
+
+/** Autodetect the best available SHA256 implementation (restricted to use_implementation).
+ *  Returns the name of the implementation.
+ */
+std::string SHA256AutoDetect(sha256_implementation::UseImplementation use_implementation = sha256_implementation::USE_ALL);
+
 #endif // PIVX_CRYPTO_SHA256_H
@@ -12,6 +12,7 @@
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "crypto/sha256.h"
 #include "key_io.h"
 #include "guiinterface.h"
 #include "masternodeman.h" // for mnodeman (!TODO: remove)
@@ -238,27 +239,35 @@ std::vector<CDeterministicMNCPtr> CDeterministicMNList::CalculateQuorum(size_t m
 
 std::vector<std::pair<arith_uint256, CDeterministicMNCPtr>> CDeterministicMNList::CalculateScores(const uint256& modifier) const
 {
-    std::vector<std::pair<arith_uint256, CDeterministicMNCPtr>> scores;
-    scores.reserve(GetAllMNsCount());
+    std::vector<CDeterministicMNCPtr> mns;
+    std::vector<unsigned char> buf;
+    mns.reserve(GetAllMNsCount());
+    buf.reserve(GetAllMNsCount() * 64);
     ForEachMN(true, [&](const CDeterministicMNCPtr& dmn) {
         if (dmn->pdmnState->confirmedHash.IsNull()) {
             // we only take confirmed MNs into account to avoid hash grinding on the ProRegTxHash to sneak MNs into a
             // future quorums
             return;
         }
-        // calculate sha256(sha256(proTxHash, confirmedHash), modifier) per MN
-        // Please note that this is not a double-sha256 but a single-sha256
-        // The first part is already precalculated (confirmedHashWithProRegTxHash)
-        // TODO When https://github.com/bitcoin/bitcoin/pull/13191 gets backported, implement something that is similar but for single-sha256
-        uint256 h;
-        CSHA256 sha256;
-        sha256.Write(dmn->pdmnState->confirmedHashWithProRegTxHash.begin(), dmn->pdmnState->confirmedHashWithProRegTxHash.size());
-        sha256.Write(modifier.begin(), modifier.size());
-        sha256.Finalize(h.begin());
-
-        scores.emplace_back(UintToArith256(h), dmn);
+        mns.emplace_back(dmn);
+        buf.insert(buf.end(), dmn->pdmnState->confirmedHashWithProRegTxHash.begin(), dmn->pdmnState->confirmedHashWithProRegTxHash.end());
+        buf.insert(buf.end(), modifier.begin(), modifier.end());
     });
 
+    // calculate sha256(sha256(proTxHash, confirmedHash), modifier) per MN
+    // Please note that this is not a double-sha256 but a single-sha256
+    // The first part is already precalculated (confirmedHashWithProRegTxHash)
+    // All the inputs are 64 bytes, so hash them in one batch.
+    std::vector<unsigned char> hashes(mns.size() * 32);
+    SHA256Multi64(hashes.data(), buf.data(), mns.size());
+
+    std::vector<std::pair<arith_uint256, CDeterministicMNCPtr>> scores;
+    scores.reserve(mns.size());
+    for (size_t i = 0; i < mns.size(); i++) {
+        uint256 h;
+        memcpy(h.begin(), hashes.data() + i * 32, 32);
+        scores.emplace_back(UintToArith256(h), std::move(mns[i]));
+    }
     return scores;
 }
 
@@ -462,6 +471,10 @@ void CDeterministicMNList::RemoveMN(const uint256& proTxHash)
 CDeterministicMNManager::CDeterministicMNManager(CEvoDB& _evoDb) :
     evoDb(_evoDb)
 {
+    for (const auto& p : Params().GetConsensus().llmqs) {
+        mapQuorumMembers.emplace(std::piecewise_construct, std::forward_as_tuple(p.first),
+            std::forward_as_tuple(p.second.signingActiveQuorumCount + 1));
+    }
 }
 
 bool CDeterministicMNManager::ProcessBlock(const CBlock& block, const CBlockIndex* pindex, CValidationState& _state, bool fJustCheck)
@@ -546,6 +559,7 @@ bool CDeterministicMNManager::UndoBlock(const CBlock& block, const CBlockIndex*
         }
 
         mnListsCache.erase(blockHash);
+        mnListsLRUCache.erase(blockHash);
         mnListDiffsCache.erase(blockHash);
     }
 
@@ -859,6 +873,9 @@ CDeterministicMNList CDeterministicMNManager::GetListForBlock(const CBlockIndex*
             snapshot = itLists->second;
             break;
         }
+        if (mnListsLRUCache.get(pindex->GetBlockHash(), snapshot)) {
+            break;
+        }
 
         if (evoDb.Read(std::make_pair(DB_LIST_SNAPSHOT, pindex->GetBlockHash()), snapshot)) {
             mnListsCache.emplace(pindex->GetBlockHash(), snapshot);
@@ -901,14 +918,19 @@ CDeterministicMNList CDeterministicMNManager::GetListForBlock(const CBlockIndex*
             snapshot.SetBlockHash(diffIndex->GetBlockHash());
             snapshot.SetHeight(diffIndex->nHeight);
         }
+        // keep intermediate snapshots, so the next lookups replay at most MEM_SNAPSHOT_PERIOD diffs
+        if (diffIndex->nHeight % MEM_SNAPSHOT_PERIOD == 0) {
+            mnListsLRUCache.insert(snapshot.GetBlockHash(), snapshot);
+        }
     }
 
-    if (tipIndex) {
-        // always keep a snapshot for the tip
-        if (snapshot.GetBlockHash() == tipIndex->GetBlockHash()) {
+    if (!listDiffIndexes.empty()) {
+        if (tipIndex && (snapshot.GetBlockHash() == tipIndex->GetBlockHash() ||
+                         IsQuorumBaseListAlive(snapshot.GetHeight(), tipIndex->nHeight))) {
+            // always keep a snapshot for the tip and for yet alive quorums
             mnListsCache.emplace(snapshot.GetBlockHash(), snapshot);
         } else {
-            // !TODO: keep snapshots for yet alive quorums
+            mnListsLRUCache.insert(snapshot.GetBlockHash(), snapshot);
         }
     }
 
@@ -946,6 +968,18 @@ bool CDeterministicMNManager::LegacyMNObsolete() const
     return LegacyMNObsolete(tipHeight);
 }
 
+bool CDeterministicMNManager::IsQuorumBaseListAlive(int nListHeight, int nTipHeight)
+{
+    for (const auto& p : Params().GetConsensus().llmqs) {
+        const auto& params = p.second;
+        if ((nListHeight % params.dkgInterval) == 0 &&
+            nListHeight + params.dkgInterval * (params.keepOldConnections + 1) >= nTipHeight) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void CDeterministicMNManager::CleanupCache(int nHeight)
 {
     AssertLockHeld(cs);
@@ -957,7 +991,15 @@ void CDeterministicMNManager::CleanupCache(int nHeight)
             toDeleteLists.emplace_back(p.first);
             continue;
         }
-        // !TODO: llmq cache cleanup
+        // the tip, the disk snapshots and the base lists of the quorums still alive stay pinned
+        if ((tipIndex && p.first == tipIndex->GetBlockHash()) || p.second.GetHeight() == nHeight ||
+                (p.second.GetHeight() % DISK_SNAPSHOT_PERIOD) == 0 ||
+                IsQuorumBaseListAlive(p.second.GetHeight(), nHeight)) {
+            continue;
+        }
+        // no longer pinned, move it to the LRU cache
+        mnListsLRUCache.insert(p.first, p.second);
+        toDeleteLists.emplace_back(p.first);
     }
     for (const auto& h : toDeleteLists) {
         mnListsCache.erase(h);
@@ -974,10 +1016,24 @@ void CDeterministicMNManager::CleanupCache(int nHeight)
 
 std::vector<CDeterministicMNCPtr> CDeterministicMNManager::GetAllQuorumMembers(Consensus::LLMQType llmqType, const CBlockIndex* pindexQuorum)
 {
+    std::vector<CDeterministicMNCPtr> members;
+    const uint256& quorumHash = pindexQuorum->GetBlockHash();
+    {
+        LOCK(cs);
+        if (mapQuorumMembers.at(llmqType).get(quorumHash, members)) {
+            return members;
+        }
+    }
+
+    // The list of a given block never changes, so neither do the members of a quorum
     auto& params = Params().GetConsensus().llmqs.at(llmqType);
     auto allMns = GetListForBlock(pindexQuorum);
-    auto modifier = ::SerializeHash(std::make_pair(static_cast<uint8_t>(llmqType), pindexQuorum->GetBlockHash()));
-    return allMns.CalculateQuorum(params.size, modifier);
+    auto modifier = ::SerializeHash(std::make_pair(static_cast<uint8_t>(llmqType), quorumHash));
+    members = allMns.CalculateQuorum(params.size, modifier);
+
+    LOCK(cs);
+    mapQuorumMembers.at(llmqType).insert(quorumHash, members);
+    return members;
 }
 
 
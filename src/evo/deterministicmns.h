@@ -16,6 +16,7 @@
 #include "saltedhasher.h"
 #include "serialize.h"
 #include "sync.h"
+#include "unordered_lru_cache.h"
 #include "version.h"
 
 #include <immer/map.hpp>
@@ -556,6 +557,8 @@ class CDeterministicMNManager
     static const int DISK_SNAPSHOT_PERIOD = 1440; // once per day
     static const int DISK_SNAPSHOTS = 3; // keep cache for 3 disk snapshots to have 2 full days covered
     static const int LIST_DIFFS_CACHE_SIZE = DISK_SNAPSHOT_PERIOD * DISK_SNAPSHOTS;
+    static const int MEM_SNAPSHOT_PERIOD = 32; // keep in memory a list every 32 blocks, when materialized
+    static const int LIST_LRU_CACHE_SIZE = 256;
 
 public:
     mutable RecursiveMutex cs;
@@ -563,10 +566,16 @@ public:
 private:
     CEvoDB& evoDb;
 
+    // tip, disk snapshots (within the diffs window) and base lists of the quorums still alive
     std::unordered_map<uint256, CDeterministicMNList, StaticSaltedHasher> mnListsCache;
+    // recently materialized lists and intermediate snapshots
+    unordered_lru_cache<uint256, CDeterministicMNList, StaticSaltedHasher> mnListsLRUCache{LIST_LRU_CACHE_SIZE};
     std::unordered_map<uint256, CDeterministicMNListDiff, StaticSaltedHasher> mnListDiffsCache;
     const CBlockIndex* tipIndex{nullptr};
 
+    // llmqType -> quorumHash -> members (sorted by score)
+    std::map<Consensus::LLMQType, unordered_lru_cache<uint256, std::vector<CDeterministicMNCPtr>, StaticSaltedHasher>> mapQuorumMembers;
+
 public:
     explicit CDeterministicMNManager(CEvoDB& _evoDb);
 
@@ -596,6 +605,8 @@ public:
     std::vector<CDeterministicMNCPtr> GetAllQuorumMembers(Consensus::LLMQType llmqType, const CBlockIndex* pindexQuorum);
 
 private:
+    // Whether the list at nListHeight is the base of a quorum that is still alive at nTipHeight
+    static bool IsQuorumBaseListAlive(int nListHeight, int nTipHeight);
     void CleanupCache(int nHeight);
 };
 
@@ -17,15 +17,19 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockcompression.h"
+#include "blockstatsindex.h"
 #include "bls/bls_wrapper.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
+#include "crypto/sha256.h"
 #include "fs.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "invalid.h"
 #include "key.h"
+#include "legacy/stakemodifier.h"
 #include "mapport.h"
 #include "miner.h"
 #include "netbase.h"
@@ -34,12 +38,14 @@
 #include "policy/policy.h"
 #include "rpc/register.h"
 #include "rpc/server.h"
+#include "sapling/sapling_validation.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
 #include "scheduler.h"
 #include "shutdown.h"
 #include "spork.h"
 #include "sporkdb.h"
+#include "stakeinput.h"
 #include "tiertwo/init.h"
 #include "txdb.h"
 #include "torcontrol.h"
@@ -86,6 +92,10 @@ static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
+static const bool DEFAULT_LOCKPROFILE = false;
+static const int64_t DEFAULT_LOCKPROFILE_INTERVAL = 600;
+//! Number of lock sites in the periodic lock profile log
+static const size_t LOCK_PROFILE_LOG_SITES = 20;
 
 std::unique_ptr<CConnman> g_connman;
 std::unique_ptr<PeerLogicValidation> peerLogic;
@@ -228,6 +238,10 @@ void Shutdown()
     // using the other before destroying them.
     if (peerLogic) UnregisterValidationInterface(peerLogic.get());
     if (g_connman) g_connman->Stop();
+    if (g_blockstatsindex) {
+        g_blockstatsindex->Interrupt();
+        UnregisterValidationInterface(g_blockstatsindex.get());
+    }
 
     StopTorControl();
 
@@ -241,6 +255,10 @@ void Shutdown()
     // destruct and reset all to nullptr.
     g_connman.reset();
     peerLogic.reset();
+    if (g_blockstatsindex) {
+        g_blockstatsindex->Stop();
+        g_blockstatsindex.reset();
+    }
 
     DumpTierTwo();
     if (::mempool.IsLoaded() && gArgs.GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
@@ -329,6 +347,8 @@ void Shutdown()
     globalVerifyHandle.reset();
     ECC_Stop();
     LogPrintf("%s: done\n", __func__);
+    // Flush the asynchronous logger
+    g_logger->StopAsync();
 }
 
 /**
@@ -391,10 +411,12 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", "This help message");
     strUsage += HelpMessageOpt("-version", "Print version and exit");
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", "Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)");
+    strUsage += HelpMessageOpt("-blockcompression", strprintf("Compress the blocks and undo data written to the blk/rev files. Compressed records are read transparently, but older versions cannot read them (default: %u)", DEFAULT_BLOCK_COMPRESSION));
     strUsage += HelpMessageOpt("-blocksdir=<dir>", "Specify directory to hold blocks subdirectory for *.dat files (default: <datadir>)");
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", "Execute command when the best block changes (%s in cmd is replaced by block hash)");
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf("How many blocks to check at startup (default: %u, 0 = all)", DEFAULT_CHECKBLOCKS));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf("How thorough the block verification of -checkblocks is (0-4, default: %u)", DEFAULT_CHECKLEVEL));
+    strUsage += HelpMessageOpt("-checksupply", strprintf("Verify the money supply with a full scan of the UTXO set at startup (default: %u)", DEFAULT_CHECKSUPPLY));
 
     strUsage += HelpMessageOpt("-conf=<file>", strprintf("Specify configuration file (default: %s)", PIVX_CONF_FILENAME));
     if (mode == HMM_BITCOIND) {
@@ -426,6 +448,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", "Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)");
 #endif
+    strUsage += HelpMessageOpt("-blockstatsindex", strprintf("Maintain an index of per-block statistics, used by the getblockindexstats and getfeeinfo rpc calls (default: %u)", DEFAULT_BLOCKSTATSINDEX));
     strUsage += HelpMessageOpt("-txindex", strprintf("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)", DEFAULT_TXINDEX));
     strUsage += HelpMessageOpt("-forcestart", "Attempt to force blockchain corruption recovery on startup");
 
@@ -446,6 +469,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf("Maintain at most <n> connections to peers (default: %u)", DEFAULT_MAX_PEER_CONNECTIONS));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)", DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)", DEFAULT_MAXSENDBUFFER));
+    strUsage += HelpMessageOpt("-msgworkers=<n>", strprintf("Number of threads processing the masternode, budget and LLMQ messages, 0 to process them on the message handler thread (0 to %d, default: %d)", MAX_MESSAGE_WORKERS, DEFAULT_MESSAGE_WORKERS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)", "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", "Only connect to nodes in network <net> (ipv4, ipv6 or onion)");
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf("Relay non-P2SH multisig (default: %u)", DEFAULT_PERMIT_BAREMULTISIG));
@@ -454,6 +478,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", "Connect through SOCKS5 proxy");
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)", DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", "Connect to a node to retrieve peer addresses, and disconnect");
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf("Socket events mode, which must be one of: %s (default: %s)", GetSupportedSocketEventsModes(), DEFAULT_SOCKETEVENTS));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf("Specify connection timeout in milliseconds (minimum: 1, default: %d)", DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf("Tor control port to use if onion listening enabled (default: %s)", DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", "Tor control port password (default: empty)");
@@ -510,9 +535,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-logips", strprintf("Include IP addresses in debug output (default: %u)", DEFAULT_LOGIPS));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf("Prepend debug output with timestamp (default: %u)", DEFAULT_LOGTIMESTAMPS));
     strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
+    strUsage += HelpMessageOpt("-lockprofile", strprintf("Profile the lock contention, see getlockprofile (default: %u)", DEFAULT_LOCKPROFILE));
+    strUsage += HelpMessageOpt("-lockprofileinterval=<n>", strprintf("With -lockprofile, log the most contended locks every <n> seconds, 0 to disable (default: %u)", DEFAULT_LOCKPROFILE_INTERVAL));
+    strUsage += HelpMessageOpt("-logasync", strprintf("Write the debug output from a dedicated thread. Messages are dropped when more than %u are waiting (default: %u)", DEFAULT_LOGASYNC_QUEUE, DEFAULT_LOGASYNC));
     if (showDebug) {
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsaplingcachesize=<n>", strprintf("Limit size of the Sapling proofs cache to <n> MiB (default: %u)", DEFAULT_MAX_SAPLING_CACHE_SIZE));
     }
     strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf("Fees (in %s/Kb) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)", CURRENCY_UNIT, FormatMoney(::minRelayTxFee.GetFeePerK())));
@@ -799,6 +828,7 @@ namespace { // Variables internal to initialization process only
     int nMaxConnections;
     int nUserMaxConnections;
     int nFD;
+    SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
     ServiceFlags nLocalServices = NODE_NETWORK;
 }
 
@@ -994,13 +1024,14 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = gArgs.GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    const std::string strSocketEventsMode = gArgs.GetArg("-socketevents", DEFAULT_SOCKETEVENTS);
+    if (!ParseSocketEventsMode(strSocketEventsMode, socketEventsMode)) {
+        return UIError(strprintf(_("Invalid -socketevents ('%s') specified. Only these modes are supported: %s"), strSocketEventsMode, GetSupportedSocketEventsModes()));
+    }
+
     // Trim requested connection counts, to fit into system limitations
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
-#ifdef USE_POLL
-    int fd_max = nFD;
-#else
-    int fd_max = FD_SETSIZE;
-#endif
+    int fd_max = socketEventsMode == SOCKETEVENTS_SELECT ? FD_SETSIZE : nFD;
     nMaxConnections = std::max(std::min<int>(nMaxConnections, fd_max - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS), 0);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return UIError(_("Not enough file descriptors available."));
@@ -1053,6 +1084,7 @@ bool AppInitParameterInteraction()
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = gArgs.GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
+    fBlockCompression = gArgs.GetBoolArg("-blockcompression", DEFAULT_BLOCK_COMPRESSION);
     Checkpoints::fEnabled = gArgs.GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     // -mempoollimit limits
@@ -1152,6 +1184,10 @@ bool AppInitSanityChecks()
 {
     // ********************************************************* Step 4: sanity checks
 
+    // Select the fastest SHA256 implementation supported by the CPU
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+
     // Initialize elliptic curve code
     RandomInit();
     ECC_Start();
@@ -1188,6 +1224,9 @@ bool AppInitMain()
         if (!g_logger->OpenDebugLog())
             return UIError(strprintf(_("Could not open debug log file %s"), g_logger->m_file_path.string()));
     }
+    if (gArgs.GetBoolArg("-logasync", DEFAULT_LOGASYNC)) {
+        g_logger->StartAsync();
+    }
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -1209,11 +1248,13 @@ bool AppInitMain()
     }
 
     InitSignatureCache();
+    InitSaplingProofsCache();
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        for (int i = 0; i < nScriptCheckThreads - 1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+        }
     }
 
     if (gArgs.IsArgSet("-sporkkey")) // spork priv key
@@ -1231,6 +1272,17 @@ bool AppInitMain()
         RandAddPeriodic();
     }, 60000);
 
+    // Lock contention profiler
+    if (gArgs.GetBoolArg("-lockprofile", DEFAULT_LOCKPROFILE)) {
+        EnableLockProfiling(true);
+        const int64_t nLockProfileInterval = gArgs.GetArg("-lockprofileinterval", DEFAULT_LOCKPROFILE_INTERVAL);
+        if (nLockProfileInterval > 0) {
+            scheduler.scheduleEvery([]{
+                LogLockProfile(LOCK_PROFILE_LOG_SITES);
+            }, nLockProfileInterval * 1000);
+        }
+    }
+
     GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
 
     // Initialize Sapling circuit parameters
@@ -1534,6 +1586,19 @@ bool AppInitMain()
                     break;
                 }
 
+                // Refuse the chainstate of a newer release, and mark this one with the
+                // current format before anything is written in it
+                const int nChainstateVersion = pcoinsdbview->GetVersion();
+                if (nChainstateVersion > CHAINSTATE_VERSION) {
+                    strLoadError = strprintf(_("The chainstate database was written by a newer version of %s. You will need to rebuild the database using %s."),
+                                             PACKAGE_NAME, "-reindex-chainstate");
+                    break;
+                }
+                if (nChainstateVersion < CHAINSTATE_VERSION && !pcoinsdbview->WriteVersion(CHAINSTATE_VERSION)) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+
                 // ReplayBlocks is a no-op if we cleared the coinsviewdb with -reindex or -reindex-chainstate
                 if (!ReplayBlocks(chainparams, pcoinsdbview.get())) {
                     strLoadError = strprintf(_("Unable to replay blocks. You will need to rebuild the database using %s."), "-reindex");
@@ -1553,6 +1618,7 @@ bool AppInitMain()
                         break;
                     }
                     assert(chainActive.Tip() != nullptr);
+                    LoadOldModifierIndex();
                 }
 
                 if (Params().NetworkIDString() == CBaseChainParams::MAIN) {
@@ -1566,7 +1632,7 @@ bool AppInitMain()
                             strLoadError = _("System error while flushing the chainstate after pruning invalid entries. Possible corrupt database.");
                             break;
                         }
-                        MoneySupply.Update(pcoinsTip->GetTotalAmount(), chainHeight);
+                        UpdateMoneySupply();
                         // No need to keep the invalid outs in memory. Clear the map 100 blocks after the last invalid UTXO
                         if (chainHeight > consensus.height_last_invalid_UTXO + 100) {
                             invalid_out::setInvalidOutPoints.clear();
@@ -1594,6 +1660,12 @@ bool AppInitMain()
                         strLoadError = _("Corrupted block database detected");
                         break;
                     }
+
+                    // Warm up the spent stake inputs cache, to check the blocks of a fork without
+                    // reading the previous transactions from disk
+                    if (!g_spent_stakes.LoadFromDisk(gArgs.GetArg("-maxreorg", DEFAULT_MAX_REORG_DEPTH))) {
+                        LogPrintf("%s: Unable to load the spent stake inputs cache\n", __func__);
+                    }
                 }
             } catch (const std::exception& e) {
                 LogPrintf("%s\n", e.what());
@@ -1702,6 +1774,13 @@ bool AppInitMain()
         return false;
     }
 
+    if (gArgs.GetBoolArg("-blockstatsindex", DEFAULT_BLOCKSTATSINDEX)) {
+        // Entries are keyed by height: wipe them when the block chain is rebuilt
+        g_blockstatsindex.reset(new CBlockStatsIndex(1 << 23, false, gArgs.GetBoolArg("-reindex", false) || fReindexChainState));
+        RegisterValidationInterface(g_blockstatsindex.get());
+        g_blockstatsindex->Start();
+    }
+
     int chain_active_height;
 
     //// debug print
@@ -1715,7 +1794,7 @@ bool AppInitMain()
     // Update money supply
     if (!fReindex && !fReindexChainState) {
         uiInterface.InitMessage(_("Calculating money supply..."));
-        MoneySupply.Update(pcoinsTip->GetTotalAmount(), chain_active_height);
+        WITH_LOCK(cs_main, UpdateMoneySupply(gArgs.GetBoolArg("-checksupply", DEFAULT_CHECKSUPPLY)); );
     }
 
 
@@ -1783,6 +1862,8 @@ bool AppInitMain()
     connOptions.nSendBufferMaxSize = 1000*gArgs.GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*gArgs.GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
     connOptions.m_added_nodes = gArgs.GetArgs("-addnode");
+    connOptions.socketEventsMode = socketEventsMode;
+    connOptions.nMessageWorkers = std::max(0, std::min<int>(gArgs.GetArg("-msgworkers", DEFAULT_MESSAGE_WORKERS), MAX_MESSAGE_WORKERS));
 
     if (gArgs.IsArgSet("-bind")) {
         for (const std::string& strBind : gArgs.GetArgs("-bind")) {
@@ -7,6 +7,7 @@
 
 #include "kernel.h"
 
+#include "crypto/common.h"
 #include "db.h"
 #include "legacy/stakemodifier.h"
 #include "policy/policy.h"
@@ -58,9 +59,7 @@ uint256 CStakeKernel::GetHash() const
 bool CStakeKernel::CheckKernelHash(bool fSkipLog) const
 {
     // Get weighted target
-    arith_uint256 bnTarget;
-    bnTarget.SetCompact(nBits);
-    bnTarget *= (arith_uint256(stakeValue) / 100);
+    const arith_uint256& bnTarget = GetTarget();
 
     // Check PoS kernel hash
     const arith_uint256& hashProofOfStake = UintToArith256(GetHash());
@@ -82,6 +81,64 @@ bool CStakeKernel::CheckKernelHash(bool fSkipLog) const
     return res;
 }
 
+CSHA256 CStakeKernel::GetPrefixHasher() const
+{
+    CDataStream ss(stakeModifier);
+    ss << nTimeBlockFrom << stakeUniqueness;
+    CSHA256 hasher;
+    hasher.Write((const unsigned char*)ss.data(), ss.size());
+    return hasher;
+}
+
+arith_uint256 CStakeKernel::GetTarget() const
+{
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits);
+    bnTarget *= (arith_uint256(stakeValue) / 100);
+    return bnTarget;
+}
+
+CStakeKernelBatch::CStakeKernelBatch(const CBlockIndex* _pindexPrev, unsigned int _nBits):
+    pindexPrev(_pindexPrev),
+    nBits(_nBits)
+{}
+
+void CStakeKernelBatch::Add(CStakeInput* stakeInput, const COutPoint& outpoint)
+{
+    CStakeKernel stakeKernel(pindexPrev, stakeInput, nBits, 0);
+    vKernels.push_back({stakeKernel.GetPrefixHasher(), stakeKernel.GetTarget(), outpoint});
+}
+
+void CStakeKernelBatch::Erase(size_t i)
+{
+    vKernels.erase(vKernels.begin() + i);
+}
+
+// Same as CStakeKernel::GetHash, starting from the hashed prefix
+uint256 CStakeKernelBatch::GetHash(size_t i, int nTimeTx) const
+{
+    unsigned char vchTime[4];
+    WriteLE32(vchTime, (uint32_t)nTimeTx);
+    unsigned char vchHash[CSHA256::OUTPUT_SIZE];
+    CSHA256 hasher(vKernels[i].hasher);
+    hasher.Write(vchTime, sizeof(vchTime)).Finalize(vchHash);
+    uint256 hash;
+    CSHA256().Write(vchHash, sizeof(vchHash)).Finalize(hash.begin());
+    return hash;
+}
+
+int CStakeKernelBatch::Find(int nTimeTx, size_t nStart, size_t nEnd, int& nHashed) const
+{
+    nEnd = std::min(nEnd, vKernels.size());
+    for (size_t i = nStart; i < nEnd; i++) {
+        nHashed++;
+        if (UintToArith256(GetHash(i, nTimeTx)) < vKernels[i].bnTarget) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
 
 /*
  * PoS Validation
@@ -103,30 +160,6 @@ static bool LoadStakeInput(const CBlock& block, std::unique_ptr<CStakeInput>& st
     return stake != nullptr;
 }
 
-/*
- * Stake                Check if stakeInput can stake a block on top of pindexPrev
- *
- * @param[in]   pindexPrev      index of the parent block of the block being staked
- * @param[in]   stakeInput      input for the coinstake
- * @param[in]   nBits           target difficulty bits
- * @param[in]   nTimeTx         new blocktime
- * @return      bool            true if stake kernel hash meets target protocol
- */
-bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, int64_t& nTimeTx)
-{
-    if (!stakeInput) return false;
-
-    // Get the new time slot (and verify it's not the same as previous block)
-    const bool fRegTest = Params().IsRegTestNet();
-    nTimeTx = (fRegTest ? GetAdjustedTime() : GetCurrentTimeSlot());
-    if (nTimeTx <= pindexPrev->nTime && !fRegTest) return false;
-
-    // Verify Proof Of Stake
-    CStakeKernel stakeKernel(pindexPrev, stakeInput, nBits, nTimeTx);
-    return stakeKernel.CheckKernelHash(true);
-}
-
-
 /*
  * CheckProofOfStake    Check if block has valid proof of stake
  *
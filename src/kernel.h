@@ -8,8 +8,12 @@
 #ifndef PIVX_KERNEL_H
 #define PIVX_KERNEL_H
 
+#include "arith_uint256.h"
+#include "crypto/sha256.h"
 #include "stakeinput.h"
 
+#include <vector>
+
 class CStakeKernel {
 public:
     /**
@@ -28,6 +32,12 @@ public:
     // Check that the kernel hash meets the target required
     bool CheckKernelHash(bool fSkipLog = false) const;
 
+    // Hasher fed with the part of the kernel message which doesn't depend on the time
+    CSHA256 GetPrefixHasher() const;
+
+    // Target weighted with the stake value
+    arith_uint256 GetTarget() const;
+
 private:
     // kernel message hashed
     CDataStream stakeModifier{CDataStream(SER_GETHASH, 0)};
@@ -39,18 +49,43 @@ private:
     CAmount stakeValue{0};     // target multiplier
 };
 
-/* PoS Validation */
-
-/*
- * Stake                Check if stakeInput can stake a block on top of pindexPrev
- *
- * @param[in]   pindexPrev      index of the parent block of the block being staked
- * @param[in]   stakeInput      input for the coinstake
- * @param[in]   nBits           target difficulty bits
- * @param[in]   nTimeTx         new blocktime
- * @return      bool            true if stake kernel hash meets target protocol
+/**
+ * Stake kernels of the stakeable coins of a wallet, on top of the same block.
+ * The part of each kernel message which doesn't depend on the time (stake modifier,
+ * time of the origin block, uniqueness) is hashed once per tip, and its SHA-256
+ * midstate kept: each time slot then only costs the last block of the first hash,
+ * and the second hash, for every coin.
  */
-bool Stake(const CBlockIndex* pindexPrev, CStakeInput* stakeInput, unsigned int nBits, int64_t& nTimeTx);
+class CStakeKernelBatch
+{
+public:
+    CStakeKernelBatch(const CBlockIndex* pindexPrev, unsigned int nBits);
+
+    void Add(CStakeInput* stakeInput, const COutPoint& outpoint);
+    void Erase(size_t i);
+
+    // Return the position of the first kernel, from nStart, meeting the target at nTimeTx (-1 if none).
+    // nHashed is increased with the number of kernels hashed.
+    int Find(int nTimeTx, size_t nStart, size_t nEnd, int& nHashed) const;
+
+    uint256 GetHash(size_t i, int nTimeTx) const;
+    const COutPoint& GetOutPoint(size_t i) const { return vKernels[i].outpoint; }
+    size_t Size() const { return vKernels.size(); }
+    bool IsFor(const CBlockIndex* pindex, unsigned int nBitsIn) const { return pindex == pindexPrev && nBitsIn == nBits; }
+
+private:
+    struct Kernel {
+        CSHA256 hasher;
+        arith_uint256 bnTarget;
+        COutPoint outpoint;
+    };
+
+    const CBlockIndex* pindexPrev;
+    unsigned int nBits;
+    std::vector<Kernel> vKernels;
+};
+
+/* PoS Validation */
 
 /*
  * CheckProofOfStake    Check if block has valid proof of stake
@@ -6,7 +6,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "legacy/stakemodifier.h"
-#include "validation.h"   // mapBlockIndex, chainActive
+#include "validation.h"   // chainActive
 
 /*
  * Old Modifier - Only for IBD
@@ -24,38 +24,26 @@ static int64_t GetStakeModifierSelectionIntervalSection(int nSection)
     return a;
 }
 
-// select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
-// nSelectionIntervalStop.
-static bool SelectBlockFromCandidates(
-    std::vector<std::pair<int64_t, uint256> >& vSortedByTimestamp,
-    std::map<uint256, const CBlockIndex*>& mapSelectedBlocks,
-    int64_t nSelectionIntervalStop,
-    uint64_t nStakeModifierPrev,
-    const CBlockIndex** pindexSelected)
+// A candidate block for the modifier selection, with its selection hash
+struct ModifierCandidate
 {
-    bool fModifierV2 = false;
-    bool fFirstRun = true;
-    bool fSelected = false;
-    arith_uint256 hashBest = ARITH_UINT256_ZERO;
-    *pindexSelected = (const CBlockIndex*)0;
-    for (const auto& item : vSortedByTimestamp) {
-        if (!mapBlockIndex.count(item.second))
-            return error("%s : failed to find block index for candidate block %s", __func__, item.second.ToString().c_str());
-
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
-        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
-            break;
-
-        //if the lowest block height (vSortedByTimestamp[0]) is >= switch height, use new modifier calc
-        if (fFirstRun){
-            fModifierV2 = Params().GetConsensus().NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_POS_V2);
-            fFirstRun = false;
-        }
+    const CBlockIndex* pindex;
+    arith_uint256 hashSelection;
+    bool fSelected{false};
 
-        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
-            continue;
+    explicit ModifierCandidate(const CBlockIndex* pindexIn) : pindex(pindexIn) {}
+};
 
+// Compute the selection hashes of the candidates (sorted by timestamp).
+// They only depend on the previous stake modifier, so they are the same for
+// all the selection rounds.
+static void ComputeSelectionHashes(std::vector<ModifierCandidate>& vCandidates, uint64_t nStakeModifierPrev)
+{
+    if (vCandidates.empty()) return;
+    //if the lowest block height (vCandidates[0]) is >= switch height, use new modifier calc
+    const bool fModifierV2 = Params().GetConsensus().NetworkUpgradeActive(vCandidates[0].pindex->nHeight, Consensus::UPGRADE_POS_V2);
+    for (auto& candidate : vCandidates) {
+        const CBlockIndex* pindex = candidate.pindex;
         // compute the selection hash by hashing an input that is unique to that block
         uint256 hashProof;
         if(fModifierV2)
@@ -65,30 +53,141 @@ static bool SelectBlockFromCandidates(
 
         CDataStream ss(SER_GETHASH, 0);
         ss << hashProof << nStakeModifierPrev;
-        arith_uint256 hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
+        candidate.hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
 
         // the selection hash is divided by 2**32 so that proof-of-stake block
         // is always favored over proof-of-work block. this is to preserve
         // the energy efficiency property
         if (pindex->IsProofOfStake())
-            hashSelection >>= 32;
-
-        if (fSelected && hashSelection < hashBest) {
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*)pindex;
-        } else if (!fSelected) {
-            fSelected = true;
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*)pindex;
+            candidate.hashSelection >>= 32;
+    }
+}
+
+// select a block from the candidate blocks in vCandidates (sorted by timestamp),
+// excluding already selected blocks, and with timestamp up to
+// nSelectionIntervalStop.
+static bool SelectBlockFromCandidates(
+    std::vector<ModifierCandidate>& vCandidates,
+    int64_t nSelectionIntervalStop,
+    const CBlockIndex** pindexSelected)
+{
+    ModifierCandidate* pBest = nullptr;
+    for (auto& candidate : vCandidates) {
+        if (pBest && candidate.pindex->GetBlockTime() > nSelectionIntervalStop)
+            break;
+        if (candidate.fSelected)
+            continue;
+        if (!pBest || candidate.hashSelection < pBest->hashSelection)
+            pBest = &candidate;
+    }
+    if (!pBest) {
+        *pindexSelected = nullptr;
+        return false;
+    }
+    pBest->fSelected = true;
+    *pindexSelected = pBest->pindex;
+    return true;
+}
+
+void COldModifierIndex::Clear()
+{
+    vModifierHeight.clear();
+    setPending.clear();
+    dqResolved.clear();
+    nMinRewindHeight = -1;
+    pindexLast = nullptr;
+}
+
+void COldModifierIndex::Rewind(const CChain& chain, int nForkHeight)
+{
+    // forget the blocks after the fork
+    if ((int)vModifierHeight.size() > nForkHeight + 1) {
+        vModifierHeight.resize(nForkHeight + 1);
+    }
+    for (auto it = setPending.begin(); it != setPending.end();) {
+        it = it->second > nForkHeight ? setPending.erase(it) : std::next(it);
+    }
+    // and the modifiers they provided
+    while (!dqResolved.empty() && dqResolved.back().second > nForkHeight) {
+        const int nHeight = dqResolved.back().first;
+        dqResolved.pop_back();
+        if (nHeight <= nForkHeight) {
+            vModifierHeight[nHeight] = -1;
+            setPending.emplace(chain[nHeight]->GetBlockTime() + OLD_MODIFIER_INTERVAL, nHeight);
+        }
+    }
+}
+
+void COldModifierIndex::Sync(const CChain& chain)
+{
+    if (pindexLast && !chain.Contains(pindexLast)) {
+        const CBlockIndex* pindexFork = chain.FindFork(pindexLast);
+        if (pindexFork && pindexFork->nHeight >= nMinRewindHeight) {
+            Rewind(chain, pindexFork->nHeight);
+            pindexLast = pindexFork;
+        } else {
+            Clear();
         }
     }
-    return fSelected;
+    const Consensus::Params& consensus = Params().GetConsensus();
+    for (const CBlockIndex* pindex = pindexLast ? chain.Next(pindexLast) : chain.Genesis();
+            pindex; pindex = chain.Next(pindex)) {
+        if (pindex->GeneratedStakeModifier()) {
+            while (!setPending.empty() && setPending.begin()->first <= pindex->GetBlockTime()) {
+                const int nHeight = setPending.begin()->second;
+                vModifierHeight[nHeight] = pindex->nHeight;
+                dqResolved.emplace_back(nHeight, pindex->nHeight);
+                setPending.erase(setPending.begin());
+            }
+        }
+        if (!consensus.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_V3_4)) {
+            vModifierHeight.emplace_back(-1);
+            setPending.emplace(pindex->GetBlockTime() + OLD_MODIFIER_INTERVAL, pindex->nHeight);
+        }
+        pindexLast = pindex;
+    }
+    // only the last MAX_REWIND_DEPTH blocks can be rewound
+    while (pindexLast && !dqResolved.empty() && dqResolved.front().second < pindexLast->nHeight - MAX_REWIND_DEPTH) {
+        nMinRewindHeight = dqResolved.front().second;
+        dqResolved.pop_front();
+    }
+}
+
+void COldModifierIndex::Load(const CChain& chain)
+{
+    LOCK(cs);
+    Sync(chain);
+}
+
+bool COldModifierIndex::Get(const CChain& chain, const CBlockIndex* pindexFrom, uint64_t& nStakeModifier)
+{
+    LOCK(cs);
+    Sync(chain);
+    const int nHeight = pindexFrom->nHeight;
+    if (nHeight >= (int)vModifierHeight.size() || vModifierHeight[nHeight] < 0 || chain[nHeight] != pindexFrom)
+        return false;
+    nStakeModifier = chain[vModifierHeight[nHeight]]->GetStakeModifierV1();
+    return true;
+}
+
+static COldModifierIndex oldModifierIndex;
+
+void LoadOldModifierIndex()
+{
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    // Only needed to validate the legacy blocks
+    if (pindexTip && Params().GetConsensus().NetworkUpgradeActive(pindexTip->nHeight, Consensus::UPGRADE_V3_4))
+        return;
+    oldModifierIndex.Load(chainActive);
 }
 
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
 bool GetOldModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier)
 {
+    if (oldModifierIndex.Get(chainActive, pindexFrom, nStakeModifier))
+        return true;
+
     int64_t nStakeModifierTime = pindexFrom->GetBlockTime();
     const CBlockIndex* pindex = pindexFrom;
     CBlockIndex* pindexNext = chainActive[pindex->nHeight + 1];
@@ -131,13 +230,12 @@ bool GetOldStakeModifier(CStakeInput* stake, uint64_t& nStakeModifier)
 }
 
 // sort blocks by timestamp, soliving tie with hash (taken as arith_uint)
-static bool sortedByTimestamp(const std::pair<uint64_t, uint256>& a,
-                              const std::pair<uint64_t, uint256>& b)
+static bool sortedByTimestamp(const ModifierCandidate& a, const ModifierCandidate& b)
 {
-    if (a.first == b.first) {
-        return UintToArith256(a.second) < UintToArith256(b.second);
+    if (a.pindex->GetBlockTime() == b.pindex->GetBlockTime()) {
+        return UintToArith256(a.pindex->GetBlockHash()) < UintToArith256(b.pindex->GetBlockHash());
     }
-    return a.first < b.first;
+    return a.pindex->GetBlockTime() < b.pindex->GetBlockTime();
 }
 
 // Stake Modifier (hash modifier of proof-of-stake):
@@ -182,36 +280,33 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
         return true;
 
     // Sort candidate blocks by timestamp
-    std::vector<std::pair<int64_t, uint256> > vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * MODIFIER_INTERVAL  / Params().GetConsensus().nTargetSpacing);
+    std::vector<ModifierCandidate> vCandidates;
+    vCandidates.reserve(64 * MODIFIER_INTERVAL  / Params().GetConsensus().nTargetSpacing);
     int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / MODIFIER_INTERVAL ) * MODIFIER_INTERVAL  - OLD_MODIFIER_INTERVAL;
     const CBlockIndex* pindex = pindexPrev;
 
     while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart) {
-        vSortedByTimestamp.emplace_back(pindex->GetBlockTime(), pindex->GetBlockHash());
+        vCandidates.emplace_back(pindex);
         pindex = pindex->pprev;
     }
 
-    std::reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    std::sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end(), sortedByTimestamp);
+    std::reverse(vCandidates.begin(), vCandidates.end());
+    std::sort(vCandidates.begin(), vCandidates.end(), sortedByTimestamp);
+    ComputeSelectionHashes(vCandidates, nStakeModifier);
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64_t nStakeModifierNew = 0;
     int64_t nSelectionIntervalStop = nSelectionIntervalStart;
-    std::map<uint256, const CBlockIndex*> mapSelectedBlocks;
-    for (int nRound = 0; nRound < std::min(64, (int)vSortedByTimestamp.size()); nRound++) {
+    for (int nRound = 0; nRound < std::min(64, (int)vCandidates.size()); nRound++) {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
 
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+        if (!SelectBlockFromCandidates(vCandidates, nSelectionIntervalStop, &pindex))
             return error("%s : unable to select block at round %d", __func__, nRound);
 
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
-
-        // add the selected block from candidates to selected list
-        mapSelectedBlocks.emplace(pindex->GetBlockHash(), pindex);
     }
 
     nStakeModifier = nStakeModifierNew;
@@ -10,9 +10,53 @@
 
 #include "chain.h"
 #include "stakeinput.h"
+#include "sync.h"
+
+#include <deque>
+#include <set>
+#include <vector>
 
 // Old Modifier - Only for IBD
 bool GetOldStakeModifier(CStakeInput* stake, uint64_t& nStakeModifier);
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
+// Fill the index of the old modifiers of chainActive (when the tip is before v3.4)
+void LoadOldModifierIndex();
+
+/**
+ * Index of the old modifiers of a chain: for each legacy block (before v3.4),
+ * the height of the block whose modifier GetOldModifier selects for the coins
+ * of that block. It is filled in a single forward pass over the chain, while
+ * loading the block index and then as the chain grows: a block is pending until
+ * the first following block that generates a modifier at least
+ * OLD_MODIFIER_INTERVAL seconds after it. After a reorg, it is rewound to the fork.
+ */
+class COldModifierIndex
+{
+public:
+    //! Reorgs deeper than this rebuild the index from the genesis
+    static const int MAX_REWIND_DEPTH = 1000;
+
+    //! Add the blocks of chain that are not indexed yet
+    void Load(const CChain& chain);
+    //! Returns false if pindexFrom is not in chain, or its modifier is not known yet
+    bool Get(const CChain& chain, const CBlockIndex* pindexFrom, uint64_t& nStakeModifier);
+
+private:
+    Mutex cs;
+    //! Height of the old modifier block, by height of the block from (-1 while pending)
+    std::vector<int> vModifierHeight GUARDED_BY(cs);
+    //! Pending blocks: (minimum modifier time, height), earliest first
+    std::set<std::pair<int64_t, int>> setPending GUARDED_BY(cs);
+    //! Blocks resolved in the last MAX_REWIND_DEPTH blocks: (height, modifier height), by modifier height
+    std::deque<std::pair<int, int>> dqResolved GUARDED_BY(cs);
+    //! Highest modifier height dropped from dqResolved: the index can't be rewound below it
+    int nMinRewindHeight GUARDED_BY(cs){-1};
+    //! Last block of the chain added to the index
+    const CBlockIndex* pindexLast GUARDED_BY(cs){nullptr};
+
+    void Clear() EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void Rewind(const CChain& chain, int nForkHeight) EXCLUSIVE_LOCKS_REQUIRED(cs);
+    void Sync(const CChain& chain) EXCLUSIVE_LOCKS_REQUIRED(cs);
+};
 
 #endif // PIVX_LEGACY_STAKEMODIFIER_H
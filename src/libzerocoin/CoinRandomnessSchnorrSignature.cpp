@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "CoinRandomnessSchnorrSignature.h"
+#include "FixedBaseExp.h"
 
 namespace libzerocoin {
 
@@ -38,19 +39,20 @@ bool CoinRandomnessSchnorrSignature::Verify(
 {
     const CBigNum p = zcparams->coinCommitmentGroup.modulus;
     const CBigNum q = zcparams->coinCommitmentGroup.groupOrder;
-    const CBigNum h = zcparams->coinCommitmentGroup.h;
-    const CBigNum g = zcparams->coinCommitmentGroup.g;
 
     // Params validation.
     if (!IsValidSerial(zcparams, S)) return error("%s: Invalid serial range", __func__);
     if (alpha < BN_ZERO || alpha >= q) return error("%s: alpha out of range", __func__);
     if (beta < BN_ZERO || beta >= q) return error("%s: beta out of range", __func__);
 
-    // Schnorr public key computation.
-    const CBigNum pk = C.mul_mod(g.pow_mod(-S,p),p);
+    // g and h are fixed: use their precomputed powers
+    const std::shared_ptr<const IntegerGroupTables> tables = IntegerGroupTables::Get(&zcparams->coinCommitmentGroup);
+
+    // Schnorr public key computation (g^-S = (g^S)^-1).
+    const CBigNum pk = C.mul_mod(tables->PowG(S).inverse(p),p);
 
     // Signature verification.
-    const CBigNum rv = (pk.pow_mod(alpha,p)).mul_mod(h.pow_mod(beta,p),p);
+    const CBigNum rv = (pk.pow_mod(alpha,p)).mul_mod(tables->PowH(beta),p);
     CHashWriter hasher(0,0);
     hasher << *zcparams << pk << rv << msghash;
 
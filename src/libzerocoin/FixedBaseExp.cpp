@@ -0,0 +1,95 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "FixedBaseExp.h"
+
+#include <map>
+#include <mutex>
+
+namespace libzerocoin {
+
+FixedBaseTable::FixedBaseTable(const CBigNum& _base, const CBigNum& _modulus, int nBits):
+        base(_base),
+        modulus(_modulus),
+        nWindows((nBits + 7) / 8)
+{
+    vTable.resize((size_t)nWindows * WINDOW_SIZE);
+    CBigNum b = base % modulus;
+    for (int i = 0; i < nWindows; i++) {
+        CBigNum* window = &vTable[(size_t)i * WINDOW_SIZE];
+        window[0] = BN_ONE;
+        window[1] = b;
+        for (int d = 2; d < WINDOW_SIZE; d++) {
+            window[d] = window[d - 1].mul_mod(b, modulus);
+        }
+        // base^(256^(i+1))
+        b = window[WINDOW_SIZE - 1].mul_mod(b, modulus);
+    }
+}
+
+bool FixedBaseTable::MulPow(CBigNum& acc, const CBigNum& e) const
+{
+    if (e < BN_ZERO) {
+        return false;
+    }
+    // little endian, with a trailing sign byte when the top bit is set
+    const std::vector<unsigned char> vch = e.getvch();
+    int nBytes = vch.size();
+    while (nBytes > 0 && vch[nBytes - 1] == 0) nBytes--;
+    if (nBytes > nWindows) {
+        return false;
+    }
+    for (int i = 0; i < nBytes; i++) {
+        if (vch[i] != 0) {
+            acc = acc.mul_mod(vTable[(size_t)i * WINDOW_SIZE + vch[i]], modulus);
+        }
+    }
+    return true;
+}
+
+CBigNum FixedBaseTable::pow_mod(const CBigNum& e) const
+{
+    CBigNum ret = BN_ONE;
+    if (!MulPow(ret, e)) {
+        return base.pow_mod(e, modulus);
+    }
+    return ret;
+}
+
+IntegerGroupTables::IntegerGroupTables(const IntegerGroupParams& group):
+        g(group.g, group.modulus, group.groupOrder.bitSize()),
+        h(group.h, group.modulus, group.groupOrder.bitSize())
+{}
+
+CBigNum IntegerGroupTables::MultiExp(const CBigNum& a, const CBigNum& b) const
+{
+    const CBigNum& p = g.getModulus();
+    CBigNum ret = BN_ONE;
+    if (!g.MulPow(ret, a)) {
+        ret = g.getBase().pow_mod(a, p);
+    }
+    if (!h.MulPow(ret, b)) {
+        ret = ret.mul_mod(h.getBase().pow_mod(b, p), p);
+    }
+    return ret;
+}
+
+std::shared_ptr<const IntegerGroupTables> IntegerGroupTables::Get(const IntegerGroupParams* group)
+{
+    static std::mutex cs;
+    static std::map<const IntegerGroupParams*, std::shared_ptr<const IntegerGroupTables>> mapTables;
+
+    std::lock_guard<std::mutex> lock(cs);
+    std::shared_ptr<const IntegerGroupTables>& tables = mapTables[group];
+    // The params are static, but rebuild if a different group took the same address
+    if (!tables ||
+            tables->g.getBase() != group->g ||
+            tables->h.getBase() != group->h ||
+            tables->g.getModulus() != group->modulus) {
+        tables = std::make_shared<const IntegerGroupTables>(*group);
+    }
+    return tables;
+}
+
+} /* namespace libzerocoin */
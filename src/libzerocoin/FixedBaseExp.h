@@ -0,0 +1,68 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_LIBZEROCOIN_FIXEDBASEEXP_H
+#define PIVX_LIBZEROCOIN_FIXEDBASEEXP_H
+
+#include "Params.h"
+#include "bignum.h"
+
+#include <memory>
+#include <vector>
+
+namespace libzerocoin {
+
+/**
+ * Precomputed powers of a fixed base modulo a fixed modulus.
+ * Holds base^(d * 256^i) for every byte value d and byte position i of the
+ * exponents up to nBits, so base^e is the product of one entry per byte of e
+ * instead of a full square-and-multiply.
+ */
+class FixedBaseTable {
+public:
+    FixedBaseTable(const CBigNum& base, const CBigNum& modulus, int nBits);
+
+    /** Multiply acc by base^e mod modulus. Returns false (acc unchanged) if e is negative or too large. */
+    bool MulPow(CBigNum& acc, const CBigNum& e) const;
+
+    /** base^e mod modulus, for any e */
+    CBigNum pow_mod(const CBigNum& e) const;
+
+    const CBigNum& getBase() const { return base; }
+    const CBigNum& getModulus() const { return modulus; }
+
+private:
+    static const int WINDOW_SIZE = 256;
+    CBigNum base;
+    CBigNum modulus;
+    int nWindows;
+    std::vector<CBigNum> vTable;
+};
+
+/**
+ * Fixed-base tables for the two generators of an integer group, used to
+ * verify the commitments and the Schnorr signatures of the public spends.
+ */
+class IntegerGroupTables {
+public:
+    explicit IntegerGroupTables(const IntegerGroupParams& group);
+
+    /** g^a * h^b mod p */
+    CBigNum MultiExp(const CBigNum& a, const CBigNum& b) const;
+    /** g^e mod p */
+    CBigNum PowG(const CBigNum& e) const { return g.pow_mod(e); }
+    /** h^e mod p */
+    CBigNum PowH(const CBigNum& e) const { return h.pow_mod(e); }
+
+    /** The tables of group, built on first use (about 1 MB per generator). Thread safe. */
+    static std::shared_ptr<const IntegerGroupTables> Get(const IntegerGroupParams* group);
+
+private:
+    FixedBaseTable g;
+    FixedBaseTable h;
+};
+
+} /* namespace libzerocoin */
+
+#endif // PIVX_LIBZEROCOIN_FIXEDBASEEXP_H
@@ -5,8 +5,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "logging.h"
+#include "util/threadnames.h"
 #include "utiltime.h"
 
+#include <chrono>
+
 
 const char * const DEFAULT_DEBUGLOGFILE = "debug.log";
 
@@ -209,6 +212,24 @@ void BCLog::Logger::LogPrintStr(const std::string &str)
 {
     std::string strTimestamped = LogTimestampStr(str);
 
+    // Queue the message for the logger thread, when running. StopAsync waits
+    // for the producers which have seen m_async set, before draining the queue.
+    m_async_producers++;
+    if (m_async) {
+        if (!m_async_queue->Push(std::move(strTimestamped))) {
+            m_async_dropped++;
+        }
+        m_async_producers--;
+        m_async_cond.notify_one();
+        return;
+    }
+    m_async_producers--;
+
+    WriteStr(strTimestamped);
+}
+
+void BCLog::Logger::WriteStr(const std::string& strTimestamped)
+{
     if (m_print_to_console) {
         // print to console
         fwrite(strTimestamped.data(), 1, strTimestamped.size(), stdout);
@@ -238,6 +259,111 @@ void BCLog::Logger::LogPrintStr(const std::string &str)
     }
 }
 
+BCLog::LogQueue::LogQueue(size_t size) :
+    m_mask([size]() { size_t n = 2; while (n < size) n <<= 1; return n - 1; }())
+{
+    m_cells.reset(new Cell[m_mask + 1]);
+    for (size_t i = 0; i <= m_mask; i++) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool BCLog::LogQueue::Push(std::string&& msg)
+{
+    Cell* cell;
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        cell = &m_cells[pos & m_mask];
+        const size_t seq = cell->sequence.load(std::memory_order_acquire);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            // the cell is free, claim it
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            // full
+            return false;
+        } else {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->msg = std::move(msg);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool BCLog::LogQueue::Pop(std::string& msg)
+{
+    Cell* cell;
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        cell = &m_cells[pos & m_mask];
+        const size_t seq = cell->sequence.load(std::memory_order_acquire);
+        const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            // empty
+            return false;
+        } else {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    msg = std::move(cell->msg);
+    cell->msg.clear();
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+void BCLog::Logger::StartAsync(size_t queue_size)
+{
+    if (m_async) return;
+    m_async_queue.reset(new LogQueue(queue_size));
+    m_async_stop = false;
+    m_async_thread = std::thread(&BCLog::Logger::ThreadAsyncLogger, this);
+    m_async = true;
+}
+
+void BCLog::Logger::StopAsync()
+{
+    if (!m_async.exchange(false)) return;
+    // new messages are written synchronously, wait for the ones being queued
+    while (m_async_producers > 0) {
+        std::this_thread::yield();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_async_mutex);
+        m_async_stop = true;
+    }
+    m_async_cond.notify_one();
+    m_async_thread.join();
+    DrainAsyncQueue();
+    m_async_queue.reset();
+}
+
+void BCLog::Logger::DrainAsyncQueue()
+{
+    std::string msg;
+    while (m_async_queue->Pop(msg)) {
+        WriteStr(msg);
+    }
+    const uint64_t nDropped = m_async_dropped.exchange(0);
+    if (nDropped > 0) {
+        WriteStr(LogTimestampStr(strprintf("Asynchronous logger queue full, %d messages dropped\n", nDropped)));
+    }
+}
+
+void BCLog::Logger::ThreadAsyncLogger()
+{
+    util::ThreadRename("pivx-logger");
+    while (true) {
+        DrainAsyncQueue();
+        std::unique_lock<std::mutex> lock(m_async_mutex);
+        if (m_async_stop) break;
+        // producers don't take the mutex when notifying: a wakeup can be missed, hence the timeout
+        m_async_cond.wait_for(lock, std::chrono::milliseconds(100));
+    }
+}
+
 void BCLog::Logger::ShrinkDebugFile()
 {
     // Amount of debug.log to save at end when shrinking (must fit in memory)
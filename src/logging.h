@@ -16,15 +16,21 @@
 #include "tinyformat.h"
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const bool DEFAULT_LOGASYNC      = false;
+/** Number of messages the asynchronous logger can hold before dropping the new ones */
+static const size_t DEFAULT_LOGASYNC_QUEUE = 8192;
 extern const char * const DEFAULT_DEBUGLOGFILE;
 
 extern bool fLogIPs;
@@ -70,6 +76,30 @@ namespace BCLog {
         ALL         = ~(uint32_t)0,
     };
 
+    /**
+     * Bounded multi-producer queue of log messages, without locks
+     * (Dmitry Vyukov's bounded MPMC queue). Push fails, instead of blocking,
+     * when the queue is full.
+     */
+    class LogQueue
+    {
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            std::string msg;
+        };
+        std::unique_ptr<Cell[]> m_cells;
+        const size_t m_mask;
+        std::atomic<size_t> m_enqueue_pos{0};
+        std::atomic<size_t> m_dequeue_pos{0};
+
+    public:
+        // The size is rounded up to a power of two
+        explicit LogQueue(size_t size);
+        bool Push(std::string&& msg);
+        bool Pop(std::string& msg);
+    };
+
     class Logger
     {
     private:
@@ -87,8 +117,28 @@ namespace BCLog {
         /** Log categories bitfield. */
         std::atomic<uint32_t> m_categories{0};
 
+        /**
+         * Asynchronous mode: the messages are queued, and written by the logger
+         * thread. When the queue is full, the new messages are dropped (and the
+         * number of dropped messages logged), so that logging never blocks.
+         */
+        std::unique_ptr<LogQueue> m_async_queue;
+        std::atomic<bool> m_async{false};
+        std::atomic<int> m_async_producers{0};
+        std::atomic<uint64_t> m_async_dropped{0};
+        std::thread m_async_thread;
+        std::mutex m_async_mutex;
+        std::condition_variable m_async_cond;
+        bool m_async_stop = false;
+
         std::string LogTimestampStr(const std::string& str);
 
+        /** Write a timestamped string to the console and the log file */
+        void WriteStr(const std::string& str);
+
+        void DrainAsyncQueue();
+        void ThreadAsyncLogger();
+
     public:
         bool m_print_to_console = false;
         bool m_print_to_file = false;
@@ -108,6 +158,14 @@ namespace BCLog {
         bool OpenDebugLog();
         void ShrinkDebugFile();
 
+        /** Start writing the log from a dedicated thread */
+        void StartAsync(size_t queue_size = DEFAULT_LOGASYNC_QUEUE);
+        /** Write the queued messages and stop the logger thread */
+        void StopAsync();
+        bool IsAsync() const { return m_async; }
+        /** Number of messages dropped (queue full) since they were last reported */
+        uint64_t GetAsyncDropped() const { return m_async_dropped; }
+
         uint32_t GetCategoryMask() const { return m_categories.load(); }
 
         void EnableCategory(LogFlags flag);
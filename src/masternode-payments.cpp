@@ -427,11 +427,8 @@ bool CMasternodePayments::ProcessMessageMasternodePayments(CNode* pfrom, std::st
         vRecv >> winner;
         if (pfrom->nVersion < ActiveProtocol()) return false;
 
-        {
-            // Clear inv request
-            LOCK(cs_main);
-            g_connman->RemoveAskFor(winner.GetHash(), MSG_MASTERNODE_WINNER);
-        }
+        // Clear inv request
+        g_connman->RemoveAskFor(winner.GetHash(), MSG_MASTERNODE_WINNER);
 
         ProcessMNWinner(winner, pfrom, state);
         return state.IsValid();
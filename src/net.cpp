@@ -15,6 +15,7 @@
 #include "clientversion.h"
 #include "crypto/common.h"
 #include "crypto/sha256.h"
+#include "ctpl_stl.h"
 #include "guiinterface.h"
 #include "netaddress.h"
 #include "netbase.h"
@@ -23,6 +24,7 @@
 #include "primitives/transaction.h"
 #include "scheduler.h"
 #include "tiertwo/net_masternodes.h"
+#include "util/threadnames.h"
 
 #ifdef WIN32
 #include <string.h>
@@ -38,6 +40,10 @@
 #include <poll.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #include <cstdint>
 #include <unordered_map>
 
@@ -76,6 +82,11 @@ enum BindFlags {
 // The sleep time needs to be small to avoid new sockets stalling
 static const uint64_t SELECT_TIMEOUT_MILLISECONDS = 50;
 
+#ifdef USE_EPOLL
+/** Maximum number of events returned by a single epoll_wait. Any other is kept by the kernel for the next call */
+static const int MAX_EPOLL_EVENTS = 256;
+#endif
+
 const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
 constexpr const CConnman::CFullyConnectedOnly CConnman::FullyConnectedOnly;
@@ -93,6 +104,7 @@ std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 static bool vfLimited[NET_MAX] = {};
 std::string strSubVersion;
 
+Mutex g_cs_askfor;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 
 void CConnman::AddOneShot(const std::string& strDest)
@@ -415,6 +427,11 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char* pszDest, bool fCo
         CloseSocket(hSocket);
         return nullptr;
     }
+    if (!IsSelectableSocketForMode(hSocket)) {
+        LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
+        CloseSocket(hSocket);
+        return nullptr;
+    }
 
     // Add node
     NodeId id = GetNewNodeId();
@@ -1109,7 +1126,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket)) {
+    if (!IsSelectableSocketForMode(hSocket)) {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
         return;
@@ -1152,6 +1169,9 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint(BCLog::NET, "connection from %s accepted\n", addr.ToString());
 
+    if (!RegisterEvents(pnode)) {
+        pnode->CloseSocketDisconnect();
+    }
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -1257,6 +1277,70 @@ void CConnman::InactivityCheck(CNode* pnode)
     }
 }
 
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode)
+{
+    if (str == "select") {
+        mode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef USE_POLL
+    if (str == "poll") {
+        mode = SOCKETEVENTS_POLL;
+        return true;
+    }
+#endif
+#ifdef USE_EPOLL
+    if (str == "epoll") {
+        mode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string GetSupportedSocketEventsModes()
+{
+    std::string strModes = "select";
+#ifdef USE_POLL
+    strModes += ", poll";
+#endif
+#ifdef USE_EPOLL
+    strModes += ", epoll";
+#endif
+    return strModes;
+}
+
+bool CConnman::IsSelectableSocketForMode(const SOCKET& hSocket) const
+{
+#ifdef WIN32
+    return true;
+#else
+    // select() can't watch descriptors above FD_SETSIZE
+    return socketEventsMode != SOCKETEVENTS_SELECT || hSocket < FD_SETSIZE;
+#endif
+}
+
+bool CConnman::RegisterEvents(CNode* pnode)
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode != SOCKETEVENTS_EPOLL) return true;
+
+    LOCK(pnode->cs_hSocket);
+    if (pnode->hSocket == INVALID_SOCKET) return false;
+    // Edge-triggered: the socket is registered once, for both directions, and the
+    // readiness is kept in the node flags until recv/send would block.
+    // Closing the socket removes it from the epoll set.
+    struct epoll_event e;
+    e.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    e.data.fd = pnode->hSocket;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &e) != 0) {
+        LogPrintf("Failed to add socket of peer=%d to epoll set: %s\n", pnode->GetId(), NetworkErrorString(WSAGetLastError()));
+        return false;
+    }
+#endif
+    return true;
+}
+
 bool CConnman::GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
 {
     for (const ListenSocket& hListenSocket : vhListenSocket) {
@@ -1311,8 +1395,38 @@ bool CConnman::GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& s
     return !recv_set.empty() || !send_set.empty() || !error_set.empty();
 }
 
+#ifdef USE_EPOLL
+void CConnman::SocketEventsEpoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set, bool fOnlyPoll)
+{
+    // Nothing to build here: the sockets are registered once, and only the
+    // ready ones are returned.
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    if (!fOnlyPoll) wakeupSelectNeeded = true;
+    int r = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, fOnlyPoll ? 0 : SELECT_TIMEOUT_MILLISECONDS);
+    wakeupSelectNeeded = false;
+    if (r < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    if (interruptNet) return;
+
+    for (int i = 0; i < r; i++) {
+        const struct epoll_event& e = events[i];
+        if (e.events & EPOLLIN)                              recv_set.insert(e.data.fd);
+        if (e.events & EPOLLOUT)                             send_set.insert(e.data.fd);
+        if (e.events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))   error_set.insert(e.data.fd);
+    }
+}
+#endif
+
 #ifdef USE_POLL
-void CConnman::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
+void CConnman::SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
 {
     std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
     if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
@@ -1358,8 +1472,9 @@ void CConnman::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_s
         if (pollfd_entry.revents & (POLLERR|POLLHUP)) error_set.insert(pollfd_entry.fd);
     }
 }
-#else
-void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+#endif
+
+void CConnman::SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set)
 {
     std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
     if (!GenerateSelectSet(recv_select_set, send_select_set, error_select_set)) {
@@ -1433,12 +1548,31 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
         }
     }
 }
+
+void CConnman::SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set, bool fOnlyPoll)
+{
+    switch (socketEventsMode) {
+#ifdef USE_EPOLL
+    case SOCKETEVENTS_EPOLL:
+        SocketEventsEpoll(recv_set, send_set, error_set, fOnlyPoll);
+        break;
+#endif
+#ifdef USE_POLL
+    case SOCKETEVENTS_POLL:
+        SocketEventsPoll(recv_set, send_set, error_set);
+        break;
 #endif
+    default:
+        SocketEventsSelect(recv_set, send_set, error_set);
+        break;
+    }
+}
 
 void CConnman::SocketHandler()
 {
     std::set<SOCKET> recv_set, send_set, error_set;
-    SocketEvents(recv_set, send_set, error_set);
+    SocketEvents(recv_set, send_set, error_set, fPendingSocketWork);
+    fPendingSocketWork = false;
 
 #ifdef USE_WAKEUP_PIPE
     // drain the wakeup pipe
@@ -1488,6 +1622,21 @@ void CConnman::SocketHandler()
             sendSet = send_set.count(pnode->hSocket) > 0;
             errorSet = error_set.count(pnode->hSocket) > 0;
         }
+        if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+            // Edge-triggered events are reported once: remember them until
+            // the socket would block, and apply the select/poll logic here
+            // (drain the send buffer first, don't receive when paused).
+            pnode->fHasRecvData |= recvSet || errorSet;
+            pnode->fCanSendData |= sendSet;
+            bool fHasSendData;
+            {
+                LOCK(pnode->cs_vSend);
+                fHasSendData = !pnode->vSendMsg.empty();
+            }
+            sendSet = pnode->fCanSendData && fHasSendData;
+            recvSet = pnode->fHasRecvData && !pnode->fPauseRecv && !fHasSendData;
+            errorSet = false;
+        }
         if (recvSet || errorSet) {
             // typical socket buffer is 8K-64K
             char pchBuf[0x10000];
@@ -1498,6 +1647,12 @@ void CConnman::SocketHandler()
                     continue;
                 nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
             }
+            // A full buffer means that there may be more to read: don't block in the next epoll_wait
+            if (nBytes >= 0 && (size_t)nBytes < sizeof(pchBuf)) {
+                pnode->fHasRecvData = false;
+            } else if (nBytes > 0 && !pnode->fPauseRecv) {
+                fPendingSocketWork = true;
+            }
             if (nBytes > 0) {
                 bool notify = false;
                 if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
@@ -1531,6 +1686,8 @@ void CConnman::SocketHandler()
                     if (!pnode->fDisconnect)
                         LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
                     pnode->CloseSocketDisconnect();
+                } else if (nErr == WSAEWOULDBLOCK) {
+                    pnode->fHasRecvData = false;
                 }
             }
         }
@@ -1543,6 +1700,10 @@ void CConnman::SocketHandler()
             size_t nBytes = SocketSendData(pnode);
             if (nBytes)
                 RecordBytesSent(nBytes);
+            // Data left means that the socket buffer is full: wait for the next EPOLLOUT
+            if (!pnode->vSendMsg.empty()) {
+                pnode->fCanSendData = false;
+            }
         }
 
         InactivityCheck(pnode);
@@ -1568,6 +1729,35 @@ void CConnman::WakeMessageHandler()
     condMsgProc.notify_one();
 }
 
+void CConnman::QueueWorkerMessages(CNode* pnode, std::list<CNetMessage>& msgs)
+{
+    assert(messageWorkers);
+    // The queued messages keep counting in the receive flood control until a worker pops them
+    size_t nSizeAdded = 0;
+    for (const CNetMessage& msg : msgs) {
+        nSizeAdded += msg.vRecv.size() + CMessageHeader::HEADER_SIZE;
+    }
+    {
+        LOCK(pnode->cs_vProcessMsg);
+        pnode->nProcessQueueSize += nSizeAdded;
+        pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+    }
+    {
+        LOCK(pnode->cs_vWorkerMsg);
+        pnode->vWorkerMsg.splice(pnode->vWorkerMsg.end(), msgs);
+        // A single task per node: it processes the queue in order, until empty
+        if (pnode->fWorkerScheduled) return;
+        pnode->fWorkerScheduled = true;
+    }
+    pnode->AddRef();
+    messageWorkers->push([this, pnode](int) {
+        m_msgproc->ProcessWorkerMessages(pnode, flagInterruptMsgProc);
+        pnode->Release();
+        // The message handler may be waiting for this node's queue to be empty
+        WakeMessageHandler();
+    });
+}
+
 void CConnman::WakeSelect()
 {
 #ifdef USE_WAKEUP_PIPE
@@ -1978,6 +2168,9 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         pnode->m_masternode_probe_connection = true;
 
     m_msgproc->InitializeNode(pnode);
+    if (!RegisterEvents(pnode)) {
+        pnode->CloseSocketDisconnect();
+    }
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -2309,6 +2502,39 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
     }
 #endif
 
+#ifdef USE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            LogPrintf("epoll_create1 failed (%s), falling back to poll\n", NetworkErrorString(WSAGetLastError()));
+            socketEventsMode = SOCKETEVENTS_POLL;
+        } else {
+            // Level-triggered: at most one connection is accepted per loop,
+            // and the wakeup pipe is drained on every wakeup.
+            std::vector<SOCKET> vLevelTriggered;
+            for (const ListenSocket& hListenSocket : vhListenSocket) {
+                vLevelTriggered.push_back(hListenSocket.socket);
+            }
+            if (wakeupPipe[0] != -1) vLevelTriggered.push_back(wakeupPipe[0]);
+            for (SOCKET hSocket : vLevelTriggered) {
+                struct epoll_event e;
+                e.events = EPOLLIN;
+                e.data.fd = hSocket;
+                if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &e) != 0) {
+                    LogPrintf("Failed to add socket to epoll set: %s\n", NetworkErrorString(WSAGetLastError()));
+                }
+            }
+        }
+    }
+#endif
+    LogPrintf("Using %s for socket events\n", socketEventsMode == SOCKETEVENTS_EPOLL ? "epoll" :
+                                              socketEventsMode == SOCKETEVENTS_POLL ? "poll" : "select");
+
+    if (nMessageWorkers > 0) {
+        messageWorkers = std::make_unique<ctpl::thread_pool>(nMessageWorkers);
+        RenameThreadPool(*messageWorkers, "pivx-msgworker");
+    }
+
     // Send and receive from sockets, accept connections
     threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
@@ -2401,6 +2627,12 @@ void CConnman::Stop()
 {
     if (threadMessageHandler.joinable())
         threadMessageHandler.join();
+    if (messageWorkers) {
+        // The workers hold references to the nodes: finish (or drop, when
+        // interrupted) the queued messages before the nodes are deleted.
+        messageWorkers->stop(true);
+        messageWorkers.reset();
+    }
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2443,6 +2675,10 @@ void CConnman::Stop()
     if (wakeupPipe[1] != -1) close(wakeupPipe[1]);
     wakeupPipe[0] = wakeupPipe[1] = -1;
 #endif
+#ifdef USE_EPOLL
+    if (epollfd != -1) close(epollfd);
+    epollfd = -1;
+#endif
 }
 
 void CConnman::DeleteNode(CNode* pnode)
@@ -2578,9 +2814,9 @@ void CConnman::RelayInv(CInv& inv, int minProtoVersion)
 
 void CConnman::RemoveAskFor(const uint256& invHash, int invType)
 {
+    LOCK2(g_cs_askfor, cs_vNodes);
     mapAlreadyAskedFor.erase(CInv(invType, invHash));
 
-    LOCK(cs_vNodes);
     for (const auto& pnode : vNodes) {
         pnode->AskForInvReceived(invHash);
     }
@@ -2706,6 +2942,7 @@ CNode::~CNode()
 
 void CNode::AskFor(const CInv& inv, int64_t doubleRequestDelay)
 {
+    LOCK(g_cs_askfor);
     if (mapAskFor.size() > MAPASKFOR_MAX_SZ || setAskFor.size() > SETASKFOR_MAX_SZ)
         return;
     // a peer may not have multiple non-responded queue positions for a single inv item
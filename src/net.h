@@ -53,9 +53,14 @@
 class CAddrMan;
 class CBlockIndex;
 class CScheduler;
+class CNetMessage;
 class CNode;
 class TierTwoConnMan;
 
+namespace ctpl {
+    class thread_pool;
+}
+
 /** Time between pings automatically sent out for latency probing and keepalive (in seconds). */
 static const int PING_INTERVAL = 2 * 60;
 /** Time after which to disconnect, after waiting for a ping response (or inactivity). */
@@ -102,10 +107,33 @@ static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Default number of threads processing tier two messages off the message handler thread (-msgworkers) */
+static const int DEFAULT_MESSAGE_WORKERS = 2;
+static const int MAX_MESSAGE_WORKERS = 16;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
+/** Readiness notification mechanism used by the socket handler thread (-socketevents) */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT = 0,
+    SOCKETEVENTS_POLL = 1,
+    SOCKETEVENTS_EPOLL = 2,
+};
+
+#if defined(USE_EPOLL)
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+#elif defined(USE_POLL)
+static const char* const DEFAULT_SOCKETEVENTS = "poll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+#endif
+
+/** Parse a -socketevents value. Returns false if the mode is unknown or not supported on this platform */
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode);
+/** Comma separated list of the -socketevents modes supported on this platform */
+std::string GetSupportedSocketEventsModes();
+
 typedef int NodeId;
 
 struct AddedNodeInfo
@@ -172,6 +200,8 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        SocketEventsMode socketEventsMode = SOCKETEVENTS_SELECT;
+        int nMessageWorkers = 0;
     };
 
     void Init(const Options& connOptions) {
@@ -186,6 +216,8 @@ public:
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         vWhitelistedRange = connOptions.vWhitelistedRange;
+        socketEventsMode = connOptions.socketEventsMode;
+        nMessageWorkers = connOptions.nMessageWorkers;
         {
             LOCK(cs_vAddedNodes);
             vAddedNodes = connOptions.m_added_nodes;
@@ -377,6 +409,16 @@ public:
     void UpdateQuorumRelayMemberIfNeeded(CNode* pnode);
     /** Interrupt the select/poll system call **/
     void WakeSelect();
+    void WakeMessageHandler();
+
+    /** Whether messages can be handed to the message worker pool */
+    bool HasMessageWorkers() const { return messageWorkers != nullptr; }
+    /**
+     * Hand a node's messages to the message worker pool. They are processed
+     * (by NetEventsInterface::ProcessWorkerMessages) after the ones already
+     * queued for this node, one at a time.
+     */
+    void QueueWorkerMessages(CNode* pnode, std::list<CNetMessage>& msgs);
 
 private:
     struct ListenSocket {
@@ -398,14 +440,23 @@ private:
     void DisconnectNodes();
     void NotifyNumConnectionsChanged();
     void InactivityCheck(CNode* pnode);
+    /** Whether the socket can be watched with the socket events mode in use */
+    bool IsSelectableSocketForMode(const SOCKET& hSocket) const;
+    /** Add a new peer socket to the epoll set (no-op with the other modes) */
+    bool RegisterEvents(CNode* pnode);
     bool GenerateSelectSet(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
-    void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#ifdef USE_EPOLL
+    void SocketEventsEpoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set, bool fOnlyPoll);
+#endif
+#ifdef USE_POLL
+    void SocketEventsPoll(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+#endif
+    void SocketEventsSelect(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set);
+    void SocketEvents(std::set<SOCKET>& recv_set, std::set<SOCKET>& send_set, std::set<SOCKET>& error_set, bool fOnlyPoll);
     void SocketHandler();
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
-    void WakeMessageHandler();
-
     uint64_t CalculateKeyedNetGroup(const CAddress& ad);
 
     CNode* FindNode(const CNetAddr& ip);
@@ -495,6 +546,9 @@ private:
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
+    int nMessageWorkers{0};
+    std::unique_ptr<ctpl::thread_pool> messageWorkers;
+
     CThreadInterrupt interruptNet;
 
 #ifdef USE_WAKEUP_PIPE
@@ -503,6 +557,14 @@ private:
 #endif
     std::atomic<bool> wakeupSelectNeeded{false};
 
+    SocketEventsMode socketEventsMode{SOCKETEVENTS_SELECT};
+#ifdef USE_EPOLL
+    /** epoll instance, with the listening sockets, the wakeup pipe and the peer sockets registered once */
+    int epollfd{-1};
+#endif
+    /** Some socket has data left to read: poll for new events without waiting. Used only by SocketHandler thread */
+    bool fPendingSocketWork{false};
+
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
@@ -568,7 +630,9 @@ bool validateMasternodeIP(const std::string& addrStr);          // valid, reacha
 extern bool fDiscover;
 extern bool fListen;
 
-extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
+/** Guards the inv requests: mapAlreadyAskedFor, and mapAskFor/setAskFor of the nodes */
+extern Mutex g_cs_askfor;
+extern limitedmap<CInv, int64_t> mapAlreadyAskedFor GUARDED_BY(g_cs_askfor);
 
 /** Subversion as sent to the P2P network in `version` messages */
 extern std::string strSubVersion;
@@ -685,6 +749,11 @@ public:
     std::list<CNetMessage> vProcessMsg;
     size_t nProcessQueueSize;
 
+    // Messages waiting for the message worker pool, and whether a worker is processing them
+    RecursiveMutex cs_vWorkerMsg;
+    std::list<CNetMessage> vWorkerMsg GUARDED_BY(cs_vWorkerMsg);
+    bool fWorkerScheduled GUARDED_BY(cs_vWorkerMsg){false};
+
     RecursiveMutex cs_sendProcessing;
 
     std::deque<CInv> vRecvGetData;
@@ -733,6 +802,9 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+    // Edge-triggered readiness, with -socketevents=epoll. Used only by SocketHandler thread
+    bool fHasRecvData{false};
+    bool fCanSendData{false};
 
     // If true, we will announce/send him plain recovered sigs (usually true for full nodes)
     std::atomic<bool> m_wants_recsigs{false};
@@ -773,8 +845,8 @@ public:
     // Set of tier two messages ids we still have to announce.
     std::vector<CInv> vInventoryTierTwoToSend;
     RecursiveMutex cs_inventory;
-    std::multimap<int64_t, CInv> mapAskFor;
-    std::set<uint256> setAskFor;
+    std::multimap<int64_t, CInv> mapAskFor GUARDED_BY(g_cs_askfor);
+    std::set<uint256> setAskFor GUARDED_BY(g_cs_askfor);
     std::vector<uint256> vBlockRequested;
     std::chrono::microseconds nNextInvSend{0};
     // Used for BIP35 mempool sending, also protected by cs_inventory
@@ -927,7 +999,7 @@ public:
 
     void AskFor(const CInv& inv, int64_t doubleRequestDelay = 2 * 60 * 1000000);
     // inv response received, clear it from the waiting inv set.
-    void AskForInvReceived(const uint256& invHash);
+    void AskForInvReceived(const uint256& invHash) EXCLUSIVE_LOCKS_REQUIRED(g_cs_askfor);
 
     void CloseSocketDisconnect();
     bool DisconnectOldProtocol(int nVersionIn, int nVersionRequired);
@@ -962,6 +1034,8 @@ public:
     virtual bool SendMessages(CNode* pnode, std::atomic<bool>& interrupt) EXCLUSIVE_LOCKS_REQUIRED(pnode->cs_sendProcessing) = 0;
     virtual void InitializeNode(CNode* pnode) = 0;
     virtual void FinalizeNode(NodeId id, bool& update_connection_time) = 0;
+    /** Process the messages queued with CConnman::QueueWorkerMessages, called from the message worker pool */
+    virtual void ProcessWorkerMessages(CNode* pnode, std::atomic<bool>& interrupt) = 0;
 };
 
 /** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
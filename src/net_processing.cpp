@@ -7,6 +7,7 @@
 
 #include "net_processing.h"
 
+#include "blockencodings.h"
 #include "budget/budgetmanager.h"
 #include "chain.h"
 #include "evo/deterministicmns.h"
@@ -27,6 +28,7 @@
 #include "sporkdb.h"
 #include "streams.h"
 #include "tiertwo/tiertwo_sync_state.h"
+#include "unordered_lru_cache.h"
 #include "util/validation.h"
 #include "validation.h"
 
@@ -69,12 +71,21 @@ namespace {
 /** Number of nodes with fSyncStarted. */
 int nSyncStarted = 0;
 
+/** Number of nodes with fSyncStarted, syncing headers-first. */
+int nHeadersSyncStarted = 0;
+
 /**
  * Sources of received blocks, to be able to send them reject messages or ban
  * them, if processing happens afterwards. Protected by cs_main.
  */
 std::map<uint256, NodeId> mapBlockSource;
 
+/**
+ * Peers asked to announce new blocks with a "cmpctblock" (high bandwidth mode),
+ * the one asked the longest ago first. Protected by cs_main.
+ */
+std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
 /**
  * Filter for transactions that were recently rejected by
  * AcceptToMemoryPool. These are not rerequested until the chain tip
@@ -114,8 +125,60 @@ int nQueuedValidatedHeaders = 0;
 /** Number of preferable block download peers. */
 int nPreferredDownload = 0;
 
+/** A block downloaded before the data of its parent, and the peer it was received from */
+struct PendingBlock {
+    NodeId nodeid;
+    std::shared_ptr<const CBlock> pblock;
+    size_t nSize;
+    int64_t nTimeExpire;
+};
+/**
+ * Blocks are downloaded in parallel from several peers, so they arrive out of order, but they
+ * must be accepted in chain order (the proof of stake of a block needs the stake modifier, and
+ * the coins, of its parent). These are the blocks waiting for the data of their parent, keyed
+ * by hashPrevBlock. Protected by cs_main.
+ */
+std::multimap<uint256, PendingBlock> mapBlocksPendingConnect;
+/** Total serialized size of the blocks in mapBlocksPendingConnect. Protected by cs_main. */
+size_t nBlocksPendingConnectSize = 0;
+
+/** The last block connected, and its compact version (built when announcing it) */
+RecursiveMutex cs_most_recent_block;
+std::shared_ptr<const CBlock> most_recent_block GUARDED_BY(cs_most_recent_block);
+std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block GUARDED_BY(cs_most_recent_block);
+uint256 most_recent_block_hash GUARDED_BY(cs_most_recent_block);
+
+/** Serialized blocks recently sent to peers (syncing peers request the same blocks from all their peers) */
+typedef std::shared_ptr<const std::vector<uint8_t>> RawBlockRef;
+RecursiveMutex cs_raw_blocks;
+unordered_lru_cache<uint256, RawBlockRef, StaticSaltedHasher, RAW_BLOCKS_CACHE_SIZE> rawBlocksCache GUARDED_BY(cs_raw_blocks);
+
 } // anon namespace
 
+/**
+ * Make nodeid the most recent of the high bandwidth compact block peers, evicting the oldest
+ * one beyond MAX_CMPCTBLOCK_HB_PEERS (nodeEvicted, or -1).
+ * Returns whether nodeid is new to the list (and has to be asked to switch to high bandwidth).
+ */
+bool AddHighBandwidthPeer(std::list<NodeId>& lPeers, NodeId nodeid, NodeId& nodeEvicted)
+{
+    nodeEvicted = -1;
+    for (auto it = lPeers.begin(); it != lPeers.end(); ++it) {
+        if (*it == nodeid) {
+            // Already in high bandwidth mode, now the most recent one
+            lPeers.erase(it);
+            lPeers.push_back(nodeid);
+            return false;
+        }
+    }
+    if (lPeers.size() >= MAX_CMPCTBLOCK_HB_PEERS) {
+        nodeEvicted = lPeers.front();
+        lPeers.pop_front();
+    }
+    lPeers.push_back(nodeid);
+    return true;
+}
+
 namespace
 {
 
@@ -218,12 +281,29 @@ struct CNodeState {
     const CBlockIndex* pindexLastCommonBlock;
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted;
+    //! Whether this peer supports headers-first sync ("getheaders" answered with "headers").
+    bool fHeadersFirst;
+    //! Whether we stopped asking this peer for headers, as we are too far ahead of our tip.
+    bool fHeadersSyncPaused;
+    //! The index entries created from this peer's headers, whose block data we don't have yet.
+    std::vector<const CBlockIndex*> vHeadersOnly;
+    //! The number of unconnecting headers (or blocks) in a row this peer sent us.
+    int nUnconnectingHeaders;
+    //! When we last asked this peer whether it has our best header (in microseconds), or 0.
+    int64_t nLastBestHeaderCheck;
     //! Since when we're stalling block download progress (in microseconds), or 0.
     int64_t nStallingSince;
     std::list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer wants new blocks announced with a "cmpctblock" (instead of an "inv").
+    bool fPreferHeaderAndIDs;
+    //! Whether this peer supports compact blocks ("sendcmpct" with our version).
+    bool fProvidesHeaderAndIDs;
+    //! The compact block announced by this peer, waiting for the "blocktxn" with the missing txes.
+    std::unique_ptr<PartiallyDownloadedBlock> partialBlock;
+    uint256 hashPartialBlock;
     //! Addresses processed
     uint64_t amt_addr_processed = 0;
     //! Addresses rate limited
@@ -239,9 +319,15 @@ struct CNodeState {
         hashLastUnknownBlock.SetNull();
         pindexLastCommonBlock = nullptr;
         fSyncStarted = false;
+        fHeadersFirst = false;
+        fHeadersSyncPaused = false;
+        nUnconnectingHeaders = 0;
+        nLastBestHeaderCheck = 0;
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        fPreferHeaderAndIDs = false;
+        fProvidesHeaderAndIDs = false;
     }
 };
 
@@ -347,6 +433,42 @@ static void ProcessBlockAvailability(NodeId nodeid) EXCLUSIVE_LOCKS_REQUIRED(cs_
     }
 }
 
+/**
+ * Accept the headers sent by a peer, within the number of index entries without block data that
+ * each peer can make us create (counted on all the branches): the headers of PoS blocks carry no
+ * work, so the height limit alone doesn't bound what forks of headers can make us store.
+ */
+static bool ProcessPeerHeaders(NodeId nodeid, const std::vector<CBlockHeader>& headers, CValidationState& state, CBlockIndex** ppindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+
+    CNodeState* nodestate = State(nodeid);
+    assert(nodestate != nullptr);
+
+    std::vector<const CBlockIndex*>& vHeadersOnly = nodestate->vHeadersOnly;
+    vHeadersOnly.erase(std::remove_if(vHeadersOnly.begin(), vHeadersOnly.end(), [](const CBlockIndex* pindex) {
+        return pindex->nStatus & BLOCK_HAVE_DATA;
+    }), vHeadersOnly.end());
+
+    std::vector<uint256> vNewHashes;
+    for (const CBlockHeader& header : headers) {
+        const uint256& hash = header.GetHash();
+        if (!LookupBlockIndex(hash)) vNewHashes.emplace_back(hash);
+    }
+    if (vHeadersOnly.size() + vNewHashes.size() > MAX_HEADERS_ONLY_PER_PEER) {
+        return state.DoS(100, error("%s: peer=%d sent too many headers without their blocks", __func__, nodeid),
+                         REJECT_INVALID, "too-many-headers");
+    }
+
+    // Record the new entries, also those accepted before an invalid header
+    const bool fAccepted = ProcessNewBlockHeaders(headers, state, ppindex);
+    for (const uint256& hash : vNewHashes) {
+        const CBlockIndex* pindex = LookupBlockIndex(hash);
+        if (pindex && !(pindex->nStatus & BLOCK_HAVE_DATA)) vHeadersOnly.emplace_back(pindex);
+    }
+    return fAccepted;
+}
+
 /** Update tracking information about which blocks a peer is assumed to have. */
 static void UpdateBlockAvailability(NodeId nodeid, const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
@@ -368,6 +490,115 @@ static void UpdateBlockAvailability(NodeId nodeid, const uint256& hash) EXCLUSIV
     }
 }
 
+/**
+ * Ask a peer that delivered us a new tip to announce the next blocks with a "cmpctblock"
+ * (high bandwidth mode). At most MAX_CMPCTBLOCK_HB_PEERS peers are in this mode: the one
+ * asked the longest ago goes back to announcing them with an "inv" (low bandwidth mode).
+ */
+static void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman* connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    CNodeState* nodestate = State(nodeid);
+    if (!nodestate || !nodestate->fProvidesHeaderAndIDs) {
+        return;
+    }
+    NodeId nodeEvicted;
+    if (!AddHighBandwidthPeer(lNodesAnnouncingHeaderAndIDs, nodeid, nodeEvicted)) {
+        return;
+    }
+    if (nodeEvicted != -1) {
+        connman->ForNode(nodeEvicted, [connman](CNode* pnodeStop) {
+            connman->PushMessage(pnodeStop, CNetMsgMaker(pnodeStop->GetSendVersion()).Make(NetMsgType::SENDCMPCT, false, CMPCTBLOCKS_VERSION));
+            return true;
+        });
+    }
+    connman->ForNode(nodeid, [connman](CNode* pfrom) {
+        connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SENDCMPCT, true, CMPCTBLOCKS_VERSION));
+        return true;
+    });
+}
+
+/** Whether the block was downloaded, and is waiting for the data of its parent. */
+static bool IsBlockPendingConnect(const CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    if (!pindex->pprev)
+        return false;
+
+    const auto range = mapBlocksPendingConnect.equal_range(pindex->pprev->GetBlockHash());
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.pblock->GetHash() == pindex->GetBlockHash())
+            return true;
+    }
+    return false;
+}
+
+/** Drop the blocks waiting for their parent that match pred (they are downloaded again, if needed). */
+template <typename Pred>
+static int EraseBlocksPendingConnect(Pred pred) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+    int nErased = 0;
+    for (auto it = mapBlocksPendingConnect.begin(); it != mapBlocksPendingConnect.end();) {
+        if (pred(it->first, it->second)) {
+            nBlocksPendingConnectSize -= it->second.nSize;
+            it = mapBlocksPendingConnect.erase(it);
+            nErased++;
+        } else {
+            ++it;
+        }
+    }
+    return nErased;
+}
+
+/** Drop the blocks waiting for too long, or for a parent that is not going to be accepted. */
+static void ExpireBlocksPendingConnect() EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    const int64_t nNow = GetTime();
+    const int nErased = EraseBlocksPendingConnect([nNow](const uint256& hashPrev, const PendingBlock& pending) {
+        if (pending.nTimeExpire <= nNow)
+            return true;
+        const CBlockIndex* pindexPrev = LookupBlockIndex(hashPrev);
+        return !pindexPrev || (pindexPrev->nStatus & BLOCK_FAILED_MASK);
+    });
+    if (nErased > 0) LogPrint(BCLog::NET, "Erased %d blocks waiting for their parent\n", nErased);
+}
+
+/** Accept the blocks that were downloaded ahead of the given one, now that it was processed. */
+static void ProcessBlocksPendingConnect(const uint256& hashBlock)
+{
+    AssertLockNotHeld(cs_main);
+
+    std::deque<uint256> vParents{hashBlock};
+    while (!vParents.empty()) {
+        std::vector<std::shared_ptr<const CBlock>> vBlocks;
+        {
+            LOCK(cs_main);
+            const auto range = mapBlocksPendingConnect.equal_range(vParents.front());
+            if (range.first == range.second) {
+                vParents.pop_front();
+                continue;
+            }
+            // If the parent was rejected, the blocks are dropped (and downloaded again, if needed)
+            const CBlockIndex* pindexParent = LookupBlockIndex(vParents.front());
+            const bool fParentAccepted = pindexParent && (pindexParent->nStatus & BLOCK_HAVE_DATA);
+            for (auto it = range.first; it != range.second; ++it) {
+                nBlocksPendingConnectSize -= it->second.nSize;
+                if (fParentAccepted) {
+                    mapBlockSource.emplace(it->second.pblock->GetHash(), it->second.nodeid);
+                    vBlocks.emplace_back(it->second.pblock);
+                }
+            }
+            mapBlocksPendingConnect.erase(range.first, range.second);
+        }
+        vParents.pop_front();
+        for (const auto& pblock : vBlocks) {
+            ProcessNewBlock(pblock, nullptr);
+            vParents.emplace_back(pblock->GetHash());
+        }
+    }
+}
+
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
 static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
@@ -406,7 +637,10 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
     // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    // The blocks downloaded out of order are kept in memory until their parent is accepted. If too many
+    // are waiting, only fetch the block right after the last one we have in common.
+    const int nWindowSize = nBlocksPendingConnectSize > MAX_BLOCKS_PENDING_CONNECT_SIZE / 2 ? 1 : BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + nWindowSize;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
@@ -432,6 +666,9 @@ static void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vec
             if (pindex->nStatus & BLOCK_HAVE_DATA) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (IsBlockPendingConnect(pindex)) {
+                // Downloaded already, waiting for its parent.
+                continue;
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -474,8 +711,11 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
     LOCK(cs_main);
     CNodeState* state = State(nodeid);
 
-    if (state->fSyncStarted)
+    if (state->fSyncStarted) {
         nSyncStarted--;
+        if (state->fHeadersFirst)
+            nHeadersSyncStarted--;
+    }
 
     if (state->nMisbehavior == 0 && state->fCurrentlyConnected) {
         fUpdateConnectionTime = true;
@@ -484,7 +724,9 @@ void PeerLogicValidation::FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTim
     for (const QueuedBlock& entry : state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
+    EraseBlocksPendingConnect([nodeid](const uint256&, const PendingBlock& pending) { return pending.nodeid == nodeid; });
     nPreferredDownload -= state->fPreferredDownload;
+    lNodesAnnouncingHeaderAndIDs.remove(nodeid);
 
     mapNodeState.erase(nodeid);
     LogPrint(BCLog::NET, "Cleared nodestate for peer=%d\n", nodeid);
@@ -645,6 +887,20 @@ void Misbehaving(NodeId pnode, int howmuch, const std::string& message) EXCLUSIV
     }
 }
 
+/** Ask the peer for the headers between our best header and the unconnecting one (or block) it sent,
+ *  with a DoS penalty every MAX_UNCONNECTING_HEADERS in a row (they are cheap to make up). */
+static void RequestUnconnectingHeaders(CNode* pfrom, const uint256& hash, CConnman* connman) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    CNodeState* nodestate = State(pfrom->GetId());
+    nodestate->nUnconnectingHeaders++;
+    connman->PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), UINT256_ZERO));
+    LogPrint(BCLog::NET, "received header %s with unknown prev, sending getheaders (%d) to end (peer=%d, nUnconnectingHeaders=%d)\n",
+             hash.ToString(), pindexBestHeader->nHeight, pfrom->GetId(), nodestate->nUnconnectingHeaders);
+    if (nodestate->nUnconnectingHeaders % MAX_UNCONNECTING_HEADERS == 0) {
+        Misbehaving(pfrom->GetId(), 20, strprintf("%d non-connecting headers", nodestate->nUnconnectingHeaders));
+    }
+}
+
 // Requires cs_main.
 bool IsBanned(NodeId pnode)
 {
@@ -710,6 +966,14 @@ PeerLogicValidation::PeerLogicValidation(CConnman* connmanIn) :
 
 void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex)
 {
+    {
+        // Keep it around to be announced, and to serve "getblocktxn", without reading it from disk
+        LOCK(cs_most_recent_block);
+        most_recent_block = pblock;
+        most_recent_compact_block.reset();
+        most_recent_block_hash = pindex->GetBlockHash();
+    }
+
     LOCK(g_cs_orphans);
 
     std::vector<uint256> vOrphanErase;
@@ -746,14 +1010,40 @@ void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex* pindexNew, const CB
 
     if (!fInitialDownload) {
         const uint256& hashNewTip = pindexNew->GetBlockHash();
+
+        // A single block extending our previous tip is announced with a
+        // "cmpctblock" to the peers asking for it: they can rebuild it from
+        // their mempool, without the inv/getdata round-trip.
+        std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+        if (pindexNew->pprev == pindexFork) {
+            LOCK(cs_most_recent_block);
+            if (most_recent_block_hash == hashNewTip) {
+                if (!most_recent_compact_block) {
+                    most_recent_compact_block = std::make_shared<const CBlockHeaderAndShortTxIDs>(*most_recent_block);
+                }
+                pcmpctblock = most_recent_compact_block;
+            }
+        }
+
         // Relay inventory, but don't relay old inventory during initial block download.
-        connman->ForEachNode([nNewHeight, hashNewTip](CNode* pnode) {
+        LOCK(cs_main);
+        connman->ForEachNode([this, nNewHeight, hashNewTip, &pcmpctblock](CNode* pnode) {
             // Don't sync from MN only connections.
             if (!pnode->CanRelay()) {
                 return;
             }
             if (nNewHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : 0)) {
-                pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                const CInv inv(MSG_BLOCK, hashNewTip);
+                if (pcmpctblock && State(pnode->GetId())->fPreferHeaderAndIDs) {
+                    // Skip the peer that sent us this block
+                    if (WITH_LOCK(pnode->cs_inventory, return pnode->filterInventoryKnown.contains(hashNewTip))) {
+                        return;
+                    }
+                    pnode->AddInventoryKnown(inv);
+                    connman->PushMessage(pnode, CNetMsgMaker(pnode->GetSendVersion()).Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+                } else {
+                    pnode->PushInventory(inv);
+                }
             }
         });
     }
@@ -777,6 +1067,11 @@ void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationSta
             // Spam filter
             CheckBlockSpam(it->second, block.GetHash());
         }
+    } else if (state.IsValid() && it != mapBlockSource.end() && !IsInitialBlockDownload() &&
+            mapBlocksInFlight.count(hash) == mapBlocksInFlight.size()) {
+        // The peer delivered us a new tip (and we aren't downloading other blocks):
+        // prefer it for the next compact block announcements.
+        MaybeSetPeerAsAnnouncingHeaderAndIDs(it->second, connman);
     }
 
     if (it != mapBlockSource.end())
@@ -1067,6 +1362,21 @@ bool static PushTierTwoGetDataRequest(const CInv& inv,
     return false;
 }
 
+static void SendBlockTransactions(const CBlock& block, const BlockTransactionsRequest& req, CNode* pfrom, CConnman* connman)
+{
+    BlockTransactions resp(req);
+    for (size_t i = 0; i < req.indexes.size(); i++) {
+        if (req.indexes[i] >= block.vtx.size()) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), 100, strprintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices", pfrom->GetId()));
+            return;
+        }
+        resp.txn[i] = block.vtx[req.indexes[i]];
+    }
+    CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
+}
+
 void static ProcessGetBlockData(CNode* pfrom, const CInv& inv, CConnman* connman, const std::atomic<bool>& interruptMsgProc)
 {
     LOCK(cs_main);
@@ -1090,14 +1400,23 @@ void static ProcessGetBlockData(CNode* pfrom, const CInv& inv, CConnman* connman
     }
     // Don't send not-validated blocks
     if (send && (pindex->nStatus & BLOCK_HAVE_DATA)) {
-        // Send block from disk
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex))
-            assert(!"cannot load block from disk");
-        if (inv.type == MSG_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
-        else // MSG_FILTERED_BLOCK)
+        if (inv.type == MSG_BLOCK) {
+            // Send the block as it is stored on disk (the disk and network
+            // serializations of a block are the same), without deserializing it.
+            RawBlockRef pblockData;
+            if (!WITH_LOCK(cs_raw_blocks, return rawBlocksCache.get(inv.hash, pblockData))) {
+                std::vector<uint8_t> blockData;
+                if (!ReadRawBlockFromDisk(blockData, pindex, Params().MessageStart()))
+                    assert(!"cannot load block from disk");
+                pblockData = std::make_shared<const std::vector<uint8_t>>(std::move(blockData));
+                WITH_LOCK(cs_raw_blocks, rawBlocksCache.insert(inv.hash, pblockData));
+            }
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, MakeSpan(*pblockData)));
+        } else // MSG_FILTERED_BLOCK)
         {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex))
+                assert(!"cannot load block from disk");
             bool send_ = false;
             CMerkleBlock merkleBlock;
             {
@@ -1350,6 +1669,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             LOCK(cs_main);
             // Potentially mark this peer as a preferred download peer.
             UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
+            State(pfrom->GetId())->fHeadersFirst = nVersion >= HEADERS_FIRST_VERSION;
         }
 
         if (!pfrom->fInbound) {
@@ -1445,6 +1765,13 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             CMNAuth::PushMNAUTH(pfrom, *connman);
         }
 
+        if (pfrom->nVersion >= COMPACT_BLOCKS_VERSION) {
+            // Tell the peer that we support compact blocks, announced with an "inv" (low bandwidth mode).
+            // The peers that deliver us new tips are then asked to push them with a "cmpctblock"
+            // (high bandwidth mode), up to MAX_CMPCTBLOCK_HB_PEERS of them (see MaybeSetPeerAsAnnouncingHeaderAndIDs).
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, false, CMPCTBLOCKS_VERSION));
+        }
+
         pfrom->fSuccessfullyConnected = true;
         LogPrintf("New outbound peer connected: version: %d, blocks=%d, peer=%d%s\n",
                   pfrom->nVersion.load(), pfrom->nStartingHeight, pfrom->GetId(),
@@ -1486,6 +1813,19 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         return true;
     }
 
+    else if (strCommand == NetMsgType::SENDCMPCT) {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == CMPCTBLOCKS_VERSION) {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            nodestate->fProvidesHeaderAndIDs = true;
+            nodestate->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+        return true;
+    }
+
     if (strCommand != NetMsgType::GETSPORKS &&
         strCommand != NetMsgType::SPORK &&
         !pfrom->fFirstMessageReceived.exchange(true)) {
@@ -1611,9 +1951,18 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint(BCLog::NET, "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->GetId());
+                    const bool fHeadersFirst = State(pfrom->GetId())->fHeadersFirst;
+                    if (fHeadersFirst) {
+                        // Get the headers of the blocks we miss: the blocks are then downloaded from
+                        // all the peers having them (see FindNextBlocksToDownload).
+                        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), inv.hash));
+                        LogPrint(BCLog::NET, "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->GetId());
+                    }
+                    if (!fHeadersFirst || !IsInitialBlockDownload()) {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(inv);
+                        LogPrint(BCLog::NET, "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->GetId());
+                    }
                 }
             } else {
                 // Allowed inv request types while we are in IBD
@@ -1678,7 +2027,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == NetMsgType::GETBLOCKS || strCommand == NetMsgType::GETHEADERS) {
+    else if (strCommand == NetMsgType::GETBLOCKS) {
 
         // Don't relay blocks inv to masternode-only connections
         if (!pfrom->CanRelay()) {
@@ -1723,27 +2072,35 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     }
 
 
-    else if (strCommand == NetMsgType::HEADERS && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == NetMsgType::GETHEADERS) {
+
+        // Don't relay blocks headers to masternode-only connections
+        if (!pfrom->CanRelay()) {
+            LogPrint(BCLog::NET, "getheaders, don't relay blocks headers to masternode connection. peer=%d\n", pfrom->GetId());
+            return true;
+        }
+
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
 
         if (locator.vHave.size() > MAX_LOCATOR_SZ) {
-            LogPrint(BCLog::NET, "getblocks locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
+            LogPrint(BCLog::NET, "getheaders locator size %lld > %d, disconnect peer=%d\n", locator.vHave.size(), MAX_LOCATOR_SZ, pfrom->GetId());
             pfrom->fDisconnect = true;
             return true;
         }
 
         LOCK(cs_main);
-
-        if (IsInitialBlockDownload())
+        if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
+            LogPrint(BCLog::NET, "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->GetId());
             return true;
+        }
 
         CBlockIndex* pindex = nullptr;
         if (locator.IsNull()) {
             // If locator is null, return the hashStop block
-            CBlockIndex* pindex = LookupBlockIndex(hashStop);
-            if (!pindex)
+            pindex = LookupBlockIndex(hashStop);
+            if (!pindex || !chainActive.Contains(pindex))
                 return true;
         } else {
             // Find the last block the caller has in the main chain
@@ -1755,7 +2112,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
         std::vector<CBlock> vHeaders;
         int nLimit = MAX_HEADERS_RESULTS;
-        LogPrintf("getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->GetId());
+        LogPrint(BCLog::NET, "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.IsNull() ? "end" : hashStop.ToString(), pfrom->GetId());
         for (; pindex; pindex = chainActive.Next(pindex)) {
             vHeaders.push_back(pindex->GetBlockHeader());
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
@@ -1780,8 +2137,11 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         bool fMissingInputs = false;
         CValidationState state;
 
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv);
+        {
+            LOCK(g_cs_askfor);
+            pfrom->setAskFor.erase(inv.hash);
+            mapAlreadyAskedFor.erase(inv);
+        }
 
         if (ptx->ContainsZerocoins()) {
             // Don't even try to check zerocoins at all.
@@ -1916,7 +2276,7 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         }
     }
 
-    else if (strCommand == NetMsgType::HEADERS && Params().HeadersFirstSyncingActive() && !fImporting && !fReindex) // Ignore headers received while importing
+    else if (strCommand == NetMsgType::HEADERS && !fImporting && !fReindex) // Ignore headers received while importing
     {
         std::vector<CBlockHeader> headers;
 
@@ -1939,38 +2299,57 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
             // Nothing interesting. Stop asking this peers for more headers.
             return true;
         }
-        CBlockIndex* pindexLast = nullptr;
-        for (const CBlockHeader& header : headers) {
-            CValidationState state;
-            if (pindexLast && header.hashPrevBlock != pindexLast->GetBlockHash()) {
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != headers[n - 1].GetHash()) {
                 Misbehaving(pfrom->GetId(), 20, "non-continuous headers sequence");
                 return false;
             }
+        }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
-                int nDoS;
-                if (state.IsInvalid(nDoS)) {
-                    if (nDoS > 0) {
-                        Misbehaving(pfrom->GetId(), nDoS, "invalid header received");
-                    } else {
-                        LogPrint(BCLog::NET, "peer=%d: invalid header received\n", pfrom->GetId());
-                    }
-                    return false;
+        CNodeState* nodestate = State(pfrom->GetId());
+        const CBlockIndex* pindexFirstPrev = LookupBlockIndex(headers[0].hashPrevBlock);
+        if (!pindexFirstPrev) {
+            // The headers don't connect to our tree (e.g. a new block announced by a peer that reorganized):
+            // ask for the ones in between.
+            if (nodestate->fHeadersFirst && headers[0].GetHash() != Params().GetConsensus().hashGenesisBlock) {
+                RequestUnconnectingHeaders(pfrom, headers[0].GetHash(), connman);
+            }
+            return true;
+        }
+
+        // Don't store the headers too far ahead of our tip: the sync with this peer
+        // is resumed as the blocks get connected (see SendMessages).
+        const int nMaxHeight = chainActive.Height() + MAX_HEADERS_AHEAD_OF_TIP;
+        if (pindexFirstPrev->nHeight + (int) nCount > nMaxHeight) {
+            headers.resize(std::max(0, nMaxHeight - pindexFirstPrev->nHeight));
+            nodestate->fHeadersSyncPaused = true;
+        }
+
+        CValidationState state;
+        CBlockIndex* pindexLast = nullptr;
+        if (!ProcessPeerHeaders(pfrom->GetId(), headers, state, &pindexLast)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0) {
+                    Misbehaving(pfrom->GetId(), nDoS, "invalid header received");
+                } else {
+                    LogPrint(BCLog::NET, "peer=%d: invalid header received\n", pfrom->GetId());
                 }
+                return false;
             }
         }
+        nodestate->nUnconnectingHeaders = 0;
 
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (nodestate->fHeadersSyncPaused) {
+            LogPrint(BCLog::NET, "headers sync paused at height %d (tip %d) peer=%d\n", nMaxHeight, chainActive.Height(), pfrom->GetId());
+        } else if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
-            LogPrintf("more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->GetId(), pfrom->nStartingHeight);
+            LogPrint(BCLog::NET, "more getheaders (%d) to end to peer=%d (startheight:%d)\n", pindexLast->nHeight, pfrom->GetId(), pfrom->nStartingHeight);
             connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexLast), UINT256_ZERO));
         }
     }
@@ -1983,34 +2362,242 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint(BCLog::NET, "received block %s peer=%d\n", inv.hash.ToString(), pfrom->GetId());
 
-        // sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
-        if (!mapBlockIndex.count(pblock->hashPrevBlock)) {
-            CBlockLocator locator = WITH_LOCK(cs_main, return chainActive.GetLocator(););
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
-                // we already asked for this block, so lets work backwards and ask for the previous block
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKS, locator, pblock->hashPrevBlock));
-                pfrom->vBlockRequested.emplace_back(pblock->hashPrevBlock);
-            } else {
-                // ask to sync to this block
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKS, locator, hashBlock));
-                pfrom->vBlockRequested.emplace_back(hashBlock);
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindexPrev = LookupBlockIndex(pblock->hashPrevBlock);
+            if (!pindexPrev) {
+                // sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
+                if (State(pfrom->GetId())->fHeadersFirst) {
+                    RequestUnconnectingHeaders(pfrom, hashBlock, connman);
+                    return true;
+                }
+                CBlockLocator locator = chainActive.GetLocator();
+                if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+                    // we already asked for this block, so lets work backwards and ask for the previous block
+                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKS, locator, pblock->hashPrevBlock));
+                    pfrom->vBlockRequested.emplace_back(pblock->hashPrevBlock);
+                } else {
+                    // ask to sync to this block
+                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKS, locator, hashBlock));
+                    pfrom->vBlockRequested.emplace_back(hashBlock);
+                }
+                return true;
             }
-        } else {
+
             pfrom->AddInventoryKnown(inv);
-            if (!mapBlockIndex.count(hashBlock)) {
-                {
-                    LOCK(cs_main);
-                    MarkBlockAsReceived(hashBlock);
-                    mapBlockSource.emplace(hashBlock, pfrom->GetId());
+            CBlockIndex* pindex = LookupBlockIndex(hashBlock);
+            if (pindex && (pindex->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, hashBlock.GetHex());
+                return true;
+            }
+            const auto itInFlight = mapBlocksInFlight.find(hashBlock);
+            const bool fRequested = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+            MarkBlockAsReceived(hashBlock);
+
+            if (!(pindexPrev->nStatus & BLOCK_HAVE_DATA)) {
+                // Only the blocks requested from this peer are kept
+                if (!fRequested) {
+                    LogPrint(BCLog::NET, "unrequested block %s ahead of its parent, peer=%d\n", hashBlock.ToString(), pfrom->GetId());
+                    return true;
+                }
+                // Downloaded ahead of its parent (headers-first sync): keep it until the parent is accepted.
+                CValidationState state;
+                if (!pindex && (!CheckBlockStakeHeader(*pblock, state, pindexPrev) ||
+                                !ProcessPeerHeaders(pfrom->GetId(), {pblock->GetBlockHeader()}, state, &pindex))) {
+                    int nDoS;
+                    if (state.IsInvalid(nDoS) && nDoS > 0) {
+                        Misbehaving(pfrom->GetId(), nDoS, "invalid header received");
+                    }
+                    return true;
+                }
+                ExpireBlocksPendingConnect();
+                const size_t nSize = GetSerializeSize(*pblock, PROTOCOL_VERSION);
+                if (pindex->nHeight <= chainActive.Height() + (int) BLOCK_DOWNLOAD_WINDOW + 1 && !IsBlockPendingConnect(pindex) &&
+                        nBlocksPendingConnectSize + nSize <= MAX_BLOCKS_PENDING_CONNECT_SIZE) {
+                    mapBlocksPendingConnect.emplace(pblock->hashPrevBlock, PendingBlock{pfrom->GetId(), pblock, nSize, GetTime() + BLOCK_PENDING_CONNECT_EXPIRE_TIME});
+                    nBlocksPendingConnectSize += nSize;
+                    LogPrint(BCLog::NET, "block %s (%d) waiting for its parent, peer=%d\n", hashBlock.ToString(), pindex->nHeight, pfrom->GetId());
                 }
-                ProcessNewBlock(pblock, nullptr);
+                return true;
+            }
+            mapBlockSource.emplace(hashBlock, pfrom->GetId());
+        }
+        ProcessNewBlock(pblock, nullptr);
+        ProcessBlocksPendingConnect(hashBlock);
 
-                // Disconnect node if its running an old protocol version,
-                // used during upgrades, when the node is already connected.
-                pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol());
-            } else {
-                LogPrint(BCLog::NET, "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, pblock->GetHash().GetHex());
+        // Disconnect node if its running an old protocol version,
+        // used during upgrades, when the node is already connected.
+        pfrom->DisconnectOldProtocol(pfrom->nVersion, ActiveProtocol());
+    }
+
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        const uint256& hashBlock = cmpctblock.header.GetHash();
+        const CInv inv(MSG_BLOCK, hashBlock);
+        LogPrint(BCLog::NET, "received cmpctblock %s peer=%d\n", hashBlock.ToString(), pfrom->GetId());
+        pfrom->AddInventoryKnown(inv);
+
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        {
+            LOCK(cs_main);
+            CBlockIndex* pindex = LookupBlockIndex(hashBlock);
+            if ((pindex && (pindex->nStatus & BLOCK_HAVE_DATA)) || mapBlocksInFlight.count(hashBlock)) {
+                // Already have it, or already being downloaded
+                return true;
+            }
+            const CBlockIndex* pindexPrev = LookupBlockIndex(cmpctblock.header.hashPrevBlock);
+            if (!pindexPrev || !(pindexPrev->nStatus & BLOCK_HAVE_DATA) || IsInitialBlockDownload()) {
+                // Not a block we can connect now: go through the full block path
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>{inv}));
+                return true;
+            }
+
+            // Accept the header first: the mempool scan is only worth it for a valid
+            // block that would become our new tip. The header of a PoS block is checked
+            // with the coinstake (second prefilled tx) and the signature it comes with.
+            CValidationState state;
+            if (!pindex && Params().GetConsensus().NetworkUpgradeActive(pindexPrev->nHeight + 1, Consensus::UPGRADE_POS)) {
+                const CTransactionRef coinstake = cmpctblock.GetPrefilledCoinstake();
+                if (!coinstake) {
+                    // No coinstake to check the header with: go through the full block path
+                    connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>{inv}));
+                    return true;
+                }
+                CBlock stakeBlock(cmpctblock.header);
+                // the coinbase is not needed by the checks
+                stakeBlock.vtx = {MakeTransactionRef(), coinstake};
+                stakeBlock.vchBlockSig = cmpctblock.vchBlockSig;
+                if (!CheckBlockStakeHeader(stakeBlock, state, pindexPrev)) {
+                    int nDoS;
+                    if (state.IsInvalid(nDoS) && nDoS > 0) {
+                        Misbehaving(pfrom->GetId(), nDoS, "invalid proof of stake");
+                    }
+                    return false;
+                }
+            }
+            if (!ProcessPeerHeaders(pfrom->GetId(), {cmpctblock.header}, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && nDoS > 0) {
+                    Misbehaving(pfrom->GetId(), nDoS, "invalid header received");
+                    return false;
+                }
+                return true;
+            }
+            UpdateBlockAvailability(pfrom->GetId(), hashBlock);
+            if (pindex->nChainWork <= chainActive.Tip()->nChainWork) {
+                // Not a candidate tip (e.g. a stale fork): nothing to download now
+                return true;
+            }
+
+            PartiallyDownloadedBlock partialBlock(&mempool);
+            const ReadStatus status = partialBlock.InitData(cmpctblock);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100, strprintf("Peer %d sent us invalid compact block", pfrom->GetId()));
+                return false;
+            } else if (status == READ_STATUS_FAILED) {
+                // Duplicate short ids, just request the full block
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>{inv}));
+                return true;
+            }
+
+            BlockTransactionsRequest req;
+            for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                if (!partialBlock.IsTxAvailable(i))
+                    req.indexes.push_back(i);
+            }
+            if (!req.indexes.empty()) {
+                // Ask the peer for the txes missing from our mempool
+                CNodeState* nodestate = State(pfrom->GetId());
+                if (nodestate->partialBlock) {
+                    MarkBlockAsReceived(nodestate->hashPartialBlock);
+                }
+                req.blockhash = hashBlock;
+                MarkBlockAsInFlight(pfrom->GetId(), hashBlock);
+                nodestate->partialBlock.reset(new PartiallyDownloadedBlock(std::move(partialBlock)));
+                nodestate->hashPartialBlock = hashBlock;
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+                return true;
+            }
+            if (partialBlock.FillBlock(*pblock, {}) != READ_STATUS_OK) {
+                // Short id collision, request the full block
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>{inv}));
+                return true;
+            }
+            mapBlockSource.emplace(hashBlock, pfrom->GetId());
+        }
+        ProcessNewBlock(pblock, nullptr);
+        ProcessBlocksPendingConnect(hashBlock);
+    }
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (!nodestate->partialBlock || nodestate->hashPartialBlock != resp.blockhash) {
+                LogPrint(BCLog::NET, "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->GetId());
+                return true;
+            }
+
+            const ReadStatus status = nodestate->partialBlock->FillBlock(*pblock, resp.txn);
+            nodestate->partialBlock.reset();
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100, strprintf("Peer %d sent us invalid compact block/non-matching block transactions", pfrom->GetId()));
+                return false;
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now (the block stays in flight)
+                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::GETDATA, std::vector<CInv>{CInv(MSG_BLOCK, resp.blockhash)}));
+                return true;
             }
+            MarkBlockAsReceived(resp.blockhash);
+            mapBlockSource.emplace(resp.blockhash, pfrom->GetId());
+        }
+        ProcessNewBlock(pblock, nullptr);
+        ProcessBlocksPendingConnect(resp.blockhash);
+    }
+
+    else if (strCommand == NetMsgType::GETBLOCKTXN) {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        std::shared_ptr<const CBlock> recent_block;
+        {
+            LOCK(cs_most_recent_block);
+            if (most_recent_block_hash == req.blockhash)
+                recent_block = most_recent_block;
+        }
+        if (recent_block) {
+            SendBlockTransactions(*recent_block, req, pfrom, connman);
+            return true;
+        }
+
+        bool fSendFullBlock = false;
+        CBlock block;
+        {
+            LOCK(cs_main);
+            const CBlockIndex* pindex = LookupBlockIndex(req.blockhash);
+            if (!pindex || !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                LogPrint(BCLog::NET, "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->GetId());
+                return true;
+            }
+            // Peers requesting txes of old blocks are not relaying: send the full block,
+            // which is subject to the same checks of a getdata.
+            fSendFullBlock = pindex->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH;
+            if (!fSendFullBlock && !ReadBlockFromDisk(block, pindex)) {
+                return error("%s: cannot load block %s from disk", __func__, req.blockhash.ToString());
+            }
+        }
+        if (fSendFullBlock) {
+            ProcessGetBlockData(pfrom, CInv(MSG_BLOCK, req.blockhash), connman, interruptMsgProc);
+        } else {
+            SendBlockTransactions(block, req, pfrom, connman);
         }
     }
 
@@ -2228,6 +2815,62 @@ bool static ProcessMessage(CNode* pfrom, std::string strCommand, CDataStream& vR
     return true;
 }
 
+/**
+ * Tier two messages processed on the message worker pool. Their handlers
+ * (masternode, budget and LLMQ managers) have their own locks and take
+ * cs_main only when needed, so they don't have to wait for the messages of
+ * other peers (e.g. blocks) on the message handler thread.
+ * Sporks and mn winners update the tier two sync state, and chainlocks and
+ * final commitments go through validation: they stay on the handler thread.
+ */
+static bool IsWorkerMessage(const std::string& strCommand)
+{
+    static const std::set<std::string> setWorkerMessages = {
+        NetMsgType::MNBROADCAST,
+        NetMsgType::MNBROADCAST2,
+        NetMsgType::MNPING,
+        NetMsgType::BUDGETPROPOSAL,
+        NetMsgType::BUDGETVOTE,
+        NetMsgType::FINALBUDGET,
+        NetMsgType::FINALBUDGETVOTE,
+        NetMsgType::QCONTRIB,
+        NetMsgType::QCOMPLAINT,
+        NetMsgType::QJUSTIFICATION,
+        NetMsgType::QPCOMMITMENT,
+        NetMsgType::QSIGSESANN,
+        NetMsgType::QSIGSHARESINV,
+        NetMsgType::QGETSIGSHARES,
+        NetMsgType::QBSIGSHARES,
+        NetMsgType::QSIGSHARE,
+        NetMsgType::QSIGREC,
+    };
+    return setWorkerMessages.count(strCommand) > 0;
+}
+
+static Mutex cs_msgLatency;
+static std::map<std::string, CMessageLatencyStats> mapMsgLatency GUARDED_BY(cs_msgLatency);
+
+static void RecordMessageLatency(const std::string& strCommand, int64_t nTimeReceived, int64_t nTimeStart, bool fWorker)
+{
+    // Unknown commands aren't recorded, the map can't be filled with garbage
+    static const std::set<std::string> setKnownMessages(getAllNetMessageTypes().begin(), getAllNetMessageTypes().end());
+    if (!setKnownMessages.count(strCommand)) return;
+
+    const int64_t nProcessTime = GetTimeMicros() - nTimeStart;
+    LOCK(cs_msgLatency);
+    CMessageLatencyStats& stats = mapMsgLatency[strCommand];
+    stats.nCount++;
+    stats.nWaitTime += std::max<int64_t>(0, nTimeStart - nTimeReceived);
+    stats.nProcessTime += nProcessTime;
+    stats.nMaxProcessTime = std::max(stats.nMaxProcessTime, nProcessTime);
+    stats.fWorker = fWorker;
+}
+
+std::map<std::string, CMessageLatencyStats> GetMessageLatencyStats()
+{
+    return WITH_LOCK(cs_msgLatency, return mapMsgLatency; );
+}
+
 static bool DisconnectIfBanned(CNode* pnode, CConnman* connman)
 {
     AssertLockHeld(cs_main);
@@ -2252,6 +2895,42 @@ static bool DisconnectIfBanned(CNode* pnode, CConnman* connman)
     return false;
 }
 
+/** Process a message (whose header and checksum were verified), catching the deserialization errors.
+ *  Returns false if interrupted. */
+static bool ProcessMessageChecked(CNode* pfrom, CNetMessage& msg, const std::string& strCommand, CConnman* connman, std::atomic<bool>& interruptMsgProc, bool fWorker)
+{
+    CDataStream& vRecv = msg.vRecv;
+    const unsigned int nMessageSize = msg.hdr.nMessageSize;
+    const int64_t nTimeStart = GetTimeMicros();
+    bool fRet = false;
+    try {
+        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, connman, interruptMsgProc);
+        if (interruptMsgProc)
+            return false;
+    } catch (const std::ios_base::failure& e) {
+        if (strstr(e.what(), "end of data")) {
+            // Allow exceptions from under-length message on vRecv
+            LogPrint(BCLog::NET, "ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
+        } else if (strstr(e.what(), "size too large")) {
+            // Allow exceptions from over-long size
+            LogPrint(BCLog::NET, "ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
+        } else {
+            PrintExceptionContinue(&e, "ProcessMessages()");
+        }
+    } catch (const std::exception& e) {
+        PrintExceptionContinue(&e, "ProcessMessages()");
+    } catch (...) {
+        PrintExceptionContinue(nullptr, "ProcessMessages()");
+    }
+
+    if (!fRet) {
+        LogPrint(BCLog::NET, "ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize,
+                 pfrom->GetId());
+    }
+    RecordMessageLatency(strCommand, msg.nTime, nTimeStart, fWorker);
+    return true;
+}
+
 bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& interruptMsgProc)
 {
     // Message format
@@ -2281,6 +2960,12 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         LOCK(pfrom->cs_vProcessMsg);
         if (pfrom->vProcessMsg.empty())
             return false;
+        // Keep the peer's messages in order: the next one waits for the messages
+        // queued on the worker pool, unless it goes there too.
+        // The worker wakes the message handler when done.
+        if (WITH_LOCK(pfrom->cs_vWorkerMsg, return pfrom->fWorkerScheduled; ) &&
+                !IsWorkerMessage(pfrom->vProcessMsg.front().hdr.GetCommand()))
+            return false;
         // Just take one message
         msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
         pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
@@ -2309,7 +2994,6 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
     unsigned int nMessageSize = hdr.nMessageSize;
 
     // Checksum
-    CDataStream& vRecv = msg.vRecv;
     uint256 hash = msg.GetMessageHash();
     if (memcmp(hash.begin(), hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) != 0)
     {
@@ -2320,41 +3004,56 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         return fMoreWork;
     }
 
-    // Process message
-    bool fRet = false;
-    try {
-        fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, connman, interruptMsgProc);
-        if (interruptMsgProc)
-            return false;
-        if (!pfrom->vRecvGetData.empty())
-            fMoreWork = true;
-    } catch (const std::ios_base::failure& e) {
-        if (strstr(e.what(), "end of data")) {
-            // Allow exceptions from under-length message on vRecv
-            LogPrint(BCLog::NET, "ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
-        } else if (strstr(e.what(), "size too large")) {
-            // Allow exceptions from over-long size
-            LogPrint(BCLog::NET, "ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
-        } else {
-            PrintExceptionContinue(&e, "ProcessMessages()");
-        }
-    } catch (const std::exception& e) {
-        PrintExceptionContinue(&e, "ProcessMessages()");
-    } catch (...) {
-        PrintExceptionContinue(nullptr, "ProcessMessages()");
+    if (connman->HasMessageWorkers() && pfrom->fSuccessfullyConnected && IsWorkerMessage(strCommand)) {
+        connman->QueueWorkerMessages(pfrom, msgs);
+        return fMoreWork;
     }
 
-    if (!fRet) {
-        LogPrint(BCLog::NET, "ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize,
-                 pfrom->GetId());
-    }
+    // Process message
+    if (!ProcessMessageChecked(pfrom, msg, strCommand, connman, interruptMsgProc, false))
+        return false;
 
-    LOCK(cs_main);
-    DisconnectIfBanned(pfrom, connman);
+    {
+        LOCK(cs_main);
+        DisconnectIfBanned(pfrom, connman);
+    }
+    if (!pfrom->vRecvGetData.empty())
+        fMoreWork = true;
 
     return fMoreWork;
 }
 
+void PeerLogicValidation::ProcessWorkerMessages(CNode* pfrom, std::atomic<bool>& interruptMsgProc)
+{
+    while (true) {
+        std::list<CNetMessage> msgs;
+        bool fDone;
+        {
+            LOCK(pfrom->cs_vWorkerMsg);
+            fDone = pfrom->vWorkerMsg.empty() || interruptMsgProc || pfrom->fDisconnect;
+            if (fDone) {
+                msgs.swap(pfrom->vWorkerMsg);
+                pfrom->fWorkerScheduled = false;
+            } else {
+                msgs.splice(msgs.begin(), pfrom->vWorkerMsg, pfrom->vWorkerMsg.begin());
+            }
+        }
+        // Release the popped (or dropped) messages from the receive flood control
+        size_t nSizeRemoved = 0;
+        for (const CNetMessage& msg : msgs) {
+            nSizeRemoved += msg.vRecv.size() + CMessageHeader::HEADER_SIZE;
+        }
+        if (nSizeRemoved > 0) {
+            LOCK(pfrom->cs_vProcessMsg);
+            pfrom->nProcessQueueSize -= nSizeRemoved;
+            pfrom->fPauseRecv = pfrom->nProcessQueueSize > connman->GetReceiveFloodSize();
+        }
+        if (fDone) return;
+        ProcessMessageChecked(pfrom, msgs.front(), msgs.front().hdr.GetCommand(), connman, interruptMsgProc, true);
+    }
+}
+
+
 class CompareInvMempoolOrder
 {
     CTxMemPool *mp;
@@ -2464,16 +3163,42 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         bool fFetch = state.fPreferredDownload || (nPreferredDownload == 0 && !pto->fClient && !pto->fOneShot); // Download if this is a nice peer, or we have no nice peers and this one might do.
         if (!state.fSyncStarted && !pto->fClient && !fImporting && !fReindex && pto->CanRelay()) {
             // Only actively request headers from a single peer, unless we're close to end of initial download.
-            if ((nSyncStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
+            // A headers-first peer is preferred to the legacy (getblocks) sync.
+            const int nStarted = state.fHeadersFirst ? nHeadersSyncStarted : nSyncStarted;
+            if ((nStarted == 0 && fFetch) || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->GetId(), pto->nStartingHeight);
-                //pto->PushMessage(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO);
-                connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO));
+                if (state.fHeadersFirst) {
+                    nHeadersSyncStarted++;
+                    const CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint(BCLog::NET, "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->GetId(), pto->nStartingHeight);
+                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO));
+                } else {
+                    connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETBLOCKS, chainActive.GetLocator(chainActive.Tip()), UINT256_ZERO));
+                }
             }
         }
 
+        // Ask the other headers-first peers whether they have our best header: the blocks are then
+        // downloaded from all of them, and not only from the peer we get the headers from.
+        const int nBestKnownHeight = state.pindexBestKnownBlock ? state.pindexBestKnownBlock->nHeight : -1;
+        if (state.fHeadersFirst && !state.fSyncStarted && fFetch && !pto->fClient && pto->CanRelay() &&
+                state.pindexBestKnownBlock != pindexBestHeader && pto->nStartingHeight > nBestKnownHeight &&
+                state.nLastBestHeaderCheck < GetTimeMicros() - BEST_HEADER_CHECK_INTERVAL * 1000000) {
+            state.nLastBestHeaderCheck = GetTimeMicros();
+            const CBlockIndex* pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+            connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO));
+        }
+
+        // Resume the headers sync paused at MAX_HEADERS_AHEAD_OF_TIP, once the blocks caught up
+        if (state.fHeadersSyncPaused && (!state.pindexBestKnownBlock ||
+                state.pindexBestKnownBlock->nHeight - chainActive.Height() < MAX_HEADERS_AHEAD_OF_TIP / 2)) {
+            state.fHeadersSyncPaused = false;
+            const CBlockIndex* pindexStart = state.pindexBestKnownBlock ? state.pindexBestKnownBlock : chainActive.Tip();
+            LogPrint(BCLog::NET, "resume getheaders (%d) to peer=%d\n", pindexStart->nHeight, pto->GetId());
+            connman->PushMessage(pto, msgMaker.Make(NetMsgType::GETHEADERS, chainActive.GetLocator(pindexStart), UINT256_ZERO));
+        }
+
         // Resend wallet transactions that haven't gotten in a block yet
         // Except during reindex, importing and IBD, when old wallet
         // transactions become unconfirmed and spams other nodes.
@@ -2645,6 +3370,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         // Message: getdata (non-blocks)
         //
+        LOCK(g_cs_askfor);
         while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow) {
             const CInv& inv = (*pto->mapAskFor.begin()).second;
             if (!AlreadyHave(inv)) {
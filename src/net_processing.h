@@ -25,6 +25,27 @@ static const unsigned int DEFAULT_BLOCK_SPAM_FILTER_MAX_SIZE = 100;
 /** Default for -blockspamfiltermaxavg, maximum average size of an index occurrence in the block spam filter */
 static const unsigned int DEFAULT_BLOCK_SPAM_FILTER_MAX_AVG = 10;
 
+/** Number of serialized blocks kept in memory to serve the peers requesting them */
+static const unsigned int RAW_BLOCKS_CACHE_SIZE = 16;
+/** Maximum depth of the blocks whose txes are served in "blocktxn" messages (deeper blocks are sent in full) */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Maximum number of headers accepted ahead of the active chain, during headers-first sync.
+ *  The headers of PoS blocks don't carry any work, so this bounds what a peer can make us store. */
+static const int MAX_HEADERS_AHEAD_OF_TIP = 8000;
+/** Maximum number of index entries without block data that each peer can make us create (on any branch) */
+static const unsigned int MAX_HEADERS_ONLY_PER_PEER = MAX_HEADERS_AHEAD_OF_TIP + MAX_HEADERS_RESULTS;
+/** Number of headers (or blocks) in a row not connecting to our tree a peer can send before it gets a DoS penalty */
+static const int MAX_UNCONNECTING_HEADERS = 10;
+/** Maximum total size of the blocks downloaded ahead of their parent, waiting to be accepted.
+ *  Past half of it, the download window shrinks to the next block needed. */
+static const size_t MAX_BLOCKS_PENDING_CONNECT_SIZE = 64 * 1000 * 1000;
+/** Expiration time for the blocks waiting for their parent, in seconds */
+static const int64_t BLOCK_PENDING_CONNECT_EXPIRE_TIME = 10 * 60;
+/** Maximum number of peers asked to announce new blocks with a "cmpctblock" (high bandwidth mode) */
+static const unsigned int MAX_CMPCTBLOCK_HB_PEERS = 3;
+/** Minimum time (in seconds) between two queries of a download peer about our best header */
+static const int64_t BEST_HEADER_CHECK_INTERVAL = 10;
+
 /** Average delay between trickled inventory transmissions in seconds.
  *  Blocks and whitelisted receivers bypass this, outbound peers get half this delay. */
 static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
@@ -57,6 +78,8 @@ public:
     * @return                      True if there is more work to be done
     */
     bool SendMessages(CNode* pto, std::atomic<bool>& interrupt) override EXCLUSIVE_LOCKS_REQUIRED(pto->cs_sendProcessing);
+    /** Process the tier two messages handed to the message worker pool, in order */
+    void ProcessWorkerMessages(CNode* pfrom, std::atomic<bool>& interrupt) override;
 };
 
 struct CNodeStateStats {
@@ -68,8 +91,21 @@ struct CNodeStateStats {
     uint64_t m_addr_rate_limited = 0;
 };
 
+/** Processing latency of a message type, in microseconds */
+struct CMessageLatencyStats {
+    uint64_t nCount{0};
+    // From the receipt of the message to the start of its processing
+    int64_t nWaitTime{0};
+    int64_t nProcessTime{0};
+    int64_t nMaxProcessTime{0};
+    // Processed on the message worker pool
+    bool fWorker{false};
+};
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats& stats);
+/** Get the processing latency of the messages received, per message type */
+std::map<std::string, CMessageLatencyStats> GetMessageLatencyStats();
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch, const std::string& message="") EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 bool IsBanned(NodeId nodeid);
@@ -5,6 +5,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php.
 
+#include "blockstatsindex.h"
 #include "budget/budgetmanager.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -22,6 +23,7 @@
 #include "script/descriptor.h"
 #include "sync.h"
 #include "txdb.h"
+#include "undo.h"
 #include "util/system.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
@@ -700,18 +702,21 @@ UniValue getblockheader(const JSONRPCRequest& request)
 
 UniValue getsupplyinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() > 1)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "getsupplyinfo ( force_update )\n"
+            "getsupplyinfo ( force_update full_scan )\n"
             "\nIf force_update=false (default if no argument is given): return the last cached money supply"
             "\n(sum of spendable transaction outputs) and the height of the chain when it was last updated"
             "\n(it is updated periodically, whenever the chainstate is flushed)."
             "\n"
             "\nIf force_update=true: Flush the chainstate to disk and return the money supply updated to"
             "\nthe current chain height.\n"
+            "\nIf full_scan=true: Flush the chainstate to disk and verify the running money supply with a"
+            "\n(slow) scan of the whole UTXO set.\n"
 
             "\nArguments:\n"
             "1. force_update       (boolean, optional, default=false) flush chainstate to disk and update cache\n"
+            "2. full_scan          (boolean, optional, default=false) recompute the supply scanning the UTXO set\n"
 
             "\nResult:\n"
             "{\n"
@@ -722,12 +727,18 @@ UniValue getsupplyinfo(const JSONRPCRequest& request)
             "}\n"
 
             "\nExamples:\n" +
-            HelpExampleCli("getsupplyinfo", "") + HelpExampleCli("getsupplyinfo", "true") +
+            HelpExampleCli("getsupplyinfo", "") + HelpExampleCli("getsupplyinfo", "true") + HelpExampleCli("getsupplyinfo", "true true") +
             HelpExampleRpc("getsupplyinfo", ""));
 
     const bool fForceUpdate = request.params.size() > 0 ? request.params[0].get_bool() : false;
+    const bool fFullScan = request.params.size() > 1 ? request.params[1].get_bool() : false;
 
-    if (fForceUpdate) {
+    if (fFullScan) {
+        // Flush state to disk, then scan the UTXO set and update the cached supply
+        LOCK(cs_main);
+        FlushStateToDisk();
+        UpdateMoneySupply(true);
+    } else if (fForceUpdate) {
         // Flush state to disk (which updates the cached supply)
         FlushStateToDisk();
     }
@@ -1379,6 +1390,13 @@ UniValue getblockindexstats(const JSONRPCRequest& request) {
                 "  \"txbytes\": xxxxx                (numeric) Sum of the size of all txes over block range\n"
                 "  \"ttlfee\": xxxxx                 (numeric) Sum of the fee amount of all txes over block range\n"
                 "  \"feeperkb\": xxxxx               (numeric) Average fee per kb (excluding zc txes)\n"
+                "  \"feerate_percentiles\": [       (array) Median over the range of the per-block fee rates (per kb) at the\n"
+                "                                      10th, 25th, 50th, 75th and 90th percentile of the block's tx bytes\n"
+                "    xxxxx, ...\n"
+                "  ]\n"
+                "  \"shielded_txcount\": xxxxx       (numeric) Number of shielded txes\n"
+                "  \"shielded_spends\": xxxxx        (numeric) Number of shielded spends\n"
+                "  \"shielded_outputs\": xxxxx       (numeric) Number of shielded outputs\n"
                 "}\n"
 
                 "\nExamples:\n" +
@@ -1392,69 +1410,81 @@ UniValue getblockindexstats(const JSONRPCRequest& request) {
     ret.pushKV("Starting block", heightStart);
     ret.pushKV("Ending block", heightEnd);
 
+    // Use the block stats index when it's available and up to date with
+    // the requested range, otherwise compute the stats from disk.
+    std::vector<CBlockStats> vStats;
+    if (!g_blockstatsindex || !g_blockstatsindex->LookupRange(heightStart, heightEnd, vStats)) {
+        vStats.clear();
+        const CBlockIndex* pindex = WITH_LOCK(cs_main, return chainActive[heightEnd]);
+        if (!pindex)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "invalid block height");
+
+        while (pindex && pindex->nHeight >= heightStart) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex)) {
+                throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block from disk");
+            }
+            CBlockUndo blockundo;
+            if (block.vtx.size() > 1 && !UndoReadFromDisk(blockundo, pindex)) {
+                throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block undo data from disk");
+            }
+            vStats.emplace_back();
+            if (!ComputeBlockStats(block, blockundo, vStats.back())) {
+                throw JSONRPCError(RPC_DATABASE_ERROR, "block undo data mismatch");
+            }
+            pindex = pindex->pprev;
+        }
+    }
+
     CAmount nFees = 0;
     int64_t nBytes = 0;
     int64_t nTxCount = 0;
     int64_t nTxCount_all = 0;
-
-    const CBlockIndex* pindex = WITH_LOCK(cs_main, return chainActive[heightEnd]);
-    if (!pindex)
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "invalid block height");
-
-    while (pindex && pindex->nHeight >= heightStart) {
-        CBlock block;
-        if (!ReadBlockFromDisk(block, pindex)) {
-            throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read block from disk");
-        }
-
-        CAmount nValueIn = 0;
-        CAmount nValueOut = 0;
-        const int ntx = block.vtx.size();
-        const int firstTxIndex = block.IsProofOfStake() ? 2 : 1;
-        nTxCount_all += ntx;
-        nTxCount = nTxCount + ntx - firstTxIndex;
-
-        // loop through each tx in block and save size and fee (except for coinbase/coinstake)
-        for (int idx = firstTxIndex; idx < ntx; idx++) {
-            const CTransaction& tx = *(block.vtx[idx]);
-
-            // zerocoin txes have fixed fee, don't count them here.
-            if (tx.ContainsZerocoins())
-                continue;
-
-            // Transaction size
-            nBytes += GetSerializeSize(tx, CLIENT_VERSION);
-
-            // Transparent inputs
-            for (unsigned int j = 0; j < tx.vin.size(); j++) {
-                COutPoint prevout = tx.vin[j].prevout;
-                CTransactionRef txPrev;
-                uint256 hashBlock;
-                if(!GetTransaction(prevout.hash, txPrev, hashBlock, true))
-                    throw JSONRPCError(RPC_DATABASE_ERROR, "failed to read tx from disk");
-                nValueIn += txPrev->vout[prevout.n].nValue;
+    int64_t nShieldedTxCount = 0;
+    int64_t nShieldedSpends = 0;
+    int64_t nShieldedOutputs = 0;
+    std::vector<CAmount> vPercentiles[NUM_FEERATE_PERCENTILES];
+    for (const CBlockStats& stats : vStats) {
+        nTxCount += stats.nTxCount;
+        nTxCount_all += stats.nTxCountAll;
+        nBytes += stats.nTxBytes;
+        nFees += stats.nFees;
+        nShieldedTxCount += stats.nShieldedTxCount;
+        nShieldedSpends += stats.nShieldedSpends;
+        nShieldedOutputs += stats.nShieldedOutputs;
+        // blocks without (non-zerocoin) txes don't have a fee rate
+        if (stats.nTxBytes > 0) {
+            for (int i = 0; i < NUM_FEERATE_PERCENTILES; i++) {
+                vPercentiles[i].push_back(stats.feeratePercentiles[i]);
             }
-            // Shield inputs
-            nValueIn += tx.GetShieldedValueIn();
-
-            // Transparent/Shield outputs
-            nValueOut += tx.GetValueOut();
-
-            // update fee
-            nFees += nValueIn - nValueOut;
         }
-        pindex = pindex->pprev;
     }
 
     // get fee rate
     CFeeRate nFeeRate = CFeeRate(nFees, nBytes);
 
+    // median, over the block range, of each per-block fee rate percentile
+    UniValue feeratePercentiles(UniValue::VARR);
+    for (int i = 0; i < NUM_FEERATE_PERCENTILES; i++) {
+        std::vector<CAmount>& v = vPercentiles[i];
+        CAmount nMedian = 0;
+        if (!v.empty()) {
+            std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+            nMedian = v[v.size() / 2];
+        }
+        feeratePercentiles.push_back(FormatMoney(nMedian));
+    }
+
     // return UniValue object
     ret.pushKV("txcount", (int64_t)nTxCount);
     ret.pushKV("txcount_all", (int64_t)nTxCount_all);
     ret.pushKV("txbytes", (int64_t)nBytes);
     ret.pushKV("ttlfee", FormatMoney(nFees));
     ret.pushKV("feeperkb", FormatMoney(nFeeRate.GetFeePerK()));
+    ret.pushKV("feerate_percentiles", feeratePercentiles);
+    ret.pushKV("shielded_txcount", nShieldedTxCount);
+    ret.pushKV("shielded_spends", nShieldedSpends);
+    ret.pushKV("shielded_outputs", nShieldedOutputs);
 
     return ret;
 }
@@ -1729,7 +1759,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getfeeinfo",             &getfeeinfo,             true,  {"blocks"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
-    { "blockchain",         "getsupplyinfo",          &getsupplyinfo,          true,  {"force_update"} },
+    { "blockchain",         "getsupplyinfo",          &getsupplyinfo,          true,  {"force_update", "full_scan"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
     { "blockchain",         "scantxoutset",           &scantxoutset,           true,  {"action", "scanobjects"} },
@@ -62,6 +62,8 @@ static const CRPCConvertParam vRPCConvertParams[] = {
     { "getfeeinfo", 0, "blocks" },
     { "getshieldbalance", 1, "minconf" },
     { "getshieldbalance", 2, "include_watchonly" },
+    { "getlockprofile", 0, "count" },
+    { "getlockprofile", 1, "reset" },
     { "getminedcommitment", 0, "llmq_type" },
     { "getnetworkhashps", 0, "nblocks" },
     { "getnetworkhashps", 1, "height" },
@@ -73,6 +75,7 @@ static const CRPCConvertParam vRPCConvertParams[] = {
     { "getreceivedbylabel", 1, "minconf" },
     { "getsaplingnotescount", 0, "minconf" },
     { "getsupplyinfo", 0, "force_update" },
+    { "getsupplyinfo", 1, "full_scan" },
     { "gettransaction", 1, "include_watchonly" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
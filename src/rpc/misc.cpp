@@ -754,6 +754,74 @@ UniValue getmemoryinfo(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue getlockprofile(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 2)
+        throw std::runtime_error(
+            "getlockprofile ( count reset )\n"
+            "\nReturns the lock contention profile (enabled with -lockprofile), for the lock sites\n"
+            "with the highest total wait time.\n"
+
+            "\nArguments:\n"
+            "1. count      (numeric, optional, default=20) Maximum number of lock sites to return\n"
+            "2. reset      (boolean, optional, default=false) Reset the counters after returning them\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,      (boolean) whether the lock profiler is enabled\n"
+            "  \"sites\": [\n"
+            "    {\n"
+            "      \"name\": \"xxx\",          (string) the locked mutex\n"
+            "      \"site\": \"file:line\",    (string) the location of the lock\n"
+            "      \"acquired\": n,          (numeric) number of acquisitions\n"
+            "      \"contended\": n,         (numeric) number of acquisitions which had to wait for another thread\n"
+            "      \"wait_us\": n,           (numeric) total time spent waiting for the lock, in microseconds\n"
+            "      \"hold_us\": n,           (numeric) total time the lock was held, in microseconds\n"
+            "      \"hold_histogram\": {     (json object) number of acquisitions by hold time\n"
+            "        \"<10us\": n, \"<100us\": n, \"<1ms\": n, \"<10ms\": n, \"<100ms\": n, \"<1s\": n, \">=1s\": n\n"
+            "      }\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+
+            "\nExamples:\n"
+            + HelpExampleCli("getlockprofile", "")
+            + HelpExampleCli("getlockprofile", "10 true")
+            + HelpExampleRpc("getlockprofile", "10, true")
+        );
+
+    const int nCount = request.params.size() > 0 ? request.params[0].get_int() : 20;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid count, must be non-negative");
+    const bool fReset = request.params.size() > 1 && request.params[1].get_bool();
+
+    static const char* const histogramLabels[LockSite::HOLD_BUCKETS] = {"<10us", "<100us", "<1ms", "<10ms", "<100ms", "<1s", ">=1s"};
+    const std::vector<LockSiteStats>& vStats = GetLockProfile();
+    if (fReset) ResetLockProfile();
+
+    UniValue sites(UniValue::VARR);
+    for (size_t i = 0; i < vStats.size() && i < (size_t)nCount; i++) {
+        const LockSiteStats& stats = vStats[i];
+        UniValue site(UniValue::VOBJ);
+        site.pushKV("name", stats.name);
+        site.pushKV("site", strprintf("%s:%d", stats.file, stats.line));
+        site.pushKV("acquired", stats.nAcquired);
+        site.pushKV("contended", stats.nContended);
+        site.pushKV("wait_us", stats.nWaitMicros);
+        site.pushKV("hold_us", stats.nHoldMicros);
+        UniValue histogram(UniValue::VOBJ);
+        for (int j = 0; j < LockSite::HOLD_BUCKETS; j++) {
+            histogram.pushKV(histogramLabels[j], stats.vHoldHistogram[j]);
+        }
+        site.pushKV("hold_histogram", histogram);
+        sites.push_back(site);
+    }
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("enabled", g_lock_profiling.load());
+    obj.pushKV("sites", sites);
+    return obj;
+}
+
 UniValue echo(const JSONRPCRequest& request)
 {
     if (request.fHelp)
@@ -849,6 +917,7 @@ static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafe argNames
   //  --------------------- ------------------------  -----------------------  ------ --------
     { "control",            "getinfo",                &getinfo,                true,  {} }, /* uses wallet if enabled */
+    { "control",            "getlockprofile",         &getlockprofile,         true,  {"count","reset"} },
     { "control",            "getmemoryinfo",          &getmemoryinfo,          true,  {} },
     { "control",            "mnsync",                 &mnsync,                 true,  {"mode"} },
     { "control",            "spork",                  &spork,                  true,  {"name","value"} },
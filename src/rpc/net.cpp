@@ -363,6 +363,45 @@ UniValue getnettotals(const JSONRPCRequest& request)
     return obj;
 }
 
+UniValue getmessagelatency(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 0)
+        throw std::runtime_error(
+            "getmessagelatency\n"
+            "\nReturns the processing latency of the p2p messages received, per message type.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"msg\": {                  (json object) The message type\n"
+            "    \"count\": n,             (numeric) Number of messages processed\n"
+            "    \"avgwait\": n,           (numeric) Average time (in microseconds) from the receipt of a message to the start of its processing\n"
+            "    \"avgprocess\": n,        (numeric) Average processing time (in microseconds)\n"
+            "    \"maxprocess\": n,        (numeric) Maximum processing time (in microseconds)\n"
+            "    \"worker\": true|false    (boolean) Whether the messages are processed by the message worker threads\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmessagelatency", "") + HelpExampleRpc("getmessagelatency", ""));
+
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    UniValue ret(UniValue::VOBJ);
+    for (const auto& it : GetMessageLatencyStats()) {
+        const CMessageLatencyStats& stats = it.second;
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("count", stats.nCount);
+        obj.pushKV("avgwait", stats.nCount ? stats.nWaitTime / (int64_t) stats.nCount : 0);
+        obj.pushKV("avgprocess", stats.nCount ? stats.nProcessTime / (int64_t) stats.nCount : 0);
+        obj.pushKV("maxprocess", stats.nMaxProcessTime);
+        obj.pushKV("worker", stats.fWorker);
+        ret.pushKV(it.first, obj);
+    }
+    return ret;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -714,6 +753,7 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         true,  {"node"} },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,  {"dummy","node"} },
     { "network",            "getconnectioncount",     &getconnectioncount,     true,  {} },
+    { "network",            "getmessagelatency",      &getmessagelatency,      true,  {} },
     { "network",            "getnettotals",           &getnettotals,           true,  {} },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true,  {} },
     { "network",            "getnodeaddresses",       &getnodeaddresses,       true,  {"count"} },
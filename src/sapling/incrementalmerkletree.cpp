@@ -7,6 +7,7 @@
 
 #include "crypto/sha256.h"
 #include "sapling/incrementalmerkletree.h"
+#include "util/workerpool.h"
 
 #include <librustzcash.h>
 
@@ -867,6 +868,30 @@ public:
 template<size_t Depth, typename Hash>
 EmptyMerkleRoots<Depth, Hash> PathFiller<Depth, Hash>::emptyroots;
 
+// Minimum number of hashes of a tree level to dispatch them to the worker pool
+static const size_t MIN_PARALLEL_COMBINES = 64;
+
+// Combine the consecutive pairs of nodes at the given depth. The hashes are
+// independent, so the big levels are split among the shared worker pool.
+template<typename Hash>
+static std::vector<Hash> CombinePairs(const std::vector<Hash>& nodes, size_t depth)
+{
+    assert(nodes.size() % 2 == 0);
+    std::vector<Hash> res(nodes.size() / 2);
+    auto combineRange = [&nodes, &res, depth](size_t start, size_t end) {
+        for (size_t j = start; j < end; j++) {
+            res[j] = Hash::combine(nodes[2 * j], nodes[2 * j + 1], depth);
+        }
+    };
+
+    if (res.size() < MIN_PARALLEL_COMBINES) {
+        combineRange(0, res.size());
+        return res;
+    }
+    ParallelForRanges(res.size(), combineRange);
+    return res;
+}
+
 template<size_t Depth, typename Hash>
 void IncrementalMerkleTree<Depth, Hash>::wfcheck() const {
     if (parents.size() >= Depth) {
@@ -956,6 +981,53 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append(Span<const uint256> objs) {
+    if (objs.size() == 0) {
+        return;
+    }
+    if (objs.size() > ((uint64_t)1 << Depth) - size()) {
+        throw std::runtime_error("tree is full");
+    }
+
+    // The leaves not combined yet, followed by the new ones
+    std::vector<Hash> nodes;
+    nodes.reserve(objs.size() + 2);
+    if (left) {
+        nodes.emplace_back(*left);
+    }
+    if (right) {
+        nodes.emplace_back(*right);
+    }
+    nodes.insert(nodes.end(), objs.begin(), objs.end());
+
+    // As in append(Hash), the last leaf (or the last pair of leaves) is not combined
+    const size_t nKept = nodes.size() % 2 == 0 ? 2 : 1;
+    left = nodes[nodes.size() - nKept];
+    right = nKept == 2 ? Optional<Hash>(nodes.back()) : nullopt;
+    nodes.resize(nodes.size() - nKept);
+
+    // Build the complete subtrees bottom-up. At each level, the "left" subtree
+    // of the frontier is followed by the new ones, and the odd one out becomes
+    // the new "left" subtree of that level.
+    for (size_t i = 0; !nodes.empty(); i++) {
+        nodes = CombinePairs(nodes, i);
+        if (i < parents.size() && parents[i]) {
+            nodes.insert(nodes.begin(), *parents[i]);
+        }
+        Optional<Hash> parent;
+        if (nodes.size() % 2 == 1) {
+            parent = nodes.back();
+            nodes.pop_back();
+        }
+        if (i < parents.size()) {
+            parents[i] = parent;
+        } else {
+            parents.push_back(parent);
+        }
+    }
+}
+
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
@@ -1138,6 +1210,36 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::append(Span<const uint256> objs) {
+    size_t pos = 0;
+    while (pos < objs.size()) {
+        if (!cursor) {
+            cursor_depth = tree.next_depth(filled.size());
+
+            if (cursor_depth >= Depth) {
+                throw std::runtime_error("tree is full");
+            }
+
+            if (cursor_depth == 0) {
+                filled.emplace_back(objs[pos++]);
+                continue;
+            }
+            cursor = IncrementalMerkleTree<Depth, Hash>();
+        }
+
+        // Fill the cursor subtree as far as possible
+        const size_t nCount = std::min(((size_t)1 << cursor_depth) - cursor->size(), objs.size() - pos);
+        cursor->append(objs.subspan(pos, nCount));
+        pos += nCount;
+
+        if (cursor->is_complete(cursor_depth)) {
+            filled.push_back(cursor->root(cursor_depth));
+            cursor = nullopt;
+        }
+    }
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
@@ -9,6 +9,7 @@
 #include "uint256.h"
 #include "optional.h"
 #include "serialize.h"
+#include "span.h"
 
 #include "sapling/sapling.h"
 #include "sapling/sapling_util.h"
@@ -103,6 +104,10 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+    // Append the objects in order. Same result as appending them one at a time, but the
+    // complete subtrees are built bottom-up, each level hashed at once, and the frontier
+    // is updated a single time.
+    void append(Span<const uint256> objs);
     Hash root() const {
         return root(Depth, std::deque<Hash>());
     }
@@ -176,6 +181,8 @@ public:
     }
 
     void append(Hash obj);
+    // Append the objects in order, filling each uncle subtree with a single batch append
+    void append(Span<const uint256> objs);
 
     SERIALIZE_METHODS(IncrementalWitness, obj)
     {
@@ -8,6 +8,25 @@
 static const char DB_SAPLING_ANCHOR = 'Z';
 static const char DB_SAPLING_NULLIFIER = 'S';
 static const char DB_BEST_SAPLING_ANCHOR = 'z';
+static const char DB_SAPLING_ANCHOR_DELTA = 'y';
+
+/**
+ * A Sapling anchor stored as the note commitments appended to the tree of a
+ * previous anchor. Full trees (checkpoints) are stored under DB_SAPLING_ANCHOR,
+ * and nDepth is the number of deltas to walk back to reach one.
+ */
+struct SaplingAnchorDelta
+{
+    uint256 prevRoot;
+    uint32_t nDepth{0};
+    std::vector<uint256> vCommitments;
+
+    SaplingAnchorDelta() = default;
+    SaplingAnchorDelta(const uint256& _prevRoot, uint32_t _nDepth, const std::vector<uint256>& _vCommitments) :
+        prevRoot(_prevRoot), nDepth(_nDepth), vCommitments(_vCommitments) {}
+
+    SERIALIZE_METHODS(SaplingAnchorDelta, obj) { READWRITE(obj.prevRoot, VARINT(obj.nDepth), obj.vCommitments); }
+};
 
 // Sapling
 bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
@@ -17,9 +36,59 @@ bool CCoinsViewDB::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree
         return true;
     }
 
-    bool read = db.Read(std::make_pair(DB_SAPLING_ANCHOR, rt), tree);
+    {
+        LOCK(cs_saplingAnchors);
+        if (saplingAnchorsLRUCache.get(rt, tree)) {
+            return true;
+        }
+    }
+
+    if (!ReadSaplingAnchor(rt, tree)) {
+        return false;
+    }
+
+    LOCK(cs_saplingAnchors);
+    saplingAnchorsLRUCache.insert(rt, tree);
+    return true;
+}
+
+bool CCoinsViewDB::ReadSaplingAnchor(const uint256& rt, SaplingMerkleTree& tree) const
+{
+    // Walk back the deltas up to a full tree: a checkpoint, or one already in memory
+    std::vector<SaplingAnchorDelta> vDeltas;
+    uint256 root = rt;
+    while (true) {
+        if (root == SaplingMerkleTree::empty_root()) {
+            tree = SaplingMerkleTree();
+            break;
+        }
+        if (root != rt) {
+            LOCK(cs_saplingAnchors);
+            if (saplingAnchorsLRUCache.get(root, tree)) break;
+        }
+        if (db.Read(std::make_pair(DB_SAPLING_ANCHOR, root), tree)) {
+            break;
+        }
+        SaplingAnchorDelta delta;
+        if (!db.Read(std::make_pair(DB_SAPLING_ANCHOR_DELTA, root), delta)) {
+            if (root == rt) return false;
+            return error("%s: missing sapling anchor %s, needed by %s", __func__, root.ToString(), rt.ToString());
+        }
+        if (vDeltas.size() >= SAPLING_ANCHOR_CHECKPOINT_INTERVAL) {
+            return error("%s: no sapling checkpoint found for %s", __func__, rt.ToString());
+        }
+        root = delta.prevRoot;
+        vDeltas.emplace_back(std::move(delta));
+    }
 
-    return read;
+    // Replay the deltas, oldest first
+    for (auto it = vDeltas.rbegin(); it != vDeltas.rend(); ++it) {
+        tree.append(it->vCommitments);
+    }
+    if (tree.root() != rt) {
+        return error("%s: corrupt sapling anchor %s", __func__, rt.ToString());
+    }
+    return true;
 }
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf) const {
@@ -53,27 +122,90 @@ void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char&
     LogPrint(BCLog::COINDB, "Committed %u changed nullifiers (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
 }
 
-template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+uint32_t CCoinsViewDB::GetSaplingAnchorDepth(const uint256& rt,
+                                             const CAnchorsSaplingMap& mapSaplingAnchors,
+                                             std::unordered_map<uint256, uint32_t, SaltedIdHasher>& mapDepths) const
 {
-    size_t count = 0;
-    size_t changed = 0;
-    for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
-        if (it->second.flags & MapEntry::DIRTY) {
-            if (!it->second.entered)
-                batch.Erase(std::make_pair(dbChar, it->first));
-            else {
-                if (it->first != Tree::empty_root()) {
-                    batch.Write(std::make_pair(dbChar, it->first), it->second.tree);
-                }
+    // Walk back the anchors written by this batch as deltas, up to one whose depth is known
+    std::vector<uint256> vChain;
+    uint256 root = rt;
+    uint32_t nDepth;
+    while (true) {
+        auto itDepth = mapDepths.find(root);
+        if (itDepth != mapDepths.end()) {
+            nDepth = itDepth->second;
+            break;
+        }
+        auto it = mapSaplingAnchors.find(root);
+        if (it != mapSaplingAnchors.end() && (it->second.flags & CAnchorsSaplingCacheEntry::DIRTY)) {
+            if (!it->second.entered) {
+                // Removed by this batch: the children must be checkpoints
+                nDepth = SAPLING_ANCHOR_CHECKPOINT_INTERVAL;
+                break;
             }
-            changed++;
+            if (!it->second.HasDelta() || root == SaplingMerkleTree::empty_root()) {
+                nDepth = 0;
+                mapDepths.emplace(root, nDepth);
+                break;
+            }
+            vChain.emplace_back(root);
+            root = it->second.prevRoot;
+            continue;
+        }
+        // Already in the database
+        SaplingAnchorDelta delta;
+        if (root == SaplingMerkleTree::empty_root() || db.Exists(std::make_pair(DB_SAPLING_ANCHOR, root))) {
+            nDepth = 0;
+        } else if (db.Read(std::make_pair(DB_SAPLING_ANCHOR_DELTA, root), delta)) {
+            nDepth = delta.nDepth;
+        } else {
+            nDepth = SAPLING_ANCHOR_CHECKPOINT_INTERVAL;
         }
+        break;
+    }
+
+    for (auto it = vChain.rbegin(); it != vChain.rend(); ++it) {
+        nDepth = (nDepth + 1 >= SAPLING_ANCHOR_CHECKPOINT_INTERVAL) ? 0 : nDepth + 1;
+        mapDepths.emplace(*it, nDepth);
+    }
+    return nDepth;
+}
+
+void CCoinsViewDB::BatchWriteSaplingAnchors(CDBBatch& batch, CAnchorsSaplingMap& mapSaplingAnchors)
+{
+    size_t count = 0;
+    size_t changed = 0;
+    size_t deltas = 0;
+    std::unordered_map<uint256, uint32_t, SaltedIdHasher> mapDepths;
+    for (const auto& it : mapSaplingAnchors) {
+        const uint256& rt = it.first;
+        const CAnchorsSaplingCacheEntry& entry = it.second;
         count++;
-        MapIterator itOld = it++;
-        mapToUse.erase(itOld);
+        if (!(entry.flags & CAnchorsSaplingCacheEntry::DIRTY)) {
+            continue;
+        }
+        changed++;
+        if (!entry.entered) {
+            batch.Erase(std::make_pair(DB_SAPLING_ANCHOR, rt));
+            batch.Erase(std::make_pair(DB_SAPLING_ANCHOR_DELTA, rt));
+            LOCK(cs_saplingAnchors);
+            saplingAnchorsLRUCache.erase(rt);
+            continue;
+        }
+        if (rt == SaplingMerkleTree::empty_root()) {
+            continue;
+        }
+        const uint32_t nDepth = GetSaplingAnchorDepth(rt, mapSaplingAnchors, mapDepths);
+        if (nDepth == 0) {
+            batch.Write(std::make_pair(DB_SAPLING_ANCHOR, rt), entry.tree);
+        } else {
+            batch.Write(std::make_pair(DB_SAPLING_ANCHOR_DELTA, rt), SaplingAnchorDelta(entry.prevRoot, nDepth, entry.vCommitments));
+            deltas++;
+        }
     }
-    LogPrint(BCLog::COINDB, "Committed %u changed sapling anchors (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    mapSaplingAnchors.clear();
+    LogPrint(BCLog::COINDB, "Committed %u changed sapling anchors (%u as deltas, out of %u) to coin database...\n",
+             (unsigned int)changed, (unsigned int)deltas, (unsigned int)count);
 }
 
 bool CCoinsViewDB::BatchWriteSapling(const uint256& hashSaplingAnchor,
@@ -81,7 +213,7 @@ bool CCoinsViewDB::BatchWriteSapling(const uint256& hashSaplingAnchor,
                               CNullifiersMap& mapSaplingNullifiers,
                               CDBBatch& batch) {
 
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    BatchWriteSaplingAnchors(batch, mapSaplingAnchors);
     ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
@@ -10,9 +10,74 @@
 #include "consensus/validation.h" // for CValidationState
 #include "util/system.h" // for error()
 #include "consensus/upgrades.h" // for CurrentEpochBranchId()
+#include "cuckoocache.h"
+#include "random.h"
+#include "script/sigcache.h" // for SignatureCacheHasher
 
 #include <librustzcash.h>
 
+#include <boost/thread/shared_mutex.hpp>
+
+namespace {
+/**
+ * Valid Sapling proofs cache, to avoid verifying the zk-proofs and the
+ * signatures of a shielded transaction twice (once when accepted into
+ * memory pool, and again when accepted into the block chain)
+ */
+class CSaplingProofsCache
+{
+private:
+    //! Entries are SHA256(nonce || txid || signature hash)
+    uint256 nonce;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_saplingcache;
+
+public:
+    CSaplingProofsCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        // Minimum size, until InitSaplingProofsCache is called
+        setValid.setup_bytes(0);
+    }
+
+    void ComputeEntry(uint256& entry, const uint256& txid, const uint256& sighash)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(txid.begin(), 32).Write(sighash.begin(), 32).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry, const bool erase)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_saplingcache);
+        return setValid.contains(entry, erase);
+    }
+
+    void Set(uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_saplingcache);
+        setValid.insert(entry);
+    }
+
+    uint32_t setup_bytes(size_t n)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_saplingcache);
+        return setValid.setup_bytes(n);
+    }
+};
+
+static CSaplingProofsCache saplingProofsCache;
+}
+
+// To be called once in AppInitMain/BasicTestingSetup to initialize the
+// saplingProofsCache.
+void InitSaplingProofsCache()
+{
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, gArgs.GetArg("-maxsaplingcachesize", DEFAULT_MAX_SAPLING_CACHE_SIZE)), MAX_MAX_SAPLING_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = saplingProofsCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu requested for Sapling proofs cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, nMaxCacheSize>>20, nElems);
+}
+
 namespace SaplingValidation {
 
 // Verifies that Shielded txs are properly formed and performs content-independent checks
@@ -97,6 +162,63 @@ bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidatio
     return true;
 }
 
+bool CheckTransactionProofs(const CTransaction& tx, const uint256& dataToBeSigned, CValidationState& state, int dosLevel)
+{
+    assert(tx.sapData);
+
+    // Sapling verification process
+    auto ctx = librustzcash_sapling_verification_ctx_init();
+
+    for (const SpendDescription &spend : tx.sapData->vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
+                ctx,
+                spend.cv.begin(),
+                spend.anchor.begin(),
+                spend.nullifier.begin(),
+                spend.rk.begin(),
+                spend.zkproof.begin(),
+                spend.spendAuthSig.begin(),
+                dataToBeSigned.begin())) {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            return state.DoS(
+                    dosLevel,
+                    error("%s: Sapling spend description invalid", __func__ ),
+                    REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
+        }
+    }
+
+    for (const OutputDescription &output : tx.sapData->vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+                ctx,
+                output.cv.begin(),
+                output.cmu.begin(),
+                output.ephemeralKey.begin(),
+                output.zkproof.begin())) {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            // This should be a non-contextual check, but we check it here
+            // as we need to pass over the outputs anyway in order to then
+            // call librustzcash_sapling_final_check().
+            return state.DoS(100, error("%s: Sapling output description invalid", __func__ ),
+                             REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
+        }
+    }
+
+    if (!librustzcash_sapling_final_check(
+            ctx,
+            tx.sapData->valueBalance,
+            tx.sapData->bindingSig.begin(),
+            dataToBeSigned.begin())) {
+        librustzcash_sapling_verification_ctx_free(ctx);
+        return state.DoS(
+                dosLevel,
+                error("%s: Sapling binding signature invalid", __func__ ),
+                REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+    }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
+    return true;
+}
+
 /**
 * Check a transaction contextually against a set of consensus rules valid at a given block height.
 *
@@ -116,7 +238,9 @@ bool ContextualCheckTransaction(
         const CChainParams& chainparams,
         const int nHeight,
         const bool isMined,
-        bool isInitBlockDownload)
+        bool isInitBlockDownload,
+        std::vector<CSaplingCheck>* pvChecks,
+        bool eraseCached)
 {
     const int DOS_LEVEL_BLOCK = 100;
     // DoS level set to 10 to be more forgiving.
@@ -177,59 +301,37 @@ bool ContextualCheckTransaction(
                              REJECT_INVALID, "error-computing-signature-hash");
         }
 
-        // Sapling verification process
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.sapData->vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                    ctx,
-                    spend.cv.begin(),
-                    spend.anchor.begin(),
-                    spend.nullifier.begin(),
-                    spend.rk.begin(),
-                    spend.zkproof.begin(),
-                    spend.spendAuthSig.begin(),
-                    dataToBeSigned.begin())) {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(
-                        dosLevelPotentiallyRelaxing,
-                        error("%s: Sapling spend description invalid", __func__ ),
-                        REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
+        // Skip the proofs verification if the tx was already validated (e.g. when accepted to the mempool).
+        // Once the tx is in a connected block its entry is useless: erase it, to make room for the mempool ones.
+        uint256 cacheEntry;
+        saplingProofsCache.ComputeEntry(cacheEntry, tx.GetHash(), dataToBeSigned);
+        if (saplingProofsCache.Get(cacheEntry, eraseCached)) {
+            return true;
         }
 
-        for (const OutputDescription &output : tx.sapData->vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                    ctx,
-                    output.cv.begin(),
-                    output.cmu.begin(),
-                    output.ephemeralKey.begin(),
-                    output.zkproof.begin())) {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                // This should be a non-contextual check, but we check it here
-                // as we need to pass over the outputs anyway in order to then
-                // call librustzcash_sapling_final_check().
-                return state.DoS(100, error("%s: Sapling output description invalid", __func__ ),
-                                 REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
+        // Proofs verification can be deferred to the caller (e.g. to the block check queue)
+        if (pvChecks) {
+            pvChecks->emplace_back(tx, dataToBeSigned);
+            return true;
         }
 
-        if (!librustzcash_sapling_final_check(
-                ctx,
-                tx.sapData->valueBalance,
-                tx.sapData->bindingSig.begin(),
-                dataToBeSigned.begin())) {
-            librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(
-                    dosLevelPotentiallyRelaxing,
-                    error("%s: Sapling binding signature invalid", __func__ ),
-                    REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+        if (!CheckTransactionProofs(tx, dataToBeSigned, state, dosLevelPotentiallyRelaxing)) {
+            return false;
         }
 
-        librustzcash_sapling_verification_ctx_free(ctx);
+        // Cache the result only for mempool txs, which are expected to be checked again once mined.
+        if (!isMined) {
+            saplingProofsCache.Set(cacheEntry);
+        }
     }
     return true;
 }
 
 
 } // End SaplingValidation namespace
+
+bool CSaplingCheck::operator()()
+{
+    CValidationState state;
+    return SaplingValidation::CheckTransactionProofs(*ptx, dataToBeSigned, state, 100);
+}
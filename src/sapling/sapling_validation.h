@@ -7,10 +7,21 @@
 #define PIVX_SAPLING_SAPLING_VALIDATION_H
 
 #include "chainparams.h"
+#include "uint256.h"
 
+#include <vector>
+
+class CSaplingCheck;
 class CTransaction;
 class CValidationState;
 
+// Default and maximum size (in MiB) of the cache of verified Sapling proofs
+static const unsigned int DEFAULT_MAX_SAPLING_CACHE_SIZE = 4;
+static const int64_t MAX_MAX_SAPLING_CACHE_SIZE = 1024;
+
+/** Initialize the cache of verified Sapling proofs (shared between mempool and block validation) */
+void InitSaplingProofsCache();
+
 namespace SaplingValidation {
 
 /** Context-independent validity checks */
@@ -19,12 +30,43 @@ namespace SaplingValidation {
 bool CheckTransaction(const CTransaction& tx, CValidationState& state, CAmount& nValueOut);
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state, CAmount& nValueOut);
 
+/** Verify the spend/output proofs and the binding signature of a shielded tx (expensive) */
+bool CheckTransactionProofs(const CTransaction& tx, const uint256& dataToBeSigned, CValidationState& state, int dosLevel);
+
 /** Check a transaction contextually against a set of consensus rules */
 // Note: if v5 upgrade wasn't enforced, this method returns true without performing any check.
+// Note2: if pvChecks is not null, the proofs verification is not performed here, but appended to pvChecks.
+// Note3: eraseCached drops the tx from the proofs cache (a block being connected: it won't be checked again).
 bool ContextualCheckTransaction(const CTransaction &tx, CValidationState &state,
                                 const CChainParams &chainparams, int nHeight, bool isMined,
-                                bool sInitBlockDownload);
+                                bool sInitBlockDownload, std::vector<CSaplingCheck>* pvChecks = nullptr,
+                                bool eraseCached = false);
 
 }; // End SaplingValidation namespace
 
+/**
+ * Closure representing the Sapling proofs verification of one transaction.
+ * Note that this stores a reference to the transaction
+ */
+class CSaplingCheck
+{
+private:
+    const CTransaction* ptx;
+    uint256 dataToBeSigned;
+
+public:
+    CSaplingCheck() : ptx(nullptr) {}
+    CSaplingCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn),
+        dataToBeSigned(dataToBeSignedIn) {}
+
+    bool operator()();
+
+    void swap(CSaplingCheck& check)
+    {
+        std::swap(ptx, check.ptx);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+    }
+};
+
 #endif // PIVX_SAPLING_SAPLING_VALIDATION_H
@@ -3,6 +3,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php.
 
+// wallet.h first: it uses mapSaplingTxNotes_t, from the header it includes here
+#include "wallet/wallet.h"
 #include "sapling/saplingscriptpubkeyman.h"
 
 #include "chain.h" // for CBlockIndex
@@ -11,8 +13,8 @@
 #include "primitives/block.h"
 #include "sapling/incrementalmerkletree.h"
 #include "uint256.h"
+#include "util/workerpool.h"
 #include "validation.h" // for ReadBlockFromDisk()
-#include "wallet/wallet.h"
 #include <algorithm>
 #include <map>
 #include <string>
@@ -158,7 +160,7 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-void AppendNoteCommitment(SaplingNoteData* nd, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+void AppendNoteCommitments(SaplingNoteData* nd, int indexHeight, int64_t nWitnessCacheSize, Span<const uint256> noteCommitments)
 {
     // skip externally sent notes
     if (!nd->IsMyNote()) return;
@@ -167,7 +169,7 @@ void AppendNoteCommitment(SaplingNoteData* nd, int indexHeight, int64_t nWitness
         // Check the validity of the cache
         // See comment in CopyPreviousWitnesses about validity.
         assert(nWitnessCacheSize >= (int64_t) nd->witnesses.size());
-        nd->witnesses.front().append(note_commitment);
+        nd->witnesses.front().append(noteCommitments);
     }
 }
 
@@ -264,7 +266,8 @@ bool SaplingScriptPubKeyMan::BuildWitnessChain(const CBlockIndex* pTargetBlock,
     for (CBlock& block : cblocks) {
         // Finally build the witness cache for each sapling note
         std::vector<uint256> noteCommitments;
-        std::vector<SaplingNoteData*> inBlockArrivingNotes;
+        // Notes of the wallet arriving in this block, with the number of block commitments up to them
+        std::vector<std::pair<SaplingNoteData*, size_t>> inBlockArrivingNotes;
         for (const auto& tx : block.vtx) {
             const auto& hash = tx->GetHash();
             auto it = wallet->mapWallet.find(hash);
@@ -272,33 +275,38 @@ bool SaplingScriptPubKeyMan::BuildWitnessChain(const CBlockIndex* pTargetBlock,
 
             if (!tx->IsShieldedTx()) continue;
             for (uint32_t i = 0; i < tx->sapData->vShieldedOutput.size(); i++) {
-                const auto& cmu = tx->sapData->vShieldedOutput[i].cmu;
-                noteCommitments.emplace_back(cmu);
-                for (auto& item : inBlockArrivingNotes) {
-                    item->witnesses.front().append(cmu);
-                }
-                initialSaplingTree.append(cmu);
+                noteCommitments.emplace_back(tx->sapData->vShieldedOutput[i].cmu);
                 if (txIsOurs) {
                     CWalletTx* wtx = &it->second;
                     auto ndIt = wtx->mapSaplingNoteData.find({hash, i});
                     if (ndIt != wtx->mapSaplingNoteData.end()) {
-                        SaplingNoteData* nd = &ndIt->second;
-                        nd->witnesses.push_front(initialSaplingTree.witness());
-                        inBlockArrivingNotes.emplace_back(nd);
+                        inBlockArrivingNotes.emplace_back(&ndIt->second, noteCommitments.size());
                     }
                 }
             }
         }
+        // Append the commitments to the tree in batches, witnessing the notes on the way,
+        // then append the following block commitments to the new witnesses.
+        const Span<const uint256> vCommitments(noteCommitments);
+        size_t nAppended = 0;
+        for (auto& item : inBlockArrivingNotes) {
+            initialSaplingTree.append(vCommitments.subspan(nAppended, item.second - nAppended));
+            nAppended = item.second;
+            item.first->witnesses.push_front(initialSaplingTree.witness());
+        }
+        initialSaplingTree.append(vCommitments.subspan(nAppended));
+        for (auto& item : inBlockArrivingNotes) {
+            item.first->witnesses.front().append(vCommitments.subspan(item.second));
+        }
         for (auto& it2 : cachedWitnessMap) {
             // Don't duplicate if the block is too old
             if (height >= rollbackTargetHeight) {
                 it2.second.emplace_front(it2.second.front());
             }
-            for (auto& noteComm : noteCommitments) {
-                it2.second.front().append(noteComm);
-            }
+            it2.second.front().append(noteCommitments);
         }
-        for (auto nd : inBlockArrivingNotes) {
+        for (auto& item : inBlockArrivingNotes) {
+            SaplingNoteData* nd = item.first;
             if (nd->nullifier) {
                 std::list<SaplingWitness> witnesses;
                 witnesses.push_front(nd->witnesses.front());
@@ -310,6 +318,40 @@ bool SaplingScriptPubKeyMan::BuildWitnessChain(const CBlockIndex* pTargetBlock,
     return true;
 }
 
+// Minimum number of witness updates (wallet txs * block note commitments) to dispatch the work to the worker pool
+static const size_t MIN_PARALLEL_WITNESS_UPDATES = 256;
+
+void SaplingScriptPubKeyMan::AddToWitnessedTxes(const CWalletTx& wtx)
+{
+    AssertLockHeld(wallet->cs_wallet);
+    for (const auto& item : wtx.mapSaplingNoteData) {
+        if (item.second.IsMyNote()) {
+            setWitnessedTxes.emplace(wtx.GetHash());
+            return;
+        }
+    }
+    setWitnessedTxes.erase(wtx.GetHash());
+}
+
+void SaplingScriptPubKeyMan::RemoveFromWitnessedTxes(const uint256& txid)
+{
+    AssertLockHeld(wallet->cs_wallet);
+    setWitnessedTxes.erase(txid);
+}
+
+std::vector<CWalletTx*> SaplingScriptPubKeyMan::GetWitnessedTxes()
+{
+    AssertLockHeld(wallet->cs_wallet);
+    std::vector<CWalletTx*> vWtx;
+    vWtx.reserve(setWitnessedTxes.size());
+    for (const uint256& txid : setWitnessedTxes) {
+        auto it = wallet->mapWallet.find(txid);
+        assert(it != wallet->mapWallet.end());
+        vWtx.emplace_back(&it->second);
+    }
+    return vWtx;
+}
+
 void SaplingScriptPubKeyMan::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                                     const CBlock* pblock,
                                                     SaplingMerkleTree& saplingTreeRes)
@@ -324,10 +366,11 @@ void SaplingScriptPubKeyMan::IncrementNoteWitnesses(const CBlockIndex* pindex,
         nWitnessCacheNeedsUpdate = true;
     }
 
-    // 1) Loop over the block txs and gather the note commitments ordered.
-    // If the wtx is from this wallet, witness it and append the following block note commitments on top.
+    // 1) Loop over the block txs and gather the note commitments ordered, along with the
+    // wallet's notes arriving in this block (and the number of block commitments up to them).
     std::vector<uint256> noteCommitments;
     std::vector<std::pair<CWalletTx*, SaplingNoteData*>> inBlockArrivingNotes;
+    std::vector<size_t> inBlockArrivingPos;
     for (const auto& tx : pblock->vtx) {
         if (!tx->IsShieldedTx()) continue;
 
@@ -336,57 +379,64 @@ void SaplingScriptPubKeyMan::IncrementNoteWitnesses(const CBlockIndex* pindex,
         bool txIsOurs = it != wallet->mapWallet.end();
 
         for (uint32_t i = 0; i < tx->sapData->vShieldedOutput.size(); i++) {
-            const auto& cmu = tx->sapData->vShieldedOutput[i].cmu;
-            noteCommitments.emplace_back(cmu);
-
-            // Append note commitment to the in-block wallet's notes.
-            // This is processed here because we already looked for the wtx on
-            // the WitnessNoteIfMine call and only need to append the follow-up block notes,
-            // not every block note (check below).
-            for (auto& item : inBlockArrivingNotes) {
-                ::AppendNoteCommitment(item.second, chainHeight, nWitnessCacheSize, cmu);
-            }
-
-            // If tx is from this wallet, try to witness the note for the first time (if exists).
-            // And add it to the in-block arriving txs.
-            saplingTreeRes.append(cmu);
+            noteCommitments.emplace_back(tx->sapData->vShieldedOutput[i].cmu);
             if (txIsOurs) {
                 CWalletTx* wtx = &it->second;
                 auto ndIt = wtx->mapSaplingNoteData.find({hash, i});
                 if (ndIt != wtx->mapSaplingNoteData.end()) {
-                    SaplingNoteData* nd = &ndIt->second;
-                    ::WitnessNoteIfMine(nd, chainHeight, nWitnessCacheSize, saplingTreeRes.witness());
-                    inBlockArrivingNotes.emplace_back(std::make_pair(wtx, nd));
+                    inBlockArrivingNotes.emplace_back(std::make_pair(wtx, &ndIt->second));
+                    inBlockArrivingPos.emplace_back(noteCommitments.size());
                 }
             }
         }
     }
 
-    // 2) Mark already sync wtx, so we don't process them again.
+    // 2) Append the note commitments to the tree in batches. If the wtx is from this wallet,
+    // witness the note once the tree reaches it (if not witnessed yet), then append the
+    // following block note commitments on top, and mark the wtx as synced so we don't
+    // process it again.
+    const Span<const uint256> vCommitments(noteCommitments);
+    size_t nAppended = 0;
+    for (size_t j = 0; j < inBlockArrivingNotes.size(); j++) {
+        saplingTreeRes.append(vCommitments.subspan(nAppended, inBlockArrivingPos[j] - nAppended));
+        nAppended = inBlockArrivingPos[j];
+        ::WitnessNoteIfMine(inBlockArrivingNotes[j].second, chainHeight, nWitnessCacheSize, saplingTreeRes.witness());
+    }
+    saplingTreeRes.append(vCommitments.subspan(nAppended));
+    for (size_t j = 0; j < inBlockArrivingNotes.size(); j++) {
+        ::AppendNoteCommitments(inBlockArrivingNotes[j].second, chainHeight, nWitnessCacheSize, vCommitments.subspan(inBlockArrivingPos[j]));
+    }
     for (auto& item : inBlockArrivingNotes) {
         ::UpdateWitnessHeights(item.first->mapSaplingNoteData, chainHeight, nWitnessCacheSize);
     }
 
-    // 3) Loop over the shield txs in the wallet's map (excluding the wtx arriving in this block) and for each tx:
+    // 3) Loop over the wallet txs holding our notes (excluding the wtx arriving in this block) and for each tx:
     //    a) Copy the previous witness.
     //    b) Append all new notes commitments
     //    c) Update witness last processed height
-    for (auto& it : wallet->mapWallet) {
-        CWalletTx& wtx = it.second;
-        if (!wtx.mapSaplingNoteData.empty()) {
+    // Every tx has its own witnesses, so the txs are split among the worker pool.
+    const std::vector<CWalletTx*> vWtx = GetWitnessedTxes();
+    const int64_t witCacheSize = nWitnessCacheSize;
+    auto updateRange = [&vWtx, &vCommitments, chainHeight, prevWitCacheSize, witCacheSize](size_t start, size_t end) {
+        for (size_t j = start; j < end; j++) {
+            mapSaplingNoteData_t& noteData = vWtx[j]->mapSaplingNoteData;
             // Create copy of the previous witness (verifying pre-arriving block witness cache size)
-            ::CopyPreviousWitnesses(wtx.mapSaplingNoteData, chainHeight, prevWitCacheSize);
+            ::CopyPreviousWitnesses(noteData, chainHeight, prevWitCacheSize);
 
             // Append new notes commitments.
-            for (auto& noteComm : noteCommitments) {
-                for (auto& item : wtx.mapSaplingNoteData) {
-                    AppendNoteCommitment(&(item.second), chainHeight, nWitnessCacheSize, noteComm);
-                }
+            for (auto& item : noteData) {
+                ::AppendNoteCommitments(&(item.second), chainHeight, witCacheSize, vCommitments);
             }
 
             // Set last processed height.
-            ::UpdateWitnessHeights(wtx.mapSaplingNoteData, chainHeight, nWitnessCacheSize);
+            ::UpdateWitnessHeights(noteData, chainHeight, witCacheSize);
         }
+    };
+
+    if (vWtx.size() * std::max((size_t)1, noteCommitments.size()) < MIN_PARALLEL_WITNESS_UPDATES) {
+        updateRange(0, vWtx.size());
+    } else {
+        ParallelForRanges(vWtx.size(), updateRange);
     }
 
     // For performance reasons, we write out the witness cache in
@@ -471,11 +521,9 @@ void SaplingScriptPubKeyMan::DecrementNoteWitnesses(const CBlockIndex* pindex)
     int nChainHeight = pindex->nHeight;
     // if the targetHeight is different from -1 we have a cache to use
     if (rollbackTargetHeight != -1) {
-        for (std::pair<const uint256, CWalletTx>& wtxItem : wallet->mapWallet) {
-            if (!wtxItem.second.mapSaplingNoteData.empty()) {
-                // For each sapling note that you own reset the current witness with the cached one
-                ResetNoteWitnesses(wtxItem.second.mapSaplingNoteData, cachedWitnessMap, nChainHeight);
-            }
+        for (CWalletTx* wtx : GetWitnessedTxes()) {
+            // For each sapling note that you own reset the current witness with the cached one
+            ResetNoteWitnesses(wtx->mapSaplingNoteData, cachedWitnessMap, nChainHeight);
         }
         nWitnessCacheSize = 1;
         nWitnessCacheNeedsUpdate = true;
@@ -488,8 +536,8 @@ void SaplingScriptPubKeyMan::DecrementNoteWitnesses(const CBlockIndex* pindex)
         return;
     }
 
-    for (std::pair<const uint256, CWalletTx>& wtxItem : wallet->mapWallet) {
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, nChainHeight, nWitnessCacheSize);
+    for (CWalletTx* wtx : GetWitnessedTxes()) {
+        ::DecrementNoteWitnesses(wtx->mapSaplingNoteData, nChainHeight, nWitnessCacheSize);
     }
     nWitnessCacheSize -= 1;
     nWitnessCacheNeedsUpdate = true;
@@ -518,45 +566,101 @@ std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> SaplingScriptPubKe
         return {};
     }
 
-    LOCK(wallet->cs_KeyStore);
-    const uint256& hash = tx.GetHash();
+    auto notes = TrialDecryptSaplingNotes({&tx});
+    auto it = notes.find(tx.GetHash());
+    return it != notes.end() ? it->second : std::make_pair(mapSaplingNoteData_t(), SaplingIncomingViewingKeyMap());
+}
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+mapSaplingTxNotes_t SaplingScriptPubKeyMan::FindMySaplingNotes(const std::vector<CTransactionRef>& vtx) const
+{
+    std::vector<const CTransaction*> vShieldedTxes;
+    for (const CTransactionRef& tx : vtx) {
+        if (tx->IsShieldedTx()) {
+            vShieldedTxes.emplace_back(tx.get());
+        }
+    }
+    return TrialDecryptSaplingNotes(vShieldedTxes);
+}
+
+// Minimum number of trial decryptions (outputs * keys) to dispatch the work to the worker pool
+static const size_t MIN_PARALLEL_TRIAL_DECRYPTIONS = 64;
+
+mapSaplingTxNotes_t SaplingScriptPubKeyMan::TrialDecryptSaplingNotes(const std::vector<const CTransaction*>& vtx) const
+{
+    mapSaplingTxNotes_t ret;
+
+    // Collect all the shielded outputs
+    std::vector<std::pair<const CTransaction*, uint32_t>> vOutputs;
+    for (const CTransaction* tx : vtx) {
+        for (uint32_t i = 0; i < tx->sapData->vShieldedOutput.size(); ++i) {
+            vOutputs.emplace_back(tx, i);
+        }
+    }
+    if (vOutputs.empty()) {
+        return ret;
+    }
+
+    LOCK(wallet->cs_KeyStore);
+    std::vector<libzcash::SaplingIncomingViewingKey> vIvks;
+    vIvks.reserve(wallet->mapSaplingFullViewingKeys.size());
+    for (const auto& it : wallet->mapSaplingFullViewingKeys) {
+        vIvks.emplace_back(it.first);
+    }
+    if (vIvks.empty()) {
+        return ret;
+    }
 
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.sapData->vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.sapData->vShieldedOutput[i];
-        for (auto it = wallet->mapSaplingFullViewingKeys.begin(); it != wallet->mapSaplingFullViewingKeys.end(); ++it) {
-            libzcash::SaplingIncomingViewingKey ivk = it->first;
-            auto result = libzcash::SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
-            if (!result) {
-                continue;
+    // Trial-decrypt every output with every key. Each output is processed by a single worker.
+    std::vector<Optional<std::pair<libzcash::SaplingNotePlaintext, size_t>>> vResults(vOutputs.size());
+    auto decryptRange = [&vOutputs, &vIvks, &vResults](size_t start, size_t end) {
+        for (size_t j = start; j < end; j++) {
+            const OutputDescription& output = vOutputs[j].first->sapData->vShieldedOutput[vOutputs[j].second];
+            for (size_t k = 0; k < vIvks.size(); k++) {
+                auto result = libzcash::SaplingNotePlaintext::decrypt(output.encCiphertext, vIvks[k], output.ephemeralKey, output.cmu);
+                if (result) {
+                    vResults[j] = std::make_pair(*result, k);
+                    break;
+                }
             }
+        }
+    };
 
-            // Check if we already have it.
-            Optional<libzcash::SaplingPaymentAddress> address = ivk.address(result.get().d);
-            if (address && wallet->mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
-                viewingKeysToAdd[address.get()] = ivk;
-            }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            nd.amount = result->value();
-            nd.address = address;
-            const auto& memo = result->memo();
-            // don't save empty memo (starting with 0xF6)
-            if (memo[0] < 0xF6) {
-                nd.memo = memo;
-            }
-            noteData.insert(std::make_pair(op, nd));
-            break;
+    if (vOutputs.size() * vIvks.size() < MIN_PARALLEL_TRIAL_DECRYPTIONS) {
+        decryptRange(0, vOutputs.size());
+    } else {
+        ParallelForRanges(vOutputs.size(), decryptRange);
+    }
+
+    for (size_t j = 0; j < vOutputs.size(); j++) {
+        if (!vResults[j]) {
+            continue;
+        }
+        const libzcash::SaplingNotePlaintext& result = vResults[j]->first;
+        const libzcash::SaplingIncomingViewingKey& ivk = vIvks[vResults[j]->second];
+        auto& txNotes = ret[vOutputs[j].first->GetHash()];
+
+        // Check if we already have it.
+        Optional<libzcash::SaplingPaymentAddress> address = ivk.address(result.d);
+        if (address && wallet->mapSaplingIncomingViewingKeys.count(address.get()) == 0) {
+            txNotes.second[address.get()] = ivk;
         }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {vOutputs[j].first->GetHash(), vOutputs[j].second};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        nd.amount = result.value();
+        nd.address = address;
+        const auto& memo = result.memo();
+        // don't save empty memo (starting with 0xF6)
+        if (memo[0] < 0xF6) {
+            nd.memo = memo;
+        }
+        txNotes.first.insert(std::make_pair(op, nd));
     }
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+    return ret;
 }
 
 std::vector<libzcash::SaplingPaymentAddress> SaplingScriptPubKeyMan::FindMySaplingAddresses(const CTransaction& tx) const
@@ -14,6 +14,7 @@
 #include "wallet/wallet.h"
 #include "wallet/walletdb.h"
 #include <map>
+#include <set>
 
 //! Size of witness cache
 //  Should be large enough that we can expect not to reorg beyond our cache
@@ -134,6 +135,8 @@ enum KeyAddResult {
 };
 
 typedef std::map<SaplingOutPoint, SaplingNoteData> mapSaplingNoteData_t;
+//! Notes found in a batch of transactions (and the addresses -> IVK mappings to add), keyed by txid
+typedef std::map<uint256, std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> mapSaplingTxNotes_t;
 
 /*
  * Sapling keys manager
@@ -280,6 +283,11 @@ public:
     //! SaplingPaymentAddress in this wallet
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
 
+    //! Batch version of FindMySaplingNotes: collects all the shielded outputs of the
+    //! given txs (e.g. a block) and trial-decrypts them in parallel on a worker pool.
+    //! Only the txs with at least one note for this wallet are included in the result.
+    mapSaplingTxNotes_t FindMySaplingNotes(const std::vector<CTransactionRef>& vtx) const;
+
     //! Find all of the addresses in the given tx that have been sent to a SaplingPaymentAddress in this wallet.
     std::vector<libzcash::SaplingPaymentAddress> FindMySaplingAddresses(const CTransaction& tx) const;
 
@@ -353,6 +361,11 @@ public:
     //! Clear every notesData from every wallet tx and reset the witness cache size
     void ClearNoteWitnessCache();
 
+    //! Index the wallet tx if it holds notes of this wallet (drop it otherwise)
+    void AddToWitnessedTxes(const CWalletTx& wtx);
+    //! Remove the wallet tx from the index of the txs holding notes of this wallet
+    void RemoveFromWitnessedTxes(const uint256& txid);
+
     // Sapling metadata
     std::map<libzcash::SaplingIncomingViewingKey, CKeyMetadata> mapSaplingZKeyMetadata;
 
@@ -427,6 +440,18 @@ private:
     Optional<uint256> commonOVK;
     uint256 getCommonOVKFromSeed() const;
 
+    /**
+     * Hashes of the wallet txs holding at least one note of this wallet (guarded by cs_wallet).
+     * Only their witnesses are updated when a block is connected or disconnected, so the cost
+     * depends on the number of own notes instead of the size of mapWallet. Spent notes are
+     * kept, as their witnesses are needed again if the spending tx is disconnected.
+     */
+    std::set<uint256> setWitnessedTxes;
+    /* Return the indexed wallet txs */
+    std::vector<CWalletTx*> GetWitnessedTxes();
+
+    /* Trial-decrypt all the shielded outputs of the txs with all the wallet's IVKs */
+    mapSaplingTxNotes_t TrialDecryptSaplingNotes(const std::vector<const CTransaction*>& vtx) const;
 
     /**
      * Used to keep track of spent Notes, and
@@ -6,8 +6,11 @@
 
 #include "chain.h"
 #include "txdb.h"
+#include "undo.h"
 #include "validation.h"
 
+CSpentStakeCache g_spent_stakes;
+
 static bool HasStakeMinAgeOrDepth(int nHeight, uint32_t nTime, const CBlockIndex* pindex)
 {
     const Consensus::Params& consensus = Params().GetConsensus();
@@ -38,6 +41,23 @@ CPivStake* CPivStake::NewPivStake(const CTxIn& txin, int nHeight, uint32_t nTime
         return new CPivStake(coin.out, txin.prevout, pindexFrom);
     }
 
+    // Then in the outputs recently spent on the active chain (stake of a block on a fork)
+    CTxOut outFrom;
+    int nHeightFrom;
+    if (g_spent_stakes.Get(txin.prevout, outFrom, nHeightFrom)) {
+        const CBlockIndex* pindexFrom = chainActive[nHeightFrom];
+        if (!pindexFrom) {
+            error("%s : Failed to find the block index for stake origin", __func__);
+            return nullptr;
+        }
+        // Check that the stake has the required depth/age
+        if (!HasStakeMinAgeOrDepth(nHeight, nTime, pindexFrom)) {
+            return nullptr;
+        }
+        // All good
+        return new CPivStake(outFrom, txin.prevout, pindexFrom);
+    }
+
     // Otherwise find the previous transaction in database
     uint256 hashBlock;
     CTransactionRef txPrev;
@@ -95,3 +115,95 @@ const CBlockIndex* CPivStake::GetIndexFrom() const
     return pindexFrom;
 }
 
+
+void CSpentStakeCache::AddBlockSpends(const CBlock& block, const CBlockUndo& blockundo, int nSpendHeight, int nKeepDepth)
+{
+    if (blockundo.vtxundo.size() + 1 != block.vtx.size()) return;
+
+    LOCK(cs);
+    // A block connected again at the same height (after a reorg) replaces the old one
+    auto itHeight = mapSpendHeights.find(nSpendHeight);
+    if (itHeight != mapSpendHeights.end()) {
+        for (const COutPoint& outpoint : itHeight->second) mapSpent.erase(outpoint);
+        mapSpendHeights.erase(itHeight);
+    }
+
+    std::vector<COutPoint> vSpent;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        const CTransaction& tx = *block.vtx[i];
+        // zerocoin spends have no undo data
+        if (tx.HasZerocoinSpendInputs()) continue;
+        const CTxUndo& txundo = blockundo.vtxundo[i - 1];
+        if (txundo.vprevout.size() != tx.vin.size()) continue;
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const Coin& coin = txundo.vprevout[j];
+            if (coin.out.IsNull()) continue;
+            mapSpent[tx.vin[j].prevout] = {coin.out, (int)coin.nHeight, nSpendHeight};
+            vSpent.emplace_back(tx.vin[j].prevout);
+        }
+    }
+    if (!vSpent.empty()) mapSpendHeights.emplace(nSpendHeight, std::move(vSpent));
+
+    // Outputs spent below the max reorg depth can't be the stake of a valid fork
+    auto itPrune = mapSpendHeights.begin();
+    while (itPrune != mapSpendHeights.end() && itPrune->first <= nSpendHeight - nKeepDepth) {
+        for (const COutPoint& outpoint : itPrune->second) {
+            auto it = mapSpent.find(outpoint);
+            if (it != mapSpent.end() && it->second.nSpendHeight == itPrune->first) mapSpent.erase(it);
+        }
+        itPrune = mapSpendHeights.erase(itPrune);
+    }
+}
+
+void CSpentStakeCache::BlockDisconnected(int nSpendHeight)
+{
+    LOCK(cs);
+    auto itHeight = mapSpendHeights.find(nSpendHeight);
+    if (itHeight == mapSpendHeights.end()) return;
+    for (const COutPoint& outpoint : itHeight->second) {
+        auto it = mapSpent.find(outpoint);
+        if (it != mapSpent.end() && it->second.nSpendHeight == nSpendHeight) mapSpent.erase(it);
+    }
+    mapSpendHeights.erase(itHeight);
+}
+
+bool CSpentStakeCache::LoadFromDisk(int nDepth)
+{
+    AssertLockHeld(cs_main);
+    Clear();
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (!pindexTip) return true;
+    for (int nHeight = std::max(1, pindexTip->nHeight - nDepth + 1); nHeight <= pindexTip->nHeight; nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        CBlock block;
+        CBlockUndo blockundo;
+        if (!ReadBlockFromDisk(block, pindex) || !UndoReadFromDisk(blockundo, pindex)) {
+            return error("%s: unable to read block %d", __func__, nHeight);
+        }
+        AddBlockSpends(block, blockundo, nHeight, nDepth);
+    }
+    return true;
+}
+
+bool CSpentStakeCache::Get(const COutPoint& outpoint, CTxOut& out, int& nHeight) const
+{
+    LOCK(cs);
+    auto it = mapSpent.find(outpoint);
+    if (it == mapSpent.end()) return false;
+    out = it->second.out;
+    nHeight = it->second.nHeight;
+    return true;
+}
+
+size_t CSpentStakeCache::Size() const
+{
+    LOCK(cs);
+    return mapSpent.size();
+}
+
+void CSpentStakeCache::Clear()
+{
+    LOCK(cs);
+    mapSpent.clear();
+    mapSpendHeights.clear();
+}
@@ -6,9 +6,16 @@
 #define PIVX_STAKEINPUT_H
 
 #include "chain.h"
+#include "coins.h"
 #include "streams.h"
+#include "sync.h"
 #include "uint256.h"
 
+#include <map>
+#include <unordered_map>
+
+class CBlock;
+class CBlockUndo;
 class CKeyStore;
 class CWallet;
 class CWalletTx;
@@ -49,5 +56,40 @@ public:
     bool IsZPIV() const override { return false; }
 };
 
+/**
+ * Outputs spent in the last blocks of the active chain (up to the max reorg depth),
+ * with the height of the block that created them.
+ * Filled from the undo data in ConnectBlock, so that the stake inputs of blocks on a
+ * fork, already spent on the active chain, can be checked without reading the
+ * previous transaction from the block files.
+ */
+class CSpentStakeCache
+{
+private:
+    struct Entry {
+        CTxOut out;
+        int nHeight;
+        int nSpendHeight;
+    };
+
+    mutable Mutex cs;
+    std::unordered_map<COutPoint, Entry, SaltedOutpointHasher> mapSpent GUARDED_BY(cs);
+    // outpoints by height of the spending block
+    std::map<int, std::vector<COutPoint>> mapSpendHeights GUARDED_BY(cs);
+
+public:
+    // Add the outputs spent by a block connected at nSpendHeight, and forget the
+    // ones spent more than nKeepDepth blocks below it
+    void AddBlockSpends(const CBlock& block, const CBlockUndo& blockundo, int nSpendHeight, int nKeepDepth);
+    // Forget the outputs spent by the block at nSpendHeight, restored in the coins view
+    void BlockDisconnected(int nSpendHeight);
+    // Load the outputs spent by the last nDepth blocks of the active chain
+    bool LoadFromDisk(int nDepth);
+    bool Get(const COutPoint& outpoint, CTxOut& out, int& nHeight) const;
+    size_t Size() const;
+    void Clear();
+};
+
+extern CSpentStakeCache g_spent_stakes;
 
 #endif // PIVX_STAKEINPUT_H
@@ -9,12 +9,104 @@
 #include "utilstrencodings.h"
 #include "util/threadnames.h"
 
+#include <algorithm>
 #include <stdio.h>
 #include <system_error>
 #include <map>
 #include <memory>
 #include <set>
 
+std::atomic<bool> g_lock_profiling{false};
+
+namespace {
+// The lock sites, registered the first time they are reached.
+// Leaked on purpose: lock sites can be reached during static destruction.
+struct LockSiteRegistry {
+    std::mutex mutex;
+    std::vector<LockSite*> vSites;
+};
+
+LockSiteRegistry& GetLockSiteRegistry()
+{
+    static LockSiteRegistry* registry = new LockSiteRegistry();
+    return *registry;
+}
+} // namespace
+
+LockSite::LockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn) :
+    pszName(pszNameIn),
+    pszFile(pszFileIn),
+    nLine(nLineIn)
+{
+    LockSiteRegistry& registry = GetLockSiteRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.vSites.push_back(this);
+}
+
+void LockSite::RecordHold(int64_t nMicros)
+{
+    nHoldMicros.fetch_add(nMicros, std::memory_order_relaxed);
+    int nBucket = 0;
+    for (int64_t nLimit = 10; nBucket < HOLD_BUCKETS - 1 && nMicros >= nLimit; nLimit *= 10) {
+        nBucket++;
+    }
+    vHoldHistogram[nBucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void EnableLockProfiling(bool fEnable)
+{
+    g_lock_profiling = fEnable;
+}
+
+std::vector<LockSiteStats> GetLockProfile()
+{
+    std::vector<LockSiteStats> vStats;
+    LockSiteRegistry& registry = GetLockSiteRegistry();
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (const LockSite* site : registry.vSites) {
+            const uint64_t nAcquired = site->nAcquired.load(std::memory_order_relaxed);
+            if (nAcquired == 0) continue;
+            LockSiteStats stats{site->pszName, site->pszFile, site->nLine, nAcquired,
+                                site->nContended.load(std::memory_order_relaxed),
+                                site->nWaitMicros.load(std::memory_order_relaxed),
+                                site->nHoldMicros.load(std::memory_order_relaxed), {}};
+            for (const auto& bucket : site->vHoldHistogram) {
+                stats.vHoldHistogram.push_back(bucket.load(std::memory_order_relaxed));
+            }
+            vStats.push_back(std::move(stats));
+        }
+    }
+    std::sort(vStats.begin(), vStats.end(), [](const LockSiteStats& a, const LockSiteStats& b) {
+        return a.nWaitMicros > b.nWaitMicros;
+    });
+    return vStats;
+}
+
+void ResetLockProfile()
+{
+    LockSiteRegistry& registry = GetLockSiteRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (LockSite* site : registry.vSites) {
+        site->nAcquired = 0;
+        site->nContended = 0;
+        site->nWaitMicros = 0;
+        site->nHoldMicros = 0;
+        for (auto& bucket : site->vHoldHistogram) bucket = 0;
+    }
+}
+
+void LogLockProfile(size_t nTop)
+{
+    const std::vector<LockSiteStats>& vStats = GetLockProfile();
+    LogPrintf("Lock profile: %d lock sites\n", vStats.size());
+    for (size_t i = 0; i < vStats.size() && i < nTop; i++) {
+        const LockSiteStats& stats = vStats[i];
+        LogPrintf("  %s at %s:%d: acquired=%d contended=%d wait=%dus hold=%dus\n", stats.name, stats.file, stats.line,
+                  stats.nAcquired, stats.nContended, stats.nWaitMicros, stats.nHoldMicros);
+    }
+}
+
 #ifdef DEBUG_LOCKCONTENTION
 #if !defined(HAVE_THREAD_LOCAL)
 static_assert(false, "thread_local is not supported");
@@ -10,10 +10,13 @@
 #include "threadsafety.h"
 #include "util/macros.h"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 
 
 /////////////////////////////////////////////////
@@ -118,14 +121,88 @@ typedef AnnotatedMixin<std::mutex> Mutex;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Lock contention profiler (-lockprofile), cheap enough to be left enabled.
+ * Every LOCK/LOCK2/WITH_LOCK site has a static LockSite recording the number of
+ * acquisitions, the contended ones (the lock was taken by another thread), the time
+ * spent waiting for the lock, and a histogram of the time it was held.
+ * When the profiler is disabled, a lock costs one more relaxed atomic load.
+ */
+struct LockSite
+{
+    // Hold time histogram buckets: < 10us, < 100us, < 1ms, < 10ms, < 100ms, < 1s, >= 1s
+    static const int HOLD_BUCKETS = 7;
+
+    const char* pszName;
+    const char* pszFile;
+    const int nLine;
+    std::atomic<uint64_t> nAcquired{0};
+    std::atomic<uint64_t> nContended{0};
+    std::atomic<uint64_t> nWaitMicros{0};
+    std::atomic<uint64_t> nHoldMicros{0};
+    std::atomic<uint64_t> vHoldHistogram[HOLD_BUCKETS]{};
+
+    LockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn);
+    void RecordHold(int64_t nMicros);
+};
+
+/** Snapshot of the counters of a LockSite */
+struct LockSiteStats
+{
+    std::string name;
+    std::string file;
+    int line;
+    uint64_t nAcquired;
+    uint64_t nContended;
+    uint64_t nWaitMicros;
+    uint64_t nHoldMicros;
+    std::vector<uint64_t> vHoldHistogram;
+};
+
+extern std::atomic<bool> g_lock_profiling;
+
+void EnableLockProfiling(bool fEnable);
+/** Return the stats of the lock sites acquired at least once, sorted by total wait time */
+std::vector<LockSiteStats> GetLockProfile();
+void ResetLockProfile();
+/** Log the nTop lock sites with the highest total wait time */
+void LogLockProfile(size_t nTop);
+
+static inline int64_t LockProfileMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 /** Wrapper around std::unique_lock style lock for Mutex. */
 template <typename Mutex, typename Base = typename Mutex::UniqueLock>
 class SCOPED_LOCKABLE UniqueLock  : public Base
 {
 private:
-    void Enter(const char* pszName, const char* pszFile, int nLine)
+    LockSite* m_site{nullptr};
+    int64_t m_locked_time{0};
+
+    void EnterProfiled(LockSite* pSite)
+    {
+        int64_t nNow = LockProfileMicros();
+        if (!Base::try_lock()) {
+            Base::lock();
+            const int64_t nLocked = LockProfileMicros();
+            pSite->nContended.fetch_add(1, std::memory_order_relaxed);
+            pSite->nWaitMicros.fetch_add(nLocked - nNow, std::memory_order_relaxed);
+            nNow = nLocked;
+        }
+        pSite->nAcquired.fetch_add(1, std::memory_order_relaxed);
+        m_site = pSite;
+        m_locked_time = nNow;
+    }
+
+    void Enter(const char* pszName, const char* pszFile, int nLine, LockSite* pSite)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(Base::mutex()));
+        if (pSite && g_lock_profiling.load(std::memory_order_relaxed)) {
+            EnterProfiled(pSite);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!Base::try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -146,15 +223,15 @@ private:
     }
 
 public:
-    UniqueLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : Base(mutexIn, std::defer_lock)
+    UniqueLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, LockSite* pSite = nullptr) EXCLUSIVE_LOCK_FUNCTION(mutexIn) : Base(mutexIn, std::defer_lock)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
         else
-            Enter(pszName, pszFile, nLine);
+            Enter(pszName, pszFile, nLine, pSite);
     }
 
-    UniqueLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
+    UniqueLock(Mutex* pmutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false, LockSite* pSite = nullptr) EXCLUSIVE_LOCK_FUNCTION(pmutexIn)
     {
         if (!pmutexIn) return;
 
@@ -162,13 +239,15 @@ public:
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
         else
-            Enter(pszName, pszFile, nLine);
+            Enter(pszName, pszFile, nLine, pSite);
     }
 
     ~UniqueLock() UNLOCK_FUNCTION()
     {
-        if (Base::owns_lock())
+        if (Base::owns_lock()) {
+            if (m_site) m_site->RecordHold(LockProfileMicros() - m_locked_time);
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -188,6 +267,7 @@ public:
     public:
         explicit reverse_lock(UniqueLock& _lock, const char* _guardname, const char* _file, int _line) : lock(_lock), file(_file), line(_line) {
             CheckLastCritical((void*)lock.mutex(), lockname, _guardname, _file, _line);
+            if (lock.m_site) lock.m_site->RecordHold(LockProfileMicros() - lock.m_locked_time);
             lock.unlock();
             LeaveCritical();
             lock.swap(templock);
@@ -197,6 +277,7 @@ public:
             templock.swap(lock);
             EnterCritical(lockname.c_str(), file.c_str(), line, (void*)lock.mutex());
             lock.lock();
+            lock.m_locked_time = LockProfileMicros();
         }
 
      private:
@@ -217,11 +298,19 @@ public:
 template<typename MutexArg>
 using DebugLock = UniqueLock<typename std::remove_reference<typename std::remove_pointer<MutexArg>::type>::type>;
 
-#define LOCK(cs) DebugLock<decltype(cs)> PASTE2(criticalblock, __COUNTER__)(cs, #cs, __FILE__, __LINE__)
-#define LOCK2(cs1, cs2)                                               \
-    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__); \
-    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__);
+#define LOCK_SITE(cs, site) static LockSite site(#cs, __FILE__, __LINE__)
+#define LOCK_AT(cs, n)                                                                     \
+    LOCK_SITE(cs, PASTE2(locksite, n));                                                    \
+    DebugLock<decltype(cs)> PASTE2(criticalblock, n)(cs, #cs, __FILE__, __LINE__, false, &PASTE2(locksite, n))
+
+#define LOCK(cs) LOCK_AT(cs, __COUNTER__)
+#define LOCK2(cs1, cs2)                                                                         \
+    LOCK_SITE(cs1, locksite1);                                                                  \
+    LOCK_SITE(cs2, locksite2);                                                                  \
+    DebugLock<decltype(cs1)> criticalblock1(cs1, #cs1, __FILE__, __LINE__, false, &locksite1); \
+    DebugLock<decltype(cs2)> criticalblock2(cs2, #cs2, __FILE__, __LINE__, false, &locksite2);
 #define TRY_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__, true)
+// Not profiled: the lock is usually released while waiting on a condition variable
 #define WAIT_LOCK(cs, name) DebugLock<decltype(cs)> name(cs, #cs, __FILE__, __LINE__)
 
 #define ENTER_CRITICAL_SECTION(cs)                            \
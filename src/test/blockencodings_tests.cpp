@@ -0,0 +1,167 @@
+// Copyright (c) 2016-2020 The Bitcoin Core developers
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_pivx.h"
+
+#include "blockencodings.h"
+#include "consensus/merkle.h"
+#include "net_processing.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <list>
+
+#include <boost/test/unit_test.hpp>
+
+// Internal to net_processing.cpp
+extern bool AddHighBandwidthPeer(std::list<NodeId>& lPeers, NodeId nodeid, NodeId& nodeEvicted);
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, BasicTestingSetup)
+
+static CMutableTransaction CreateTx(unsigned int n)
+{
+    CMutableTransaction tx;
+    tx.vin.emplace_back(COutPoint(GetRandHash(), n));
+    tx.vin[0].scriptSig = CScript() << OP_TRUE;
+    tx.vout.emplace_back(n * COIN, CScript() << OP_TRUE);
+    return tx;
+}
+
+static CBlock BuildBlock(bool fProofOfStake)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.emplace_back();
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_0;
+    coinbase.vout.emplace_back(fProofOfStake ? 0 : 250 * COIN, CScript() << OP_TRUE);
+    block.vtx.emplace_back(MakeTransactionRef(coinbase));
+    if (fProofOfStake) {
+        // coinstake: empty first output, masternode payment in the last one
+        CMutableTransaction coinstake = CreateTx(0);
+        coinstake.vout.clear();
+        coinstake.vout.emplace_back();
+        coinstake.vout[0].SetEmpty();
+        coinstake.vout.emplace_back(100 * COIN, CScript() << OP_TRUE);
+        coinstake.vout.emplace_back(3 * COIN, CScript() << OP_2);
+        block.vtx.emplace_back(MakeTransactionRef(coinstake));
+        block.vchBlockSig = {0x01, 0x02, 0x03};
+    }
+    for (unsigned int i = 1; i <= 3; i++) {
+        block.vtx.emplace_back(MakeTransactionRef(CreateTx(i)));
+    }
+    block.nVersion = 10;
+    block.nTime = 1;
+    block.nBits = 0x207fffff;
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+static void CheckRoundTrip(bool fProofOfStake)
+{
+    const CBlock block = BuildBlock(fProofOfStake);
+    BOOST_CHECK_EQUAL(block.IsProofOfStake(), fProofOfStake);
+    const size_t nPrefilled = fProofOfStake ? 2 : 1;
+
+    // The receiver has the first and the last tx in its mempool
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    pool.addUnchecked(block.vtx[nPrefilled]->GetHash(), entry.FromTx(*block.vtx[nPrefilled]));
+    pool.addUnchecked(block.vtx.back()->GetHash(), entry.FromTx(*block.vtx.back()));
+
+    // Send the compact block over the wire
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CBlockHeaderAndShortTxIDs(block);
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    stream >> cmpctblock;
+    BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), block.vtx.size());
+    BOOST_CHECK(cmpctblock.header.GetHash() == block.GetHash());
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(cmpctblock) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialBlock.GetPrefilledCount(), nPrefilled);
+    BOOST_CHECK_EQUAL(partialBlock.GetMempoolCount(), 2U);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(partialBlock.IsTxAvailable(i), i != nPrefilled + 1);
+    }
+
+    // Missing tx request/response
+    BlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    req.indexes.push_back(nPrefilled + 1);
+    stream << req;
+    BlockTransactionsRequest req2;
+    stream >> req2;
+    BOOST_CHECK(req2.blockhash == req.blockhash);
+    BOOST_CHECK(req2.indexes == req.indexes);
+
+    // Wrong tx: merkle root mismatch
+    {
+        PartiallyDownloadedBlock partialBlock2(&pool);
+        BOOST_CHECK(partialBlock2.InitData(cmpctblock) == READ_STATUS_OK);
+        CBlock block2;
+        BOOST_CHECK(partialBlock2.FillBlock(block2, {block.vtx[nPrefilled]}) == READ_STATUS_FAILED);
+    }
+    // Wrong number of txes
+    {
+        PartiallyDownloadedBlock partialBlock2(&pool);
+        BOOST_CHECK(partialBlock2.InitData(cmpctblock) == READ_STATUS_OK);
+        CBlock block2;
+        BOOST_CHECK(partialBlock2.FillBlock(block2, {}) == READ_STATUS_INVALID);
+    }
+
+    CBlock blockRebuilt;
+    BOOST_CHECK(partialBlock.FillBlock(blockRebuilt, {block.vtx[nPrefilled + 1]}) == READ_STATUS_OK);
+    BOOST_CHECK(blockRebuilt.GetHash() == block.GetHash());
+    BOOST_CHECK(blockRebuilt.vchBlockSig == block.vchBlockSig);
+    BOOST_CHECK_EQUAL(blockRebuilt.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK(blockRebuilt.vtx[i]->GetHash() == block.vtx[i]->GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_pow)
+{
+    CheckRoundTrip(false);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_pos)
+{
+    CheckRoundTrip(true);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_invalid)
+{
+    // Empty compact block
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    CTxMemPool pool(CFeeRate(0));
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(cmpctblock) == READ_STATUS_INVALID);
+}
+
+BOOST_AUTO_TEST_CASE(high_bandwidth_peers_cap)
+{
+    std::list<NodeId> lPeers;
+    NodeId nodeEvicted;
+    for (NodeId id = 0; id < (NodeId) MAX_CMPCTBLOCK_HB_PEERS; id++) {
+        BOOST_CHECK(AddHighBandwidthPeer(lPeers, id, nodeEvicted));
+        BOOST_CHECK_EQUAL(nodeEvicted, -1);
+    }
+    BOOST_CHECK_EQUAL(lPeers.size(), MAX_CMPCTBLOCK_HB_PEERS);
+
+    // A peer already in the list becomes the most recent one, nothing to send
+    BOOST_CHECK(!AddHighBandwidthPeer(lPeers, 0, nodeEvicted));
+    BOOST_CHECK_EQUAL(nodeEvicted, -1);
+    BOOST_CHECK_EQUAL(lPeers.back(), 0);
+
+    // A new peer evicts the one asked the longest ago
+    BOOST_CHECK(AddHighBandwidthPeer(lPeers, 100, nodeEvicted));
+    BOOST_CHECK_EQUAL(nodeEvicted, 1);
+    BOOST_CHECK_EQUAL(lPeers.size(), MAX_CMPCTBLOCK_HB_PEERS);
+    BOOST_CHECK_EQUAL(lPeers.back(), 100);
+    BOOST_CHECK(std::find(lPeers.begin(), lPeers.end(), 1) == lPeers.end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,74 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_pivx.h"
+
+#include "blockstatsindex.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "policy/feerate.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "undo.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockstatsindex_tests, BasicTestingSetup)
+
+static CTransactionRef CreateSpend(const CAmount& nValueIn, const CAmount& nValueOut, CTxUndo& txundo)
+{
+    CMutableTransaction mtx;
+    mtx.vin.emplace_back(COutPoint(GetRandHash(), 0));
+    mtx.vout.emplace_back(nValueOut, CScript() << OP_TRUE);
+    txundo.vprevout.emplace_back(CTxOut(nValueIn, CScript() << OP_TRUE), 1, false, false);
+    return MakeTransactionRef(mtx);
+}
+
+BOOST_AUTO_TEST_CASE(compute_block_stats)
+{
+    CBlock block;
+    CBlockUndo blockundo;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.emplace_back();
+    coinbase.vout.emplace_back(250 * COIN, CScript() << OP_TRUE);
+    block.vtx.emplace_back(MakeTransactionRef(coinbase));
+
+    // high fee rate tx, and low fee rate tx
+    blockundo.vtxundo.emplace_back();
+    block.vtx.emplace_back(CreateSpend(10 * COIN, 9 * COIN, blockundo.vtxundo.back()));
+    blockundo.vtxundo.emplace_back();
+    block.vtx.emplace_back(CreateSpend(5 * COIN, 5 * COIN - 10000, blockundo.vtxundo.back()));
+
+    const int64_t nSize1 = GetSerializeSize(*block.vtx[1], CLIENT_VERSION);
+    const int64_t nSize2 = GetSerializeSize(*block.vtx[2], CLIENT_VERSION);
+
+    CBlockStats stats;
+    BOOST_CHECK(ComputeBlockStats(block, blockundo, stats));
+    BOOST_CHECK(stats.hashBlock == block.GetHash());
+    BOOST_CHECK_EQUAL(stats.nTxCountAll, 3);
+    BOOST_CHECK_EQUAL(stats.nTxCount, 2);
+    BOOST_CHECK_EQUAL(stats.nTxBytes, nSize1 + nSize2);
+    BOOST_CHECK_EQUAL(stats.nFees, COIN + 10000);
+    BOOST_CHECK_EQUAL(stats.nShieldedTxCount, 0);
+    BOOST_CHECK_EQUAL(stats.feeratePercentiles[0], CFeeRate(10000, nSize2).GetFeePerK());
+    BOOST_CHECK_EQUAL(stats.feeratePercentiles[NUM_FEERATE_PERCENTILES - 1], CFeeRate(COIN, nSize1).GetFeePerK());
+
+    // serialization round-trip
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << stats;
+    CBlockStats stats2;
+    ss >> stats2;
+    BOOST_CHECK(stats2.hashBlock == stats.hashBlock);
+    BOOST_CHECK_EQUAL(stats2.nFees, stats.nFees);
+    for (int i = 0; i < NUM_FEERATE_PERCENTILES; i++) {
+        BOOST_CHECK_EQUAL(stats2.feeratePercentiles[i], stats.feeratePercentiles[i]);
+    }
+
+    // undo data not matching the block
+    blockundo.vtxundo.pop_back();
+    BOOST_CHECK(!ComputeBlockStats(block, blockundo, stats));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
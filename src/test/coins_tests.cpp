@@ -7,6 +7,7 @@
 
 #include "coins.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "undo.h"
 #include "utilstrencodings.h"
@@ -38,6 +39,7 @@ class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
     std::map<COutPoint, Coin> map_;
+    CAmount supply_{0};
 
     // Sapling
     uint256 hashBestSaplingAnchor_;
@@ -71,6 +73,8 @@ public:
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
 
+    CAmount GetSupply() const { return supply_; }
+
     // Sapling
 
     bool GetSaplingAnchorAt(const uint256& rt, SaplingMerkleTree &tree) const {
@@ -144,7 +148,8 @@ public:
                     const uint256& hashBlock,
                     const uint256& hashSaplingAnchor,
                     CAnchorsSaplingMap& mapSaplingAnchors,
-                    CNullifiersMap& mapSaplingNullifiers)
+                    CNullifiersMap& mapSaplingNullifiers,
+                    const CAmount& nSupplyDelta)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -161,6 +166,7 @@ public:
         BatchWriteAnchors<SaplingMerkleTree, CAnchorsSaplingMap, CAnchorsSaplingCacheEntry>(mapSaplingAnchors, mapSaplingAnchors_);
         BatchWriteNullifiers(mapSaplingNullifiers, mapSaplingNullifiers_);
 
+        supply_ += nSupplyDelta;
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
         if (!hashSaplingAnchor.IsNull())
@@ -705,6 +711,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             for (const CCoinsViewCacheTest *test : stack) {
                 test->SelfTest();
             }
+            // Verify the tracking of the sum of the unspent outputs values
+            CAmount nExpectedSupply = 0;
+            for (const auto& entry : result) {
+                if (!entry.second.IsSpent()) nExpectedSupply += entry.second.out.nValue;
+            }
+            CAmount nSupply = base.GetSupply();
+            for (const CCoinsViewCacheTest *test : stack) {
+                nSupply += test->GetSupplyDelta();
+            }
+            BOOST_CHECK_EQUAL(nSupply, nExpectedSupply);
         }
 
         if (InsecureRandRange(100) == 0) {
@@ -1060,7 +1076,7 @@ void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
     InsertCoinsMapEntry(map, value, flags);
     CAnchorsSaplingMap mapSaplingAnchors;
     CNullifiersMap mapSaplingNullifiers;
-    view.BatchWrite(map, {}, {}, mapSaplingAnchors, mapSaplingNullifiers);
+    view.BatchWrite(map, {}, {}, mapSaplingAnchors, mapSaplingNullifiers, 0);
 }
 
 class SingleEntryCacheTest
@@ -1320,4 +1336,78 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(sapling_anchors_delta_db_test)
+{
+    // Anchors pushed with their commitments are stored as deltas by the coins db
+    CCoinsViewDB db(1 << 20, true, false);
+    // that carries the format version written at startup
+    BOOST_CHECK_EQUAL(db.GetVersion(), 0);
+    BOOST_CHECK(db.WriteVersion(CHAINSTATE_VERSION));
+    BOOST_CHECK_EQUAL(db.GetVersion(), CHAINSTATE_VERSION);
+    const int nAnchors = SAPLING_ANCHOR_CHECKPOINT_INTERVAL * 2 + SAPLING_ANCHOR_LRU_CACHE_SIZE;
+    std::vector<SaplingMerkleTree> vTrees;
+    SaplingMerkleTree tree;
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < nAnchors; i++) {
+            std::vector<uint256> vCommitments(1 + InsecureRandRange(3));
+            for (uint256& cm : vCommitments) {
+                cm = InsecureRand256();
+            }
+            tree.append(vCommitments);
+            cache.PushAnchor(tree, vCommitments);
+            vTrees.emplace_back(tree);
+            if (i % 50 == 49) {
+                cache.SetBestBlock(InsecureRand256());
+                BOOST_CHECK(cache.Flush());
+            }
+        }
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Rebuild them from the checkpoints, newest first
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.GetBestAnchor() == tree.root());
+        for (auto it = vTrees.rbegin(); it != vTrees.rend(); ++it) {
+            SaplingMerkleTree checkTree;
+            BOOST_CHECK(cache.GetSaplingAnchorAt(it->root(), checkTree));
+            BOOST_CHECK(checkTree == *it);
+        }
+    }
+
+    // Pop the last anchors, then push a new one on top
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 10; i++) {
+            vTrees.pop_back();
+            cache.PopAnchor(vTrees.back().root());
+        }
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+    }
+    {
+        CCoinsViewCache cache(&db);
+        SaplingMerkleTree checkTree;
+        BOOST_CHECK(!cache.GetSaplingAnchorAt(tree.root(), checkTree));
+        BOOST_CHECK(cache.GetBestAnchor() == vTrees.back().root());
+        BOOST_CHECK(cache.GetSaplingAnchorAt(cache.GetBestAnchor(), checkTree));
+        BOOST_CHECK(checkTree == vTrees.back());
+
+        std::vector<uint256> vCommitments{InsecureRand256()};
+        checkTree.append(vCommitments);
+        cache.PushAnchor(checkTree, vCommitments);
+        cache.SetBestBlock(InsecureRand256());
+        BOOST_CHECK(cache.Flush());
+        tree = checkTree;
+    }
+    {
+        CCoinsViewCache cache(&db);
+        SaplingMerkleTree checkTree;
+        BOOST_CHECK(cache.GetSaplingAnchorAt(tree.root(), checkTree));
+        BOOST_CHECK(checkTree == tree);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
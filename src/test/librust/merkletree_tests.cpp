@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "test/test_pivx.h"
+#include "test/util/saplingutil.h"
 
 #include "test/data/merkle_roots_sapling.json.h"
 #include "test/data/merkle_serialization_sapling.json.h"
@@ -134,6 +135,66 @@ BOOST_AUTO_TEST_CASE(SaplingVectors) {
     );
 }
 
+// Append the commitments in batches of doubling size, checking the tree and
+// the witnesses (one for each batch) against the ones of the single appends.
+template<typename Tree, typename Witness>
+void test_batch_append(const std::vector<uint256>& commitments)
+{
+    Tree tree, batchTree;
+    std::vector<Witness> witnesses, batchWitnesses;
+    size_t pos = 0;
+    for (size_t nBatch = 1; pos < commitments.size(); nBatch *= 2) {
+        const size_t nCount = std::min(nBatch, commitments.size() - pos);
+        const Span<const uint256> batch = Span<const uint256>(commitments).subspan(pos, nCount);
+        for (const uint256& cm : batch) {
+            tree.append(cm);
+            for (Witness& wit : witnesses) {
+                wit.append(cm);
+            }
+        }
+        batchTree.append(batch);
+        for (Witness& wit : batchWitnesses) {
+            wit.append(batch);
+        }
+        pos += nCount;
+
+        BOOST_CHECK(tree == batchTree);
+        BOOST_CHECK(tree.root() == batchTree.root());
+        for (size_t i = 0; i < witnesses.size(); i++) {
+            BOOST_CHECK(witnesses[i] == batchWitnesses[i]);
+            BOOST_CHECK(batchWitnesses[i].root() == batchTree.root());
+        }
+        witnesses.emplace_back(tree.witness());
+        batchWitnesses.emplace_back(batchTree.witness());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(BatchAppend) {
+    UniValue commitment_tests = read_json(MAKE_STRING(json_tests::merkle_commitments_sapling));
+    std::vector<uint256> commitments;
+    for (size_t i = 0; i < commitment_tests.size(); i++) {
+        commitments.emplace_back(uint256S(commitment_tests[i].get_str()));
+    }
+    test_batch_append<SaplingTestingMerkleTree, SaplingTestingWitness>(commitments);
+
+    // Enough commitments to hash the tree levels on the worker pool
+    commitments.clear();
+    for (size_t i = 0; i < 400; i++) {
+        commitments.emplace_back(GetRandomNoteCommitment());
+    }
+    test_batch_append<SaplingMerkleTree, SaplingWitness>(commitments);
+    test_batch_append<libzcash::IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress>,
+                      libzcash::IncrementalWitness<INCREMENTAL_MERKLE_TREE_DEPTH, libzcash::SHA256Compress>>(commitments);
+
+    // A batch that doesn't fit in the tree is rejected
+    SaplingTestingMerkleTree fullTree;
+    std::vector<uint256> leaves(17, uint256());
+    BOOST_CHECK_THROW(fullTree.append(leaves), std::runtime_error);
+    BOOST_CHECK(fullTree.size() == 0);
+    fullTree.append(Span<const uint256>(leaves).first(16));
+    BOOST_CHECK_THROW(fullTree.append(leaves[0]), std::runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(emptyroots) {
     libzcash::EmptyMerkleRoots<64, libzcash::SHA256Compress> emptyroots;
     std::array<libzcash::SHA256Compress, 65> computed;
@@ -15,6 +15,7 @@
 #include "random.h"
 #include "sapling/transaction_builder.h"
 #include "test/librust/utiltest.h"
+#include "test/util/saplingutil.h"
 #include "wallet/wallet.h"
 #include "consensus/merkle.h"
 #include "sapling/note.h"
@@ -174,6 +175,58 @@ BOOST_AUTO_TEST_CASE(FindMySaplingNotes)
     BOOST_CHECK_EQUAL(2, noteMap.size());
 }
 
+BOOST_AUTO_TEST_CASE(FindMySaplingNotesBatch)
+{
+    auto consensusParams = Params().GetConsensus();
+
+    CWallet& wallet = m_wallet;
+    LOCK(wallet.cs_wallet);
+    wallet.SetupSPKM(false);
+    auto sspkm = wallet.GetSaplingScriptPubKeyMan();
+
+    auto sk = GetTestMasterSaplingSpendingKey();
+    auto expsk = sk.expsk;
+    auto extfvk = sk.ToXFVK();
+    auto pa = sk.DefaultAddress();
+
+    // Generate a few transactions, plus one without shielded outputs
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 4; i++) {
+        auto testNote = GetTestSaplingNote(pa, 50000000);
+        auto builder = TransactionBuilder(consensusParams);
+        builder.AddSaplingSpend(expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+        builder.AddSaplingOutput(extfvk.fvk.ovk, pa, 25000000, {});
+        builder.SetFee(10000000);
+        vtx.emplace_back(MakeTransactionRef(builder.Build().GetTxOrThrow()));
+    }
+    vtx.emplace_back(MakeTransactionRef(CMutableTransaction()));
+
+    // Nothing found without the key
+    BOOST_CHECK(sspkm->FindMySaplingNotes(vtx).empty());
+
+    // Add enough keys to exceed the threshold for the parallel trial decryption
+    BOOST_CHECK(wallet.AddSaplingZKey(sk));
+    for (int i = 0; i < 20; i++) {
+        wallet.GenerateNewSaplingZKey();
+    }
+
+    // The batch must find exactly the same notes as the single-tx version
+    auto batchNotes = sspkm->FindMySaplingNotes(vtx);
+    BOOST_CHECK_EQUAL(batchNotes.size(), 4);
+    for (const auto& tx : vtx) {
+        auto single = sspkm->FindMySaplingNotes(*tx);
+        auto it = batchNotes.find(tx->GetHash());
+        if (single.first.empty()) {
+            BOOST_CHECK(it == batchNotes.end());
+            continue;
+        }
+        BOOST_CHECK(it != batchNotes.end());
+        BOOST_CHECK_EQUAL(it->second.first.size(), 2);
+        BOOST_CHECK(it->second.first == single.first);
+        BOOST_CHECK(it->second.second == single.second);
+    }
+}
+
 // Generate note A and spend to create note B, from which we spend to create two conflicting transactions
 BOOST_AUTO_TEST_CASE(GetConflictedSaplingNotes)
 {
@@ -909,6 +962,73 @@ BOOST_AUTO_TEST_CASE(ClearNoteWitnessCache)
     BOOST_CHECK_EQUAL(0, wallet.GetSaplingScriptPubKeyMan()->nWitnessCacheSize);
 }
 
+BOOST_AUTO_TEST_CASE(CachedWitnessesManyTxes)
+{
+    CWallet& wallet = m_wallet;
+    {
+        LOCK(wallet.cs_wallet);
+        setupWallet(wallet);
+    }
+
+    // Enough wallet txs and block commitments to update the witnesses on the worker pool
+    const size_t nWalletTxes = 32;
+    const size_t nBlockTxes = 16;
+
+    // First block: the wallet txs, each one with a note of this wallet
+    CBlock block1;
+    std::vector<SaplingOutPoint> saplingNotes;
+    for (size_t i = 0; i < nWalletTxes; i++) {
+        CWalletTx wtx(&wallet, MakeShieldedTxWithCommitment());
+        saplingNotes.emplace_back(SetSaplingNoteData(wtx)[0]);
+        BOOST_CHECK(wallet.LoadToWallet(wtx));
+        block1.vtx.emplace_back(wtx.tx);
+    }
+    // A wallet tx without notes of this wallet is left untouched
+    CWalletTx wtxNoNotes(&wallet, MakeShieldedTxWithCommitment());
+    BOOST_CHECK(wallet.LoadToWallet(wtxNoNotes));
+    block1.vtx.emplace_back(wtxNoNotes.tx);
+
+    SaplingMerkleTree saplingTree;
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    wallet.IncrementNoteWitnesses(&index1, &block1, saplingTree);
+
+    std::vector<Optional<SaplingWitness>> saplingWitnesses;
+    uint256 anchors1 = GetWitnessesAndAnchors(wallet, saplingNotes, saplingWitnesses);
+    BOOST_CHECK(anchors1 == saplingTree.root());
+
+    // Second block: commitments of txs not in the wallet
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    for (size_t i = 0; i < nBlockTxes; i++) {
+        block2.vtx.emplace_back(MakeShieldedTxWithCommitment());
+    }
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+    wallet.IncrementNoteWitnesses(&index2, &block2, saplingTree);
+
+    uint256 anchors2 = GetWitnessesAndAnchors(wallet, saplingNotes, saplingWitnesses);
+    BOOST_CHECK(anchors2 == saplingTree.root());
+    for (size_t i = 0; i < saplingNotes.size(); i++) {
+        BOOST_CHECK((bool) saplingWitnesses[i]);
+        BOOST_CHECK_EQUAL(2, wallet.mapWallet.at(saplingNotes[i].hash).mapSaplingNoteData.at(saplingNotes[i]).witnessHeight);
+    }
+    BOOST_CHECK(wallet.mapWallet.at(wtxNoNotes.GetHash()).mapSaplingNoteData.empty());
+
+    // Erased txs are removed from the index
+    wallet.EraseFromWallet(saplingNotes.back().hash);
+    saplingNotes.pop_back();
+
+    // Disconnecting the second block restores the previous witnesses
+    wallet.DecrementNoteWitnesses(&index2);
+    uint256 anchors3 = GetWitnessesAndAnchors(wallet, saplingNotes, saplingWitnesses);
+    BOOST_CHECK(anchors1 == anchors3);
+    for (size_t i = 0; i < saplingNotes.size(); i++) {
+        BOOST_CHECK((bool) saplingWitnesses[i]);
+        BOOST_CHECK_EQUAL(1, wallet.mapWallet.at(saplingNotes[i].hash).mapSaplingNoteData.at(saplingNotes[i]).witnessHeight);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(UpdatedSaplingNoteData)
 {
     auto consensusParams = Params().GetConsensus();
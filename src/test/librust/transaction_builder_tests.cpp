@@ -49,6 +49,22 @@ BOOST_AUTO_TEST_CASE(TransparentToSapling)
     CValidationState state;
     BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 2, true, false));
     BOOST_CHECK_EQUAL(state.GetRejectReason(), "");
+
+    // Proofs are not cached for mined txs
+    std::vector<CSaplingCheck> vChecks;
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 2, true, false, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1);
+
+    // Once accepted to the mempool, the proofs verification is skipped when the tx is mined
+    vChecks.clear();
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 2, false, false));
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 2, true, false, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "");
+
+    // Still a hit when the block is connected (the entry is then released for reuse)
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 2, true, false, &vChecks, true));
+    BOOST_CHECK(vChecks.empty());
 }
 
 BOOST_AUTO_TEST_CASE(SaplingToSapling)
@@ -99,6 +115,23 @@ BOOST_AUTO_TEST_CASE(SaplingToSapling)
     BOOST_CHECK_EQUAL(tx2.sapData->valueBalance, 10000000);
     BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx2, state, Params(), 3, true, false));
     BOOST_CHECK_EQUAL(state.GetRejectReason(), "");
+
+    // --- Deferred proofs verification (block check queue)
+    std::vector<CSaplingCheck> vChecks;
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx, state, Params(), 3, true, false, &vChecks));
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx2, state, Params(), 3, true, false, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 2);
+    for (CSaplingCheck& check : vChecks) {
+        BOOST_CHECK(check());
+    }
+    // Proofs are bound to the sighash: swapping the transactions must fail
+    CMutableTransaction mtx(tx2);
+    mtx.sapData->vShieldedSpend[0] = tx.sapData->vShieldedSpend[0];
+    const CTransaction tx3(mtx);
+    vChecks.clear();
+    BOOST_CHECK(SaplingValidation::ContextualCheckTransaction(tx3, state, Params(), 3, true, false, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1);
+    BOOST_CHECK(!vChecks[0]());
 }
 
 BOOST_AUTO_TEST_CASE(ThrowsOnTransparentInputWithoutKeyStore)
@@ -0,0 +1,98 @@
+// Copyright (c) 2022 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_pivx.h"
+
+#include "logging.h"
+
+#include <fstream>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(logging_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(log_queue)
+{
+    // rounded up to 4
+    BCLog::LogQueue queue(3);
+    std::string msg;
+    BOOST_CHECK(!queue.Pop(msg));
+    for (int i = 0; i < 4; i++) {
+        BOOST_CHECK(queue.Push(std::to_string(i)));
+    }
+    // full
+    BOOST_CHECK(!queue.Push("4"));
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK(queue.Pop(msg));
+        BOOST_CHECK_EQUAL(msg, std::to_string(i));
+    }
+    BOOST_CHECK(queue.Push("4"));
+    BOOST_CHECK(queue.Push("5"));
+    for (int i = 2; i < 6; i++) {
+        BOOST_CHECK(queue.Pop(msg));
+        BOOST_CHECK_EQUAL(msg, std::to_string(i));
+    }
+    BOOST_CHECK(!queue.Pop(msg));
+
+    // concurrent producers
+    BCLog::LogQueue queue2(4096);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&queue2, t]() {
+            for (int i = 0; i < 1000; i++) BOOST_CHECK(queue2.Push(strprintf("%d-%d", t, i)));
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    std::vector<int> vNext(4, 0);
+    int nPopped = 0;
+    while (queue2.Pop(msg)) {
+        // each producer's messages are in order
+        const int t = msg[0] - '0';
+        BOOST_CHECK_EQUAL(msg, strprintf("%d-%d", t, vNext[t]++));
+        nPopped++;
+    }
+    BOOST_CHECK_EQUAL(nPopped, 4000);
+}
+
+BOOST_AUTO_TEST_CASE(async_logger)
+{
+    BCLog::Logger logger;
+    logger.m_print_to_file = true;
+    logger.m_log_timestamps = false;
+    logger.m_file_path = SetDataDir("async_logger") / "debug.log";
+    BOOST_CHECK(logger.OpenDebugLog());
+
+    logger.StartAsync();
+    BOOST_CHECK(logger.IsAsync());
+    for (int i = 0; i < 100; i++) {
+        logger.LogPrintStr(strprintf("message %d\n", i));
+    }
+    const bool fCategoryEnabled = LogAcceptCategory(BCLog::VALIDATION);
+    g_logger->EnableCategory(BCLog::VALIDATION);
+    {
+        CBatchedLogger batch(&logger, BCLog::VALIDATION, "batch");
+        batch.Batch("batched %d", 1);
+    }
+    if (!fCategoryEnabled) g_logger->DisableCategory(BCLog::VALIDATION);
+    // flushed when stopped
+    logger.StopAsync();
+    BOOST_CHECK(!logger.IsAsync());
+    logger.LogPrintStr("sync message\n");
+
+    std::ifstream file(logger.m_file_path.string());
+    std::string line;
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK(std::getline(file, line));
+        BOOST_CHECK_EQUAL(line, strprintf("message %d", i));
+    }
+    BOOST_CHECK(std::getline(file, line));
+    BOOST_CHECK_EQUAL(line, "batch:");
+    BOOST_CHECK(std::getline(file, line));
+    BOOST_CHECK_EQUAL(line, "    batched 1");
+    BOOST_CHECK(std::getline(file, line));
+    BOOST_CHECK_EQUAL(line, "sync message");
+    BOOST_CHECK_EQUAL(logger.GetAsyncDropped(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
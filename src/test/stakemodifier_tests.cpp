@@ -0,0 +1,245 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "test/test_pivx.h"
+
+#include "arith_uint256.h"
+#include "hash.h"
+#include "legacy/stakemodifier.h"
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(stakemodifier_tests, BasicTestingSetup)
+
+static const unsigned int MODIFIER_INTERVAL = 60;
+static const int MODIFIER_INTERVAL_RATIO = 3;
+static const int64_t OLD_MODIFIER_INTERVAL = 2087;
+
+typedef std::map<uint256, const CBlockIndex*> TestBlockMap;
+
+/*
+ * Reference implementation: the legacy modifier selection as it was before
+ * the candidates were hashed once per modifier (with mapBlockIndex replaced
+ * by the blocks of the test).
+ */
+
+static int64_t RefSelectionIntervalSection(int nSection)
+{
+    return MODIFIER_INTERVAL * 63 / (63 + ((63 - nSection) * (MODIFIER_INTERVAL_RATIO - 1)));
+}
+
+static bool RefSelectBlockFromCandidates(
+    const TestBlockMap& mapBlocks,
+    std::vector<std::pair<int64_t, uint256> >& vSortedByTimestamp,
+    std::map<uint256, const CBlockIndex*>& mapSelectedBlocks,
+    int64_t nSelectionIntervalStop,
+    uint64_t nStakeModifierPrev,
+    const CBlockIndex** pindexSelected)
+{
+    bool fModifierV2 = false;
+    bool fFirstRun = true;
+    bool fSelected = false;
+    arith_uint256 hashBest = ARITH_UINT256_ZERO;
+    *pindexSelected = nullptr;
+    for (const auto& item : vSortedByTimestamp) {
+        auto it = mapBlocks.find(item.second);
+        if (it == mapBlocks.end())
+            return false;
+
+        const CBlockIndex* pindex = it->second;
+        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+            break;
+
+        if (fFirstRun) {
+            fModifierV2 = Params().GetConsensus().NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_POS_V2);
+            fFirstRun = false;
+        }
+
+        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+            continue;
+
+        uint256 hashProof;
+        if (fModifierV2)
+            hashProof = pindex->GetBlockHash();
+        else
+            hashProof = pindex->IsProofOfStake() ? UINT256_ZERO : pindex->GetBlockHash();
+
+        CDataStream ss(SER_GETHASH, 0);
+        ss << hashProof << nStakeModifierPrev;
+        arith_uint256 hashSelection = UintToArith256(Hash(ss.begin(), ss.end()));
+        if (pindex->IsProofOfStake())
+            hashSelection >>= 32;
+
+        if (fSelected && hashSelection < hashBest) {
+            hashBest = hashSelection;
+            *pindexSelected = pindex;
+        } else if (!fSelected) {
+            fSelected = true;
+            hashBest = hashSelection;
+            *pindexSelected = pindex;
+        }
+    }
+    return fSelected;
+}
+
+static bool RefSortedByTimestamp(const std::pair<int64_t, uint256>& a,
+                                 const std::pair<int64_t, uint256>& b)
+{
+    if (a.first == b.first) {
+        return UintToArith256(a.second) < UintToArith256(b.second);
+    }
+    return a.first < b.first;
+}
+
+static bool RefComputeNextStakeModifier(const TestBlockMap& mapBlocks, const CBlockIndex* pindexPrev,
+                                        uint64_t& nStakeModifier, bool& fGeneratedStakeModifier)
+{
+    // The first two modifiers don't select any block
+    if (!pindexPrev || pindexPrev->nHeight == 0)
+        return ComputeNextStakeModifier(pindexPrev, nStakeModifier, fGeneratedStakeModifier);
+
+    nStakeModifier = 0;
+    fGeneratedStakeModifier = false;
+
+    const CBlockIndex* p = pindexPrev;
+    while (p && p->pprev && !p->GeneratedStakeModifier()) p = p->pprev;
+    if (!p->GeneratedStakeModifier()) return false;
+    nStakeModifier = p->GetStakeModifierV1();
+    int64_t nModifierTime = p->GetBlockTime();
+
+    if (nModifierTime / MODIFIER_INTERVAL >= pindexPrev->GetBlockTime() / MODIFIER_INTERVAL)
+        return true;
+
+    std::vector<std::pair<int64_t, uint256> > vSortedByTimestamp;
+    int64_t nSelectionIntervalStart = (pindexPrev->GetBlockTime() / MODIFIER_INTERVAL) * MODIFIER_INTERVAL - OLD_MODIFIER_INTERVAL;
+    const CBlockIndex* pindex = pindexPrev;
+    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart) {
+        vSortedByTimestamp.emplace_back(pindex->GetBlockTime(), pindex->GetBlockHash());
+        pindex = pindex->pprev;
+    }
+    std::reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+    std::sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end(), RefSortedByTimestamp);
+
+    uint64_t nStakeModifierNew = 0;
+    int64_t nSelectionIntervalStop = nSelectionIntervalStart;
+    std::map<uint256, const CBlockIndex*> mapSelectedBlocks;
+    for (int nRound = 0; nRound < std::min(64, (int)vSortedByTimestamp.size()); nRound++) {
+        nSelectionIntervalStop += RefSelectionIntervalSection(nRound);
+        if (!RefSelectBlockFromCandidates(mapBlocks, vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+            return false;
+        nStakeModifierNew |= (((uint64_t)pindex->GetStakeEntropyBit()) << nRound);
+        mapSelectedBlocks.emplace(pindex->GetBlockHash(), pindex);
+    }
+
+    nStakeModifier = nStakeModifierNew;
+    fGeneratedStakeModifier = true;
+    return true;
+}
+
+// Reference: the old modifier of pindexFrom, walking chain forward
+static bool RefGetOldModifier(const CChain& chain, const CBlockIndex* pindexFrom, uint64_t& nStakeModifier)
+{
+    int64_t nStakeModifierTime = pindexFrom->GetBlockTime();
+    const CBlockIndex* pindex = pindexFrom;
+    const CBlockIndex* pindexNext = chain[pindex->nHeight + 1];
+    do {
+        if (!pindexNext) return false;
+        pindex = pindexNext;
+        if (pindex->GeneratedStakeModifier()) nStakeModifierTime = pindex->GetBlockTime();
+        pindexNext = chain[pindex->nHeight + 1];
+    } while (nStakeModifierTime < pindexFrom->GetBlockTime() + OLD_MODIFIER_INTERVAL);
+
+    nStakeModifier = pindex->GetStakeModifierV1();
+    return true;
+}
+
+// A branch of synthetic legacy blocks (with stable pointers)
+struct TestBranch
+{
+    std::vector<uint256> vHash;
+    std::vector<CBlockIndex> vIndex;
+
+    TestBranch(TestBlockMap& mapBlocks, CBlockIndex* pindexPrev, int nBlocks) : vHash(nBlocks), vIndex(nBlocks)
+    {
+        for (int i = 0; i < nBlocks; i++) {
+            CBlockIndex& index = vIndex[i];
+            vHash[i] = InsecureRand256();
+            index.phashBlock = &vHash[i];
+            index.pprev = i > 0 ? &vIndex[i - 1] : pindexPrev;
+            index.nHeight = index.pprev ? index.pprev->nHeight + 1 : 0;
+            // block times are not monotonic
+            index.nTime = index.pprev ? index.pprev->nTime + InsecureRandRange(150) - 30 : 1500000000;
+            if (InsecureRandBool()) index.SetProofOfStake();
+            index.BuildSkip();
+
+            uint64_t nModifier = 0, nRefModifier = 0;
+            bool fGenerated = false, fRefGenerated = false;
+            BOOST_CHECK(ComputeNextStakeModifier(index.pprev, nModifier, fGenerated));
+            BOOST_CHECK(RefComputeNextStakeModifier(mapBlocks, index.pprev, nRefModifier, fRefGenerated));
+            BOOST_CHECK_EQUAL(nModifier, nRefModifier);
+            BOOST_CHECK_EQUAL(fGenerated, fRefGenerated);
+            index.SetStakeModifier(nModifier, fGenerated);
+            mapBlocks.emplace(vHash[i], &index);
+        }
+    }
+
+    CBlockIndex* Tip() { return &vIndex.back(); }
+};
+
+static void CheckOldModifierIndex(COldModifierIndex& modifierIndex, const CChain& chain)
+{
+    int nResolved = 0;
+    for (int h = 0; h <= chain.Height(); h++) {
+        uint64_t nModifier = 0, nRefModifier = 0;
+        const bool fFound = modifierIndex.Get(chain, chain[h], nModifier);
+        BOOST_CHECK_EQUAL(fFound, RefGetOldModifier(chain, chain[h], nRefModifier));
+        BOOST_CHECK_EQUAL(nModifier, nRefModifier);
+        if (fFound) nResolved++;
+    }
+    // only the last blocks wait for their modifier
+    BOOST_CHECK(nResolved > chain.Height() - 100);
+}
+
+BOOST_AUTO_TEST_CASE(old_modifier_selection_and_index)
+{
+    // Cover the selection hashes both before and after the PoS v2 upgrade
+    const int nPosV2Height = Params().GetConsensus().vUpgrades[Consensus::UPGRADE_POS_V2].nActivationHeight;
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_POS_V2, 1500);
+
+    TestBlockMap mapBlocks;
+    TestBranch mainBranch(mapBlocks, nullptr, 3000);
+    CChain chain;
+    chain.SetTip(mainBranch.Tip());
+    COldModifierIndex modifierIndex;
+    modifierIndex.Load(chain);
+    CheckOldModifierIndex(modifierIndex, chain);
+
+    // shallow reorg: the index is rewound to the fork
+    TestBranch shallowFork(mapBlocks, &mainBranch.vIndex[2950], 80);
+    chain.SetTip(shallowFork.Tip());
+    CheckOldModifierIndex(modifierIndex, chain);
+    uint64_t nModifier;
+    BOOST_CHECK(!modifierIndex.Get(chain, &mainBranch.vIndex[2960], nModifier));
+
+    // and back to the original branch
+    chain.SetTip(mainBranch.Tip());
+    CheckOldModifierIndex(modifierIndex, chain);
+    BOOST_CHECK(!modifierIndex.Get(chain, &shallowFork.vIndex[10], nModifier));
+
+    // reorg deeper than MAX_REWIND_DEPTH: the index is rebuilt
+    TestBranch deepFork(mapBlocks, &mainBranch.vIndex[500], 2700);
+    chain.SetTip(deepFork.Tip());
+    CheckOldModifierIndex(modifierIndex, chain);
+    BOOST_CHECK(!modifierIndex.Get(chain, &mainBranch.vIndex[1000], nModifier));
+
+    // tip moved back (blocks disconnected without a new branch)
+    chain.SetTip(&deepFork.vIndex[2000]);
+    CheckOldModifierIndex(modifierIndex, chain);
+
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_POS_V2, nPosV2Height);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
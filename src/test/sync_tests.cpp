@@ -4,6 +4,7 @@
 
 #include "sync.h"
 #include "test/test_pivx.h"
+#include "utiltime.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -49,4 +50,54 @@ BOOST_AUTO_TEST_CASE(potential_deadlock_detected)
     #endif
 }
 
+BOOST_AUTO_TEST_CASE(lock_profile)
+{
+    Mutex mutex;
+    int nLine = 0;
+    auto FindSite = [&nLine]() {
+        for (const LockSiteStats& stats : GetLockProfile()) {
+            if (stats.line == nLine && stats.name == "mutex") return stats;
+        }
+        return LockSiteStats{"", "", 0, 0, 0, 0, 0, {}};
+    };
+    auto LockIt = [&mutex, &nLine]() {
+        nLine = __LINE__ + 1;
+        LOCK(mutex);
+    };
+
+    // Not recorded while disabled
+    LockIt();
+    BOOST_CHECK_EQUAL(FindSite().nAcquired, 0U);
+
+    EnableLockProfiling(true);
+    LockIt();
+    LockIt();
+    LockSiteStats stats = FindSite();
+    BOOST_CHECK_EQUAL(stats.nAcquired, 2U);
+    BOOST_CHECK_EQUAL(stats.nContended, 0U);
+    BOOST_CHECK_EQUAL(stats.vHoldHistogram.size(), (size_t)LockSite::HOLD_BUCKETS);
+
+    // Contended acquisition: the lock is held by another thread for 50ms
+    std::atomic<bool> fLocked{false};
+    std::thread holder([&mutex, &fLocked]() {
+        LOCK(mutex);
+        fLocked = true;
+        UninterruptibleSleep(std::chrono::milliseconds{50});
+    });
+    while (!fLocked) std::this_thread::yield();
+    LockIt();
+    holder.join();
+    stats = FindSite();
+    BOOST_CHECK_EQUAL(stats.nAcquired, 3U);
+    BOOST_CHECK_EQUAL(stats.nContended, 1U);
+    BOOST_CHECK(stats.nWaitMicros > 0);
+    uint64_t nHolds = 0;
+    for (uint64_t n : stats.vHoldHistogram) nHolds += n;
+    BOOST_CHECK_EQUAL(nHolds, 3U);
+
+    EnableLockProfiling(false);
+    ResetLockProfile();
+    BOOST_CHECK_EQUAL(FindSite().nAcquired, 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 
 #include "blockassembler.h"
 #include "consensus/merkle.h"
+#include "crypto/sha256.h"
 #include "bls/bls_wrapper.h"
 #include "guiinterface.h"
 #include "evo/deterministicmns.h"
@@ -20,6 +21,7 @@
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "pow.h"
+#include "sapling/sapling_validation.h"
 #include "script/sigcache.h"
 #include "sporkdb.h"
 #include "streams.h"
@@ -67,10 +69,12 @@ std::ostream& operator<<(std::ostream& os, const uint256& num)
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
     : m_path_root{fs::temp_directory_path() / "test_pivx" / std::to_string(g_insecure_rand_ctx_temp_path.rand32())}
 {
+    SHA256AutoDetect();
     ECC_Start();
     BLSInit();
     SetupEnvironment();
     InitSignatureCache();
+    InitSaplingProofsCache();
     fCheckBlockIndex = true;
     SelectParams(chainName);
     SeedInsecureRand();
@@ -133,8 +137,9 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
             BOOST_CHECK(ok);
         }
         nScriptCheckThreads = 3;
-        for (int i=0; i < nScriptCheckThreads-1; i++)
+        for (int i=0; i < nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+        }
         peerLogic.reset(new PeerLogicValidation(connman));
 }
 
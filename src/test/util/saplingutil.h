@@ -0,0 +1,33 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_TEST_UTIL_SAPLINGUTIL_H
+#define PIVX_TEST_UTIL_SAPLINGUTIL_H
+
+#include "primitives/transaction.h"
+#include "random.h"
+
+// Header only, so that the benchmarks can use it too.
+
+// Random note commitment, kept below the modulus of the field.
+inline uint256 GetRandomNoteCommitment()
+{
+    uint256 cm = GetRandHash();
+    *(cm.begin() + 31) &= 0x0f;
+    return cm;
+}
+
+// Shielded tx with a single output, only carrying a (random) note commitment.
+inline CTransactionRef MakeShieldedTxWithCommitment()
+{
+    CMutableTransaction mtx;
+    mtx.nVersion = CTransaction::TxVersion::SAPLING;
+    mtx.sapData = SaplingTxData();
+    OutputDescription output;
+    output.cmu = GetRandomNoteCommitment();
+    mtx.sapData->vShieldedOutput.emplace_back(output);
+    return MakeTransactionRef(mtx);
+}
+
+#endif // PIVX_TEST_UTIL_SAPLINGUTIL_H
@@ -4,9 +4,13 @@
 
 #include "test/test_pivx.h"
 #include "blockassembler.h"
+#include "blockcompression.h"
+#include "pow.h"
 #include "primitives/transaction.h"
 #include "sapling/sapling_validation.h"
+#include "stakeinput.h"
 #include "test/librust/utiltest.h"
+#include "undo.h"
 #include "util/blockstatecatcher.h"
 #include "wallet/test/wallet_test_fixture.h"
 
@@ -159,4 +163,215 @@ BOOST_FIXTURE_TEST_CASE(zerocoin_rejection_tests, WalletRegTestingSetup)
     CheckMempoolZcRejection(mtx, "bad-txns-zc-public-spend");
 }
 
+BOOST_FIXTURE_TEST_CASE(read_raw_block_from_disk, TestChain100Setup)
+{
+    const CBlockIndex* pindex = WITH_LOCK(cs_main, return chainActive.Tip(); );
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex));
+
+    // The raw bytes on disk are the network serialization of the block
+    std::vector<uint8_t> blockData;
+    BOOST_CHECK(ReadRawBlockFromDisk(blockData, pindex, Params().MessageStart()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(blockData == std::vector<uint8_t>(ss.begin(), ss.end()));
+
+    // Wrong magic bytes
+    CMessageHeader::MessageStartChars wrongStart = {0x00, 0x00, 0x00, 0x00};
+    BOOST_CHECK(!ReadRawBlockFromDisk(blockData, pindex, wrongStart));
+
+    // Bytes that don't hash to the requested block
+    CBlockIndex indexWrongPos = WITH_LOCK(cs_main, return *pindex; );
+    indexWrongPos.nDataPos = WITH_LOCK(cs_main, return pindex->pprev->nDataPos; );
+    BOOST_CHECK(!ReadRawBlockFromDisk(blockData, &indexWrongPos, Params().MessageStart()));
+}
+
+BOOST_FIXTURE_TEST_CASE(compressed_block_records, TestChain100Setup)
+{
+    // Blocks and undo data written while the compression is enabled
+    fBlockCompression = true;
+    const CBlock block = CreateAndProcessBlock({}, coinbaseKey);
+    fBlockCompression = false;
+    const CBlockIndex* pindex = WITH_LOCK(cs_main, return chainActive.Tip(); );
+    BOOST_CHECK(pindex->GetBlockHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(WITH_LOCK(cs_main, return GetBlockFileInfo(pindex->GetBlockPos().nFile)->nVersion; ), BLOCKFILE_VERSION_COMPRESSED);
+
+    // are read back transparently, together with the uncompressed ones
+    CBlock blockRead;
+    BOOST_CHECK(ReadBlockFromDisk(blockRead, pindex));
+    BOOST_CHECK(blockRead.GetHash() == block.GetHash());
+    BOOST_CHECK(ReadBlockFromDisk(blockRead, pindex->pprev));
+    CBlockUndo blockundo;
+    BOOST_CHECK(UndoReadFromDisk(blockundo, pindex));
+    BOOST_CHECK(UndoReadFromDisk(blockundo, pindex->pprev));
+
+    std::vector<uint8_t> blockData;
+    BOOST_CHECK(ReadRawBlockFromDisk(blockData, pindex, Params().MessageStart()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(blockData == std::vector<uint8_t>(ss.begin(), ss.end()));
+
+    // Corrupt payloads are rejected
+    std::vector<unsigned char> vCompressed;
+    BOOST_CHECK(CompressRecord(blockData, vCompressed));
+    CDataStream ssDecompressed(SER_DISK, CLIENT_VERSION);
+    DecompressRecord(vCompressed, ssDecompressed);
+    BOOST_CHECK(std::vector<uint8_t>(ssDecompressed.begin(), ssDecompressed.end()) == blockData);
+    vCompressed.resize(vCompressed.size() - 1);
+    BOOST_CHECK_THROW(DecompressRecord(vCompressed, ssDecompressed), std::ios_base::failure);
+    vCompressed[0] = 0;
+    BOOST_CHECK_THROW(DecompressRecord(vCompressed, ssDecompressed), std::ios_base::failure);
+}
+
+BOOST_FIXTURE_TEST_CASE(headers_first_accept, TestChain100Setup)
+{
+    const CBlockIndex* pindexTip = WITH_LOCK(cs_main, return chainActive.Tip(); );
+    const CBlock block = CreateBlock({}, coinbaseKey);
+
+    // The header is accepted before the block
+    CBlockIndex* pindex = nullptr;
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(ProcessNewBlockHeaders({block.GetBlockHeader()}, state, &pindex));
+        BOOST_CHECK(pindex && pindex->GetBlockHash() == block.GetHash());
+        BOOST_CHECK(!(pindex->nStatus & BLOCK_HAVE_DATA));
+        BOOST_CHECK(pindex->vStakeModifier.empty());
+        // the best header moves with the block data only
+        BOOST_CHECK(pindexBestHeader == pindexTip);
+        BOOST_CHECK(chainActive.Tip() == pindexTip);
+
+        // Wrong difficulty
+        CBlockHeader header = block.GetBlockHeader();
+        header.nBits = UintToArith256(Params().GetConsensus().powLimit).GetCompact() - 1;
+        BOOST_CHECK(!ProcessNewBlockHeaders({header}, state, nullptr));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "bad-diffbits");
+
+        // Not connecting
+        header = block.GetBlockHeader();
+        header.hashPrevBlock = GetRandHash();
+        CValidationState state2;
+        BOOST_CHECK(!ProcessNewBlockHeaders({header}, state2, nullptr));
+        BOOST_CHECK_EQUAL(state2.GetRejectReason(), "prevblk-not-found");
+
+        // Neither does a longer fork of headers alone
+        std::vector<CBlockHeader> vFork;
+        uint256 hashPrev = pindexTip->pprev->GetBlockHash();
+        for (int i = 0; i < 3; i++) {
+            header = block.GetBlockHeader();
+            header.hashPrevBlock = hashPrev;
+            header.nTime = block.nTime + i + 1;
+            while (!CheckProofOfWork(header.GetHash(), header.nBits)) header.nNonce++;
+            hashPrev = header.GetHash();
+            vFork.emplace_back(header);
+        }
+        CBlockIndex* pindexFork = nullptr;
+        BOOST_CHECK(ProcessNewBlockHeaders(vFork, state, &pindexFork));
+        BOOST_CHECK(pindexFork && pindexFork->nChainWork > pindex->nChainWork);
+        BOOST_CHECK(pindexBestHeader == pindexTip);
+    }
+
+    // A block whose parent is known by its header only can't be accepted yet
+    std::shared_ptr<CBlock> pblockNext = std::make_shared<CBlock>(block);
+    pblockNext->hashPrevBlock = block.GetHash();
+    pblockNext->nTime = block.nTime + 1;
+    FinalizeBlock(pblockNext);
+    BOOST_CHECK(!ProcessNewBlock(pblockNext, nullptr));
+    BOOST_CHECK(WITH_LOCK(cs_main, return LookupBlockIndex(pblockNext->GetHash()); ) == nullptr);
+
+    // Then the block is received, and connected
+    BOOST_CHECK(ProcessNewBlock(std::make_shared<const CBlock>(block), nullptr));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip() == pindex);
+        BOOST_CHECK(pindexBestHeader == pindex);
+        BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_DATA);
+        BOOST_CHECK(!pindex->vStakeModifier.empty());
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(spent_stake_cache, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    const COutPoint prevout(coinbaseTxns[0].GetHash(), 0);
+    const CTxOut& prevOut = coinbaseTxns[0].vout[0];
+
+    CMutableTransaction spend;
+    spend.vin.emplace_back(prevout);
+    spend.vout.emplace_back(prevOut.nValue - CENT, scriptPubKey);
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    const CBlock block = CreateAndProcessBlock({spend}, scriptPubKey);
+    LOCK(cs_main);
+    CBlockIndex* pindexTip = chainActive.Tip();
+    BOOST_CHECK(pindexTip->GetBlockHash() == block.GetHash());
+    BOOST_CHECK(pcoinsTip->AccessCoin(prevout).IsSpent());
+
+    // The spent output is in the cache, with its origin height
+    CTxOut out;
+    int nHeight = -1;
+    BOOST_CHECK(g_spent_stakes.Get(prevout, out, nHeight));
+    BOOST_CHECK(out == prevOut);
+    BOOST_CHECK_EQUAL(nHeight, 1);
+
+    // and can be used as stake input by a block on a fork
+    std::unique_ptr<CPivStake> stake(CPivStake::NewPivStake(CTxIn(prevout), pindexTip->nHeight, pindexTip->nTime));
+    BOOST_CHECK(stake);
+    BOOST_CHECK_EQUAL(stake->GetValue(), prevOut.nValue);
+    BOOST_CHECK_EQUAL(stake->GetIndexFrom()->nHeight, 1);
+
+    // Verifying the chain disconnects and reconnects the blocks on a scratch view only
+    FlushStateToDisk();
+    BOOST_CHECK(CVerifyDB().VerifyDB(pcoinsdbview.get(), 4, 2));
+    BOOST_CHECK(g_spent_stakes.Get(prevout, out, nHeight));
+
+    // Once the block is disconnected, the output is unspent again
+    CValidationState state;
+    BOOST_CHECK(InvalidateBlock(state, Params(), pindexTip));
+    BOOST_CHECK(!pcoinsTip->AccessCoin(prevout).IsSpent());
+    BOOST_CHECK(!g_spent_stakes.Get(prevout, out, nHeight));
+}
+
+BOOST_FIXTURE_TEST_CASE(block_prefetcher, TestChain100Setup)
+{
+    std::vector<CBlockIndex*> vpindex;
+    {
+        LOCK(cs_main);
+        for (int h = 50; h <= 90; h++) vpindex.emplace_back(chainActive[h]);
+
+        CBlockPrefetcher prefetcher;
+        prefetcher.Prefetch(vpindex);
+        std::shared_ptr<const CBlock> pblock = prefetcher.Get(vpindex[0]);
+        BOOST_CHECK(pblock && pblock->GetHash() == vpindex[0]->GetBlockHash());
+        // only the first BLOCK_PREFETCH_DEPTH blocks are read
+        BOOST_CHECK(!prefetcher.Get(vpindex[BLOCK_PREFETCH_DEPTH]));
+        // a block is returned once
+        BOOST_CHECK(!prefetcher.Get(vpindex[0]));
+
+        // The window moves on: the blocks left behind are dropped
+        prefetcher.Prefetch(std::vector<CBlockIndex*>(vpindex.begin() + 5, vpindex.end()));
+        BOOST_CHECK(!prefetcher.Get(vpindex[1]));
+        for (int i = 5; i < 5 + BLOCK_PREFETCH_DEPTH; i++) {
+            pblock = prefetcher.Get(vpindex[i]);
+            BOOST_CHECK(pblock && pblock->GetHash() == vpindex[i]->GetBlockHash());
+        }
+    }
+
+    // Reconnect more blocks than an ActivateBestChain step, through the prefetched blocks
+    CBlockIndex* pindexTip = WITH_LOCK(cs_main, return chainActive.Tip(); );
+    CValidationState state;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(InvalidateBlock(state, Params(), vpindex[0]));
+        BOOST_CHECK(chainActive.Height() == vpindex[0]->nHeight - 1);
+        BOOST_CHECK(ReconsiderBlock(state, vpindex[0]));
+    }
+    BOOST_CHECK(ActivateBestChain(state));
+    BOOST_CHECK(WITH_LOCK(cs_main, return chainActive.Tip(); ) == pindexTip);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -29,6 +29,8 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 // static const char DB_MONEY_SUPPLY = 'M';
+static const char DB_UTXO_SUPPLY = 'U';
+static const char DB_VERSION = 'V';
 
 namespace {
 
@@ -74,11 +76,45 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
+bool CCoinsViewDB::GetMoneySupply(CAmount& nSupply) const
+{
+    const uint256& hashBestChain = GetBestBlock();
+    if (hashBestChain.IsNull()) {
+        // Empty database (or interrupted flush)
+        nSupply = 0;
+        return GetHeadBlocks().empty();
+    }
+    std::pair<uint256, CAmount> supply;
+    if (!db.Read(DB_UTXO_SUPPLY, supply) || supply.first != hashBestChain) {
+        return false;
+    }
+    nSupply = supply.second;
+    return true;
+}
+
+bool CCoinsViewDB::WriteMoneySupply(const CAmount& nSupply)
+{
+    return db.Write(DB_UTXO_SUPPLY, std::make_pair(GetBestBlock(), nSupply));
+}
+
+int CCoinsViewDB::GetVersion() const
+{
+    int nVersion = 0;
+    db.Read(DB_VERSION, nVersion);
+    return nVersion;
+}
+
+bool CCoinsViewDB::WriteVersion(int nVersion)
+{
+    return db.Write(DB_VERSION, nVersion, true);
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins,
                               const uint256& hashBlock,
                               const uint256& hashSaplingAnchor,
                               CAnchorsSaplingMap& mapSaplingAnchors,
-                              CNullifiersMap& mapSaplingNullifiers)
+                              CNullifiersMap& mapSaplingNullifiers,
+                              const CAmount& nSupplyDelta)
 {
     CDBBatch batch(CLIENT_VERSION);
     size_t count = 0;
@@ -87,6 +123,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins,
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
+    // The running supply can be updated only if it's known at the current best block
+    CAmount nSupply = 0;
+    const bool fSupplyKnown = GetMoneySupply(nSupply);
+
     uint256 old_tip = GetBestBlock();
     if (old_tip.IsNull()) {
         // We may be in the middle of replaying.
@@ -133,6 +173,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins,
     // Write Sapling
     BatchWriteSapling(hashSaplingAnchor, mapSaplingAnchors, mapSaplingNullifiers, batch);
 
+    // Update the sum of the unspent outputs values (or invalidate it, if it was unknown)
+    if (fSupplyKnown) {
+        batch.Write(DB_UTXO_SUPPLY, std::make_pair(hashBlock, nSupply + nSupplyDelta));
+    } else {
+        batch.Erase(DB_UTXO_SUPPLY);
+    }
+
     // In the last batch, mark the database as consistent with hashBlock again.
     batch.Erase(DB_HEAD_BLOCKS);
     batch.Write(DB_BEST_BLOCK, hashBlock);
@@ -12,6 +12,9 @@
 #include "dbwrapper.h"
 #include "libzerocoin/Coin.h"
 #include "libzerocoin/CoinSpend.h"
+#include "saltedhasher.h"
+#include "sync.h"
+#include "unordered_lru_cache.h"
 
 #include <map>
 #include <string>
@@ -66,6 +69,16 @@ struct CDiskTxPos : public FlatFilePos
     }
 };
 
+//! Format version of the chainstate database.
+//! 1: Sapling anchors stored as deltas (DB_SAPLING_ANCHOR_DELTA), that older releases can't read.
+static const int CHAINSTATE_VERSION = 1;
+
+//! Sapling anchors are stored as the note commitments appended to the previous anchor,
+//! with a full tree (checkpoint) at least every this many anchors.
+static const uint32_t SAPLING_ANCHOR_CHECKPOINT_INTERVAL = 100;
+//! Number of materialized Sapling trees kept in memory by the coin database
+static const size_t SAPLING_ANCHOR_LRU_CACHE_SIZE = 256;
+
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
@@ -89,7 +102,18 @@ public:
                     const uint256& hashBlock,
                     const uint256& hashSaplingAnchor,
                     CAnchorsSaplingMap& mapSaplingAnchors,
-                    CNullifiersMap& mapSaplingNullifiers) override;
+                    CNullifiersMap& mapSaplingNullifiers,
+                    const CAmount& nSupplyDelta) override;
+
+    //! Get the sum of the unspent outputs values, kept updated at every BatchWrite.
+    //! Returns false if it's not known at the current best block (e.g. after an upgrade or an interrupted flush).
+    bool GetMoneySupply(CAmount& nSupply) const;
+    //! Store the sum of the unspent outputs values at the current best block (e.g. after a full scan)
+    bool WriteMoneySupply(const CAmount& nSupply);
+
+    //! Format version of the database (0 if it was written by a release before CHAINSTATE_VERSION 1)
+    int GetVersion() const;
+    bool WriteVersion(int nVersion);
 
     // Sapling, the implementation of the following functions can be found in sapling_txdb.cpp.
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const override;
@@ -99,6 +123,19 @@ public:
                            CAnchorsSaplingMap& mapSaplingAnchors,
                            CNullifiersMap& mapSaplingNullifiers,
                            CDBBatch& batch);
+
+private:
+    mutable Mutex cs_saplingAnchors;
+    //! Recently read or written Sapling trees, by root
+    mutable unordered_lru_cache<uint256, SaplingMerkleTree, StaticSaltedHasher> saplingAnchorsLRUCache GUARDED_BY(cs_saplingAnchors){SAPLING_ANCHOR_LRU_CACHE_SIZE};
+
+    //! Rebuild the tree of rt from the closest full tree and the deltas stored after it.
+    bool ReadSaplingAnchor(const uint256& rt, SaplingMerkleTree& tree) const;
+    //! Number of deltas between rt and the closest full tree, looking first at the anchors being written.
+    uint32_t GetSaplingAnchorDepth(const uint256& rt,
+                                   const CAnchorsSaplingMap& mapSaplingAnchors,
+                                   std::unordered_map<uint256, uint32_t, SaltedIdHasher>& mapDepths) const;
+    void BatchWriteSaplingAnchors(CDBBatch& batch, CAnchorsSaplingMap& mapSaplingAnchors);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -0,0 +1,59 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "util/workerpool.h"
+
+#include "ctpl_stl.h"
+#include "util/system.h"
+#include "util/threadnames.h"
+
+#include <algorithm>
+#include <future>
+#include <vector>
+
+//! Whether the current thread is a worker of the shared pool (set by the first range it runs)
+static thread_local bool fSharedPoolWorker = false;
+
+CWorkerPool::CWorkerPool(int nThreadsIn, const char* nameIn) : nThreads(std::max(1, nThreadsIn)), name(nameIn) {}
+
+CWorkerPool::~CWorkerPool() = default;
+
+ctpl::thread_pool& CWorkerPool::Get()
+{
+    std::call_once(created, [this]() {
+        pool = std::make_unique<ctpl::thread_pool>(nThreads);
+        RenameThreadPool(*pool, name);
+    });
+    return *pool;
+}
+
+static ctpl::thread_pool& GetSharedWorkerPool()
+{
+    static CWorkerPool sharedPool(GetNumCores(), "pivx-worker");
+    return sharedPool.Get();
+}
+
+void ParallelForRanges(size_t nItems, const std::function<void(size_t, size_t)>& func)
+{
+    if (nItems == 0) return;
+    if (fSharedPoolWorker) {
+        func(0, nItems);
+        return;
+    }
+
+    ctpl::thread_pool& pool = GetSharedWorkerPool();
+    const size_t nBatches = std::min((size_t)pool.size(), nItems);
+    const size_t nBatchSize = (nItems + nBatches - 1) / nBatches;
+    std::vector<std::future<void>> futures;
+    for (size_t start = 0; start < nItems; start += nBatchSize) {
+        const size_t end = std::min(start + nBatchSize, nItems);
+        futures.emplace_back(pool.push([&func, start, end](int threadId) {
+            fSharedPoolWorker = true;
+            func(start, end);
+        }));
+    }
+    for (auto& f : futures) {
+        f.get();
+    }
+}
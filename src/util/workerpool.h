@@ -0,0 +1,44 @@
+// Copyright (c) 2021 The PIVX Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef PIVX_UTIL_WORKERPOOL_H
+#define PIVX_UTIL_WORKERPOOL_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace ctpl {
+    class thread_pool;
+}
+
+/**
+ * A worker pool created on first use, with its threads named "<name>-<n>".
+ * Meant to be a static object of the module using it.
+ */
+class CWorkerPool
+{
+private:
+    const int nThreads;
+    const char* const name;
+    std::once_flag created;
+    std::unique_ptr<ctpl::thread_pool> pool;
+
+public:
+    CWorkerPool(int nThreadsIn, const char* nameIn);
+    ~CWorkerPool();
+
+    ctpl::thread_pool& Get();
+};
+
+/**
+ * Call func(start, end) on consecutive ranges of [0, nItems), one for each thread of the
+ * worker pool shared by the CPU bound work split among all the cores (Sapling trial
+ * decryptions and witness updates, merkle tree hashes...), and wait for them.
+ * Called from a worker of that pool (nested work), the ranges are processed by the
+ * calling thread, as the pool may have no idle thread.
+ */
+void ParallelForRanges(size_t nItems, const std::function<void(size_t, size_t)>& func);
+
+#endif // PIVX_UTIL_WORKERPOOL_H
@@ -11,6 +11,7 @@
 #include "validation.h"
 
 #include "addrman.h"
+#include "blockcompression.h"
 #include "blocksignature.h"
 #include "budget/budgetmanager.h"
 #include "chainparams.h"
@@ -21,6 +22,7 @@
 #include "consensus/tx_verify.h"
 #include "consensus/validation.h"
 #include "consensus/zerocoin_verify.h"
+#include "ctpl_stl.h"
 #include "evo/evodb.h"
 #include "evo/specialtx_validation.h"
 #include "flatfile.h"
@@ -35,16 +37,20 @@
 #include "policy/policy.h"
 #include "pow.h"
 #include "reverse_iterate.h"
+#include "sapling/sapling_validation.h"
 #include "script/sigcache.h"
 #include "shutdown.h"
 #include "spork.h"
 #include "sporkdb.h"
+#include "stakeinput.h"
 #include "tiertwo/tiertwo_sync_state.h"
 #include "txdb.h"
 #include "undo.h"
 #include "util/blockstatecatcher.h"
 #include "util/system.h"
+#include "util/threadnames.h"
 #include "util/validation.h"
+#include "util/workerpool.h"
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 #include "warnings.h"
@@ -96,6 +102,7 @@ std::atomic<bool> fReindex{false};
 bool fTxIndex = true;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
+bool fBlockCompression = DEFAULT_BLOCK_COMPRESSION;
 size_t nCoinCacheUsage = 5000 * 300;
 
 /* If the tip is older than this (in seconds), the node is considered to be in initial block download. */
@@ -685,14 +692,27 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, uint256& hashBl
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                FlatFilePos posRecord(postx.nFile, postx.nPos - RECORD_HEADER_SIZE);
+                CAutoFile file(OpenBlockFile(posRecord, true), SER_DISK, CLIENT_VERSION);
                 if (file.IsNull())
                     return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
                 try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
+                    unsigned char pchMessageStart[4];
+                    uint32_t nSize;
+                    file >> pchMessageStart >> nSize;
+                    if (nSize & RECORD_COMPRESSED_FLAG) {
+                        // The offset of the transaction is relative to the uncompressed block
+                        CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+                        ReadCompressedRecord(file, nSize, ssBlock);
+                        ssBlock >> header;
+                        ssBlock.ignore(postx.nTxOffset);
+                        ssBlock >> txOut;
+                    } else {
+                        file >> header;
+                        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    }
                 } catch (const std::exception& e) {
                     return error("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
@@ -734,7 +754,7 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, uint256& hashBl
 // CBlock and CBlockIndex
 //
 
-bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos)
+bool WriteBlockToDisk(const DiskRecord& record, FlatFilePos& pos)
 {
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
@@ -742,15 +762,14 @@ bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos)
         return error("WriteBlockToDisk : OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(block, fileout.GetVersion());
-    fileout << Params().MessageStart() << nSize;
+    fileout << Params().MessageStart() << record.GetHeaderSize();
 
     // Write block
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("WriteBlockToDisk : ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    fileout.write((const char*)record.vData.data(), record.vData.size());
 
     return true;
 }
@@ -759,14 +778,17 @@ bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    // Open history file to read, at the header of the record
+    FlatFilePos posRecord(pos.nFile, pos.nPos - RECORD_HEADER_SIZE);
+    CAutoFile filein(OpenBlockFile(posRecord, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk : OpenBlockFile failed");
 
     // Read block
     try {
-        filein >> block;
+        CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+        ReadDiskRecord(filein, ssBlock);
+        ssBlock >> block;
     } catch (const std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -780,6 +802,73 @@ bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos)
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start)
+{
+    FlatFilePos hpos = pos;
+    hpos.nPos -= RECORD_HEADER_SIZE; // Seek back to the record header (magic and size)
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+    }
+
+    try {
+        CMessageHeader::MessageStartChars blk_start;
+        unsigned int blk_size;
+
+        filein >> blk_start >> blk_size;
+
+        if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
+            return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
+                    HexStr(blk_start),
+                    HexStr(message_start));
+        }
+
+        if (blk_size & RECORD_COMPRESSED_FLAG) {
+            CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+            ReadCompressedRecord(filein, blk_size, ssBlock);
+            block.assign(ssBlock.begin(), ssBlock.end());
+            return true;
+        }
+
+        if (blk_size > MAX_SIZE) {
+            return error("%s: Block data is larger than maximum deserialization size for %s: %s versus %s", __func__, pos.ToString(),
+                    blk_size, MAX_SIZE);
+        }
+
+        block.resize(blk_size); // Zeroing of memory is intentional here
+        filein.read((char*)block.data(), blk_size);
+    } catch (const std::exception& e) {
+        return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+/** Maximum size of a serialized block header: 80 bytes, plus the accumulator checkpoint or the sapling root */
+static const size_t MAX_BLOCK_HEADER_SIZE = 112;
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+{
+    FlatFilePos block_pos = WITH_LOCK(cs_main, return pindex->GetBlockPos(); );
+    if (!ReadRawBlockFromDisk(block, block_pos, message_start))
+        return false;
+
+    // The raw bytes are relayed as they are: check at least that they hold the requested block
+    CBlockHeader header;
+    try {
+        const char* pbegin = (const char*)block.data();
+        CDataStream ssHeader(pbegin, pbegin + std::min(block.size(), MAX_BLOCK_HEADER_SIZE), SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader >> header;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s for %s", __func__, e.what(), block_pos.ToString());
+    }
+    if (header.GetHash() != pindex->GetBlockHash()) {
+        return error("%s: Block hash mismatch for %s: %s versus expected %s", __func__, block_pos.ToString(),
+                header.GetHash().ToString(), pindex->GetBlockHash().ToString());
+    }
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
 {
     FlatFilePos blockPos = WITH_LOCK(cs_main, return pindex->GetBlockPos(); );
@@ -1184,7 +1273,7 @@ static bool AbortNode(CValidationState& state, const std::string& strMessage, co
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint256& hashBlock)
+bool UndoWriteToDisk(const CBlockUndo& blockundo, const DiskRecord& record, FlatFilePos& pos, const uint256& hashBlock)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
@@ -1192,17 +1281,16 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint25
         return error("%s : OpenUndoFile failed", __func__);
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(blockundo, fileout.GetVersion());
-    fileout << Params().MessageStart() << nSize;
+    fileout << Params().MessageStart() << record.GetHeaderSize();
 
     // Write undo data
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("%s : ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    fileout.write((const char*)record.vData.data(), record.vData.size());
 
-    // calculate & write checksum
+    // calculate & write checksum (of the uncompressed undo data)
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
@@ -1213,15 +1301,18 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, FlatFilePos& pos, const uint25
 
 bool UndoReadFromDisk(CBlockUndo& blockundo, const FlatFilePos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    // Open history file to read, at the header of the record
+    FlatFilePos posRecord(pos.nFile, pos.nPos - RECORD_HEADER_SIZE);
+    CAutoFile filein(OpenUndoFile(posRecord, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("%s : OpenBlockFile failed", __func__);
 
     // Read block
     uint256 hashChecksum;
-    CHashVerifier<CAutoFile> verifier(&filein); // We need a CHashVerifier as reserializing may lose data
+    CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+    CHashVerifier<CDataStream> verifier(&ssUndo); // We need a CHashVerifier as reserializing may lose data
     try {
+        ReadDiskRecord(filein, ssUndo);
         verifier << hashBlock;
         verifier >> blockundo;
         filein >> hashChecksum;
@@ -1238,6 +1329,15 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const FlatFilePos& pos, const uint2
 
 } // anon namespace
 
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    const FlatFilePos pos = pindex->GetUndoPos();
+    if (pos.IsNull() || !pindex->pprev) {
+        return error("%s : no undo data available for block %s", __func__, pindex->GetBlockHash().ToString());
+    }
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
+}
+
 enum DisconnectResult
 {
     DISCONNECT_OK,      // All good.
@@ -1406,14 +1506,63 @@ void static FlushBlockFile(bool fFinalize = false)
     }
 }
 
-bool FindUndoPos(CValidationState& state, int nFile, FlatFilePos& pos, unsigned int nAddSize);
+bool FindUndoPos(CValidationState& state, int nFile, FlatFilePos& pos, unsigned int nAddSize, bool fCompressed);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+/**
+ * A check of the block verification queue: the scripts of one input, the
+ * Sapling proofs of one transaction or the signatures of one zerocoin spend.
+ * A single pool of threads verifies all of them.
+ */
+class CBlockCheck
+{
+private:
+    enum CheckType { SCRIPT, SAPLING, ZEROCOIN };
+    CheckType type{SCRIPT};
+    CScriptCheck scriptCheck;
+    CSaplingCheck saplingCheck;
+    CZerocoinSpendCheck zerocoinCheck;
+
+public:
+    CBlockCheck() {}
+    explicit CBlockCheck(CScriptCheck& check) : type(SCRIPT) { scriptCheck.swap(check); }
+    explicit CBlockCheck(CSaplingCheck& check) : type(SAPLING) { saplingCheck.swap(check); }
+    explicit CBlockCheck(CZerocoinSpendCheck& check) : type(ZEROCOIN) { zerocoinCheck.swap(check); }
+
+    bool operator()()
+    {
+        if (type == SAPLING) return saplingCheck();
+        if (type == ZEROCOIN) return zerocoinCheck();
+        return scriptCheck();
+    }
+
+    void swap(CBlockCheck& check)
+    {
+        std::swap(type, check.type);
+        scriptCheck.swap(check.scriptCheck);
+        saplingCheck.swap(check.saplingCheck);
+        zerocoinCheck.swap(check.zerocoinCheck);
+    }
+};
+
+static CCheckQueue<CBlockCheck> blockcheckqueue(128);
 
 void ThreadScriptCheck()
 {
     util::ThreadRename("pivx-scriptch");
-    scriptcheckqueue.Thread();
+    blockcheckqueue.Thread();
+}
+
+// Queue the checks of a transaction
+template <typename T>
+static void AddBlockChecks(CCheckQueueControl<CBlockCheck>& control, std::vector<T>& vChecks)
+{
+    if (vChecks.empty()) return;
+    std::vector<CBlockCheck> vBlockChecks;
+    vBlockChecks.reserve(vChecks.size());
+    for (auto& check : vChecks) {
+        vBlockChecks.emplace_back(check);
+    }
+    control.Add(vBlockChecks);
 }
 
 static int64_t nTimeVerify = 0;
@@ -1424,8 +1573,9 @@ static int64_t nTimeTotal = 0;
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
-static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pblockundoOut is not null, it receives the undo data of the block (the outputs it spends). */
+static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck = false, CBlockUndo* pblockundoOut = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
@@ -1509,7 +1659,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         exchangeAddrActivated = consensus.NetworkUpgradeActive(pindex->pprev->nHeight, Consensus::UPGRADE_V5_6);
     }
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : nullptr);
+    // Scripts and zerocoin spends are verified in parallel by the check queue workers (when available)
+    CCheckQueueControl<CBlockCheck> control(nScriptCheckThreads ? &blockcheckqueue : nullptr);
 
     int64_t nTimeStart = GetTimeMicros();
     CAmount nFees = 0;
@@ -1528,6 +1679,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     // Sapling
     SaplingMerkleTree sapling_tree;
     assert(view.GetSaplingAnchorAt(view.GetBestAnchor(), sapling_tree));
+    std::vector<uint256> vSaplingCommitments;
 
     std::vector<PrecomputedTransactionData> precomTxData;
     precomTxData.reserve(block.vtx.size()); // Required so that pointers to individual precomTxData don't get invalidated
@@ -1549,9 +1701,12 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         // When v5 is enforced ContextualCheckTransaction rejects zerocoin transactions.
         // Therefore no need to call HasZerocoinSpendInputs after the enforcement.
         if (!isV5UpgradeEnforced && tx.HasZerocoinSpendInputs()) {
-            if (!ParseAndValidateZerocoinSpends(consensus, tx, pindex->nHeight, state, vSpends)) {
+            std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+            if (!ParseAndValidateZerocoinSpends(consensus, tx, pindex->nHeight, state, vSpends,
+                                                nScriptCheckThreads ? &vZerocoinChecks : nullptr)) {
                 return false; // Invalidity/DoS is handled by the function.
             }
+            AddBlockChecks(control, vZerocoinChecks);
         } else if (!tx.IsCoinBase()) {
             if (!view.HaveInputs(tx)) {
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-missingorspent");
@@ -1590,7 +1745,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
             if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, precomTxData[i], nScriptCheckThreads ? &vChecks : nullptr))
                 return error("%s: Check inputs on %s failed with %s", __func__, tx.GetHash().ToString(), FormatStateMessage(state));
-            control.Add(vChecks);
+            AddBlockChecks(control, vChecks);
         }
         nValueOut += txValueOut;
 
@@ -1601,10 +1756,10 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         const bool fSkipInvalid = SkipInvalidUTXOS(pindex->nHeight);
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight, fSkipInvalid);
 
-        // Sapling update tree
+        // Sapling note commitments, appended to the tree at once
         if (tx.IsShieldedTx() && !tx.sapData->vShieldedOutput.empty()) {
             for(const OutputDescription &outputDescription : tx.sapData->vShieldedOutput) {
-                sapling_tree.append(outputDescription.cmu);
+                vSaplingCommitments.emplace_back(outputDescription.cmu);
             }
         }
 
@@ -1612,8 +1767,11 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         pos.nTxOffset += ::GetSerializeSize(tx, CLIENT_VERSION);
     }
 
+    // Sapling update tree
+    sapling_tree.append(vSaplingCommitments);
+
     // Push new tree anchor
-    view.PushAnchor(sapling_tree);
+    view.PushAnchor(sapling_tree, vSaplingCommitments);
 
     // Verify header correctness
     if (isV5UpgradeEnforced) {
@@ -1683,9 +1841,10 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     if (pindex->GetUndoPos().IsNull() || !pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
         if (pindex->GetUndoPos().IsNull()) {
             FlatFilePos diskPosBlock;
-            if (!FindUndoPos(state, pindex->nFile, diskPosBlock, ::GetSerializeSize(blockundo, CLIENT_VERSION) + 40))
+            const DiskRecord record = MakeDiskRecord(blockundo, fBlockCompression);
+            if (!FindUndoPos(state, pindex->nFile, diskPosBlock, record.vData.size() + 40, record.fCompressed))
                 return error("ConnectBlock() : FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, diskPosBlock, pindex->pprev->GetBlockHash()))
+            if (!UndoWriteToDisk(blockundo, record, diskPosBlock, pindex->pprev->GetBlockHash()))
                 return AbortNode(state, "Failed to write undo data");
 
             // update nUndoPos in block index
@@ -1733,6 +1892,9 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         invalid_out::setInvalidOutPoints.clear();
     }
 
+    if (pblockundoOut) {
+        *pblockundoOut = std::move(blockundo);
+    }
     return true;
 }
 
@@ -1828,9 +1990,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 return AbortNode(state, "Failed to commit EvoDB");
             }
             nLastFlush = nNow;
-            // Update money supply on memory, reading data from disk
-            if (!ShutdownRequested() && !IsInitialBlockDownload()) {
-                MoneySupply.Update(pcoinsTip->GetTotalAmount(), chainActive.Height());
+            // Update money supply on memory, reading the running total from disk
+            if (!ShutdownRequested()) {
+                UpdateMoneySupply();
             }
         }
         if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
@@ -1845,6 +2007,26 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     return true;
 }
 
+void UpdateMoneySupply(bool fFullScan)
+{
+    AssertLockHeld(cs_main);
+    CAmount nSupply = 0;
+    const bool fKnown = pcoinsdbview->GetMoneySupply(nSupply);
+    if (fFullScan || !fKnown) {
+        // Sum the value of all the unspent outputs in the coins db
+        const CAmount nScanned = pcoinsTip->GetTotalAmount();
+        if (fKnown && nScanned != nSupply) {
+            LogPrintf("%s: WARNING: running money supply %s differs from UTXO set scan %s\n",
+                      __func__, FormatMoney(nSupply), FormatMoney(nScanned));
+        }
+        nSupply = nScanned;
+        if (!pcoinsdbview->WriteMoneySupply(nSupply)) {
+            LogPrintf("%s: failed to write money supply to disk\n", __func__);
+        }
+    }
+    MoneySupply.Update(nSupply, chainActive.Height());
+}
+
 void FlushStateToDisk()
 {
     CValidationState state;
@@ -1934,6 +2116,8 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
         assert(flushed);
         dbTx->Commit();
     }
+    // The inputs of the block are unspent again
+    g_spent_stakes.BlockDisconnected(pindexDelete->nHeight);
     LogPrint(BCLog::BENCHMARK, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     const uint256& saplingAnchorAfterDisconnect = pcoinsTip->GetBestAnchor();
     // Write the chain state to disk, if necessary.
@@ -2023,6 +2207,88 @@ public:
     }
 };
 
+/** Maximum number of threads used to read blocks ahead */
+static const int MAX_BLOCK_PREFETCH_THREADS = 4;
+
+static CWorkerPool blockPrefetchPool(std::min(GetNumCores(), MAX_BLOCK_PREFETCH_THREADS), "pivx-prefetch");
+
+std::shared_ptr<const CBlock> CBlockPrefetcher::ReadBlock(const FlatFilePos& pos, const uint256& hash, const CCoinsViewDB* pcoinsdb)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblock, pos) || pblock->GetHash() != hash) {
+        // Let ConnectTip read it again, and report the error.
+        return nullptr;
+    }
+    if (pcoinsdb) {
+        Coin coin;
+        for (const CTransactionRef& tx : pblock->vtx) {
+            if (tx->IsCoinBase() || tx->HasZerocoinSpendInputs()) continue;
+            for (const CTxIn& txin : tx->vin) {
+                pcoinsdb->GetCoin(txin.prevout, coin);
+            }
+        }
+    }
+    return pblock;
+}
+
+CBlockPrefetcher::~CBlockPrefetcher()
+{
+    for (auto& it : mapPending) {
+        it.second.wait();
+    }
+}
+
+void CBlockPrefetcher::Prefetch(const std::vector<CBlockIndex*>& vpindex)
+{
+    AssertLockHeld(cs_main);
+    const size_t nDepth = std::min(vpindex.size(), (size_t) BLOCK_PREFETCH_DEPTH);
+
+    // Drop the blocks we are not going to connect (e.g. after an invalid one)
+    for (auto it = mapPending.begin(); it != mapPending.end();) {
+        if (std::find(vpindex.begin(), vpindex.begin() + nDepth, it->first) == vpindex.begin() + nDepth) {
+            it->second.wait();
+            it = mapPending.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    ctpl::thread_pool& pool = blockPrefetchPool.Get();
+    const CCoinsViewDB* pcoinsdb = pcoinsdbview.get();
+    for (size_t i = 0; i < nDepth; i++) {
+        const CBlockIndex* pindex = vpindex[i];
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || mapPending.count(pindex)) continue;
+        const FlatFilePos pos = pindex->GetBlockPos();
+        const uint256 hash = pindex->GetBlockHash();
+        mapPending.emplace(pindex, pool.push([pos, hash, pcoinsdb](int threadId) {
+            return ReadBlock(pos, hash, pcoinsdb);
+        }));
+    }
+}
+
+std::shared_ptr<const CBlock> CBlockPrefetcher::Get(const CBlockIndex* pindex)
+{
+    auto it = mapPending.find(pindex);
+    if (it == mapPending.end()) return nullptr;
+    std::shared_ptr<const CBlock> pblock = it->second.get();
+    mapPending.erase(it);
+    return pblock;
+}
+
+/** The next blocks to connect after pindex, towards pindexMostWork (in connection order, at most BLOCK_PREFETCH_DEPTH) */
+static std::vector<CBlockIndex*> GetBlocksToPrefetch(const CBlockIndex* pindex, CBlockIndex* pindexMostWork)
+{
+    const int nHeight = pindex->nHeight;
+    const int nTargetHeight = std::min(nHeight + BLOCK_PREFETCH_DEPTH, pindexMostWork->nHeight);
+    std::vector<CBlockIndex*> vpindex(std::max(0, nTargetHeight - nHeight));
+    CBlockIndex* pindexIter = pindexMostWork->GetAncestor(nTargetHeight);
+    for (auto it = vpindex.rbegin(); it != vpindex.rend(); ++it) {
+        *it = pindexIter;
+        pindexIter = pindexIter->pprev;
+    }
+    return vpindex;
+}
+
 /**
  * Connect a new block to chainActive. pblock is either nullptr or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
@@ -2057,7 +2323,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const st
         auto dbTx = evoDb->BeginTransaction();
 
         CCoinsViewCache view(pcoinsTip.get());
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, false);
+        CBlockUndo blockundo;
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, false, &blockundo);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2070,6 +2337,8 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const st
         bool flushed = view.Flush();
         assert(flushed);
         dbTx->Commit();
+        // Keep the spent outputs around, for the stake inputs of blocks on a fork
+        g_spent_stakes.AddBlockSpends(blockConnecting, blockundo, pindexNew->nHeight, gArgs.GetArg("-maxreorg", DEFAULT_MAX_REORG_DEPTH));
     }
     int64_t nTime4 = GetTimeMicros();
     nTimeFlush += nTime4 - nTime3;
@@ -2184,7 +2453,7 @@ static void PruneBlockIndexCandidates()
  * Try to make some progress towards making pindexMostWork the active block.
  * pblock is either nullptr or a pointer to a CBlock corresponding to pindexMostWork.
  */
-static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMostWork, const std::shared_ptr<const CBlock>& pblock, bool& fInvalidFound, ConnectTrace& connectTrace, CBlockPrefetcher& prefetcher) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     AssertLockHeld(cs_main);
     AssertLockHeld(mempool.cs);
@@ -2227,7 +2496,11 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
 
         // Connect new blocks.
         for (CBlockIndex* pindexConnect : reverse_iterate(vpindexToConnect)) {
-            if (!ConnectTip(state, pindexConnect, (pindexConnect == pindexMostWork) ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
+            std::shared_ptr<const CBlock> pblockConnect = (pindexConnect == pindexMostWork) ? pblock : nullptr;
+            if (!pblockConnect) pblockConnect = prefetcher.Get(pindexConnect);
+            // Keep reading the next blocks in the background, while connecting this one.
+            prefetcher.Prefetch(GetBlocksToPrefetch(pindexConnect, pindexMostWork));
+            if (!ConnectTip(state, pindexConnect, pblockConnect, connectTrace, disconnectpool)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible()) {
@@ -2291,6 +2564,7 @@ bool ActivateBestChain(CValidationState& state, std::shared_ptr<const CBlock> pb
     // we use m_cs_chainstate to enforce mutual exclusion so that only one caller may execute this function at a time
     LOCK(m_cs_chainstate);
 
+    CBlockPrefetcher prefetcher;
     CBlockIndex* pindexNewTip = nullptr;
     CBlockIndex* pindexMostWork = nullptr;
     do {
@@ -2324,7 +2598,7 @@ bool ActivateBestChain(CValidationState& state, std::shared_ptr<const CBlock> pb
 
                 bool fInvalidFound = false;
                 std::shared_ptr<const CBlock> nullBlockPtr;
-                if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : nullBlockPtr, fInvalidFound, connectTrace))
+                if (!ActivateBestChainStep(state, pindexMostWork, pblock && pblock->GetHash() == pindexMostWork->GetBlockHash() ? pblock : nullBlockPtr, fInvalidFound, connectTrace, prefetcher))
                     return false;
                 blocks_connected = true;
 
@@ -2450,6 +2724,31 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex)
     return true;
 }
 
+/** Compute and set the stake modifier of a block index, from its parent and the block coinstake */
+static void SetBlockIndexStakeModifier(CBlockIndex* pindex, const CBlock& block)
+{
+    if (!Params().GetConsensus().NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_V3_4)) {
+        // compute and set new V1 stake modifier (entropy bits)
+        pindex->SetNewStakeModifier();
+
+    } else {
+        // compute and set new V2 stake modifier (hash of prevout and prevModifier)
+        pindex->SetNewStakeModifier(block.vtx[1]->vin[0].prevout.hash);
+    }
+}
+
+/**
+ * Make pindex the best header if it has more work, and we have its data (and the data of its
+ * ancestors). PoS headers cost nothing to make: headers alone must not move pindexBestHeader.
+ */
+static void UpdateBestHeader(CBlockIndex* pindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if ((pindex->nStatus & BLOCK_FAILED_MASK) || !pindex->nChainTx)
+        return;
+    if (pindexBestHeader == nullptr || pindexBestHeader->nChainWork < pindex->nChainWork)
+        pindexBestHeader = pindex;
+}
+
 static CBlockIndex* AddToBlockIndex(const CBlock& block) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     AssertLockHeld(cs_main);
@@ -2475,21 +2774,15 @@ static CBlockIndex* AddToBlockIndex(const CBlock& block) EXCLUSIVE_LOCKS_REQUIRE
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
 
-        const Consensus::Params& consensus = Params().GetConsensus();
-        if (!consensus.NetworkUpgradeActive(pindexNew->nHeight, Consensus::UPGRADE_V3_4)) {
-            // compute and set new V1 stake modifier (entropy bits)
-            pindexNew->SetNewStakeModifier();
-
-        } else {
-            // compute and set new V2 stake modifier (hash of prevout and prevModifier)
-            pindexNew->SetNewStakeModifier(block.vtx[1]->vin[0].prevout.hash);
+        // Headers received ahead of their block have no transactions: the stake
+        // modifier is set later, when the block is accepted (see AcceptBlock).
+        if (!block.vtx.empty()) {
+            SetBlockIndexStakeModifier(pindexNew, block);
         }
     }
     pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
-    if (pindexBestHeader == nullptr || pindexBestHeader->nChainWork < pindexNew->nChainWork)
-        pindexBestHeader = pindexNew;
 
     setDirtyBlockIndex.insert(pindexNew);
     // track prevBlockHash -> pindex (multimap)
@@ -2550,6 +2843,7 @@ bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBl
             if (chainActive.Tip() == nullptr || !setBlockIndexCandidates.value_comp()(pindex, chainActive.Tip())) {
                 setBlockIndexCandidates.insert(pindex);
             }
+            UpdateBestHeader(pindex);
             std::pair<std::multimap<CBlockIndex*, CBlockIndex*>::iterator, std::multimap<CBlockIndex*, CBlockIndex*>::iterator> range = mapBlocksUnlinked.equal_range(pindex);
             while (range.first != range.second) {
                 std::multimap<CBlockIndex*, CBlockIndex*>::iterator it = range.first;
@@ -2567,7 +2861,7 @@ bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBl
     return true;
 }
 
-bool FindBlockPos(CValidationState& state, FlatFilePos& pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fKnown = false)
+bool FindBlockPos(CValidationState& state, FlatFilePos& pos, unsigned int nAddSize, unsigned int nHeight, uint64_t nTime, bool fCompressed, bool fKnown = false)
 {
     LOCK(cs_LastBlockFile);
 
@@ -2596,6 +2890,8 @@ bool FindBlockPos(CValidationState& state, FlatFilePos& pos, unsigned int nAddSi
     }
 
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
+    if (fCompressed)
+        vinfoBlockFile[nFile].nVersion = BLOCKFILE_VERSION_COMPRESSED;
     if (fKnown)
         vinfoBlockFile[nFile].nSize = std::max(pos.nPos + nAddSize, vinfoBlockFile[nFile].nSize);
     else
@@ -2614,7 +2910,7 @@ bool FindBlockPos(CValidationState& state, FlatFilePos& pos, unsigned int nAddSi
     return true;
 }
 
-bool FindUndoPos(CValidationState& state, int nFile, FlatFilePos& pos, unsigned int nAddSize)
+bool FindUndoPos(CValidationState& state, int nFile, FlatFilePos& pos, unsigned int nAddSize, bool fCompressed)
 {
     pos.nFile = nFile;
 
@@ -2622,6 +2918,8 @@ bool FindUndoPos(CValidationState& state, int nFile, FlatFilePos& pos, unsigned
 
     pos.nPos = vinfoBlockFile[nFile].nUndoSize;
     vinfoBlockFile[nFile].nUndoSize += nAddSize;
+    if (fCompressed)
+        vinfoBlockFile[nFile].nVersion = BLOCKFILE_VERSION_COMPRESSED;
     setDirtyFileInfo.insert(nFile);
 
     bool out_of_space;
@@ -2955,18 +3253,29 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
     return true;
 }
 
-bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex* const pindexPrev)
+bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex* const pindexPrev, bool fJustCheck)
 {
     const int nHeight = pindexPrev == nullptr ? 0 : pindexPrev->nHeight + 1;
     const CChainParams& chainparams = Params();
+    const bool fInitialBlockDownload = IsInitialBlockDownload();
+
+    // Sapling proofs and zerocoin spends are verified in parallel by the check queue workers (when available)
+    CCheckQueueControl<CBlockCheck> control(nScriptCheckThreads ? &blockcheckqueue : nullptr);
 
     // Check that all transactions are finalized
     for (const auto& tx : block.vtx) {
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true /* isMined */, IsInitialBlockDownload())) {
+        std::vector<CSaplingCheck> vSaplingChecks;
+        std::vector<CZerocoinSpendCheck> vZerocoinChecks;
+        if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true /* isMined */, fInitialBlockDownload,
+                                        nScriptCheckThreads ? &vSaplingChecks : nullptr,
+                                        nScriptCheckThreads ? &vZerocoinChecks : nullptr,
+                                        !fJustCheck /* eraseCached */)) {
             return false;
         }
+        AddBlockChecks(control, vSaplingChecks);
+        AddBlockChecks(control, vZerocoinChecks);
 
         if (!IsFinalTx(tx, nHeight, block.GetBlockTime())) {
             return state.DoS(10, false, REJECT_INVALID, "bad-txns-nonfinal", false, "non-final transaction");
@@ -2997,6 +3306,17 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
         }
     }
 
+
+    if (!control.Wait()) {
+        // Verify the transactions again, one at a time, to reject the block with the reason of the failed check
+        for (const auto& tx : block.vtx) {
+            if (!ContextualCheckTransaction(tx, state, chainparams, nHeight, true /* isMined */, fInitialBlockDownload)) {
+                return false;
+            }
+        }
+        return state.DoS(100, error("%s: Sapling proofs or zerocoin spends verification failed", __func__), REJECT_INVALID, "bad-blk-proofs-invalid");
+    }
+
     return true;
 }
 
@@ -3075,6 +3395,64 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
     return true;
 }
 
+/**
+ * Checks of a header that don't need the block transactions: the difficulty must follow the
+ * retarget rule, and the blocks before the PoS upgrade must carry a valid proof of work.
+ */
+static bool CheckBlockHeaderWork(const CBlockHeader& header, CValidationState& state, const CBlockIndex* pindexPrev)
+{
+    if (!CheckWork(CBlock(header), pindexPrev))
+        return state.DoS(100, false, REJECT_INVALID, "bad-diffbits", false, "incorrect difficulty");
+
+    const int nHeight = pindexPrev->nHeight + 1;
+    if (!Params().GetConsensus().NetworkUpgradeActive(nHeight, Consensus::UPGRADE_POS) &&
+            !CheckProofOfWork(header.GetHash(), header.nBits))
+        return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+
+    return true;
+}
+
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, CBlockIndex** ppindex)
+{
+    AssertLockHeld(cs_main);
+
+    for (const CBlockHeader& header : headers) {
+        const CBlock block(header);
+        CBlockIndex* pindex = LookupBlockIndex(block.GetHash());
+        if (!pindex) {
+            CBlockIndex* pindexPrev = nullptr;
+            if (!GetPrevIndex(block, &pindexPrev, state))
+                return false;
+            if (pindexPrev && !CheckBlockHeaderWork(header, state, pindexPrev))
+                return error("%s: invalid header %s: %s", __func__, block.GetHash().ToString(), FormatStateMessage(state));
+        }
+        if (!AcceptBlockHeader(block, state, &pindex))
+            return false;
+        if (ppindex)
+            *ppindex = pindex;
+    }
+    return true;
+}
+
+bool CheckBlockStakeHeader(const CBlock& block, CValidationState& state, const CBlockIndex* pindexPrev)
+{
+    AssertLockHeld(cs_main);
+
+    if (!block.IsProofOfStake())
+        return true;
+
+    if (!CheckBlockSignature(block))
+        return state.DoS(100, error("%s : bad proof-of-stake block signature", __func__),
+                         REJECT_INVALID, "bad-PoS-sig", true);
+
+    if (pindexPrev && (pindexPrev->nStatus & BLOCK_HAVE_DATA)) {
+        std::string strError;
+        if (!CheckProofOfStake(block, strError, pindexPrev))
+            return state.DoS(100, error("%s: proof of stake check failed (%s)", __func__, strError));
+    }
+    return true;
+}
+
 /*
  * Collect the sets of the inputs (either regular utxos or zerocoin serials) spent
  * by in-block txes.
@@ -3262,7 +3640,7 @@ static bool IsSpentOnActiveChain(std::unordered_set<COutPoint, SaltedOutpointHas
     return outpoints.empty();
 }
 
-static bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, const FlatFilePos* dbp) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+static bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, const FlatFilePos* dbp, uint32_t nRecordSize) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     AssertLockHeld(cs_main);
 
@@ -3276,6 +3654,12 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockInde
     if (!GetPrevIndex(block, &pindexPrev, state))
         return false;
 
+    // With headers-first sync the parent may be known by its header only. Its stake modifier,
+    // and the coins the block spends, are available only once the parent block is accepted.
+    if (pindexPrev && !(pindexPrev->nStatus & BLOCK_HAVE_DATA))
+        return state.DoS(0, error("%s : prev block %s not available", __func__, block.hashPrevBlock.GetHex()), 0,
+                         "prevblk-not-available");
+
     if (block.GetHash() != consensus.hashGenesisBlock && !CheckWork(block, pindexPrev))
         return state.DoS(100, false, REJECT_INVALID);
 
@@ -3304,6 +3688,14 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockInde
         return error("%s: %s", __func__, FormatStateMessage(state));
     }
 
+    if (pindex->pprev && pindex->vStakeModifier.empty()) {
+        // The header was accepted first: now that the coinstake is known, set the stake modifier.
+        if (block.IsProofOfStake())
+            pindex->SetProofOfStake();
+        SetBlockIndexStakeModifier(pindex, block);
+        setDirtyBlockIndex.insert(pindex);
+    }
+
     int nHeight = pindex->nHeight;
 
     if (isPoS) {
@@ -3391,14 +3783,22 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockInde
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, CLIENT_VERSION);
         FlatFilePos blockPos;
-        if (dbp != nullptr)
+        DiskRecord record;
+        if (dbp != nullptr) {
+            // Already on disk (reindex), with its record size
+            assert(nRecordSize != 0);
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize + 8, nHeight, block.GetBlockTime(), dbp != nullptr))
+        } else {
+            record = MakeDiskRecord(block, fBlockCompression);
+            nRecordSize = record.GetHeaderSize();
+        }
+        const unsigned int nDiskSize = nRecordSize & ~RECORD_COMPRESSED_FLAG;
+        const bool fCompressed = nRecordSize & RECORD_COMPRESSED_FLAG;
+        if (!FindBlockPos(state, blockPos, nDiskSize + 8, nHeight, block.GetBlockTime(), fCompressed, dbp != nullptr))
             return error("%s : FindBlockPos failed", __func__);
         if (dbp == nullptr)
-            if (!WriteBlockToDisk(block, blockPos))
+            if (!WriteBlockToDisk(record, blockPos))
                 return AbortNode(state, "Failed to write block");
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
             return error("%s : ReceivedBlockTransactions failed", __func__);
@@ -3409,7 +3809,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockInde
     return true;
 }
 
-bool ProcessNewBlock(const std::shared_ptr<const CBlock>& pblock, const FlatFilePos* dbp)
+bool ProcessNewBlock(const std::shared_ptr<const CBlock>& pblock, const FlatFilePos* dbp, uint32_t nRecordSize)
 {
     AssertLockNotHeld(cs_main);
 
@@ -3428,7 +3828,7 @@ bool ProcessNewBlock(const std::shared_ptr<const CBlock>& pblock, const FlatFile
 
         // Store to disk
         CBlockIndex* pindex = nullptr;
-        bool ret = AcceptBlock(*pblock, state, &pindex, dbp);
+        bool ret = AcceptBlock(*pblock, state, &pindex, dbp, nRecordSize);
         CheckBlockIndex();
         if (!ret) {
             GetMainSignals().BlockChecked(*pblock, state);
@@ -3472,7 +3872,7 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
         return error("%s: ContextualCheckBlockHeader failed: %s", __func__, FormatStateMessage(state));
     if (!CheckBlock(block, state, fCheckPOW, fCheckMerkleRoot, fCheckBlockSig))
         return error("%s: CheckBlock failed: %s", __func__, FormatStateMessage(state));
-    if (!ContextualCheckBlock(block, state, pindexPrev))
+    if (!ContextualCheckBlock(block, state, pindexPrev, true))
         return error("%s: ContextualCheckBlock failed: %s", __func__, FormatStateMessage(state));
     if (!ConnectBlock(block, state, &indexDummy, viewNew, true))
         return false;
@@ -3582,7 +3982,9 @@ bool static LoadBlockIndexDB(std::string& strError) EXCLUSIVE_LOCKS_REQUIRED(cs_
             pindexBestInvalid = pindex;
         if (pindex->pprev)
             pindex->BuildSkip();
-        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
+        // Only the blocks we have: the headers ahead of them are synced again from the peers
+        if (pindex->IsValid(BLOCK_VALID_TREE) && (pindex->nChainTx || pindex->pprev == nullptr) &&
+                (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
 
@@ -3941,12 +4343,12 @@ bool LoadGenesisBlock()
     try {
         CBlock& block = const_cast<CBlock&>(Params().GenesisBlock());
         // Start new block file
-        unsigned int nBlockSize = ::GetSerializeSize(block, CLIENT_VERSION);
+        const DiskRecord record = MakeDiskRecord(block, fBlockCompression);
         FlatFilePos blockPos;
         CValidationState state;
-        if (!FindBlockPos(state, blockPos, nBlockSize + 8, 0, block.GetBlockTime()))
+        if (!FindBlockPos(state, blockPos, record.vData.size() + 8, 0, block.GetBlockTime(), record.fCompressed))
             return error("%s: FindBlockPos failed", __func__);
-        if (!WriteBlockToDisk(block, blockPos))
+        if (!WriteBlockToDisk(record, blockPos))
             return error("%s: writing genesis block to disk failed", __func__);
         CBlockIndex *pindex = AddToBlockIndex(block);
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
@@ -3961,8 +4363,8 @@ bool LoadGenesisBlock()
 
 bool LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, FlatFilePos> mapBlocksUnknownParent;
+    // Map of disk positions and record sizes for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, std::pair<FlatFilePos, uint32_t>> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     // Block checked event listener
@@ -3991,7 +4393,9 @@ bool LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                     continue;
                 // read size
                 blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+                if ((nSize & ~RECORD_COMPRESSED_FLAG) > MAX_BLOCK_SIZE_CURRENT)
+                    continue;
+                if (!(nSize & RECORD_COMPRESSED_FLAG) && nSize < 80)
                     continue;
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
@@ -4002,10 +4406,16 @@ bool LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                 uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
                     dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetLimit(nBlockPos + (nSize & ~RECORD_COMPRESSED_FLAG));
                 blkdat.SetPos(nBlockPos);
                 CBlock block;
-                blkdat >> block;
+                if (nSize & RECORD_COMPRESSED_FLAG) {
+                    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+                    ReadCompressedRecord(blkdat, nSize, ssBlock);
+                    ssBlock >> block;
+                } else {
+                    blkdat >> block;
+                }
                 nRewind = blkdat.GetPos();
 
                 uint256 hash = block.GetHash();
@@ -4017,7 +4427,7 @@ bool LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                         LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__,
                                 hash.ToString(), block.hashPrevBlock.ToString());
                         if (dbp)
-                            mapBlocksUnknownParent.emplace(block.hashPrevBlock, *dbp);
+                            mapBlocksUnknownParent.emplace(block.hashPrevBlock, std::make_pair(*dbp, nSize));
                         continue;
                     }
 
@@ -4028,7 +4438,7 @@ bool LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                 if (!pindex || (pindex->nStatus & BLOCK_HAVE_DATA) == 0) {
                     std::shared_ptr<const CBlock> block_ptr = std::make_shared<const CBlock>(block);
                     stateCatcher.get().setBlockHash(block_ptr->GetHash());
-                    if (ProcessNewBlock(block_ptr, dbp)) {
+                    if (ProcessNewBlock(block_ptr, dbp, nSize)) {
                         nLoaded++;
                     }
                     if (stateCatcher.get().stateErrorFound()) {
@@ -4044,14 +4454,14 @@ bool LoadExternalBlockFile(FILE* fileIn, FlatFilePos* dbp)
                 while (!queue.empty()) {
                     uint256 head = queue.front();
                     queue.pop_front();
-                    std::pair<std::multimap<uint256, FlatFilePos>::iterator, std::multimap<uint256, FlatFilePos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+                    auto range = mapBlocksUnknownParent.equal_range(head);
                     while (range.first != range.second) {
-                        std::multimap<uint256, FlatFilePos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
+                        auto it = range.first;
+                        if (ReadBlockFromDisk(block, it->second.first)) {
                             LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
                                 head.ToString());
                             std::shared_ptr<const CBlock> block_ptr = std::make_shared<const CBlock>(block);
-                            if (ProcessNewBlock(block_ptr, &it->second)) {
+                            if (ProcessNewBlock(block_ptr, &it->second.first, it->second.second)) {
                                 nLoaded++;
                                 queue.emplace_back(block.GetHash());
                             }
@@ -4234,7 +4644,7 @@ int ActiveProtocol()
 
 std::string CBlockFileInfo::ToString() const
 {
-    return strprintf("CBlockFileInfo(blocks=%u, size=%u, heights=%u...%u, time=%s...%s)", nBlocks, nSize, nHeightFirst, nHeightLast, FormatISO8601Date(nTimeFirst), FormatISO8601Date(nTimeLast));
+    return strprintf("CBlockFileInfo(blocks=%u, size=%u, heights=%u...%u, time=%s...%s, version=%u)", nBlocks, nSize, nHeightFirst, nHeightLast, FormatISO8601Date(nTimeFirst), FormatISO8601Date(nTimeLast), nVersion);
 }
 
 CBlockFileInfo* GetBlockFileInfo(size_t n)
@@ -22,6 +22,7 @@
 #include "fs.h"
 #include "moneysupply.h"
 #include "policy/feerate.h"
+#include "protocol.h"
 #include "script/script_error.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -29,6 +30,7 @@
 #include <algorithm>
 #include <atomic>
 #include <exception>
+#include <future>
 #include <map>
 #include <memory>
 #include <set>
@@ -39,6 +41,7 @@
 
 class AccumulatorCache;
 class CBlockIndex;
+class CBlockUndo;
 class CBlockTreeDB;
 class CBudgetManager;
 class CCoinsViewDB;
@@ -50,6 +53,7 @@ class CConnman;
 class CNode;
 class CScriptCheck;
 
+struct DiskRecord;
 struct PrecomputedTransactionData;
 
 /** Default for -limitancestorcount, max number of in-mempool ancestors */
@@ -77,6 +81,8 @@ static const unsigned int MAX_DISCONNECTED_TX_POOL_SIZE = 20000;
 /** Default for -checkblocks */
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** Default for -checksupply */
+static const bool DEFAULT_CHECKSUPPLY = false;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -142,6 +148,8 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
+/** Whether new block and undo records are compressed (-blockcompression) */
+extern bool fBlockCompression;
 extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern int64_t nMaxTipAge;
@@ -170,9 +178,10 @@ extern CBlockIndex* pindexBestHeader;
  *
  * @param[in]   pblock     The block we want to process.
  * @param[out]  dbp        The already known disk position of pblock, or nullptr if not yet stored.
+ * @param[in]   nRecordSize  The size field (with the compression flag) of the record at dbp, if dbp is not nullptr.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(const std::shared_ptr<const CBlock>& pblock, const FlatFilePos* dbp);
+bool ProcessNewBlock(const std::shared_ptr<const CBlock>& pblock, const FlatFilePos* dbp, uint32_t nRecordSize = 0);
 
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const FlatFilePos& pos, bool fReadOnly = false);
@@ -193,7 +202,7 @@ bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_m
 void UnloadBlockIndex();
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
-/** Run an instance of the script checking thread */
+/** Run an instance of the script checking thread (which also verifies the Sapling proofs and the zerocoin spends) */
 void ThreadScriptCheck();
 
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -214,6 +223,9 @@ CAmount GetBlockValue(int nHeight);
 CBlockIndex* InsertBlockIndex(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+/** Update the cached money supply with the running total kept in the coins db.
+ *  If it's unknown (or fFullScan is true), compute it with a full scan of the flushed UTXO set. */
+void UpdateMoneySupply(bool fFullScan = false) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 
 /** (try to) add transaction to memory pool **/
@@ -309,9 +321,13 @@ public:
 
 
 /** Functions for disk access for blocks */
-bool WriteBlockToDisk(const CBlock& block, FlatFilePos& pos);
+bool WriteBlockToDisk(const DiskRecord& record, FlatFilePos& pos);
 bool ReadBlockFromDisk(CBlock& block, const FlatFilePos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized bytes of a block (as sent over the network, decompressed if needed), without deserializing it */
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const FlatFilePos& pos, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -322,13 +338,64 @@ bool CheckWork(const CBlock& block, const CBlockIndex* const pindexPrev);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* pindexPrev) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
-bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindexPrev);
+/** fJustCheck: the block is only tested (e.g. a block template), the cached Sapling proofs of its txes are kept */
+bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindexPrev, bool fJustCheck = false);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckBlockSig = true) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = nullptr, CBlockIndex* pindexPrev = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+/**
+ * Process headers received ahead of their blocks (headers-first sync).
+ * Only the checks that don't need the block transactions are performed here: difficulty retarget,
+ * proof of work before the PoS upgrade, timestamps, version and checkpoints.
+ * The proof of stake, and the stake modifier of the index, need the coinstake, so they are
+ * checked/computed when the block itself is accepted.
+ *
+ * @param[in]   headers     The headers, in chain order.
+ * @param[out]  state       The validation state, set if a header is invalid.
+ * @param[out]  ppindex     If set, the pointer will be set to point to the last accepted header.
+ * @return False if a header is invalid
+ */
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, CBlockIndex** ppindex = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/**
+ * The PoS checks of a block that can be done before its transactions are all known, e.g. from a
+ * compact block carrying the coinstake and the block signature: the signature, and the stake
+ * kernel if we have the parent block (for its stake modifier and the staked coin).
+ */
+bool CheckBlockStakeHeader(const CBlock& block, CValidationState& state, const CBlockIndex* pindexPrev) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+
+/** Maximum number of blocks read ahead of the one being connected */
+static const int BLOCK_PREFETCH_DEPTH = 16;
 
+/**
+ * Reads the next blocks to connect on a worker pool, while the validation
+ * thread is busy with the current one, and looks up the coins spent by their
+ * inputs in the coins database (so that the cache misses of ConnectBlock are
+ * served by the LevelDB block cache/OS page cache).
+ * The coins are not added to pcoinsTip: it's not thread safe.
+ *
+ * Single-use, owned by ActivateBestChain: pending reads are waited for on
+ * destruction.
+ */
+class CBlockPrefetcher
+{
+private:
+    std::map<const CBlockIndex*, std::future<std::shared_ptr<const CBlock>>> mapPending;
+
+    static std::shared_ptr<const CBlock> ReadBlock(const FlatFilePos& pos, const uint256& hash, const CCoinsViewDB* pcoinsdb);
+
+public:
+    ~CBlockPrefetcher();
+
+    /** Schedule the read of the first blocks of vpindex (in connection order), dropping the other pending ones */
+    void Prefetch(const std::vector<CBlockIndex*>& vpindex) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+    /** Return the block read for pindex (waiting for it), or nullptr if none */
+    std::shared_ptr<const CBlock> Get(const CBlockIndex* pindex);
+};
 
 /** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
 class CVerifyDB
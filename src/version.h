@@ -11,7 +11,7 @@
  * network protocol versioning
  */
 
-static const int PROTOCOL_VERSION = 70928;
+static const int PROTOCOL_VERSION = 70930;
 
 //! initial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 209;
@@ -29,6 +29,12 @@ static const int MNAUTH_NODE_VER_VERSION = 70925;
 //! Version where LLMQ was introduced
 static const int LLMQS_PROTO_VERSION = 70928;
 
+//! Version where compact blocks (sendcmpct, cmpctblock, getblocktxn, blocktxn) were introduced
+static const int COMPACT_BLOCKS_VERSION = 70929;
+
+//! Version where getheaders/headers (headers-first sync) were introduced
+static const int HEADERS_FIRST_VERSION = 70930;
+
 // Make sure that none of the values above collide with
 // `ADDRV2_FORMAT`.
 
@@ -4429,6 +4429,7 @@ UniValue getstakingstatus(const JSONRPCRequest& request)
             "  \"lastattempt_hash\": xxx            (hex string) hash of the block on top of which the last stake attempt was made\n"
             "  \"lastattempt_coins\": n             (numeric) number of stakeable coins available during last stake attempt\n"
             "  \"lastattempt_tries\": n             (numeric) number of stakeable coins checked during last stake attempt\n"
+            "  \"lastattempt_triespersec\": n       (numeric) number of stake kernels hashed per second during last stake attempt\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -4459,6 +4460,7 @@ UniValue getstakingstatus(const JSONRPCRequest& request)
             obj.pushKV("lastattempt_hash", ss->GetLastHash().GetHex());
             obj.pushKV("lastattempt_coins", ss->GetLastCoins());
             obj.pushKV("lastattempt_tries", ss->GetLastTries());
+            obj.pushKV("lastattempt_triespersec", ss->GetLastTriesPerSec());
         }
         return obj;
     }
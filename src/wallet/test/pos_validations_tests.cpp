@@ -194,6 +194,52 @@ static COutput GetUnspentCoin(CWallet* pwallet, std::initializer_list<std::share
     throw std::runtime_error("Unspent coin not found");
 }
 
+BOOST_FIXTURE_TEST_CASE(kernel_batch_tests, TestPoSChainSetup)
+{
+    const CBlockIndex* pindexPrev = WITH_LOCK(cs_main, return chainActive.Tip());
+    SyncWithValidationInterfaceQueue();
+    std::vector<CStakeableOutput> availableCoins;
+    BOOST_CHECK(pwalletMain->StakeableCoins(&availableCoins));
+    BOOST_REQUIRE(!availableCoins.empty());
+
+    const unsigned int nBits = pindexPrev->nBits;
+    CStakeKernelBatch batch(pindexPrev, nBits);
+    std::vector<CPivStake> vStakes;
+    for (const CStakeableOutput& coin : availableCoins) {
+        const COutPoint outPoint(coin.tx->GetHash(), coin.i);
+        vStakes.emplace_back(coin.tx->tx->vout[coin.i], outPoint, coin.pindex);
+        batch.Add(&vStakes.back(), outPoint);
+    }
+    BOOST_CHECK(batch.IsFor(pindexPrev, nBits));
+    BOOST_CHECK_EQUAL(batch.Size(), availableCoins.size());
+
+    // Same kernels as the ones hashed from scratch
+    const int nTime = pindexPrev->nTime + 15;
+    for (size_t i = 0; i < vStakes.size(); i++) {
+        CStakeKernel kernel(pindexPrev, &vStakes[i], nBits, nTime);
+        BOOST_CHECK(batch.GetHash(i, nTime) == kernel.GetHash());
+        BOOST_CHECK(batch.GetHash(i, nTime + 1) != kernel.GetHash());
+    }
+
+    // Same result of the kernel search, with an easy target
+    const unsigned int nBitsEasy = UintToArith256(Params().GetConsensus().posLimitV2).GetCompact();
+    CStakeKernelBatch batchEasy(pindexPrev, nBitsEasy);
+    for (size_t i = 0; i < vStakes.size(); i++) batchEasy.Add(&vStakes[i], batch.GetOutPoint(i));
+    int nHashed = 0;
+    const int nFound = batchEasy.Find(nTime, 0, batchEasy.Size(), nHashed);
+    BOOST_CHECK_EQUAL(nHashed, nFound < 0 ? (int)vStakes.size() : nFound + 1);
+    for (int i = 0; i < (int)vStakes.size() && (nFound < 0 || i <= nFound); i++) {
+        BOOST_CHECK_EQUAL(CStakeKernel(pindexPrev, &vStakes[i], nBitsEasy, nTime).CheckKernelHash(true), i == nFound);
+    }
+
+    // Erased coins
+    batch.Erase(0);
+    BOOST_CHECK_EQUAL(batch.Size(), vStakes.size() - 1);
+    if (vStakes.size() > 1) {
+        BOOST_CHECK(batch.GetHash(0, nTime) == CStakeKernel(pindexPrev, &vStakes[1], nBits, nTime).GetHash());
+    }
+}
+
 BOOST_FIXTURE_TEST_CASE(created_on_fork_tests, TestPoSChainSetup)
 {
     // Let's create few more PoS blocks
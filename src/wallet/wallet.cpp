@@ -15,6 +15,7 @@
 
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "ctpl_stl.h"
 #include "evo/providertx.h"
 #include "guiinterfaceutil.h"
 #include "policy/policy.h"
@@ -23,6 +24,7 @@
 #include "scheduler.h"
 #include "shutdown.h"
 #include "spork.h"
+#include "util/workerpool.h"
 #include "util/validation.h"
 #include "utilmoneystr.h"
 #include "wallet/fees.h"
@@ -941,6 +943,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFlushOnClose)
             fUpdated = true;
         }
     }
+    m_sspk_man->AddToWitnessedTxes(wtx);
 
     //// debug print
     LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
@@ -1009,6 +1012,7 @@ bool CWallet::LoadToWallet(CWalletTx& wtxIn)
     wtx.BindWallet(this);
     // Sapling
     m_sspk_man->UpdateNullifierNoteMapWithTx(wtx);
+    m_sspk_man->AddToWitnessedTxes(wtx);
     wtxOrdered.emplace(wtx.nOrderPos, &wtx);
     AddToSpends(hash);
     for (const CTxIn& txin : wtx.tx->vin) {
@@ -1023,13 +1027,24 @@ bool CWallet::LoadToWallet(CWalletTx& wtxIn)
     return true;
 }
 
-bool CWallet::FindNotesDataAndAddMissingIVKToKeystore(const CTransaction& tx, Optional<mapSaplingNoteData_t>& saplingNoteData)
+bool CWallet::FindNotesDataAndAddMissingIVKToKeystore(const CTransaction& tx, Optional<mapSaplingNoteData_t>& saplingNoteData, const mapSaplingTxNotes_t* pSaplingNotes)
 {
-    auto saplingNoteDataAndAddressesToAdd = m_sspk_man->FindMySaplingNotes(tx);
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> saplingNoteDataAndAddressesToAdd;
+    if (pSaplingNotes) {
+        // Already decrypted with the rest of the batch. Txes not in the map have no notes for us.
+        auto it = pSaplingNotes->find(tx.GetHash());
+        if (it != pSaplingNotes->end()) {
+            saplingNoteDataAndAddressesToAdd = it->second;
+        }
+    } else {
+        saplingNoteDataAndAddressesToAdd = m_sspk_man->FindMySaplingNotes(tx);
+    }
     saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
     auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
     // Add my addresses
     for (const auto& addressToAdd : addressesToAdd) {
+        // The batch could have been computed before a previous tx added the same address
+        if (HaveSaplingIncomingViewingKey(addressToAdd.first)) continue;
         if (!m_sspk_man->AddSaplingIncomingViewingKey(addressToAdd.second, addressToAdd.first)) {
             return false;
         }
@@ -1074,7 +1089,7 @@ void CWallet::AddExternalNotesDataToTx(CWalletTx& wtx) const
  * Abandoned state should probably be more carefully tracked via different
  * posInBlock signals or by checking mempool presence when necessary.
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransactionRef& ptx, const CWalletTx::Confirmation& confirm, bool fUpdate)
+bool CWallet::AddToWalletIfInvolvingMe(const CTransactionRef& ptx, const CWalletTx::Confirmation& confirm, bool fUpdate, const mapSaplingTxNotes_t* pSaplingNotes)
 {
     const CTransaction& tx = *ptx;
     {
@@ -1099,7 +1114,7 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransactionRef& ptx, const CWallet
         // Check tx for Sapling notes
         Optional<mapSaplingNoteData_t> saplingNoteData {nullopt};
         if (HasSaplingSPKM()) {
-            if (!FindNotesDataAndAddMissingIVKToKeystore(tx, saplingNoteData)) {
+            if (!FindNotesDataAndAddMissingIVKToKeystore(tx, saplingNoteData, pSaplingNotes)) {
                 return false; // error adding incoming viewing key.
             }
         }
@@ -1257,9 +1272,9 @@ void CWallet::MarkConflicted(const uint256& hashBlock, int conflicting_height, c
     }
 }
 
-void CWallet::SyncTransaction(const CTransactionRef& ptx, const CWalletTx::Confirmation& confirm)
+void CWallet::SyncTransaction(const CTransactionRef& ptx, const CWalletTx::Confirmation& confirm, const mapSaplingTxNotes_t* pSaplingNotes)
 {
-    if (!AddToWalletIfInvolvingMe(ptx, confirm, true)) {
+    if (!AddToWalletIfInvolvingMe(ptx, confirm, true, pSaplingNotes)) {
         return; // Not one of ours
     }
 
@@ -1324,10 +1339,12 @@ void CWallet::BlockConnected(const std::shared_ptr<const CBlock>& pblock, const
         m_last_block_processed = pindex->GetBlockHash();
         m_last_block_processed_time = pindex->GetBlockTime();
         m_last_block_processed_height = pindex->nHeight;
+        // Trial-decrypt all the shielded outputs of the block at once
+        const mapSaplingTxNotes_t saplingNotes = HasSaplingSPKM() ? m_sspk_man->FindMySaplingNotes(pblock->vtx) : mapSaplingTxNotes_t();
         for (size_t index = 0; index < pblock->vtx.size(); index++) {
             CWalletTx::Confirmation confirm(CWalletTx::Status::CONFIRMED, m_last_block_processed_height,
                                             m_last_block_processed, index);
-            SyncTransaction(pblock->vtx[index], confirm);
+            SyncTransaction(pblock->vtx[index], confirm, &saplingNotes);
             TransactionRemovedFromMempool(pblock->vtx[index], MemPoolRemovalReason::BLOCK);
         }
 
@@ -1440,6 +1457,7 @@ void CWallet::EraseFromWallet(const uint256& hash)
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             WalletBatch(*database).EraseTx(hash);
+        m_sspk_man->RemoveFromWitnessedTxes(hash);
         LogPrintf("%s: Erased wtx %s from wallet\n", __func__, hash.GetHex());
     }
     return;
@@ -1893,6 +1911,24 @@ int64_t CWallet::RescanFromTime(int64_t startTime, const WalletRescanReserver& r
  * the main chain after to the addition of any new keys you want to detect
  * transactions for.
  */
+namespace {
+
+//! Max number of worker threads reading and pre-processing blocks during a rescan
+static const int MAX_RESCAN_WORKERS = 8;
+//! Number of blocks queued ahead of the committer, for each rescan worker
+static const size_t RESCAN_BLOCKS_AHEAD_PER_WORKER = 4;
+
+//! A block read from disk and pre-processed by a rescan worker
+struct RescanBlock {
+    CBlock block;
+    bool fRead{false};
+    mapSaplingTxNotes_t saplingNotes;
+};
+
+CWorkerPool rescanWorkerPool(std::min(GetNumCores(), MAX_RESCAN_WORKERS), "pivx-rescan");
+
+} // anonymous namespace
+
 CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlockIndex* pindexStop, const WalletRescanReserver& reserver, bool fUpdate, bool fromStartup)
 {
     int64_t nNow = GetTime();
@@ -1916,8 +1952,42 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
             dProgressTip = Checkpoints::GuessVerificationProgress(tip, false);
         }
 
+        // The scan is pipelined: a pool of workers reads the next blocks from disk and
+        // trial-decrypts their shielded outputs, while this thread applies them to the
+        // wallet strictly in chain order (transparent IsMine must run here, as the keypool
+        // can be topped up by the transactions found along the way).
+        ctpl::thread_pool& workerPool = rescanWorkerPool.Get();
+        const size_t nMaxBlocksAhead = workerPool.size() * RESCAN_BLOCKS_AHEAD_PER_WORKER;
+        std::deque<std::pair<CBlockIndex*, std::future<RescanBlock>>> pipeline;
+        CBlockIndex* pindexLastQueued = nullptr;
+        auto fillPipeline = [&]() {
+            while (pipeline.size() < nMaxBlocksAhead && !(pindexLastQueued && pindexLastQueued == pindexStop)) {
+                CBlockIndex* pindexNext = pindexLastQueued ? WITH_LOCK(cs_main, return chainActive.Next(pindexLastQueued); ) : pindexStart;
+                if (!pindexNext) {
+                    // reached the tip (for now)
+                    break;
+                }
+                pipeline.emplace_back(pindexNext, workerPool.push([this, pindexNext](int threadId) {
+                    RescanBlock res;
+                    res.fRead = ReadBlockFromDisk(res.block, pindexNext);
+                    if (res.fRead && HasSaplingSPKM()) {
+                        res.saplingNotes = m_sspk_man->FindMySaplingNotes(res.block.vtx);
+                    }
+                    return res;
+                }));
+                pindexLastQueued = pindexNext;
+            }
+        };
+
         std::vector<uint256> myTxHashes;
-        while (pindex && !fAbortRescan) {
+        while (!fAbortRescan) {
+            fillPipeline();
+            if (pipeline.empty()) {
+                pindex = nullptr;
+                break;
+            }
+            pindex = pipeline.front().first;
+
             double gvp = 0;
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
                 gvp = WITH_LOCK(cs_main, return Checkpoints::GuessVerificationProgress(pindex, false); );
@@ -1931,8 +2001,10 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 break;
             }
 
-            CBlock block;
-            if (ReadBlockFromDisk(block, pindex)) {
+            RescanBlock scanned = pipeline.front().second.get();
+            pipeline.pop_front();
+            if (scanned.fRead) {
+                const CBlock& block = scanned.block;
                 LOCK2(cs_main, cs_wallet);
                 if (pindex && !chainActive.Contains(pindex)) {
                      // Abort scan if current block is no longer active, to prevent
@@ -1943,7 +2015,7 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 for (int posInBlock = 0; posInBlock < (int) block.vtx.size(); posInBlock++) {
                     const auto& tx = block.vtx[posInBlock];
                     CWalletTx::Confirmation confirm(CWalletTx::Status::CONFIRMED, pindex->nHeight, pindex->GetBlockHash(), posInBlock);
-                    if (AddToWalletIfInvolvingMe(tx, confirm, fUpdate)) {
+                    if (AddToWalletIfInvolvingMe(tx, confirm, fUpdate, &scanned.saplingNotes)) {
                         myTxHashes.push_back(tx->GetHash());
                     }
                 }
@@ -1967,7 +2039,6 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
             }
             {
                 LOCK(cs_main);
-                pindex = chainActive.Next(pindex);
                 if (tip != chainActive.Tip()) {
                     tip = chainActive.Tip();
                     // in case the tip has changed, update progress max
@@ -1975,6 +2046,10 @@ CBlockIndex* CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, CBlock
                 }
             }
         }
+        // Wait for the blocks already queued (their results are discarded)
+        for (auto& item : pipeline) {
+            item.second.wait();
+        }
 
         // Sapling
         // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
@@ -3364,6 +3439,9 @@ bool CWallet::CreateCoinstakeOuts(const CPivStake& stakeInput, std::vector<CTxOu
     return true;
 }
 
+// Number of kernels hashed between two checks for a new block, a locked wallet or a shutdown
+static const size_t KERNEL_SEARCH_BATCH = 1000;
+
 bool CWallet::CreateCoinStake(
         const CBlockIndex* pindexPrev,
         unsigned int nBits,
@@ -3386,48 +3464,76 @@ bool CWallet::CreateCoinStake(
     pStakerStatus->SetLastTip(pindexPrev);
     pStakerStatus->SetLastCoins((int) availableCoins->size());
 
+    // Get the new time slot (and verify it's not the same as previous block)
+    const bool fRegTest = Params().IsRegTestNet();
+    nTxNewTime = (fRegTest ? GetAdjustedTime() : GetCurrentTimeSlot());
+    if (nTxNewTime <= pindexPrev->nTime && !fRegTest) {
+        pStakerStatus->SetLastTime(nTxNewTime);
+        return false;
+    }
+
+    LOCK(cs_kernelBatch);
+    // Hash the time independent part of the kernels once per tip
+    bool fBatchValid = kernelBatch && kernelBatch->IsFor(pindexPrev, nBits) && kernelBatch->Size() == availableCoins->size();
+    for (size_t i = 0; fBatchValid && i < availableCoins->size(); i++) {
+        const CStakeableOutput& coin = (*availableCoins)[i];
+        fBatchValid = kernelBatch->GetOutPoint(i) == COutPoint(coin.tx->GetHash(), coin.i);
+    }
+    if (!fBatchValid) {
+        kernelBatch.reset(new CStakeKernelBatch(pindexPrev, nBits));
+        for (const CStakeableOutput& coin : *availableCoins) {
+            const COutPoint outPoint(coin.tx->GetHash(), coin.i);
+            CPivStake stakeInput(coin.tx->tx->vout[coin.i], outPoint, coin.pindex);
+            kernelBatch->Add(&stakeInput, outPoint);
+        }
+    }
+
+    // Make sure the stake inputs haven't been spent since last check
+    {
+        LOCK(cs_wallet);
+        for (size_t i = availableCoins->size(); i-- > 0;) {
+            if (IsSpent(kernelBatch->GetOutPoint(i))) {
+                // remove it from the available coins
+                availableCoins->erase(availableCoins->begin() + i);
+                kernelBatch->Erase(i);
+            }
+        }
+    }
+
     // Kernel Search
     CAmount nCredit;
     CAmount nMasternodePayment;
-    CScript scriptPubKeyKernel;
     bool fKernelFound = false;
     int nAttempts = 0;
-    for (auto it = availableCoins->begin(); it != availableCoins->end();) {
-        COutPoint outPoint = COutPoint(it->tx->GetHash(), it->i);
-        CPivStake stakeInput(it->tx->tx->vout[it->i],
-                             outPoint,
-                             it->pindex);
-
+    const int64_t nSearchStart = GetTimeMicros();
+    size_t nNext = 0;
+    while (nNext < kernelBatch->Size()) {
         // New block came in, move on
         if (stopOnNewBlock && GetLastBlockHeightLockWallet() != pindexPrev->nHeight) return false;
 
         // Make sure the wallet is unlocked and shutdown hasn't been requested
         if (IsLocked() || ShutdownRequested()) return false;
 
-        // Make sure the stake input hasn't been spent since last check
-        if (WITH_LOCK(cs_wallet, return IsSpent(outPoint))) {
-            // remove it from the available coins
-            it = availableCoins->erase(it);
-            continue;
-        }
-
-        nCredit = 0;
-
-        nAttempts++;
-        fKernelFound = Stake(pindexPrev, &stakeInput, nBits, nTxNewTime);
+        const int nFound = kernelBatch->Find(nTxNewTime, nNext, nNext + KERNEL_SEARCH_BATCH, nAttempts);
+        nNext = (nFound < 0 ? nNext + KERNEL_SEARCH_BATCH : nFound + 1);
 
         // update staker status (time, attempts)
+        const int64_t nSearchTime = GetTimeMicros() - nSearchStart;
         pStakerStatus->SetLastTime(nTxNewTime);
         pStakerStatus->SetLastTries(nAttempts);
+        if (nSearchTime > 0) pStakerStatus->SetLastTriesPerSec((int)(nAttempts * 1000000LL / nSearchTime));
 
-        if (!fKernelFound) {
-            it++;
+        if (nFound < 0) continue;
+
+        // Found a kernel (verify it, and log it)
+        const CStakeableOutput& coin = (*availableCoins)[nFound];
+        CPivStake stakeInput(coin.tx->tx->vout[coin.i], kernelBatch->GetOutPoint(nFound), coin.pindex);
+        if (!CStakeKernel(pindexPrev, &stakeInput, nBits, nTxNewTime).CheckKernelHash(true)) {
+            LogPrintf("%s : kernel batch mismatch for %s\n", __func__, stakeInput.GetTxIn().prevout.ToString());
             continue;
         }
-
-        // Found a kernel
         LogPrintf("CreateCoinStake : kernel found\n");
-        nCredit += stakeInput.GetValue();
+        nCredit = stakeInput.GetValue();
 
         // Add block reward to the credit
         nCredit += GetBlockValue(pindexPrev->nHeight + 1);
@@ -3437,7 +3543,6 @@ bool CWallet::CreateCoinStake(
         std::vector<CTxOut> vout;
         if (!CreateCoinstakeOuts(stakeInput, vout, nCredit - nMasternodePayment)) {
             LogPrintf("%s : failed to create output\n", __func__);
-            it++;
             continue;
         }
         txNew.vout.insert(txNew.vout.end(), vout.begin(), vout.end());
@@ -3465,6 +3570,7 @@ bool CWallet::CreateCoinStake(
         if (nBytes >= DEFAULT_BLOCK_MAX_SIZE / 5)
             return error("%s : exceeded coinstake size limit", __func__);
 
+        fKernelFound = true;
         break;
     }
     LogPrint(BCLog::STAKING, "%s: attempted staking %d times\n", __func__, nAttempts);
@@ -188,6 +188,7 @@ private:
     int64_t nTime{0};
     int nTries{0};
     int nCoins{0};
+    int nTriesPerSec{0};
 
 public:
     // Get
@@ -196,16 +197,19 @@ public:
     int GetLastHeight() const { return (GetLastTip() == nullptr ? 0 : GetLastTip()->nHeight); }
     int GetLastCoins() const { return nCoins; }
     int GetLastTries() const { return nTries; }
+    int GetLastTriesPerSec() const { return nTriesPerSec; }
     int64_t GetLastTime() const { return nTime; }
     // Set
     void SetLastCoins(const int coins) { nCoins = coins; }
     void SetLastTries(const int tries) { nTries = tries; }
+    void SetLastTriesPerSec(const int triesPerSec) { nTriesPerSec = triesPerSec; }
     void SetLastTip(const CBlockIndex* lastTip) { tipBlock = lastTip; }
     void SetLastTime(const uint64_t lastTime) { nTime = lastTime; }
     void SetNull()
     {
         SetLastCoins(0);
         SetLastTries(0);
+        SetLastTriesPerSec(0);
         SetLastTip(nullptr);
         SetLastTime(0);
     }
@@ -648,7 +652,7 @@ private:
     void ChainTipAdded(const CBlockIndex *pindex, const CBlock *pblock, SaplingMerkleTree saplingTree);
 
     /* Used by TransactionAddedToMemorypool/BlockConnected/Disconnected */
-    void SyncTransaction(const CTransactionRef& tx, const CWalletTx::Confirmation& confirm);
+    void SyncTransaction(const CTransactionRef& tx, const CWalletTx::Confirmation& confirm, const mapSaplingTxNotes_t* pSaplingNotes = nullptr);
 
     bool IsKeyUsed(const CPubKey& vchPubKey) const;
 
@@ -735,6 +739,9 @@ public:
     static CAmount minStakeSplitThreshold;
     // Staker status (last hashed block and time)
     CStakerStatus* pStakerStatus = nullptr;
+    // Stake kernels of the stakeable coins, on top of the last hashed block
+    mutable Mutex cs_kernelBatch;
+    mutable std::unique_ptr<CStakeKernelBatch> kernelBatch GUARDED_BY(cs_kernelBatch);
 
     // User-defined fee PIV/kb
     bool fUseCustomFee;
@@ -926,7 +933,8 @@ public:
     //////////// Sapling //////////////////
 
     // Search for notes and addresses from this wallet in the tx, and add the addresses --> IVK mapping to the keystore if missing.
-    bool FindNotesDataAndAddMissingIVKToKeystore(const CTransaction& tx, Optional<mapSaplingNoteData_t>& saplingNoteData);
+    // If pSaplingNotes is provided, the notes are taken from it (pre-computed for a batch of txes) instead of being decrypted.
+    bool FindNotesDataAndAddMissingIVKToKeystore(const CTransaction& tx, Optional<mapSaplingNoteData_t>& saplingNoteData, const mapSaplingTxNotes_t* pSaplingNotes = nullptr);
     // Decrypt sapling output notes with the inputs ovk and updates saplingNoteDataMap
     void AddExternalNotesDataToTx(CWalletTx& wtx) const;
 
@@ -1029,7 +1037,7 @@ public:
     void TransactionAddedToMempool(const CTransactionRef& tx) override;
     void BlockConnected(const std::shared_ptr<const CBlock>& pblock, const CBlockIndex *pindex) override;
     void BlockDisconnected(const std::shared_ptr<const CBlock>& pblock, const uint256& blockHash, int nBlockHeight, int64_t blockTime) override;
-    bool AddToWalletIfInvolvingMe(const CTransactionRef& tx, const CWalletTx::Confirmation& confirm, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransactionRef& tx, const CWalletTx::Confirmation& confirm, bool fUpdate, const mapSaplingTxNotes_t* pSaplingNotes = nullptr);
     void EraseFromWallet(const uint256& hash);
 
     /**
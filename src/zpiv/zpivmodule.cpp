@@ -5,8 +5,8 @@
 #include "zpiv/zpivmodule.h"
 
 #include "hash.h"
-#include "libzerocoin/Commitment.h"
 #include "libzerocoin/Coin.h"
+#include "libzerocoin/FixedBaseExp.h"
 #include "validation.h"
 
 template <typename Stream>
@@ -41,8 +41,8 @@ bool PublicCoinSpend::Verify() const {
 
         // Check that the coin is a commitment to serial and randomness.
         libzerocoin::ZerocoinParams* params = Params().GetConsensus().Zerocoin_Params(false);
-        libzerocoin::Commitment comm(&params->coinCommitmentGroup, getCoinSerialNumber(), randomness);
-        if (comm.getCommitmentValue() != pubCoin.getValue()) {
+        const auto tables = libzerocoin::IntegerGroupTables::Get(&params->coinCommitmentGroup);
+        if (tables->MultiExp(getCoinSerialNumber(), randomness) != pubCoin.getValue()) {
             return error("%s: commitments values are not equal", __func__);
         }
 
@@ -197,7 +197,7 @@ namespace ZPIVModule {
         return spend;
     }
 
-    bool validateInput(const CTxIn &in, const CTxOut &prevOut, const CTransaction &tx, PublicCoinSpend &publicSpend) {
+    bool validateInput(const CTxIn &in, const CTxOut &prevOut, const CTransaction &tx, PublicCoinSpend &publicSpend, bool fVerify) {
         // Now prove that the commitment value opens to the input
         if (!parseCoinSpend(in, tx, prevOut, publicSpend)) {
             return false;
@@ -206,7 +206,7 @@ namespace ZPIVModule {
                 libzerocoin::IntToZerocoinDenomination(in.nSequence)) != prevOut.nValue) {
             return error("PublicCoinSpend validateInput :: input nSequence different to prevout value");
         }
-        return publicSpend.Verify();
+        return !fVerify || publicSpend.Verify();
     }
 
     bool ParseZerocoinPublicSpend(const CTxIn &txIn, const CTransaction& tx, CValidationState& state, PublicCoinSpend& publicSpend)
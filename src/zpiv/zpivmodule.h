@@ -67,7 +67,8 @@ namespace ZPIVModule {
     PublicCoinSpend parseCoinSpend(const CTxIn &in);
     bool parseCoinSpend(const CTxIn &in, const CTransaction& tx, const CTxOut &prevOut, PublicCoinSpend& publicCoinSpend);
     libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin);
-    bool validateInput(const CTxIn &in, const CTxOut &prevOut, const CTransaction& tx, PublicCoinSpend& ret);
+    // fVerify=false skips the signatures verification (PublicCoinSpend::Verify), left to the caller
+    bool validateInput(const CTxIn &in, const CTxOut &prevOut, const CTransaction& tx, PublicCoinSpend& ret, bool fVerify = true);
 
     // Public zc spend parse
     /**
@@ -17,7 +17,8 @@ class BlockIndexStatsTest(PivxTestFramework):
     def set_test_params(self):
         self.num_nodes = 2
         saplingUpgrade = ['-nuparams=v5_shield:201']
-        self.extra_args = [saplingUpgrade] * self.num_nodes
+        # node 0 answers from the block stats index, node 1 reads the blocks from disk
+        self.extra_args = [saplingUpgrade + ['-blockstatsindex'], saplingUpgrade]
 
     def send_tx(self, node_from, node_to, fee, fFromShield, fToShield):
         if not fFromShield and not fToShield:
@@ -139,6 +140,23 @@ class BlockIndexStatsTest(PivxTestFramework):
         assert_equal(count_tx + NUM_BLOCKS, alice_stats['txcount_all'])
         assert_equal(count_bytes, alice_stats['txbytes'])
         assert_equal(count_fees, float(alice_stats['ttlfee']))
+        assert_equal(len(alice_stats['feerate_percentiles']), 5)
+
+        # The index must return the same data
+        self.log.info("Checking block stats index...")
+        miner_stats = miner.getblockindexstats(start_block+1, NUM_BLOCKS)
+        assert_equal(miner_stats, alice_stats)
+        assert_equal(miner.getfeeinfo(NUM_BLOCKS), alice.getfeeinfo(NUM_BLOCKS))
+
+        # ...also after a restart and a reorg
+        self.restart_node(0, extra_args=self.extra_args[0])
+        miner.invalidateblock(miner.getblockhash(start_block + NUM_BLOCKS))
+        miner.generate(1)
+        assert_equal(miner.getblockindexstats(start_block+1, NUM_BLOCKS - 1),
+                     alice.getblockindexstats(start_block+1, NUM_BLOCKS - 1))
+        last_block = miner.getblock(miner.getbestblockhash())
+        last_stats = miner.getblockindexstats(start_block + NUM_BLOCKS, 1)
+        assert_equal(last_stats['txcount_all'], len(last_block['tx']))
 
 
 
@@ -52,6 +52,10 @@ class ReorgStakeTest(PivxTestFramework):
         piv_supply = [self.nodes[i].getsupplyinfo(True)['transparentsupply']
                       for i in range(self.num_nodes)]
         assert_equal(piv_supply, [DecimalAmt(expected_piv)] * self.num_nodes)
+        # verify the running supply against a full scan of the UTXO set
+        piv_supply_scan = [self.nodes[i].getsupplyinfo(True, True)['transparentsupply']
+                           for i in range(self.num_nodes)]
+        assert_equal(piv_supply_scan, piv_supply)
 
 
     def run_test(self):
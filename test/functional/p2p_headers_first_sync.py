@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# Copyright (c) 2021 The PIVX Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+""" Test headers-first sync: a new node downloads the headers first, then
+the blocks in parallel from all its peers"""
+
+from test_framework.test_framework import PivxTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_greater_than,
+)
+
+
+class HeadersFirstSyncTest(PivxTestFramework):
+
+    def set_test_params(self):
+        self.num_nodes = 3
+        self.setup_clean_chain = True
+
+    def setup_network(self):
+        # node2 joins the network later
+        self.setup_nodes()
+        self.connect_nodes(1, 0)
+
+    def run_test(self):
+        miner = self.nodes[0]
+        syncer = self.nodes[2]
+
+        self.log.info("Mining the chain...")
+        for _ in range(5):
+            miner.generate(50)
+        self.sync_blocks(self.nodes[:2])
+        assert_equal(syncer.getblockcount(), 0)
+
+        self.log.info("Syncing a new node from two peers...")
+        self.connect_nodes(2, 0)
+        self.connect_nodes(2, 1)
+        self.sync_blocks()
+        assert_equal(syncer.getbestblockhash(), miner.getbestblockhash())
+        chaininfo = syncer.getblockchaininfo()
+        assert_equal(chaininfo["headers"], chaininfo["blocks"])
+        assert_equal(chaininfo["headers"], 250)
+
+        # The headers were received before the blocks were requested
+        peers = syncer.getpeerinfo()
+        assert_equal(len(peers), 2)
+        assert_greater_than(sum(p["bytesrecv_per_msg"].get("headers", 0) for p in peers), 0)
+        assert_greater_than(sum(p["bytesrecv_per_msg"].get("block", 0) for p in peers), 0)
+
+if __name__ == '__main__':
+    HeadersFirstSyncTest().main()
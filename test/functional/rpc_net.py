@@ -35,6 +35,7 @@ class NetTest(PivxTestFramework):
         self._test_getaddednodeinfo()
         # self._test_getpeerinfo()
         self._test_getnodeaddresses()
+        self._test_getmessagelatency()
 
     def _test_connection_count(self):
         assert_equal(self.nodes[0].getconnectioncount(), 2)
@@ -95,6 +96,14 @@ class NetTest(PivxTestFramework):
         assert_equal(peer_info[0][0]['addrbind'], peer_info[1][0]['addr'])
         assert_equal(peer_info[1][0]['addrbind'], peer_info[0][0]['addr'])
 
+    def _test_getmessagelatency(self):
+        # ping/pong were exchanged in _test_getnettotals, on the message handler thread
+        latency = self.nodes[0].getmessagelatency()
+        for msg in ["version", "verack", "ping", "pong"]:
+            assert_greater_than(latency[msg]["count"], 0)
+            assert_greater_than_or_equal(latency[msg]["maxprocess"], latency[msg]["avgprocess"])
+            assert_equal(latency[msg]["worker"], False)
+
     def _test_getnodeaddresses(self):
         self.nodes[0].add_p2p_connection(P2PInterface())
         services = NODE_NETWORK